@@ -6,15 +6,30 @@
 
 QT       += core gui opengl
 
+# OpenMP is used to spread loops over particles on all cores, and the
+# output is written by a C++11 thread
+win32-msvc* {
+    QMAKE_CXXFLAGS += -openmp
+} else {
+    QMAKE_CXXFLAGS += -fopenmp -std=c++0x -pthread
+    QMAKE_LFLAGS   += -fopenmp -pthread
+}
+
 TARGET = MD
 TEMPLATE = app
 
 
+# The engine, built by ../MD_core
+win32:CONFIG(release, debug|release): MD_CORE_DIR = ../MD_core/release
+else:win32:CONFIG(debug, debug|release): MD_CORE_DIR = ../MD_core/debug
+else: MD_CORE_DIR = ../MD_core
+LIBS           += -L$$MD_CORE_DIR -lmd_core
+win32-msvc*: PRE_TARGETDEPS += $$MD_CORE_DIR/md_core.lib
+else:        PRE_TARGETDEPS += $$MD_CORE_DIR/libmd_core.a
+
 SOURCES += main.cpp\
         mdmainwin.cpp \
-    glwidget.cpp \
-    mdsystem.cpp \
-    settings.cpp
+    glwidget.cpp
 
 HEADERS  += mdmainwin.h \
     glwidget.h \
@@ -24,7 +39,20 @@ HEADERS  += mdmainwin.h \
     particle.h \
     callback.h \
     settings.h \
-    preprocessing.h
+    preprocessing.h \
+    thermostats.h \
+    filters.h \
+    philox.h \
+    cell_grid.h \
+    sparse_cell_grid.h \
+    simd.h \
+    time_series.h \
+    async_writer.h \
+    trajectory.h \
+    spsc_ring.h \
+    checkpoint.h \
+    task_scheduler.h \
+    all_pairs_forces.h
 
 FORMS    += mdmainwin.ui
 
@@ -0,0 +1,175 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Own includes
+#include "all_pairs_forces.h"
+#include "simd.h"
+
+/*
+ * Up to this many particles all pairs are faster than the Verlet list. For
+ * silver at 2.5 sigma on one core with SSE2 they took 0.84 and 1.02 us per
+ * particle and timestep at 500 particles, and 1.41 and 1.12 us at 864.
+ */
+const uint ALL_PAIRS_MAX_PARTICLES = 600;
+
+/* Particles in a tile, the positions and accelerations of two tiles take 24 kB */
+const uint ALL_PAIRS_TILE_SIZE = 512;
+
+/* The sum of the lanes of a register */
+static ftype sum_of_lanes(const simd_ftype &a)
+{
+    ftype lanes[SIMD_WIDTH];
+    a.store(lanes);
+    ftype sum = 0;
+    for (uint lane = 0; lane < SIMD_WIDTH; lane++) {
+        sum += lanes[lane];
+    }
+    return sum;
+}
+
+/*
+ * The pairs (i, j) with j > i of tile_i and tile_j. N is the number of
+ * particles when it is known at compile time, else 0.
+ */
+template<uint N, bool measure>
+static void all_pairs_kernel(uint num_particles, ftype *const *pos, ftype *const *acc, ftype box_size, ftype sqr_cutoff, ftype E_cutoff, ftype &Ep, ftype &distance_force_sum)
+{
+    const uint n = N > 0 ? N : num_particles;
+    const simd_ftype zero(0);
+    const simd_ftype box(box_size);
+    const simd_ftype pos_half_box(box_size/2);
+    const simd_ftype neg_half_box(-box_size/2);
+    const simd_ftype cutoff(sqr_cutoff);
+    const simd_ftype cutoff_energy(E_cutoff);
+    simd_ftype Ep_sum                 = zero;
+    simd_ftype distance_force_sum_sum = zero;
+    ftype      Ep_rest                 = 0;
+    ftype      distance_force_sum_rest = 0;
+
+    for (uint tile_i = 0; tile_i < n; tile_i += ALL_PAIRS_TILE_SIZE) {
+        const uint end_i = tile_i + ALL_PAIRS_TILE_SIZE < n ? tile_i + ALL_PAIRS_TILE_SIZE : n;
+        for (uint tile_j = tile_i; tile_j < n; tile_j += ALL_PAIRS_TILE_SIZE) {
+            const uint end_j = tile_j + ALL_PAIRS_TILE_SIZE < n ? tile_j + ALL_PAIRS_TILE_SIZE : n;
+            for (uint i = tile_i; i < end_i; i++) {
+                simd_ftype pos_i[3], acc_i[3];
+                for (uint c = 0; c < 3; c++) {
+                    pos_i[c] = simd_ftype(pos[c][i]);
+                    acc_i[c] = zero;
+                }
+                uint j = tile_j > i + 1 ? tile_j : i + 1;
+
+                // Whole registers of j
+                for (; j + SIMD_WIDTH <= end_j; j += SIMD_WIDTH) {
+                    simd_ftype r[3];
+                    for (uint c = 0; c < 3; c++) {
+                        r[c] = pos_i[c] - simd_ftype::load(&pos[c][j]);
+                        r[c] = r[c] - select(less_than(r[c], pos_half_box), zero, box) + select(less_than(r[c], neg_half_box), box, zero);
+                    }
+                    simd_ftype sqr_distance = r[0]*r[0] + r[1]*r[1] + r[2]*r[2];
+                    simd_ftype inside       = less_than(sqr_distance, cutoff);
+                    if (!any_set(inside)) {
+                        continue;
+                    }
+                    simd_ftype sqr_distance_inv    = select(inside, simd_ftype(1)/sqr_distance, zero);
+                    simd_ftype p                   = sqr_distance_inv*sqr_distance_inv*sqr_distance_inv;
+                    simd_ftype force_over_distance = simd_ftype(48)*sqr_distance_inv*p*(p - simd_ftype(0.5));
+                    for (uint c = 0; c < 3; c++) {
+                        simd_ftype force = force_over_distance*r[c];
+                        acc_i[c] = acc_i[c] + force;
+                        (simd_ftype::load(&acc[c][j]) - force).store(&acc[c][j]);
+                    }
+                    if (measure) {
+                        Ep_sum                 = Ep_sum + select(inside, simd_ftype(4)*p*(p - simd_ftype(1)) - cutoff_energy, zero);
+                        distance_force_sum_sum = distance_force_sum_sum + force_over_distance*sqr_distance;
+                    }
+                }
+                for (uint c = 0; c < 3; c++) {
+                    acc[c][i] += sum_of_lanes(acc_i[c]);
+                }
+
+                // The rest, one at a time
+                for (; j < end_j; j++) {
+                    ftype r[3];
+                    for (uint c = 0; c < 3; c++) {
+                        r[c] = pos[c][i] - pos[c][j];
+                        if      (r[c] >= box_size/2) r[c] -= box_size;
+                        else if (r[c] < -box_size/2) r[c] += box_size;
+                    }
+                    ftype sqr_distance = r[0]*r[0] + r[1]*r[1] + r[2]*r[2];
+                    if (sqr_distance >= sqr_cutoff) {
+                        continue;
+                    }
+                    ftype sqr_distance_inv    = 1/sqr_distance;
+                    ftype p                   = sqr_distance_inv*sqr_distance_inv*sqr_distance_inv;
+                    ftype force_over_distance = 48*sqr_distance_inv*p*(p - ftype(0.5));
+                    for (uint c = 0; c < 3; c++) {
+                        acc[c][i] += force_over_distance*r[c];
+                        acc[c][j] -= force_over_distance*r[c];
+                    }
+                    if (measure) {
+                        Ep_rest                 += 4*p*(p - 1) - E_cutoff;
+                        distance_force_sum_rest += force_over_distance*sqr_distance;
+                    }
+                }
+            }
+        }
+    }
+    if (measure) {
+        Ep                 = sum_of_lanes(Ep_sum) + Ep_rest;
+        distance_force_sum = sum_of_lanes(distance_force_sum_sum) + distance_force_sum_rest;
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+all_pairs_forces::all_pairs_forces()
+{
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool all_pairs_forces::is_faster(uint num_particles)
+{
+    return num_particles <= ALL_PAIRS_MAX_PARTICLES;
+}
+
+void all_pairs_forces::calculate(vector<particle> &particles, ftype box_size, ftype sqr_inner_cutoff, ftype E_cutoff, bool measure, ftype &Ep, ftype &distance_force_sum)
+{
+    const uint num_particles = uint(particles.size());
+    for (uint c = 0; c < 3; c++) {
+        pos[c].resize(num_particles);
+        acc[c].assign(num_particles, 0);
+    }
+    for (uint i = 0; i < num_particles; i++) {
+        for (uint c = 0; c < 3; c++) {
+            pos[c][i] = particles[i].pos[c];
+        }
+    }
+    if (num_particles == 0) {
+        Ep = distance_force_sum = 0;
+        return;
+    }
+
+    // The sizes of the fcc lattices, 4*n^3, have their own variants
+    ftype *const pos_arrays[3] = {&pos[0][0], &pos[1][0], &pos[2][0]};
+    ftype *const acc_arrays[3] = {&acc[0][0], &acc[1][0], &acc[2][0]};
+    typedef void (*kernel)(uint, ftype *const *, ftype *const *, ftype, ftype, ftype, ftype &, ftype &);
+    kernel measuring, not_measuring;
+    switch (num_particles) {
+    case   32: measuring = all_pairs_kernel<  32, true>; not_measuring = all_pairs_kernel<  32, false>; break;
+    case  108: measuring = all_pairs_kernel< 108, true>; not_measuring = all_pairs_kernel< 108, false>; break;
+    case  256: measuring = all_pairs_kernel< 256, true>; not_measuring = all_pairs_kernel< 256, false>; break;
+    case  500: measuring = all_pairs_kernel< 500, true>; not_measuring = all_pairs_kernel< 500, false>; break;
+    default  : measuring = all_pairs_kernel<   0, true>; not_measuring = all_pairs_kernel<   0, false>; break;
+    }
+    (measure ? measuring : not_measuring)(num_particles, pos_arrays, acc_arrays, box_size, sqr_inner_cutoff, E_cutoff, Ep, distance_force_sum);
+
+    for (uint i = 0; i < num_particles; i++) {
+        particles[i].acc = vec3(acc[0][i], acc[1][i], acc[2][i]);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef  ALL_PAIRS_FORCES_H
+#define  ALL_PAIRS_FORCES_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+#include "particle.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * The forces of a small system straight from all pairs of particles, with
+ * no Verlet list. For the systems of up to a few hundred particles that
+ * are run in bulk this is faster than the list: there is no list to build
+ * or check, and the pairs are gone through in SIMD registers without
+ * branches, with the minimum image and the cutoff as masks. The
+ * positions are copied to a structure of arrays, and the pairs are taken
+ * tile by tile, two tiles at a time fitting in the L1 cache, every pair
+ * once. For the numbers of particles of the fcc lattices up to the
+ * crossover there are variants with the number fixed at compile time, so
+ * that the compiler can unroll the loops.
+ */
+class all_pairs_forces
+{
+public:
+    // Constructor
+    all_pairs_forces();
+
+    static bool is_faster(uint num_particles); // Than the Verlet list, from measurements
+
+    // Sets the accelerations of all particles; the energy and the sum of distance times force only if measure
+    void calculate(vector<particle> &particles, ftype box_size, ftype sqr_inner_cutoff, ftype E_cutoff, bool measure, ftype &Ep, ftype &distance_force_sum);
+
+private:
+    vector<ftype> pos[3]; // Structure of arrays, x, y and z
+    vector<ftype> acc[3];
+};
+
+#endif  /* ALL_PAIRS_FORCES_H */
@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <new>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "async_writer.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR AND DESTRUCTOR
+////////////////////////////////////////////////////////////////
+
+async_writer::async_writer(uint buffer_size_in)
+{
+    buffer_size          = buffer_size_in;
+    num_jobs_in_progress = 0;
+    stopping             = false;
+    writer_started       = false;
+}
+
+async_writer::~async_writer()
+{
+    for (uint f = 0; f < file_in_use.size(); f++) {
+        if (file_in_use[f]) {
+            close(f);
+        }
+    }
+    wait();
+    if (writer_started) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_added.notify_one();
+        writer_thread.join();
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+uint async_writer::open(const string &path)
+{
+    return open_file(path, JOB_OPEN);
+}
+
+uint async_writer::open_replacing(const string &path)
+{
+    return open_file(path, JOB_OPEN_REPLACING);
+}
+
+void async_writer::write(uint file, const void *data, uint64 size)
+{
+    vector<char> &buffer = buffers[file];
+    const char *bytes = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+    if (buffer.size() >= buffer_size) {
+        hand_over(file, JOB_WRITE, "");
+    }
+}
+
+void async_writer::close(uint file)
+{
+    if (!buffers[file].empty()) {
+        hand_over(file, JOB_WRITE, "");
+    }
+    hand_over(file, JOB_CLOSE, "");
+    file_in_use[file] = false;
+}
+
+void async_writer::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!jobs.empty() || num_jobs_in_progress > 0) {
+        job_done.wait(lock);
+    }
+}
+
+bool async_writer::take_errors(string &errors_out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    errors_out.swap(errors);
+    errors.clear();
+    return !errors_out.empty();
+}
+
+void async_writer::restart_after_fork()
+{
+    /*
+     * Only the thread calling fork is copied to the new process, so the
+     * writer thread is forgotten, together with the state of the
+     * synchronization it may have been waiting in, and started again with
+     * the next file. Nothing is left to write since the parent waited.
+     */
+    new (&mutex)         std::mutex;
+    new (&job_added)     std::condition_variable;
+    new (&job_done)      std::condition_variable;
+    new (&writer_thread) std::thread;
+    writer_started       = false;
+    stopping             = false;
+    num_jobs_in_progress = 0;
+    jobs.clear();
+}
+
+void async_writer::write_uint32(uint file, uint32 value)
+{
+    write(file, &value, sizeof(value));
+}
+
+void async_writer::write_uint64(uint file, uint64 value)
+{
+    write(file, &value, sizeof(value));
+}
+
+void async_writer::write_string(uint file, const string &value)
+{
+    write_uint32(file, uint32(value.size()));
+    write(file, value.data(), value.size());
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+uint async_writer::open_file(const string &path, uint type)
+{
+    // The writer thread is only started when there is something to write
+    if (!writer_started) {
+        writer_thread  = std::thread(&async_writer::run_writer, this);
+        writer_started = true;
+    }
+
+    // Reuse the number of a closed file, the jobs are done in order anyway
+    uint file = 0;
+    while (file < file_in_use.size() && file_in_use[file]) {
+        file++;
+    }
+    if (file == file_in_use.size()) {
+        file_in_use.push_back(false);
+        buffers    .push_back(vector<char>());
+    }
+    file_in_use[file] = true;
+    buffers[file].clear();
+    hand_over(file, type, path);
+    return file;
+}
+
+void async_writer::hand_over(uint file, uint type, const string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job());
+        job &j = jobs.back();
+        j.type = type;
+        j.file = file;
+        j.path = path;
+        if (type == JOB_WRITE) {
+            // The filled buffer goes with the job, a written one takes its place
+            j.data.swap(buffers[file]);
+            if (!free_buffers.empty()) {
+                buffers[file].swap(free_buffers.back());
+                free_buffers.pop_back();
+            }
+        }
+    }
+    job_added.notify_one();
+}
+
+void async_writer::run_writer()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        while (jobs.empty() && !stopping) {
+            job_added.wait(lock);
+        }
+        if (jobs.empty()) {
+            return;
+        }
+        job j;
+        j.type = jobs.front().type;
+        j.file = jobs.front().file;
+        j.path.swap(jobs.front().path);
+        j.data.swap(jobs.front().data);
+        jobs.pop_front();
+        num_jobs_in_progress++;
+
+        // The disk is only accessed with the mutex unlocked
+        lock.unlock();
+        do_job(j);
+        lock.lock();
+
+        // Keep a few full sized buffers for reuse
+        if (j.data.capacity() >= buffer_size && free_buffers.size() < 4) {
+            j.data.clear();
+            free_buffers.push_back(vector<char>());
+            free_buffers.back().swap(j.data);
+        }
+        num_jobs_in_progress--;
+        job_done.notify_all();
+    }
+}
+
+void async_writer::do_job(job &j)
+{
+    string error;
+    if (files.size() <= j.file) {
+        files         .resize(j.file + 1, 0);
+        replaced_paths.resize(j.file + 1);
+    }
+    FILE   *&file          = files[j.file];
+    string  &replaced_path = replaced_paths[j.file];
+    switch (j.type) {
+    case JOB_OPEN:
+        file = fopen(j.path.c_str(), "wb");
+        replaced_path.clear();
+        if (!file) {
+            error = "Error: " + j.path + " could not be opened\n";
+        }
+        break;
+    case JOB_OPEN_REPLACING:
+        replaced_path = j.path;
+        file = fopen((j.path + ".part").c_str(), "wb");
+        if (!file) {
+            error = "Error: " + j.path + ".part could not be opened\n";
+        }
+        break;
+    case JOB_WRITE:
+        if (file && !j.data.empty() && fwrite(&j.data[0], 1, j.data.size(), file) != j.data.size()) {
+            error = "Error: Could not write to an output file\n";
+        }
+        break;
+    case JOB_CLOSE:
+        if (file && !replaced_path.empty()) {
+            // Everything has to be on the disk before the old file is replaced
+            bool written = fflush(file) == 0;
+#ifndef _WIN32
+            written = written && fsync(fileno(file)) == 0;
+#endif
+            written = fclose(file) == 0 && written;
+            string part_path = replaced_path + ".part";
+#ifdef _WIN32
+            remove(replaced_path.c_str()); // rename does not replace files on Windows
+#endif
+            if (!written || rename(part_path.c_str(), replaced_path.c_str()) != 0) {
+                error = "Error: " + replaced_path + " could not be replaced\n";
+            }
+        }
+        else if (file && fclose(file) != 0) {
+            error = "Error: Could not finish writing an output file\n";
+        }
+        file = 0;
+        replaced_path.clear();
+        break;
+    }
+    if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        errors += error;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef  ASYNC_WRITER_H
+#define  ASYNC_WRITER_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using std::deque;
+using std::string;
+using std::vector;
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Writes files on a background thread. Everything written is collected in
+ * large buffers, one per file, and a full buffer is handed over to the
+ * writer thread, which opens, writes and closes the files in the order it
+ * was asked to. The calling thread never waits for the disk; if the disk
+ * is slower than the output, more buffers are allocated instead. Errors
+ * are collected on the writer thread and can be picked up afterwards.
+ */
+class async_writer
+{
+public:
+    // Constructor and destructor
+    explicit async_writer(uint buffer_size_in = 1 << 22);
+    ~async_writer(); // Waits until everything is written
+
+    // Files
+    uint open (const string &path); // Returns the file number used by the other functions
+    uint open_replacing(const string &path); // Written next to path and renamed to it when closed, so path is always complete
+    void write(uint file, const void *data, uint64 size);
+    void close(uint file);          // Hands over what is left of the file, without waiting
+    void wait ();                   // Waits until all closed files are written
+    bool take_errors(string &errors);
+    void restart_after_fork(); // In a forked process, which has no writer thread. Wait before the fork
+
+    // Binary values
+    void write_uint32(uint file, uint32 value);
+    void write_uint64(uint file, uint64 value);
+    void write_string(uint file, const string &value); // Length (uint32) followed by the characters
+
+private:
+    enum enum_job_types { JOB_OPEN, JOB_OPEN_REPLACING, JOB_WRITE, JOB_CLOSE };
+    struct job
+    {
+        uint         type; // (enum_job_types)
+        uint         file;
+        string       path;
+        vector<char> data;
+    };
+
+    uint                 buffer_size;
+    // Used by the calling thread only
+    vector<vector<char> > buffers;      // The buffer being filled for each file number
+    vector<bool>         file_in_use;
+    // Shared, protected by the mutex
+    std::mutex              mutex;
+    std::condition_variable job_added, job_done;
+    deque<job>           jobs;
+    uint                 num_jobs_in_progress;
+    vector<vector<char> > free_buffers;  // Written buffers, reused to avoid allocations
+    string               errors;
+    bool                 stopping;
+    // Used by the writer thread only
+    vector<FILE*>        files;
+    vector<string>       replaced_paths; // The path each file is renamed to when closed, empty if none
+    std::thread          writer_thread;
+    bool                 writer_started;
+
+    uint open_file(const string &path, uint type);
+    void hand_over(uint file, uint type, const string &path);
+    void run_writer();
+    void do_job(job &j);
+
+    // Not copyable
+    async_writer(const async_writer &);
+    async_writer &operator=(const async_writer &);
+};
+
+#endif  /* ASYNC_WRITER_H */
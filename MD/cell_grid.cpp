@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Own includes
+#include "cell_grid.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+cell_grid::cell_grid()
+{
+    cells_per_side = 0;
+    cell_size = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void cell_grid::build(const vector<particle> &particles, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    uint num_particles = uint(particles.size());
+    start_build(num_particles, box_size, cells_per_side_in, offset_in);
+    for (uint i = 0; i < num_particles; i++) {
+        particle_cell[i] = cell_of(particles[i].pos, box_size);
+    }
+    sort_by_cell();
+}
+
+void cell_grid::build(const vector<vec3> &positions, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    uint num_particles = uint(positions.size());
+    start_build(num_particles, box_size, cells_per_side_in, offset_in);
+    for (uint i = 0; i < num_particles; i++) {
+        particle_cell[i] = cell_of(positions[i], box_size);
+    }
+    sort_by_cell();
+}
+
+uint cell_grid::num_cells() const
+{
+    return cells_per_side*cells_per_side*cells_per_side;
+}
+
+uint cell_grid::cell_index(int x, int y, int z) const
+{
+    int n = int(cells_per_side);
+    x = x < 0 ? x + n : (x >= n ? x - n : x);
+    y = y < 0 ? y + n : (y >= n ? y - n : y);
+    z = z < 0 ? z + n : (z >= n ? z - n : z);
+    return uint(x + n*(y + n*z));
+}
+
+uint cell_grid::cell_of(const vec3 &pos, ftype box_size) const
+{
+    int index[3];
+    for (int d = 0; d < 3; d++) {
+        ftype p = pos[d] - offset[d];
+        if (p < 0) p += box_size;
+        index[d] = int(p/cell_size);
+        if (index[d] >= int(cells_per_side)) index[d] = int(cells_per_side) - 1; // This actually occationally happens
+        if (index[d] < 0) index[d] = 0;
+    }
+    return uint(index[0] + cells_per_side*(index[1] + cells_per_side*index[2]));
+}
+
+uint cell_grid::color_of(uint cell) const
+{
+    uint x = cell % cells_per_side;
+    uint y = cell / cells_per_side % cells_per_side;
+    uint z = cell / cells_per_side / cells_per_side;
+    return (x & 1) + 2*(y & 1) + 4*(z & 1);
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void cell_grid::start_build(uint num_particles, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    cells_per_side = cells_per_side_in;
+    cell_size      = box_size/cells_per_side;
+    offset         = offset_in;
+    particle_cell .resize(num_particles);
+    cell_particles.resize(num_particles);
+}
+
+void cell_grid::sort_by_cell()
+{
+    // Counting sort of the particles by cell
+    uint num_particles = uint(particle_cell.size());
+    cell_start.assign(num_cells() + 1, 0);
+    for (uint i = 0; i < num_particles; i++) {
+        cell_start[particle_cell[i] + 1]++;
+    }
+    for (uint c = 0; c < num_cells(); c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+    vector<uint> next(cell_start.begin(), cell_start.end() - 1);
+    for (uint i = 0; i < num_particles; i++) {
+        cell_particles[next[particle_cell[i]]++] = i;
+    }
+}
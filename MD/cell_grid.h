@@ -0,0 +1,51 @@
+#ifndef  CELL_GRID_H
+#define  CELL_GRID_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+#include "particle.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * The particles sorted into cubic cells, stored as one array of particle
+ * indexes per cell (compressed rows). Unlike the linked cells used for the
+ * Verlet list, every cell can be traversed on its own, which is what is
+ * needed to work on several cells in parallel.
+ */
+class cell_grid
+{
+public:
+    uint         cells_per_side;
+    ftype        cell_size;
+    vec3         offset;         // Position of the corner of cell 0
+    vector<uint> cell_start;     // Index in cell_particles of the first particle of each cell, one extra entry at the end
+    vector<uint> cell_particles; // Particle indexes, cell by cell
+    vector<uint> particle_cell;  // The cell of each particle
+
+    // Constructor
+    cell_grid();
+
+    // Sorts the particles into cells_per_side^3 cells covering the box
+    void build(const vector<particle> &particles, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+    void build(const vector<vec3>     &positions, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+
+    uint num_cells() const;
+    uint cell_index(int x, int y, int z) const; // Periodic
+    uint cell_of(const vec3 &pos, ftype box_size) const;
+    uint color_of(uint cell) const;             // 0-7, neighbouring cells never have the same color (if cells_per_side is even)
+
+private:
+    void start_build(uint num_particles, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+    void sort_by_cell();
+};
+
+#endif  /* CELL_GRID_H */
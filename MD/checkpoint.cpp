@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cstdio>
+
+// Own includes
+#include "checkpoint.h"
+
+////////////////////////////////////////////////////////////////
+// WRITER
+////////////////////////////////////////////////////////////////
+
+checkpoint_writer::checkpoint_writer(async_writer &writer_in, uint file_in)
+    : writer(writer_in), file(file_in)
+{
+    writer.write(file, "MDCHECKP", 8);
+    writer.write_uint32(file, CHECKPOINT_FORMAT_VERSION);
+    writer.write_uint32(file, uint32(sizeof(ftype)));
+}
+
+void checkpoint_writer::finish()
+{
+    writer.write(file, "MDCHECKE", 8);
+    writer.close(file);
+}
+
+void checkpoint_writer::series(const time_series &s, uint num_values)
+{
+    writer.write_uint64(file, num_values);
+    for (uint i = 0; i < num_values; i = s.chunk_end(i)) {
+        uint last = s.chunk_end(i) < num_values ? s.chunk_end(i) : num_values;
+        writer.write(file, &s[i], uint64(last - i)*sizeof(ftype));
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// READER
+////////////////////////////////////////////////////////////////
+
+checkpoint_reader::checkpoint_reader()
+{
+    position = 0;
+    failed   = true;
+}
+
+bool checkpoint_reader::open(const string &path, string &error)
+{
+    contents.clear();
+    failed = true;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        error = path + " could not be opened";
+        return false;
+    }
+    char block[1 << 16];
+    size_t num_read;
+    while ((num_read = fread(block, 1, sizeof(block), file)) > 0) {
+        contents.insert(contents.end(), block, block + num_read);
+    }
+    fclose(file);
+
+    uint32 version = 0, value_size = 0;
+    if (contents.size() < 8 + 4 + 4 + 8 || memcmp(&contents[0], "MDCHECKP", 8) != 0) {
+        error = path + " is not a checkpoint file";
+        return false;
+    }
+    memcpy(&version   , &contents[8 ], 4);
+    memcpy(&value_size, &contents[12], 4);
+    if (version != CHECKPOINT_FORMAT_VERSION || value_size != sizeof(ftype)) {
+        error = path + " has an unsupported version or precision";
+        return false;
+    }
+    position = &contents[16];
+    failed   = false;
+    return true;
+}
+
+bool checkpoint_reader::finish(string &error)
+{
+    if (failed || !can_read(8) || memcmp(position, "MDCHECKE", 8) != 0) {
+        error = "The checkpoint is incomplete";
+        return false;
+    }
+    position += 8;
+    return true;
+}
+
+void checkpoint_reader::series(time_series &s, uint /*num_values*/)
+{
+    uint64 num_values = 0;
+    value(num_values);
+    if (!can_read(num_values*sizeof(ftype))) {
+        return;
+    }
+    s.resize(uint(num_values));
+    for (uint i = 0; i < num_values; i = s.chunk_end(i)) {
+        uint last = s.chunk_end(i) < num_values ? s.chunk_end(i) : uint(num_values);
+        memcpy(&s[i], position, size_t(last - i)*sizeof(ftype));
+        position += uint64(last - i)*sizeof(ftype);
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool checkpoint_reader::can_read(uint64 num_bytes)
+{
+    if (failed || num_bytes > uint64(&contents[0] + contents.size() - position)) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef  CHECKPOINT_H
+#define  CHECKPOINT_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "time_series.h"
+#include "async_writer.h"
+
+////////////////////////////////////////////////////////////////
+// FILE FORMAT
+////////////////////////////////////////////////////////////////
+
+/*
+ * A checkpoint file (.mdc) holds everything needed to continue a run, in
+ * the byte order of the machine that wrote it:
+ *   "MDCHECKP", the format version (uint32) and the size of ftype (uint32)
+ *   the state of the system, in the order of mdsystem::transfer_state
+ *   "MDCHECKE", so that a cut off file is detected
+ * Vectors and time series are stored as their length (uint64) followed by
+ * the values, and strings as their length (uint32) followed by the
+ * characters. A new version number is needed whenever the state changes.
+ * The equilibrated states in the state cache are stored the same way.
+ */
+
+const uint32 CHECKPOINT_FORMAT_VERSION = 3;
+
+////////////////////////////////////////////////////////////////
+// ARCHIVES
+////////////////////////////////////////////////////////////////
+
+/*
+ * The state is saved and loaded by the same function, templated on one of
+ * these two, so the order of the values can never differ between them.
+ */
+
+/* Copies the state into the buffers of an async_writer */
+class checkpoint_writer
+{
+public:
+    static const bool loading = false;
+
+    checkpoint_writer(async_writer &writer_in, uint file_in);
+    void finish();
+
+    template<class T> void value(const T &v)
+    {
+        writer.write(file, &v, sizeof(T));
+    }
+    template<class T> void values(const vector<T> &v)
+    {
+        writer.write_uint64(file, v.size());
+        if (!v.empty()) {
+            writer.write(file, &v[0], v.size()*sizeof(T));
+        }
+    }
+    void text(const string &s)
+    {
+        writer.write_string(file, s);
+    }
+    // The first num_values values of the series
+    void series(const time_series &s, uint num_values);
+
+private:
+    async_writer &writer;
+    uint          file;
+};
+
+/* Reads the state from a checkpoint file held in memory */
+class checkpoint_reader
+{
+public:
+    static const bool loading = true;
+
+    checkpoint_reader();
+    bool open(const string &path, string &error);
+    bool finish(string &error); // If everything was read and the end marker follows
+
+    template<class T> void value(T &v)
+    {
+        if (can_read(sizeof(T))) {
+            memcpy(&v, position, sizeof(T));
+            position += sizeof(T);
+        }
+    }
+    template<class T> void values(vector<T> &v)
+    {
+        uint64 num_values = 0;
+        value(num_values);
+        if (!can_read(num_values*sizeof(T))) {
+            return;
+        }
+        v.resize(size_t(num_values));
+        if (num_values > 0) {
+            memcpy(&v[0], position, size_t(num_values*sizeof(T)));
+            position += num_values*sizeof(T);
+        }
+    }
+    void text(string &s)
+    {
+        uint32 length = 0;
+        value(length);
+        if (can_read(length)) {
+            s.assign(position, length);
+            position += length;
+        }
+    }
+    // The series gets as many values as were saved
+    void series(time_series &s, uint num_values);
+
+private:
+    vector<char> contents;
+    const char  *position;
+    bool         failed;
+
+    bool can_read(uint64 num_bytes);
+};
+
+#endif  /* CHECKPOINT_H */
@@ -13,48 +13,6 @@
 
 #include "base_float_vec3.h"
 
-////////////////////////////////////////////////////////////////
-// COMPILE TIME OPTIONS
-////////////////////////////////////////////////////////////////
-
-/***************
- * Thermostats *
- ***************/
-/* Enumeration of thermostats */
-#define  NO_THERMOSTAT           0
-#define  BERENDSEN_THERMOSTAT    1
-#define  NOSE_HOOVER_THERMOSTAT  2
-
-#define  CHING_CHIS_THERMOSTAT   BERENDSEN_THERMOSTAT
-#define  LASSES_THERMOSTAT       NOSE_HOOVER_THERMOSTAT
-
-//#define  THERMOSTAT              CHING_CHIS_THERMOSTAT /////Using Smooth scaling Thermostat (Berendsen et. al, 1984)/////
-#define  THERMOSTAT              LASSES_THERMOSTAT
-
-/***********
- * Filters *
- ***********/
-/* Enumeration of filters */
-#define  NO_FILTER                           0
-#define  TWO_SIDED_EXPONENTIAL_DECAY_FILTER  1
-#define  ENSEMBLE_AVERAGE_FILTER             2
-
-#define  KRISTOFERS_FILTER  TWO_SIDED_EXPONENTIAL_DECAY_FILTER
-#define  EMILS_FILTER       ENSEMBLE_AVERAGE_FILTER
-
-#define  FILTER  KRISTOFERS_FILTER
-//#define  FILTER  EMILS_FILTER
-
-/*********
- * Check *
- *********/
-#if !THERMOSTAT
-#error No thermostat chosen
-#endif
-#if !FILTER
-#error No filter chosen
-#endif
-
 ////////////////////////////////////////////////////////////////
 // MISCELANEOUS DEFINITIONS
 ////////////////////////////////////////////////////////////////
@@ -68,6 +26,8 @@
 ////////////////////////////////////////////////////////////////
 
 typedef  unsigned int            uint ;
+typedef  unsigned int            uint32;
+typedef  unsigned long long      uint64;
 #if USE_DOUBLE_PRECISION
 typedef  double                  ftype;
 #else
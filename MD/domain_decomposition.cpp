@@ -0,0 +1,754 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <omp.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "domain_decomposition.h"
+#include "mdsystem.h"
+#include "philox.h"
+#include "async_writer.h"
+
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+/* The results of the domains, from the columns of the results of mdsystem */
+static const uint domain_columns[] = {RC_TOTAL_ENERGY, RC_KINETIC_ENERGY, RC_POTENTIAL_ENERGY, RC_TEMPERATURE, RC_PRESSURE, RC_MSD};
+static const uint num_domain_columns = sizeof(domain_columns)/sizeof(domain_columns[0]);
+
+/* What every rank reports at the end, for the scaling */
+enum enum_rank_stats { RANK_ATOMS, RANK_GHOSTS, RANK_TIMERS, NUM_RANK_STATS = RANK_TIMERS + 5 };
+
+/* The distinct cells next to cell c (and c itself) of n cells around a periodic border */
+static uint periodic_neighbour_cells(int c, int n, int *cells)
+{
+    if (n < 3) {
+        for (int i = 0; i < n; i++) cells[i] = i;
+        return uint(n);
+    }
+    cells[0] = (c + n - 1) % n;
+    cells[1] = c;
+    cells[2] = (c + 1) % n;
+    return 3;
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+domain_decomposition::domain_decomposition()
+{
+    num_domains   = 1;
+    random_seed   = 0;
+    num_particles = 0;
+    transport     = 0;
+    rank          = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void domain_decomposition::set_output_callback(callback<void (*)(void*, string)> output_callback_in)
+{
+    output_callback = output_callback_in;
+}
+
+void domain_decomposition::set_num_domains(uint num_domains_in)
+{
+    num_domains = num_domains_in > 0 ? num_domains_in : 1;
+}
+
+void domain_decomposition::set_random_seed(uint random_seed_in)
+{
+    random_seed = random_seed_in;
+}
+
+void domain_decomposition::set_output_directory(const string &output_directory_in)
+{
+    output_directory = output_directory_in;
+}
+
+bool domain_decomposition::init(const run_parameters &parameters, string &error)
+{
+    const run_parameters &p = parameters;
+    if (p.barostat_on || p.energy_minimization || p.monte_carlo) {
+        error = "The domains have no barostat, energy minimization or Monte Carlo";
+        return false;
+    }
+    if (p.thermostat_on && p.thermostat_type != LANGEVIN_THERMOSTAT) {
+        error = "The domains only have the Langevin thermostat";
+        return false;
+    }
+
+    // Conversion units
+    particle_mass_in_kg = p.mass;
+    sigma_in_m          = p.sigma;
+    epsilon_in_j        = p.epsilon;
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+
+    // Reduced units, as in mdsystem
+    lattice_constant = p.lattice_constant/sigma_in_m;
+    box_size_in_lattice_constants = uint(pow(ftype(p.num_particles / 4.0), ftype(1.0 / 3.0)));
+    num_particles   = 4*box_size_in_lattice_constants*box_size_in_lattice_constants*box_size_in_lattice_constants;
+    box_size        = lattice_constant*box_size_in_lattice_constants;
+    inner_cutoff    = p.inner_cutoff/sigma_in_m;
+    outer_cutoff    = p.outer_cutoff/sigma_in_m;
+    dt              = p.dt/time_unit;
+    init_temp       = p.temperature  * P_SI_KB / epsilon_in_j;
+    desired_temp    = p.desired_temp * P_SI_KB / epsilon_in_j;
+    thermostat_time = p.thermostat_time/time_unit;
+    langevin_on     = p.thermostat_on;
+    sampling_period = p.sample_period > 0 ? p.sample_period : 1;
+    num_samples     = p.num_time_steps/sampling_period + 1;
+    num_time_steps  = (num_samples - 1)*sampling_period;
+    if (outer_cutoff <= inner_cutoff) {
+        error = "The outer cutoff has to be larger than the inner one";
+        return false;
+    }
+
+    // The ghosts only come from the next slab, so a slab has to be as thick as the outer cutoff
+    uint max_domains = box_size >= 2*outer_cutoff ? uint(box_size/outer_cutoff) : 1;
+    if (num_domains > max_domains) {
+        stringstream text;
+        text << "The slabs of " << num_domains << " domains would be thinner than the outer cutoff, using " << max_domains << endl;
+        print(text.str());
+        num_domains = max_domains;
+    }
+    if (thermostat_time < sampling_period * dt) {
+        thermostat_time = sampling_period * dt;
+    }
+    ftype q = 1/(inner_cutoff*inner_cutoff);
+    q = q * q * q;
+    E_cutoff = ftype(4.0) * q * (q - ftype(1.0));
+
+    stringstream text;
+    text << num_particles << " particles in " << num_domains << (num_domains == 1 ? " domain, " : " domains, ")
+         << num_time_steps << " timesteps" << (langevin_on ? " with the Langevin thermostat" : "") << endl;
+    print(text.str());
+    return true;
+}
+
+bool domain_decomposition::run(string &error)
+{
+    if (num_particles == 0) {
+        error = "The domains are not initialized";
+        return false;
+    }
+#ifdef _WIN32
+    if (num_domains > 1) {
+        error = "More than one domain needs fork, which Windows does not have";
+        return false;
+    }
+#endif
+    double start_time = omp_get_wtime();
+    bool   completed  = false;
+    vector<int> children;
+    {
+        socket_transport sockets(num_domains);
+        if (!sockets.is_open()) {
+            error = "The sockets between the domains could not be created";
+            return false;
+        }
+
+        // Ranks 1 and up in processes of their own, rank 0 here
+#ifndef _WIN32
+        fflush(0); // Or the children write what is buffered once more
+        for (uint r = 1; r < num_domains; r++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                sockets.select_rank(r);
+                transport = &sockets;
+                rank      = r;
+                string domain_error;
+                bool ok = run_domain(domain_error);
+                if (!ok) {
+                    fprintf(stderr, "Error in domain %u: %s\n", r, domain_error.c_str());
+                }
+                _exit(ok ? 0 : 1); // Nothing of the parent is destroyed or flushed in the child
+            }
+            if (pid < 0) {
+                error = "Could not fork the processes of the domains";
+                break;
+            }
+            children.push_back(int(pid));
+        }
+#endif
+        if (children.size() + 1 == num_domains) {
+            sockets.select_rank(0);
+            transport = &sockets;
+            rank      = 0;
+            completed = run_domain(error);
+        }
+        transport = 0;
+    } // The sockets are closed here, so children waiting for rank 0 give up
+
+#ifndef _WIN32
+    for (uint i = 0; i < children.size(); i++) {
+        int status = 0;
+        waitpid(pid_t(children[i]), &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (completed) error = "A domain failed";
+            completed = false;
+        }
+    }
+#endif
+    if (completed) {
+        write_results();
+        print_summary(omp_get_wtime() - start_time, vector<double>());
+    }
+    return completed;
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool domain_decomposition::run_domain(string &error)
+{
+    for (uint t = 0; t < NUM_TIMERS; t++) {
+        timers[t] = 0;
+    }
+    num_rebuilds = 0;
+    slab_low  = box_size*rank/num_domains;
+    slab_high = rank + 1 == num_domains ? box_size : box_size*(rank + 1)/num_domains;
+    if (rank == 0) {
+        sample_Ep              .assign(num_samples, 0);
+        sample_virial          .assign(num_samples, 0);
+        sample_sqr_vel         .assign(num_samples, 0);
+        sample_sqr_displacement.assign(num_samples, 0);
+    }
+    create_atoms();
+    if (!rebuild(error)) {
+        return false;
+    }
+    calculate_forces(true);
+    if (!take_sample(0, error)) {
+        return false;
+    }
+
+    for (uint loop_num = 0; loop_num < num_time_steps; ) {
+        double start_time = omp_get_wtime();
+        if (langevin_on) {
+            // BAOAB, as in mdsystem
+            kick (dt/2);
+            drift(dt/2);
+            apply_langevin_noise(loop_num);
+            drift(dt/2);
+        }
+        else {
+            // Velocity Verlet
+            kick (dt/2);
+            drift(dt);
+        }
+        timers[TIMER_INTEGRATION] += omp_get_wtime() - start_time;
+        loop_num++;
+
+        // New ghost positions, or new ghosts
+        bool rebuild_needed = false;
+        if (!needs_rebuild(rebuild_needed, error)) {
+            return false;
+        }
+        if (rebuild_needed) {
+            if (!rebuild(error)) return false;
+        }
+        else {
+            start_time = omp_get_wtime();
+            if (!exchange_ghosts(false)) {
+                error = "The ghosts could not be exchanged";
+                return false;
+            }
+            timers[TIMER_HALO] += omp_get_wtime() - start_time;
+        }
+
+        bool sampling = loop_num % sampling_period == 0;
+        start_time = omp_get_wtime();
+        calculate_forces(sampling);
+        timers[TIMER_FORCES] += omp_get_wtime() - start_time;
+        start_time = omp_get_wtime();
+        kick(dt/2);
+        timers[TIMER_INTEGRATION] += omp_get_wtime() - start_time;
+        if (sampling && !take_sample(loop_num/sampling_period, error)) {
+            return false;
+        }
+    }
+
+    // What every rank has done, for the summary
+    vector<double> rank_stats(num_domains*NUM_RANK_STATS, 0);
+    double *stats = &rank_stats[rank*NUM_RANK_STATS];
+    stats[RANK_ATOMS ] = double(atoms.size());
+    stats[RANK_GHOSTS] = double(ghosts.size());
+    for (uint t = 0; t < NUM_TIMERS; t++) {
+        stats[RANK_TIMERS + t] = timers[t];
+    }
+    if (!transport->sum(rank_stats)) {
+        error = "The statistics of the domains could not be collected";
+        return false;
+    }
+    if (rank == 0) {
+        print_summary(-1, rank_stats);
+    }
+    return true;
+}
+
+void domain_decomposition::create_atoms()
+{
+    /*
+     * Every rank places all atoms as mdsystem does and keeps its own, so
+     * that the start does not depend on the number of domains. The sums for
+     * the drift and the temperature are taken over all atoms on every rank.
+     */
+    const uint n = box_size_in_lattice_constants;
+    const ftype offsets[4][3] = {{0, 0, 0}, {0, 0.5, 0.5}, {0.5, 0, 0.5}, {0.5, 0.5, 0}};
+    vec3  sum_vel = vec3(0, 0, 0);
+    ftype sum_sqr_vel = 0;
+    vector<vec3> velocities(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        ftype gaussian[3];
+        philox_gaussian_vec3(random_seed, RS_VELOCITIES, uint32(i), 0, gaussian);
+        velocities[i] = vec3(gaussian[0], gaussian[1], gaussian[2]);
+        sum_vel     += velocities[i];
+        sum_sqr_vel += velocities[i].sqr_length();
+    }
+    vec3  average_vel  = sum_vel/ftype(num_particles);
+    ftype vel_variance = sum_sqr_vel/num_particles - average_vel.sqr_length();
+    ftype scale_factor = vel_variance > 0 ? sqrt(ftype(3.0) * init_temp / vel_variance) : 0;
+
+    atoms.clear();
+    for (uint cell = 0; cell < n*n*n; cell++) {
+        uint cell_pos[3] = {cell % n, cell / n % n, cell / n / n};
+        for (uint k = 0; k < 4; k++) {
+            domain_atom atom;
+            atom.id = 4*cell + k;
+            for (uint c = 0; c < 3; c++) {
+                atom.pos[c] = (cell_pos[c] + offsets[k][c])*lattice_constant;
+            }
+            if (owner(atom.pos[0]) != rank) continue;
+            atom.vel          = (velocities[atom.id] - average_vel) * scale_factor;
+            atom.acc          = vec3(0, 0, 0);
+            atom.displacement = vec3(0, 0, 0);
+            atom.listed_displacement = vec3(0, 0, 0);
+            atoms.push_back(atom);
+        }
+    }
+}
+
+uint domain_decomposition::owner(ftype x) const
+{
+    int slab = int(floor(x/box_size*num_domains));
+    return slab < 0 ? 0 : (slab >= int(num_domains) ? num_domains - 1 : uint(slab));
+}
+
+bool domain_decomposition::rebuild(string &error)
+{
+    double start_time = omp_get_wtime();
+    const uint left  = (rank + num_domains - 1) % num_domains;
+    const uint right = (rank + 1) % num_domains;
+
+    // Back in the box, and away with the atoms that have left the slab
+    vector<char> to_left, to_right, from_left, from_right;
+    for (uint i = 0; i < atoms.size(); ) {
+        domain_atom &atom = atoms[i];
+        for (uint c = 0; c < 3; c++) {
+            atom.pos[c] -= box_size*floor(atom.pos[c]/box_size);
+            if (atom.pos[c] >= box_size) atom.pos[c] = 0; // Rounding
+        }
+        uint destination = owner(atom.pos[0]);
+        if (destination == rank) {
+            i++;
+            continue;
+        }
+        if (destination != right && destination != left) {
+            error = "An atom moved more than a slab between two rebuilds";
+            return false;
+        }
+        vector<char> &message = destination == right ? to_right : to_left;
+        message.insert(message.end(), (const char*)&atom, (const char*)&atom + sizeof(domain_atom));
+        atom = atoms.back();
+        atoms.pop_back();
+    }
+    if (!transport->exchange(right, to_right, left, from_left) || !transport->exchange(left, to_left, right, from_right)) {
+        error = "The atoms could not be migrated";
+        return false;
+    }
+    for (uint m = 0; m < 2; m++) {
+        const vector<char> &message = m == 0 ? from_left : from_right;
+        for (uint offset = 0; offset + sizeof(domain_atom) <= message.size(); offset += sizeof(domain_atom)) {
+            domain_atom atom;
+            memcpy(&atom, &message[offset], sizeof(domain_atom));
+            atoms.push_back(atom);
+        }
+    }
+
+    // The atoms the neighbours need as ghosts, one domain has the whole box and none
+    sent_left .clear();
+    sent_right.clear();
+    for (uint i = 0; i < atoms.size(); i++) {
+        if (num_domains > 1) {
+            if (atoms[i].pos[0] <  slab_low  + outer_cutoff) sent_left .push_back(i);
+            if (atoms[i].pos[0] >= slab_high - outer_cutoff) sent_right.push_back(i);
+        }
+        atoms[i].listed_displacement = atoms[i].displacement;
+    }
+    if (!exchange_ghosts(true)) {
+        error = "The ghosts could not be exchanged";
+        return false;
+    }
+    build_verlet_lists();
+    num_rebuilds++;
+    timers[TIMER_REBUILD] += omp_get_wtime() - start_time;
+    return true;
+}
+
+bool domain_decomposition::exchange_ghosts(bool rebuilding)
+{
+    /*
+     * The atoms near the right border go to the right neighbour, which gets
+     * them as ghosts from the left, and the other way around.
+     */
+    const uint left  = (rank + num_domains - 1) % num_domains;
+    const uint right = (rank + 1) % num_domains;
+    vector<char> to_left (sent_left .size()*sizeof(vec3));
+    vector<char> to_right(sent_right.size()*sizeof(vec3));
+    vector<char> from_left, from_right;
+    for (uint k = 0; k < sent_left.size(); k++) {
+        memcpy(&to_left[k*sizeof(vec3)], &atoms[sent_left[k]].pos, sizeof(vec3));
+    }
+    for (uint k = 0; k < sent_right.size(); k++) {
+        memcpy(&to_right[k*sizeof(vec3)], &atoms[sent_right[k]].pos, sizeof(vec3));
+    }
+    if (!transport->exchange(right, to_right, left, from_left) || !transport->exchange(left, to_left, right, from_right)) {
+        return false;
+    }
+    uint num_from_left  = uint(from_left .size()/sizeof(vec3));
+    uint num_from_right = uint(from_right.size()/sizeof(vec3));
+    if (rebuilding) {
+        num_left_ghosts = num_from_left;
+        ghosts      .resize(num_from_left + num_from_right);
+        ghost_shifts.resize(num_from_left + num_from_right);
+    }
+    else if (num_from_left != num_left_ghosts || num_from_left + num_from_right != ghosts.size()) {
+        return false;
+    }
+    for (uint g = 0; g < ghosts.size(); g++) {
+        const vector<char> &message = g < num_from_left ? from_left : from_right;
+        uint k = g < num_from_left ? g : g - num_from_left;
+        memcpy(&ghosts[g], &message[k*sizeof(vec3)], sizeof(vec3));
+        if (rebuilding) {
+            // The image across the periodic border that is next to this slab
+            ftype border = g < num_from_left ? slab_low : slab_high;
+            ghost_shifts[g] = -box_size*floor((ghosts[g][0] - border)/box_size + ftype(0.5));
+        }
+        ghosts[g][0] += ghost_shifts[g];
+    }
+    return true;
+}
+
+void domain_decomposition::build_verlet_lists()
+{
+    /*
+     * Cells at least as large as the outer cutoff, over the slab and the
+     * ghosts on both sides of it. Only x is not periodic here, the ghosts
+     * are already where they interact. With one domain there are no ghosts
+     * and x is periodic too.
+     */
+    const uint  num_atoms = uint(atoms.size());
+    const bool  x_periodic = num_domains == 1;
+    const ftype low       = x_periodic ? 0        : slab_low - outer_cutoff;
+    const ftype width     = x_periodic ? box_size : slab_high - slab_low + 2*outer_cutoff;
+    const int   nx        = width/outer_cutoff >= 1 ? int(width/outer_cutoff) : 1;
+    const int   ny        = box_size/outer_cutoff >= 1 ? int(box_size/outer_cutoff) : 1;
+    const ftype cell_x    = width/nx;
+    const ftype cell_y    = box_size/ny;
+    const ftype sqr_outer_cutoff = outer_cutoff*outer_cutoff;
+    vector<int> cell_first(nx*ny*ny, -1);
+    vector<int> cell_next (num_atoms + ghosts.size(), -1);
+    vector<int> atom_cell (num_atoms + ghosts.size());
+    for (uint j = 0; j < num_atoms + ghosts.size(); j++) {
+        const vec3 &pos = j < num_atoms ? atoms[j].pos : ghosts[j - num_atoms];
+        int cx = int((pos[0] - low)/cell_x);
+        int cy = int(pos[1]/cell_y);
+        int cz = int(pos[2]/cell_y);
+        cx = cx < 0 ? 0 : (cx >= nx ? nx - 1 : cx);
+        cy = cy < 0 ? 0 : (cy >= ny ? ny - 1 : cy);
+        cz = cz < 0 ? 0 : (cz >= ny ? ny - 1 : cz);
+        atom_cell[j] = (cz*ny + cy)*nx + cx;
+        cell_next[j] = cell_first[atom_cell[j]];
+        cell_first[atom_cell[j]] = int(j);
+    }
+
+    verlet_first.resize(num_atoms + 1);
+    verlet_neighbours.clear();
+    for (uint i = 0; i < num_atoms; i++) {
+        verlet_first[i] = uint(verlet_neighbours.size());
+        const vec3 &pos_i = atoms[i].pos;
+        int cx = atom_cell[i] % nx;
+        int cy = atom_cell[i] / nx % ny;
+        int cz = atom_cell[i] / nx / ny;
+        int xs[3], ys[3], zs[3];
+        uint num_xs = 0;
+        if (x_periodic) {
+            num_xs = periodic_neighbour_cells(cx, nx, xs);
+        }
+        else {
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                if (x >= 0 && x < nx) xs[num_xs++] = x;
+            }
+        }
+        uint num_ys = periodic_neighbour_cells(cy, ny, ys);
+        uint num_zs = periodic_neighbour_cells(cz, ny, zs);
+        for (uint e = 0; e < num_xs; e++) {
+            for (uint a = 0; a < num_ys; a++) {
+                for (uint b = 0; b < num_zs; b++) {
+                    for (int j = cell_first[(zs[b]*ny + ys[a])*nx + xs[e]]; j >= 0; j = cell_next[j]) {
+                        if (uint(j) == i) continue;
+                        const vec3 &pos_j = uint(j) < num_atoms ? atoms[j].pos : ghosts[j - num_atoms];
+                        vec3 r = pos_i - pos_j;
+                        for (uint c = x_periodic ? 0 : 1; c < 3; c++) {
+                            if      (r[c] >  box_size/2) r[c] -= box_size;
+                            else if (r[c] < -box_size/2) r[c] += box_size;
+                        }
+                        if (r.sqr_length() < sqr_outer_cutoff) {
+                            verlet_neighbours.push_back(uint(j));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    verlet_first[num_atoms] = uint(verlet_neighbours.size());
+}
+
+void domain_decomposition::calculate_forces(bool measure)
+{
+    /*
+     * Every pair of atoms in the slab is visited from both sides, and every
+     * pair with a ghost from this side only, so half of the energy and the
+     * virial of each visit belongs to this domain.
+     */
+    const uint  num_atoms = uint(atoms.size());
+    const uint  first_periodic = num_domains == 1 ? 0 : 1; // x is periodic through the ghosts otherwise
+    const ftype sqr_inner_cutoff = inner_cutoff*inner_cutoff;
+    double Ep_sum     = 0;
+    double virial_sum = 0;
+    for (uint i = 0; i < num_atoms; i++) {
+        const vec3 pos_i = atoms[i].pos;
+        vec3 acc = vec3(0, 0, 0);
+        for (uint k = verlet_first[i]; k < verlet_first[i + 1]; k++) {
+            uint j = verlet_neighbours[k];
+            vec3 r = pos_i - (j < num_atoms ? atoms[j].pos : ghosts[j - num_atoms]);
+            for (uint c = first_periodic; c < 3; c++) {
+                if      (r[c] >  box_size/2) r[c] -= box_size;
+                else if (r[c] < -box_size/2) r[c] += box_size;
+            }
+            ftype sqr_distance = r.sqr_length();
+            if (sqr_distance >= sqr_inner_cutoff) {
+                continue;
+            }
+            ftype sqr_distance_inv = 1/sqr_distance;
+            ftype p = sqr_distance_inv*sqr_distance_inv*sqr_distance_inv;
+            ftype force_over_distance = 48 * sqr_distance_inv * p * (p - ftype(0.5));
+            acc += force_over_distance * r;
+            if (measure) {
+                Ep_sum     += 0.5*(4 * p * (p - 1) - E_cutoff);
+                virial_sum += 0.5*force_over_distance*sqr_distance;
+            }
+        }
+        atoms[i].acc = acc;
+    }
+    if (measure) {
+        current_Ep     = Ep_sum;
+        current_virial = virial_sum;
+    }
+}
+
+void domain_decomposition::kick(ftype time_step)
+{
+    for (uint i = 0; i < atoms.size(); i++) {
+        atoms[i].vel += time_step * atoms[i].acc;
+    }
+}
+
+void domain_decomposition::drift(ftype time_step)
+{
+    // Not put back in the box until the next rebuild, so that the distances stay right
+    for (uint i = 0; i < atoms.size(); i++) {
+        vec3 step = time_step * atoms[i].vel;
+        atoms[i].pos          += step;
+        atoms[i].displacement += step;
+    }
+}
+
+void domain_decomposition::apply_langevin_noise(uint32 step)
+{
+    // v = c1*v + c2*R, with the random numbers of mdsystem::apply_langevin_noise for each atom
+    const ftype c1 = exp(-dt/thermostat_time);
+    const ftype c2 = sqrt((1 - c1*c1) * (desired_temp > 0 ? desired_temp : 0));
+    for (uint i = 0; i < atoms.size(); i++) {
+        ftype gaussian[3];
+        philox_gaussian_vec3(random_seed, RS_LANGEVIN, atoms[i].id, step, gaussian);
+        vec3 &vel = atoms[i].vel;
+        vel[0] = c1*vel[0] + c2*gaussian[0];
+        vel[1] = c1*vel[1] + c2*gaussian[1];
+        vel[2] = c1*vel[2] + c2*gaussian[2];
+    }
+}
+
+bool domain_decomposition::needs_rebuild(bool &rebuild_needed, string &error)
+{
+    // When any atom anywhere has moved more than half the skin
+    double start_time = omp_get_wtime();
+    ftype half_skin = (outer_cutoff - inner_cutoff)/2;
+    vector<double> moved(1, 0);
+    for (uint i = 0; i < atoms.size(); i++) {
+        if ((atoms[i].displacement - atoms[i].listed_displacement).sqr_length() > half_skin*half_skin) {
+            moved[0] = 1;
+            break;
+        }
+    }
+    if (!transport->sum(moved)) {
+        error = "The domains could not be reached";
+        return false;
+    }
+    rebuild_needed = moved[0] > 0;
+    timers[TIMER_REDUCTION] += omp_get_wtime() - start_time;
+    return true;
+}
+
+bool domain_decomposition::take_sample(uint sample, string &error)
+{
+    double start_time = omp_get_wtime();
+    vector<double> sums(5, 0);
+    sums[0] = current_Ep;
+    sums[1] = current_virial;
+    for (uint i = 0; i < atoms.size(); i++) {
+        sums[2] += atoms[i].vel.sqr_length();
+        sums[3] += atoms[i].displacement.sqr_length();
+    }
+    sums[4] = double(atoms.size());
+    if (!transport->sum(sums)) {
+        error = "The domains could not be reached";
+        return false;
+    }
+    if (uint(sums[4] + 0.5) != num_particles) {
+        error = "Atoms were lost between the domains";
+        return false;
+    }
+    if (rank == 0) {
+        sample_Ep              [sample] = sums[0];
+        sample_virial          [sample] = sums[1];
+        sample_sqr_vel         [sample] = sums[2];
+        sample_sqr_displacement[sample] = sums[3];
+    }
+    timers[TIMER_REDUCTION] += omp_get_wtime() - start_time;
+    return true;
+}
+
+static ftype domain_result(uint column, double Ep, double Ep_shift, double virial, double sqr_vel, double sqr_displacement, uint num_particles, ftype box_size, ftype epsilon_in_j, ftype sigma_in_m)
+{
+    double V  = double(box_size)*box_size*box_size;
+    double T  = sqr_vel/(3*num_particles);
+    double Ek = 0.5*sqr_vel;
+    switch (column) {
+    case RC_TOTAL_ENERGY    : return ftype((Ek + Ep + Ep_shift)*epsilon_in_j/P_SI_EV);
+    case RC_KINETIC_ENERGY  : return ftype(Ek*epsilon_in_j/P_SI_EV);
+    case RC_POTENTIAL_ENERGY: return ftype((Ep + Ep_shift)*epsilon_in_j/P_SI_EV);
+    case RC_TEMPERATURE     : return ftype(T*epsilon_in_j/P_SI_KB);
+    case RC_PRESSURE        : return ftype((num_particles*T/V + virial/(3*V))*epsilon_in_j/(double(sigma_in_m)*sigma_in_m*sigma_in_m));
+    case RC_MSD             : return ftype(sqr_displacement/num_particles*sigma_in_m*sigma_in_m);
+    }
+    return 0;
+}
+
+void domain_decomposition::write_results()
+{
+    // The potential energy is shifted as in the results of mdsystem, by the first sample
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    stringstream text;
+    text << setprecision(9) << "# time [s]";
+    for (uint k = 0; k < num_domain_columns; k++) {
+        text << "\t" << mdsystem::get_result_name(domain_columns[k]);
+    }
+    text << "\n";
+    for (uint sample = 0; sample < num_samples; sample++) {
+        text << sample*sampling_period*dt*time_unit;
+        for (uint k = 0; k < num_domain_columns; k++) {
+            text << "\t" << domain_result(domain_columns[k], sample_Ep[sample], -sample_Ep[0], sample_virial[sample], sample_sqr_vel[sample], sample_sqr_displacement[sample],
+                                          num_particles, box_size, epsilon_in_j, sigma_in_m);
+        }
+        text << "\n";
+    }
+
+    string contents = text.str();
+    async_writer writer;
+    uint file = writer.open_replacing((output_directory.empty() ? string(".") : output_directory) + "/Domains.txt");
+    writer.write(file, contents.data(), contents.size());
+    writer.close(file);
+    writer.wait();
+    string errors;
+    if (writer.take_errors(errors)) {
+        print(errors);
+    }
+}
+
+void domain_decomposition::print_summary(double run_time, const vector<double> &rank_stats)
+{
+    /*
+     * Called by rank 0 twice: with the statistics of the ranks when they are
+     * collected, and with the run time when all processes are done.
+     */
+    static const char *timer_names[NUM_TIMERS] = {"forces", "integration", "halo", "rebuilds", "reductions"};
+    stringstream text;
+    if (!rank_stats.empty()) {
+        text << "*******************" << endl;
+        text << "Domains (" << num_rebuilds << " rebuilds):" << endl;
+        for (uint r = 0; r < num_domains; r++) {
+            const double *stats = &rank_stats[r*NUM_RANK_STATS];
+            text << "  Rank " << r << ": " << uint(stats[RANK_ATOMS]) << " atoms, " << uint(stats[RANK_GHOSTS]) << " ghosts,";
+            for (uint t = 0; t < NUM_TIMERS; t++) {
+                text << " " << timer_names[t] << " " << setprecision(3) << stats[RANK_TIMERS + t] << " s" << (t + 1 < NUM_TIMERS ? "," : "");
+            }
+            text << endl;
+        }
+        print(text.str());
+        return;
+    }
+
+    // The mean over the run without the first sixth, like mdsystem::get_result_mean
+    uint first = num_samples/6;
+    text << "Domain means:" << endl;
+    for (uint k = 0; k < num_domain_columns; k++) {
+        double sum = 0;
+        for (uint sample = first; sample < num_samples; sample++) {
+            sum += domain_result(domain_columns[k], sample_Ep[sample], -sample_Ep[0], sample_virial[sample], sample_sqr_vel[sample], sample_sqr_displacement[sample],
+                                 num_particles, box_size, epsilon_in_j, sigma_in_m);
+        }
+        text << "  " << mdsystem::get_result_name(domain_columns[k]) << " = " << setprecision(6) << sum/(num_samples - first) << endl;
+    }
+    text << "Throughput: " << setprecision(4) << run_time << " s";
+    if (run_time > 0) {
+        text << ", " << num_time_steps/run_time << " timesteps/s, "
+             << double(num_time_steps)*num_particles/run_time << " particle timesteps/s";
+    }
+    text << endl;
+    print(text.str());
+}
+
+void domain_decomposition::print(const string &text)
+{
+    if (output_callback.func) {
+        output_callback.func(output_callback.param, text);
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef  DOMAIN_DECOMPOSITION_H
+#define  DOMAIN_DECOMPOSITION_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "callback.h"
+#include "run_parameters.h"
+#include "domain_transport.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * One system split into slabs along x, each simulated by a process of its
+ * own, so that a system can be larger than one address space and use
+ * more than one machine's worth of memory bandwidth. Every process owns
+ * the atoms in its slab, and gets copies (ghosts) of the atoms of the
+ * neighbouring slabs that are within the outer cutoff of its borders.
+ *
+ * The Verlet lists are rebuilt when an atom has moved half the skin, as in
+ * mdsystem. At a rebuild, the atoms that have left their slab migrate to
+ * the neighbour, and it is settled which atoms are sent as ghosts; between
+ * the rebuilds only the positions of the same ghosts are sent, once per
+ * timestep. Every process computes the forces on its own atoms from full
+ * neighbour lists, so nothing has to be sent back.
+ *
+ * The start is the lattice and the velocities of mdsystem, and the Langevin
+ * noise is keyed by atom as well, so the number of slabs does not change
+ * the random numbers. The potential energy, the virial, the kinetic energy
+ * and the mean square displacement are summed over all processes at every
+ * sample. Those sums, and the order of the neighbours of an atom, depend on
+ * the slabs, so runs with different numbers of domains round differently
+ * and only agree statistically. There are never more slabs than the box
+ * has room for, and one domain has the whole box without ghosts, with the
+ * nearest image in x too. The integration is velocity Verlet, or BAOAB with the Langevin
+ * thermostat. Rank 0 is the calling process and writes Domains.txt and
+ * the timing of every rank, for strong and weak scaling.
+ */
+class domain_decomposition
+{
+public:
+    // Constructor
+    domain_decomposition();
+
+    void set_output_callback (callback<void (*)(void*, string)> output_callback_in);
+    void set_num_domains     (uint num_domains_in);
+    void set_random_seed     (uint random_seed_in);
+    void set_output_directory(const string &output_directory_in);
+    bool init(const run_parameters &parameters, string &error);
+    bool run (string &error); // Forks the processes of the other domains
+
+private:
+    /* An atom owned by a domain, sent as it is when it migrates */
+    struct domain_atom
+    {
+        uint32 id;
+        vec3   pos;
+        vec3   vel;
+        vec3   acc;
+        vec3   displacement;        // Since the start, not wrapped into the box
+        vec3   listed_displacement; // When the Verlet list was built
+    };
+
+    /* Wall-clock time of one rank */
+    enum enum_timers { TIMER_FORCES, TIMER_INTEGRATION, TIMER_HALO, TIMER_REBUILD, TIMER_REDUCTION, NUM_TIMERS };
+
+    callback<void (*)(void*, string)> output_callback;
+    string   output_directory;
+    uint     num_domains;
+    uint     random_seed;
+    // Conversion between reduced units and SI units
+    ftype    particle_mass_in_kg;
+    ftype    epsilon_in_j;
+    ftype    sigma_in_m;
+    // The system, in reduced units
+    uint     num_particles;
+    ftype    lattice_constant;
+    uint     box_size_in_lattice_constants;
+    ftype    box_size;
+    ftype    dt;
+    ftype    inner_cutoff;
+    ftype    outer_cutoff;
+    ftype    E_cutoff;
+    bool     langevin_on;
+    ftype    init_temp;
+    ftype    desired_temp;
+    ftype    thermostat_time;
+    uint     num_time_steps;
+    uint     sampling_period;
+    uint     num_samples;
+    // The domain of this process
+    domain_transport   *transport;
+    uint                rank;
+    ftype               slab_low;       // The atoms with slab_low <= x < slab_high are owned
+    ftype               slab_high;
+    vector<domain_atom> atoms;
+    vector<vec3>        ghosts;         // From the left neighbour, then from the right one
+    vector<ftype>       ghost_shifts;   // Added to x of each ghost, to put it next to this slab across the periodic border
+    uint                num_left_ghosts;
+    vector<uint>        sent_left;      // The atoms sent as ghosts to each neighbour
+    vector<uint>        sent_right;
+    vector<uint>        verlet_first;   // Where the neighbours of each atom start in verlet_neighbours
+    vector<uint>        verlet_neighbours; // Atoms below atoms.size(), ghosts above
+    uint                num_rebuilds;
+    double              timers[NUM_TIMERS];
+    // Samples, summed over all domains, only kept by rank 0
+    vector<double>      sample_Ep;
+    vector<double>      sample_virial;
+    vector<double>      sample_sqr_vel;
+    vector<double>      sample_sqr_displacement;
+    double              current_Ep;
+    double              current_virial;
+
+    bool run_domain(string &error);
+    void create_atoms();
+    uint owner(ftype x) const;
+    bool rebuild(string &error); // Migration, ghosts and Verlet lists
+    bool exchange_ghosts(bool rebuilding); // Positions of the atoms in sent_left and sent_right
+    void build_verlet_lists();
+    void calculate_forces(bool measure);
+    void kick (ftype time_step);
+    void drift(ftype time_step);
+    void apply_langevin_noise(uint32 step);
+    bool needs_rebuild(bool &rebuild_needed, string &error);
+    bool take_sample(uint sample, string &error);
+    void write_results();
+    void print_summary(double run_time, const vector<double> &rank_stats);
+    void print(const string &text);
+};
+
+#endif  /* DOMAIN_DECOMPOSITION_H */
@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cerrno>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "domain_transport.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR AND DESTRUCTOR
+////////////////////////////////////////////////////////////////
+
+socket_transport::socket_transport(uint num_ranks_in)
+{
+    rank      = 0;
+    num_ranks = num_ranks_in > 0 ? num_ranks_in : 1;
+    sockets.assign(num_ranks*num_ranks, -1);
+    open      = true;
+#ifndef _WIN32
+    for (uint a = 0; a < num_ranks; a++) {
+        for (uint b = a + 1; b < num_ranks; b++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                open = false;
+                continue;
+            }
+            sockets[a*num_ranks + b] = pair[0];
+            sockets[b*num_ranks + a] = pair[1];
+        }
+    }
+#else
+    open = num_ranks == 1;
+#endif
+}
+
+socket_transport::~socket_transport()
+{
+#ifndef _WIN32
+    for (uint i = 0; i < sockets.size(); i++) {
+        if (sockets[i] >= 0) {
+            close(sockets[i]);
+        }
+    }
+#endif
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool socket_transport::is_open() const
+{
+    return open;
+}
+
+void socket_transport::select_rank(uint rank_in)
+{
+    rank = rank_in;
+#ifndef _WIN32
+    for (uint a = 0; a < num_ranks; a++) {
+        if (a == rank) continue;
+        for (uint b = 0; b < num_ranks; b++) {
+            int &socket = sockets[a*num_ranks + b];
+            if (socket >= 0) {
+                close(socket);
+                socket = -1;
+            }
+        }
+    }
+#endif
+}
+
+uint socket_transport::get_rank() const
+{
+    return rank;
+}
+
+uint socket_transport::get_num_ranks() const
+{
+    return num_ranks;
+}
+
+bool socket_transport::exchange(uint destination, const vector<char> &sent, uint source, vector<char> &received)
+{
+    if (destination == rank && source == rank) {
+        received = sent;
+        return true;
+    }
+    if (destination == rank || source == rank) {
+        return false; // Only whole rings of ranks
+    }
+
+    // The sizes first, so that the receiver knows how much is coming
+    int    send_socket    = sockets[rank*num_ranks + destination];
+    int    receive_socket = sockets[rank*num_ranks + source];
+    uint64 send_size      = sent.size();
+    uint64 receive_size   = 0;
+    if (!transfer(send_socket, (const char*)&send_size, sizeof(send_size), receive_socket, (char*)&receive_size, sizeof(receive_size))) {
+        return false;
+    }
+    received.resize(size_t(receive_size));
+    return transfer(send_socket, sent.empty() ? 0 : &sent[0], send_size, receive_socket, received.empty() ? 0 : &received[0], receive_size);
+}
+
+bool socket_transport::sum(vector<double> &values)
+{
+    /*
+     * Rank 0 adds the values of the others in the order of the ranks and
+     * sends the sums back.
+     */
+    if (num_ranks == 1) {
+        return true;
+    }
+    uint64 size = uint64(values.size())*sizeof(double);
+    if (rank == 0) {
+        vector<double> others(values.size());
+        for (uint r = 1; r < num_ranks; r++) {
+            if (!transfer(-1, 0, 0, sockets[r], (char*)&others[0], size)) {
+                return false;
+            }
+            for (uint i = 0; i < values.size(); i++) {
+                values[i] += others[i];
+            }
+        }
+        for (uint r = 1; r < num_ranks; r++) {
+            if (!transfer(sockets[r], (const char*)&values[0], size, -1, 0, 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    int socket = sockets[rank*num_ranks];
+    return transfer(socket, (const char*)&values[0], size, -1, 0, 0) && transfer(-1, 0, 0, socket, (char*)&values[0], size);
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool socket_transport::transfer(int send_socket, const char *sent, uint64 send_size, int receive_socket, char *received, uint64 receive_size)
+{
+#ifndef _WIN32
+    // Sends and receives whatever the sockets are ready for, until both are done
+    uint64 num_sent     = 0;
+    uint64 num_received = 0;
+    while (num_sent < send_size || num_received < receive_size) {
+        pollfd fds[2];
+        nfds_t num_fds       = 0;
+        int    send_index    = -1;
+        int    receive_index = -1;
+        if (num_sent < send_size) {
+            fds[num_fds].fd      = send_socket;
+            fds[num_fds].events  = POLLOUT;
+            fds[num_fds].revents = 0;
+            send_index = int(num_fds++);
+        }
+        if (num_received < receive_size) {
+            if (send_index >= 0 && send_socket == receive_socket) {
+                fds[send_index].events |= POLLIN;
+                receive_index = send_index;
+            }
+            else {
+                fds[num_fds].fd      = receive_socket;
+                fds[num_fds].events  = POLLIN;
+                fds[num_fds].revents = 0;
+                receive_index = int(num_fds++);
+            }
+        }
+        if (poll(fds, num_fds, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (send_index >= 0 && (fds[send_index].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            ssize_t count = send(send_socket, sent + num_sent, size_t(send_size - num_sent), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return false;
+            }
+            if (count > 0) num_sent += uint64(count);
+        }
+        if (receive_index >= 0 && (fds[receive_index].revents & (POLLIN | POLLERR | POLLHUP))) {
+            ssize_t count = recv(receive_socket, received + num_received, size_t(receive_size - num_received), MSG_DONTWAIT);
+            if (count == 0) {
+                return false; // The other rank is gone
+            }
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return false;
+            }
+            if (count > 0) num_received += uint64(count);
+        }
+    }
+    return true;
+#else
+    (void)send_socket; (void)sent; (void)receive_socket; (void)received;
+    return send_size == 0 && receive_size == 0;
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef  DOMAIN_TRANSPORT_H
+#define  DOMAIN_TRANSPORT_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASSES
+////////////////////////////////////////////////////////////////
+
+/*
+ * How the domains of a domain_decomposition talk to each other. Every
+ * domain has a rank and the messages are bytes. exchange sends to one rank
+ * while it receives from another, which is all the halo exchange and the
+ * migration of atoms need, and sum adds values over all ranks. The sums
+ * are always taken in the order of the ranks, so they do not depend on
+ * the timing. Other transports (MPI, shared memory rings) only have to
+ * implement these functions.
+ */
+class domain_transport
+{
+public:
+    virtual ~domain_transport() {}
+
+    virtual uint get_rank() const = 0;
+    virtual uint get_num_ranks() const = 0;
+    virtual bool exchange(uint destination, const vector<char> &sent, uint source, vector<char> &received) = 0;
+    virtual bool sum(vector<double> &values) = 0; // Every rank gives as many values and gets the sums
+};
+
+/*
+ * Unix domain sockets between every pair of ranks, for processes on one
+ * machine. All sockets are created before the processes are forked, and
+ * every process then selects its rank, which closes the sockets of the
+ * others. Both directions of an exchange are served at once, so two ranks
+ * sending large messages to each other never wait for each other.
+ */
+class socket_transport : public domain_transport
+{
+public:
+    // Constructor and destructor
+    explicit socket_transport(uint num_ranks_in); // Before fork
+    ~socket_transport();
+
+    bool is_open() const;          // If all the sockets could be created
+    void select_rank(uint rank_in); // After fork, in every process
+    uint get_rank() const;
+    uint get_num_ranks() const;
+    bool exchange(uint destination, const vector<char> &sent, uint source, vector<char> &received);
+    bool sum(vector<double> &values);
+
+private:
+    uint        rank;
+    uint        num_ranks;
+    vector<int> sockets; // [a*num_ranks + b] The end of the pair of a and b used by a, -1 if closed
+    bool        open;
+
+    bool transfer(int send_socket, const char *sent, uint64 send_size, int receive_socket, char *received, uint64 receive_size);
+
+    // Not copyable, the sockets are owned
+    socket_transport(const socket_transport &);
+    socket_transport &operator=(const socket_transport &);
+};
+
+#endif  /* DOMAIN_TRANSPORT_H */
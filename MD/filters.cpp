@@ -0,0 +1,631 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cmath>
+
+// Own includes
+#include "filters.h"
+#include "simd.h"
+
+////////////////////////////////////////////////////////////////
+// FILTER WORKSPACE
+////////////////////////////////////////////////////////////////
+
+void filter_workspace::prepare(uint vector_size, uint num_times, bool slope_compensate)
+{
+    if (num_times == 0) {
+        return;
+    }
+    left_y.resize(vector_size*FILTER_LANES);
+    if (slope_compensate) left_x      .resize(vector_size*FILTER_LANES);
+    if (num_times > 1   ) intermediate.resize(vector_size*FILTER_LANES);
+}
+
+void filter_workspace::set_ram_budget(uint64 ram_budget)
+{
+    left_y      .set_ram_budget(ram_budget);
+    left_x      .set_ram_budget(ram_budget);
+    intermediate.set_ram_budget(ram_budget);
+}
+
+bool filter_workspace::make_private()
+{
+    bool all_private = left_y.make_private();
+    all_private = left_x      .make_private() && all_private;
+    all_private = intermediate.make_private() && all_private;
+    return all_private;
+}
+
+////////////////////////////////////////////////////////////////
+// TWO SIDED EXPONENTIAL DECAY FILTER
+////////////////////////////////////////////////////////////////
+
+uint two_sided_exponential_decay_filter::num_sampling_points(uint num_timesteps_in, uint sampling_period, uint /*ensemble_size*/)
+{
+    uint num_time_steps = ((num_timesteps_in - 1) / sampling_period + 1) * sampling_period; // Make the smallest multiple of sample_period that has at least the specified size
+    return num_time_steps/sampling_period + 1;
+}
+
+void two_sided_exponential_decay_filter::filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype sampling_time, ftype impulse_response_decay_time, uint num_times, bool slope_compensate, uint /*ensemble_size*/)
+{
+    uint vector_size = unfiltered.size();
+    filtered.resize(vector_size);
+
+    if (num_times == 0) {
+        for (uint i = 0; i < vector_size; i++) {
+            filtered[i] = unfiltered[i];
+        }
+        return;
+    }
+
+    ftype f = exp(-sampling_time/impulse_response_decay_time);
+    ftype k = 1 - f;
+    ftype x, y, w;
+    vector<ftype> total_weight(vector_size);
+    const vector<ftype> *source;
+    vector<ftype> *destination;
+    vector<ftype> temp_vec(num_times > 1 ? vector_size : 0);
+    vector<ftype> filtered_index(vector_size);
+
+    source = &unfiltered;
+    for (; num_times > 0; num_times--) {
+        destination = (num_times & 1) ? &filtered : &temp_vec;
+        // Left side exponential decay
+        x = y = w = 0;
+        for (int i = 0; i < int(vector_size); i++) {
+            x *= f;
+            y *= f;
+            w *= f;
+            x += k*i           ;
+            y += k*(*source)[i];
+            w += k             ;
+            filtered_index[i] = x;
+            (*destination)[i] = y;
+            total_weight  [i] = w;
+        }
+
+        // Right side exponential decay
+        x = y = w = 0;
+        for (int i = int(vector_size) - 1; i >= 0; i--) {
+            x *= f;
+            y *= f;
+            w *= f;
+            filtered_index[i] += x;
+            (*destination)[i] += y;
+            total_weight  [i] += w;
+            x += k*i           ;
+            y += k*(*source)[i];
+            w += k             ;
+
+            // Compensate for weights at the same time
+            (*destination)[i] /= total_weight[i];
+            filtered_index[i] /= total_weight[i];
+        }
+
+        if (slope_compensate) {
+            vector<ftype> dy_dx(vector_size);
+            dy_dx[0] = (4*((*destination)[1]-(*destination)[0])+(*destination)[0]-(*destination)[2])/
+                       (4*(filtered_index[1]-filtered_index[0])+filtered_index[0]-filtered_index[2]);
+            for (int i = 1; i < int(vector_size) - 1; i++) {
+                dy_dx[i] = ((*destination)[i+1]-(*destination)[i-1])/
+                        (filtered_index[i+1]-filtered_index[i-1]);
+            }
+            dy_dx[vector_size-1] = (4*((*destination)[vector_size-1]-(*destination)[vector_size-2])-(*destination)[vector_size-1]+(*destination)[vector_size-3])/
+                                   (4*(filtered_index[vector_size-1]-filtered_index[vector_size-2])-filtered_index[vector_size-1]+filtered_index[vector_size-3]);
+            for (int i = 0; i < int(vector_size); i++) {
+                (*destination)[i] += (i-filtered_index[i])*dy_dx[i];
+            }
+        }
+
+        source = destination;
+    }
+}
+
+/*
+ * Rows of one sample from every channel, either interleaved in one series or
+ * (when reading) from the separate channels. For the separate channels, the
+ * rows where all of them are in the same chunks are remembered, so that the
+ * chunks only have to be looked up when leaving them.
+ */
+template<uint R>
+class row_reader
+{
+public:
+    row_reader(const time_series *interleaved_in, const time_series *const *separate_in)
+        : interleaved(interleaved_in), separate(separate_in), first(1), last(0) {}
+
+    void load(uint i, simd_ftype *row)
+    {
+        const uint L = R*SIMD_WIDTH;
+        if (interleaved) {
+            const ftype *p = &(*interleaved)[i*L]; // Rows never cross chunk boundaries
+            for (uint r = 0; r < R; r++) {
+                row[r] = simd_ftype::load(p + r*SIMD_WIDTH);
+            }
+            return;
+        }
+        if (i < first || i >= last) {
+            first = 0;
+            last  = ~0u;
+            for (uint c = 0; c < L; c++) {
+                first = separate[c]->chunk_begin(i) > first ? separate[c]->chunk_begin(i) : first;
+                last  = separate[c]->chunk_end  (i) < last  ? separate[c]->chunk_end  (i) : last ;
+            }
+            for (uint c = 0; c < L; c++) {
+                base[c] = &(*separate[c])[first];
+            }
+        }
+        for (uint r = 0; r < R; r++) {
+            row[r] = simd_ftype::gather(base + r*SIMD_WIDTH, i - first);
+        }
+    }
+
+private:
+    const time_series        *interleaved;
+    const time_series *const *separate;
+    uint                      first, last; // The rows where base is valid
+    const ftype              *base[R*SIMD_WIDTH];
+};
+
+template<uint R>
+static inline void store_row(time_series *interleaved, uint i, const simd_ftype *row)
+{
+    const uint L = R*SIMD_WIDTH;
+    ftype *p = &(*interleaved)[i*L];
+    for (uint r = 0; r < R; r++) {
+        row[r].store(p + r*SIMD_WIDTH);
+    }
+}
+
+/*
+ * The same filter for several channels at once, one channel in each SIMD
+ * lane, with exactly the arithmetic of filter() in every lane. All
+ * channels must be equally long. Compared to filtering one channel at a
+ * time, the memory traffic is cut down since
+ *   - the channels are read where they are, only the left side sums are
+ *     stored in between, and then overwritten by the result,
+ *   - the left side weight does not depend on the samples, and stops
+ *     changing after a while, so only the first rows of it are stored,
+ *   - the slope compensation is done in the right side pass, two rows
+ *     behind, and the filtered index is only calculated when needed.
+ * Lanes are masked off when their channel is done filtering.
+ */
+template<uint R>
+static void filter_lanes(const filter_channel *channels, uint num_channels, ftype sampling_time, filter_workspace &workspace)
+{
+    const uint L = R*SIMD_WIDTH;
+
+    // Parameters of each lane, the unused lanes get copies of the first channel's
+    uint         n = uint(channels[0].unfiltered->size());
+    ftype        f[L], k[L];
+    uint         num_times[L];
+    bool         slope_compensate[L];
+    uint         max_num_times = 0;
+    bool         any_slope_compensate = false;
+    const time_series *input[L];
+    for (uint c = 0; c < num_channels; c++) {
+        channels[c].filtered->resize(n);
+    }
+    if (n == 0) {
+        return;
+    }
+    for (uint c = 0; c < L; c++) {
+        const filter_channel &channel = channels[c < num_channels ? c : 0];
+        f[c] = exp(-sampling_time/channel.impulse_response_decay_time);
+        k[c] = 1 - f[c];
+        num_times       [c] = c < num_channels ? channel.num_times : 0;
+        slope_compensate[c] = num_times[c] > 0 && channel.slope_compensate && n >= 3;
+        input[c] = channel.unfiltered;
+        max_num_times = num_times[c] > max_num_times ? num_times[c] : max_num_times;
+        any_slope_compensate = any_slope_compensate || slope_compensate[c];
+    }
+    if (max_num_times == 0) {
+        for (uint c = 0; c < num_channels; c++) {
+            channels[c].filtered->assign(*channels[c].unfiltered);
+        }
+        return;
+    }
+
+    simd_ftype f_r[R], k_r[R];
+    for (uint r = 0; r < R; r++) {
+        f_r[r] = simd_ftype::load(f + r*SIMD_WIDTH);
+        k_r[r] = simd_ftype::load(k + r*SIMD_WIDTH);
+    }
+    const simd_ftype zero(0), four(4);
+
+    // Left side weights until they stop changing
+    workspace.left_w.clear();
+    {
+        ftype w[L], previous[L];
+        for (uint c = 0; c < L; c++) {
+            w[c] = 0;
+        }
+        for (uint i = 0; i < n; i++) {
+            bool converged = true;
+            for (uint c = 0; c < L; c++) {
+                previous[c] = w[c];
+                w[c] *= f[c];
+                w[c] += k[c];
+                converged = converged && w[c] == previous[c];
+            }
+            if (converged) break;
+            workspace.left_w.insert(workspace.left_w.end(), w, w + L);
+        }
+    }
+    const uint   num_left_w_rows = uint(workspace.left_w.size()/L);
+    const ftype *left_w = &workspace.left_w[0];
+
+    // Only grown, so that the chunks are kept for the next group of channels
+    if (                        workspace.left_y      .size() < n*L) workspace.left_y      .resize(n*L);
+    if (any_slope_compensate && workspace.left_x      .size() < n*L) workspace.left_x      .resize(n*L);
+    if (max_num_times > 1    && workspace.intermediate.size() < n*L) workspace.intermediate.resize(n*L);
+    time_series &left_y       = workspace.left_y;
+    time_series &left_x       = workspace.left_x;
+    time_series *intermediate = &workspace.intermediate;
+
+    for (uint pass = 0; pass < max_num_times; pass++) {
+        // The first pass reads the channels, the following ones the result of the previous one in place. The last pass writes over the left side sums as they are used.
+        const time_series *source      = pass == 0                 ? 0       : intermediate;
+        time_series       *destination = pass == max_num_times - 1 ? &left_y : intermediate;
+        row_reader<R>      reader(source, input);
+
+        bool active[L], compensate[L];
+        for (uint c = 0; c < L; c++) {
+            active    [c] = pass < num_times[c];
+            compensate[c] = active[c] && slope_compensate[c];
+        }
+        simd_ftype active_mask[R], compensate_mask[R];
+        for (uint r = 0; r < R; r++) {
+            active_mask         [r] = simd_ftype::mask(active     + r*SIMD_WIDTH);
+            compensate_mask[r] = simd_ftype::mask(compensate + r*SIMD_WIDTH);
+        }
+        bool pass_compensates = false;
+        for (uint c = 0; c < L; c++) {
+            pass_compensates = pass_compensates || compensate[c];
+        }
+
+        // Left side exponential decay
+        simd_ftype x[R], y[R], w[R], s[R];
+        for (uint r = 0; r < R; r++) {
+            x[r] = y[r] = zero;
+        }
+        for (uint i = 0; i < n; i++) {
+            reader.load(i, s);
+            simd_ftype index = simd_ftype(ftype(i));
+            ftype *ly = &left_y[i*L];
+            ftype *lx = pass_compensates ? &left_x[i*L] : 0;
+            for (uint r = 0; r < R; r++) {
+                y[r] = y[r] * f_r[r];
+                y[r] = y[r] + k_r[r]*s[r];
+                y[r].store(ly + r*SIMD_WIDTH);
+                if (pass_compensates) {
+                    x[r] = x[r] * f_r[r];
+                    x[r] = x[r] + k_r[r]*index;
+                    x[r].store(lx + r*SIMD_WIDTH);
+                }
+            }
+        }
+
+        // Right side exponential decay, with the slope compensation two rows behind
+        simd_ftype raw[3][R], raw_index[3][R], out[R];
+        for (uint r = 0; r < R; r++) {
+            x[r] = y[r] = w[r] = zero;
+        }
+        for (int i = int(n) - 1; i >= 0; i--) {
+            reader.load(i, s);
+            simd_ftype index = simd_ftype(ftype(i));
+            const ftype *lw = left_w + (uint(i) < num_left_w_rows ? i : num_left_w_rows - 1)*L;
+            const ftype *ly = &left_y[i*L];
+            const ftype *lx = pass_compensates ? &left_x[i*L] : 0;
+            simd_ftype current[R], current_index[R];
+            for (uint r = 0; r < R; r++) {
+                x[r] = x[r] * f_r[r];
+                y[r] = y[r] * f_r[r];
+                w[r] = w[r] * f_r[r];
+                simd_ftype total_weight = simd_ftype::load(lw + r*SIMD_WIDTH) + w[r];
+                current[r] = (simd_ftype::load(ly + r*SIMD_WIDTH) + y[r])/total_weight;
+                if (pass_compensates) {
+                    current_index[r] = (simd_ftype::load(lx + r*SIMD_WIDTH) + x[r])/total_weight;
+                }
+                x[r] = x[r] + k_r[r]*index;
+                y[r] = y[r] + k_r[r]*s[r];
+                w[r] = w[r] + k_r[r];
+            }
+
+            if (!pass_compensates) {
+                for (uint r = 0; r < R; r++) {
+                    out[r] = select(active_mask[r], current[r], s[r]);
+                }
+                store_row<R>(destination, i, out);
+                continue;
+            }
+            for (uint r = 0; r < R; r++) {
+                raw      [i % 3][r] = current      [r];
+                raw_index[i % 3][r] = current_index[r];
+            }
+
+            // The last row, compensated by the slope from the two before it
+            if (i == int(n) - 3) {
+                const simd_ftype *y0 = raw[(n - 1) % 3], *fi0 = raw_index[(n - 1) % 3];
+                const simd_ftype *y1 = raw[(n - 2) % 3], *fi1 = raw_index[(n - 2) % 3];
+                simd_ftype last_index = simd_ftype(ftype(n - 1));
+                reader.load(n - 1, s);
+                for (uint r = 0; r < R; r++) {
+                    simd_ftype dy_dx = (four*(y0[r]-y1[r])-y0[r]+current[r])/
+                                       (four*(fi0[r]-fi1[r])-fi0[r]+current_index[r]);
+                    out[r] = select(active_mask[r], select(compensate_mask[r], y0[r] + (last_index-fi0[r])*dy_dx, y0[r]), s[r]);
+                }
+                store_row<R>(destination, n - 1, out);
+            }
+            // The row after this one, compensated by the slope between its neighbours
+            if (i <= int(n) - 3) {
+                const simd_ftype *y1 = raw[(i + 1) % 3], *fi1 = raw_index[(i + 1) % 3];
+                const simd_ftype *y2 = raw[(i + 2) % 3], *fi2 = raw_index[(i + 2) % 3];
+                simd_ftype next_index = simd_ftype(ftype(i + 1));
+                reader.load(i + 1, s);
+                for (uint r = 0; r < R; r++) {
+                    simd_ftype dy_dx = (y2[r]-current[r])/
+                                       (fi2[r]-current_index[r]);
+                    out[r] = select(active_mask[r], select(compensate_mask[r], y1[r] + (next_index-fi1[r])*dy_dx, y1[r]), s[r]);
+                }
+                store_row<R>(destination, i + 1, out);
+            }
+        }
+        if (pass_compensates) {
+            // The first row, compensated by the slope from the two after it
+            const simd_ftype *y0 = raw[0], *fi0 = raw_index[0];
+            const simd_ftype *y1 = raw[1], *fi1 = raw_index[1];
+            const simd_ftype *y2 = raw[2], *fi2 = raw_index[2];
+            reader.load(0, s);
+            for (uint r = 0; r < R; r++) {
+                simd_ftype dy_dx = (four*(y1[r]-y0[r])+y0[r]-y2[r])/
+                                   (four*(fi1[r]-fi0[r])+fi0[r]-fi2[r]);
+                out[r] = select(active_mask[r], select(compensate_mask[r], y0[r] + (zero-fi0[r])*dy_dx, y0[r]), s[r]);
+            }
+            store_row<R>(destination, 0, out);
+        }
+    }
+
+    // De-interleave the result, a cache sized block of rows at a time
+    const uint block_size = 256;
+    for (uint first = 0; first < n; first += block_size) {
+        uint last = first + block_size < n ? first + block_size : n;
+        for (uint c = 0; c < num_channels; c++) {
+            time_series &output = *channels[c].filtered;
+            for (uint i = first; i < last; ) {
+                ftype *out = &output[i];
+                uint   end = output.chunk_end(i) < last ? output.chunk_end(i) : last;
+                for (; i < end; i++) {
+                    *out++ = left_y[i*L + c];
+                }
+            }
+        }
+    }
+}
+
+void two_sided_exponential_decay_filter::filter_channels(const filter_channel *channels, uint num_channels, ftype sampling_time, uint /*ensemble_size*/, filter_workspace &workspace)
+{
+    for (uint first = 0; first < num_channels; first += FILTER_LANES) {
+        uint num = num_channels - first < FILTER_LANES ? num_channels - first : FILTER_LANES;
+        // A few channels only need a single register per row
+        if (num <= SIMD_WIDTH) filter_lanes<1                       >(channels + first, num, sampling_time, workspace);
+        else                   filter_lanes<FILTER_LANES/SIMD_WIDTH>(channels + first, num, sampling_time, workspace);
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// STREAMING TWO SIDED EXPONENTIAL DECAY FILTER
+////////////////////////////////////////////////////////////////
+
+/*
+ * Each pass keeps, instead of the filtered index, the weighted distance u
+ * between the index and the samples on each side. It does not grow with
+ * the index, so the precision is kept in arbitrarily long runs. With W the
+ * total weight, i - filtered_index = (left_u - right_u)/W.
+ */
+
+two_sided_exponential_decay_filter_stream::two_sided_exponential_decay_filter_stream(ftype sampling_time, ftype impulse_response_decay_time, uint num_times, bool slope_compensate, ftype tolerance)
+{
+    ftype f = exp(-sampling_time/impulse_response_decay_time);
+    uint window = uint(ceil(log(tolerance)/log(f))) + 1;
+    stages.resize(num_times);
+    for (uint i = 0; i < num_times; i++) {
+        stages[i].f = f;
+        stages[i].k = 1 - f;
+        stages[i].window = window;
+        stages[i].slope_compensate = slope_compensate;
+        stages[i].samples.reserve(2*window);
+        stages[i].left_y .reserve(2*window);
+        stages[i].left_w .reserve(2*window);
+        stages[i].left_u .reserve(2*window);
+        stages[i].out_y  .reserve(2*window);
+        stages[i].out_d  .reserve(2*window);
+        stages[i].reset();
+    }
+}
+
+void two_sided_exponential_decay_filter_stream::push(ftype sample, vector<ftype> &filtered)
+{
+    if (stages.empty()) {
+        filtered.push_back(sample);
+        return;
+    }
+    stage_in.clear();
+    stage_in.push_back(sample);
+    for (uint s = 0; s < stages.size(); s++) {
+        bool last = s + 1 == stages.size();
+        if (!last) stage_out.clear();
+        for (uint i = 0; i < stage_in.size(); i++) {
+            stages[s].push(stage_in[i], last ? filtered : stage_out);
+        }
+        if (!last) stage_in.swap(stage_out);
+    }
+}
+
+void two_sided_exponential_decay_filter_stream::finish(vector<ftype> &filtered)
+{
+    stage_in.clear();
+    for (uint s = 0; s < stages.size(); s++) {
+        bool last = s + 1 == stages.size();
+        if (!last) stage_out.clear();
+        for (uint i = 0; i < stage_in.size(); i++) {
+            stages[s].push(stage_in[i], last ? filtered : stage_out);
+        }
+        stages[s].finish(last ? filtered : stage_out);
+        if (!last) stage_in.swap(stage_out);
+    }
+    reset();
+}
+
+void two_sided_exponential_decay_filter_stream::reset()
+{
+    for (uint s = 0; s < stages.size(); s++) {
+        stages[s].reset();
+    }
+}
+
+uint two_sided_exponential_decay_filter_stream::window_size() const
+{
+    return stages.empty() ? 0 : stages[0].window;
+}
+
+void two_sided_exponential_decay_filter_stream::stage::push(ftype sample, vector<ftype> &filtered)
+{
+    // Left side exponential decay
+    u = f*(u + w);
+    w = f*w + k;
+    y = f*y + k*sample;
+    samples.push_back(sample);
+    left_y .push_back(y);
+    left_w .push_back(w);
+    left_u .push_back(u);
+
+    // The first window now has a full window of samples after it
+    if (samples.size() >= 2*window) {
+        drain(window, filtered);
+    }
+}
+
+void two_sided_exponential_decay_filter_stream::stage::finish(vector<ftype> &filtered)
+{
+    drain(uint(samples.size()), filtered);
+    if (!slope_compensate) {
+        return;
+    }
+
+    if (num_raw >= 3) {
+        // The last sample is compensated by the slope from the two before it
+        uint i1 = uint((num_raw - 1) % 3), i2 = uint((num_raw - 2) % 3), i3 = uint((num_raw - 3) % 3);
+        ftype dy_dx = (4*(raw_y[i1] - raw_y[i2]) - raw_y[i1] + raw_y[i3])/
+                      (4*(1 - raw_d[i1] + raw_d[i2]) - 2 - raw_d[i3] + raw_d[i1]);
+        filtered.push_back(raw_y[i1] + raw_d[i1]*dy_dx);
+    }
+    else {
+        // Too short to estimate any slope
+        for (uint i = 0; i < num_raw; i++) {
+            filtered.push_back(raw_y[i]);
+        }
+    }
+}
+
+void two_sided_exponential_decay_filter_stream::stage::drain(uint count, vector<ftype> &filtered)
+{
+    // Right side exponential decay over all samples in the window
+    uint n = uint(samples.size());
+    ftype right_y = 0, right_w = 0, right_u = 0;
+    out_y.resize(count);
+    out_d.resize(count);
+    for (int i = int(n) - 1; i >= 0; i--) {
+        if (i < int(count)) {
+            ftype total_weight = left_w[i] + right_w;
+            out_y[i] = (left_y[i] + right_y)/total_weight;
+            out_d[i] = (left_u[i] - right_u)/total_weight;
+        }
+        right_u = f*(right_u + right_w + k);
+        right_w = f*(right_w + k);
+        right_y = f*(right_y + k*samples[i]);
+    }
+    for (uint i = 0; i < count; i++) {
+        emit(out_y[i], out_d[i], filtered);
+    }
+
+    samples.erase(samples.begin(), samples.begin() + count);
+    left_y .erase(left_y .begin(), left_y .begin() + count);
+    left_w .erase(left_w .begin(), left_w .begin() + count);
+    left_u .erase(left_u .begin(), left_u .begin() + count);
+}
+
+void two_sided_exponential_decay_filter_stream::stage::emit(ftype y_in, ftype d_in, vector<ftype> &filtered)
+{
+    if (!slope_compensate) {
+        filtered.push_back(y_in);
+        return;
+    }
+
+    // Each sample is compensated by the slope between its neighbours, the first one by the two after it
+    uint64 j = num_raw++;
+    raw_y[j % 3] = y_in;
+    raw_d[j % 3] = d_in;
+    if (j == 2) {
+        ftype dy_dx = (4*(raw_y[1] - raw_y[0]) + raw_y[0] - raw_y[2])/
+                      (4*(1 - raw_d[1] + raw_d[0]) - 2 - raw_d[0] + raw_d[2]);
+        filtered.push_back(raw_y[0] + raw_d[0]*dy_dx);
+    }
+    if (j >= 2) {
+        uint i0 = uint((j - 2) % 3), i1 = uint((j - 1) % 3), i2 = uint(j % 3);
+        ftype dy_dx = (raw_y[i2] - raw_y[i0])/(2 - raw_d[i2] + raw_d[i0]);
+        filtered.push_back(raw_y[i1] + raw_d[i1]*dy_dx);
+    }
+}
+
+void two_sided_exponential_decay_filter_stream::stage::reset()
+{
+    samples.clear();
+    left_y .clear();
+    left_w .clear();
+    left_u .clear();
+    y = w = u = 0;
+    num_raw = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// ENSEMBLE AVERAGE FILTER
+////////////////////////////////////////////////////////////////
+
+uint ensemble_average_filter::num_sampling_points(uint num_timesteps_in, uint sampling_period, uint ensemble_size)
+{
+    uint num_sampling_points = (num_timesteps_in - 1) / sampling_period + 2;
+    uint num_ensambles = (num_sampling_points - 1) / ensemble_size + 1;
+    return num_ensambles * ensemble_size;
+}
+
+void ensemble_average_filter::filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype /*sampling_time*/, ftype /*impulse_response_decay_time*/, uint /*num_times*/, bool /*slope_compensate*/, uint ensemble_size)
+{
+    filtered.resize(unfiltered.size()/ensemble_size);
+    for(uint i = 0; i < filtered.size(); i++){
+        ftype sum = 0;
+        for(uint j = 0; j < ensemble_size; j++){
+            sum += unfiltered[i*ensemble_size+j];
+        }
+        filtered[i] = sum / ensemble_size;
+    }
+}
+
+void ensemble_average_filter::filter_channels(const filter_channel *channels, uint num_channels, ftype /*sampling_time*/, uint ensemble_size, filter_workspace &/*workspace*/)
+{
+    // A single pass without recursion, nothing to gain from interleaving. Same as filter().
+    for (uint c = 0; c < num_channels; c++) {
+        const time_series &unfiltered = *channels[c].unfiltered;
+        time_series       &filtered   = *channels[c].filtered;
+        filtered.resize(unfiltered.size()/ensemble_size);
+        for(uint i = 0; i < filtered.size(); i++){
+            ftype sum = 0;
+            for(uint j = 0; j < ensemble_size; j++){
+                sum += unfiltered[i*ensemble_size+j];
+            }
+            filtered[i] = sum / ensemble_size;
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef  FILTERS_H
+#define  FILTERS_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+#include "time_series.h"
+
+////////////////////////////////////////////////////////////////
+// ENUMERATIONS
+////////////////////////////////////////////////////////////////
+
+/* Enumeration of filters */
+enum enum_filter_types
+{
+    NO_FILTER,
+    TWO_SIDED_EXPONENTIAL_DECAY_FILTER,
+    ENSEMBLE_AVERAGE_FILTER,
+    NUM_FILTER_TYPES,
+    // Aliases
+    KRISTOFERS_FILTER = TWO_SIDED_EXPONENTIAL_DECAY_FILTER,
+    EMILS_FILTER      = ENSEMBLE_AVERAGE_FILTER
+};
+
+////////////////////////////////////////////////////////////////
+// FILTER POLICIES
+////////////////////////////////////////////////////////////////
+
+/*
+ * Every policy decides how many samples a run of a given length consists of
+ * and how a measured property is filtered afterwards.
+ */
+
+/* One property to filter together with others (see filter_channels) */
+struct filter_channel
+{
+    const time_series *unfiltered;
+    time_series       *filtered;
+    ftype              impulse_response_decay_time;
+    uint               num_times;
+    bool               slope_compensate;
+
+    filter_channel() {}
+    filter_channel(const time_series &unfiltered_in, time_series &filtered_in, ftype impulse_response_decay_time_in, uint num_times_in, bool slope_compensate_in)
+        : unfiltered(&unfiltered_in), filtered(&filtered_in), impulse_response_decay_time(impulse_response_decay_time_in), num_times(num_times_in), slope_compensate(slope_compensate_in) {}
+};
+
+/*
+ * Scratch space kept between filterings so that nothing has to be
+ * allocated. The rows of all channels are as long as the channels, so they
+ * are kept in time series that can spill to disk as well.
+ */
+struct filter_workspace
+{
+    time_series   left_y, left_x, intermediate;
+    vector<ftype> left_w;
+
+    // Allocates everything up front for filtering vector_size samples
+    void prepare(uint vector_size, uint num_times, bool slope_compensate);
+    void set_ram_budget(uint64 ram_budget);
+    bool make_private(); // See time_series::make_private
+};
+
+/* Number of channels filtered at once, one in each SIMD lane */
+const uint FILTER_LANES = 8;
+
+/* Two sided exponential decay filter (Kristofer's filter) */
+struct two_sided_exponential_decay_filter
+{
+    static uint num_sampling_points(uint num_timesteps_in, uint sampling_period, uint ensemble_size);
+    static void filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype sampling_time, ftype impulse_response_decay_time, uint num_times, bool slope_compensate, uint ensemble_size);
+    static void filter_channels(const filter_channel *channels, uint num_channels, ftype sampling_time, uint ensemble_size, filter_workspace &workspace);
+};
+
+/* Ensemble average filter (Emil's filter) */
+struct ensemble_average_filter
+{
+    static uint num_sampling_points(uint num_timesteps_in, uint sampling_period, uint ensemble_size);
+    static void filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype sampling_time, ftype impulse_response_decay_time, uint num_times, bool slope_compensate, uint ensemble_size);
+    static void filter_channels(const filter_channel *channels, uint num_channels, ftype sampling_time, uint ensemble_size, filter_workspace &workspace);
+};
+
+/*
+ * The two sided exponential decay filter applied to a sequence of samples
+ * as they arrive, with memory depending on the decay time only. The left
+ * (causal) half is summed up directly, while the right half is summed
+ * backwards over a window of the latest samples. A sample is finished once
+ * window_size() newer samples have arrived, since the weights of anything
+ * further away are below the tolerance, so output lags input by up to two
+ * windows. finish() flushes the rest exactly, as if the run ended there.
+ */
+class two_sided_exponential_decay_filter_stream
+{
+public:
+    two_sided_exponential_decay_filter_stream(ftype sampling_time, ftype impulse_response_decay_time, uint num_times, bool slope_compensate, ftype tolerance = ftype(1e-7));
+
+    void push  (ftype sample, vector<ftype> &filtered); // Appends the filtered samples that became ready
+    void finish(              vector<ftype> &filtered); // Appends the remaining filtered samples
+    void reset();
+    uint window_size() const;
+
+private:
+    // One filtering pass
+    struct stage
+    {
+        ftype f, k;
+        uint  window;
+        bool  slope_compensate;
+        // Samples not yet filtered, with the left side sums up to them
+        vector<ftype> samples;
+        vector<ftype> left_y, left_w, left_u;
+        ftype         y, w, u;
+        // Filtered samples waiting for their neighbours (slope compensation)
+        ftype  raw_y[3], raw_d[3];
+        uint64 num_raw;
+        // Scratch for the right side sums
+        vector<ftype> out_y, out_d;
+
+        void push  (ftype sample, vector<ftype> &filtered);
+        void finish(              vector<ftype> &filtered);
+        void drain (uint count  , vector<ftype> &filtered);
+        void emit  (ftype y_in, ftype d_in, vector<ftype> &filtered);
+        void reset();
+    };
+
+    vector<stage> stages;
+    vector<ftype> stage_in, stage_out;
+};
+
+typedef  two_sided_exponential_decay_filter  kristofers_filter;
+typedef  ensemble_average_filter             emils_filter;
+
+#endif  /* FILTERS_H */
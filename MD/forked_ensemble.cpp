@@ -0,0 +1,316 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <omp.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "forked_ensemble.h"
+#include "async_writer.h"
+
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+#ifndef _WIN32
+static void make_directory(const string &path)
+{
+    mkdir(path.c_str(), 0777);
+}
+#endif
+
+/* The output of a trajectory goes to Output.txt in its directory */
+static void write_to_file(void* ptr, string output)
+{
+    *(std::ofstream*)ptr << output << std::flush;
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+forked_ensemble::forked_ensemble()
+{
+    num_trajectories = 0;
+    random_seed      = 0;
+    num_workers      = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void forked_ensemble::set_output_callback(callback<void (*)(void*, string)> output_callback_in)
+{
+    output_callback = output_callback_in;
+}
+
+void forked_ensemble::set_parameters(const run_parameters &parameters_in)
+{
+    parameters = parameters_in;
+}
+
+void forked_ensemble::set_num_trajectories(uint num_trajectories_in)
+{
+    num_trajectories = num_trajectories_in;
+}
+
+void forked_ensemble::set_random_seed(uint random_seed_in)
+{
+    random_seed = random_seed_in;
+}
+
+void forked_ensemble::set_num_workers(uint num_workers_in)
+{
+    num_workers = num_workers_in;
+}
+
+void forked_ensemble::set_output_directory(const string &output_directory_in)
+{
+    output_directory = output_directory_in;
+}
+
+bool forked_ensemble::run(string &error)
+{
+#ifdef _WIN32
+    error = "The ensemble needs fork, which Windows does not have";
+    return false;
+#else
+    if (num_trajectories == 0) {
+        error = "The ensemble needs at least one trajectory";
+        return false;
+    }
+    if (parameters.energy_minimization) {
+        error = "The ensemble is equilibrated by a simulation, not by an energy minimization";
+        return false;
+    }
+
+    // Equilibrate once, in this process
+    mdsystem simulation;
+    make_directory(directory("Equilibration"));
+    simulation.set_output_callback(output_callback);
+    simulation.set_output_directory(directory("Equilibration"));
+    simulation.set_random_seed(random_seed);
+    if (!run_with_parameters(simulation, parameters)) {
+        error = "The system could not be initialized";
+        return false;
+    }
+    simulation.prepare_fork();
+
+    /*
+     * The trajectories are the parallelism, one thread each. The OpenMP
+     * threads of this process are not copied to the children, and GNU
+     * OpenMP hangs when a forked process starts a team of its own.
+     */
+    uint num_concurrent = num_workers > 0 ? num_workers : uint(omp_get_num_procs());
+    if (num_concurrent > num_trajectories) {
+        num_concurrent = num_trajectories;
+    }
+    {
+        stringstream text;
+        text << num_trajectories << " trajectories, " << num_concurrent << " at a time" << endl;
+        print(text.str());
+    }
+
+    // One child at a time is forked as long as there is room, and reaped when it is done
+    trajectory_result no_result;
+    memset(&no_result, 0, sizeof(no_result));
+    results.assign(num_trajectories, no_result);
+    vector<pid_t> children    (num_trajectories, 0);
+    vector<int>   result_pipes(num_trajectories, -1);
+    uint   num_started = 0;
+    uint   num_running = 0;
+    double start_time  = omp_get_wtime();
+    while (num_started < num_trajectories || num_running > 0) {
+        if (num_started < num_trajectories && num_running < num_concurrent) {
+            uint k = num_started++;
+            make_directory(directory("Trajectory", int(k)));
+            int pipe_ends[2];
+            if (pipe(pipe_ends) != 0) {
+                print("Error: No pipe for " + directory("Trajectory", int(k)) + "\n");
+                continue;
+            }
+            fflush(0); // Or the child writes what is buffered once more
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(pipe_ends[0]);
+                run_trajectory(simulation, k, pipe_ends[1]);
+                _exit(0); // Nothing of the parent is destroyed or flushed in the child
+            }
+            close(pipe_ends[1]);
+            if (pid < 0) {
+                close(pipe_ends[0]);
+                print("Error: Could not fork for " + directory("Trajectory", int(k)) + "\n");
+                continue;
+            }
+            children    [k] = pid;
+            result_pipes[k] = pipe_ends[0];
+            num_running++;
+            continue;
+        }
+
+        int   status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            break;
+        }
+        for (uint k = 0; k < num_trajectories; k++) {
+            if (children[k] != pid) continue;
+            if (read(result_pipes[k], &results[k], sizeof(trajectory_result)) != ssize_t(sizeof(trajectory_result))) {
+                results[k] = no_result;
+            }
+            close(result_pipes[k]);
+            children[k] = 0;
+            num_running--;
+            print(directory("Trajectory", int(k)) + (results[k].completed ? " done\n" : " failed, see its Output.txt\n"));
+        }
+    }
+    double run_time = omp_get_wtime() - start_time;
+
+    write_summary();
+    stringstream text;
+    text << "Throughput: " << setprecision(4) << run_time << " s, "
+         << (run_time > 0 ? double(simulation.get_max_loops_num())*num_trajectories/run_time : 0) << " trajectory timesteps/s" << endl;
+    print(text.str());
+    return true;
+#endif
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+string forked_ensemble::directory(const char *name, int trajectory) const
+{
+    stringstream path;
+    path << (output_directory.empty() ? string(".") : output_directory) << "/" << name;
+    if (trajectory >= 0) {
+        path << trajectory;
+    }
+    return path.str();
+}
+
+void forked_ensemble::run_trajectory(mdsystem &simulation, uint trajectory, int result_pipe)
+{
+#ifndef _WIN32
+    // In the child process, with the equilibrated system of the parent
+    simulation.continue_after_fork();
+    omp_set_num_threads(1);
+    std::ofstream log((directory("Trajectory", int(trajectory)) + "/Output.txt").c_str());
+    simulation.set_output_callback(callback<void (*)(void*, string)>(write_to_file, &log));
+    simulation.set_output_directory(directory("Trajectory", int(trajectory)));
+    simulation.branch_trajectory(random_seed + 1 + trajectory);
+    simulation.run_simulation();
+    simulation.prepare_fork(); // Waits for the results to be written, since the process ends without destroying anything
+
+    trajectory_result result;
+    memset(&result, 0, sizeof(result));
+    result.completed = simulation.get_loop_num() == simulation.get_max_loops_num();
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        result.has_mean[column] = simulation.get_result_mean(column, result.mean[column]);
+    }
+    if (write(result_pipe, &result, sizeof(result)) != ssize_t(sizeof(result))) {
+        // The parent counts the trajectory as failed
+    }
+    close(result_pipe);
+#else
+    (void)simulation; (void)trajectory; (void)result_pipe;
+#endif
+}
+
+void forked_ensemble::write_summary()
+{
+    /*
+     * The mean of every result of every trajectory, and the mean over the
+     * trajectories with its standard error.
+     */
+    vector<double> mean (NUM_RESULT_COLUMNS, 0); // Squares of results like the MSD are below the range of float
+    vector<double> error(NUM_RESULT_COLUMNS, 0);
+    vector<uint>  count(NUM_RESULT_COLUMNS, 0);
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        for (uint k = 0; k < num_trajectories; k++) {
+            if (results[k].completed && results[k].has_mean[column]) {
+                mean[column] += results[k].mean[column];
+                count[column]++;
+            }
+        }
+        if (count[column] == 0) continue;
+        mean[column] /= count[column];
+        double sqr_deviation_sum = 0;
+        for (uint k = 0; k < num_trajectories; k++) {
+            if (results[k].completed && results[k].has_mean[column]) {
+                double deviation = results[k].mean[column] - mean[column];
+                sqr_deviation_sum += deviation*deviation;
+            }
+        }
+        error[column] = count[column] > 1 ? sqrt(sqr_deviation_sum/(count[column] - 1)/count[column]) : NAN;
+    }
+
+    stringstream text;
+    text << setprecision(9) << "# trajectory\tseed";
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (count[column] > 0) text << "\t" << mdsystem::get_result_name(column);
+    }
+    text << "\n";
+    for (uint k = 0; k < num_trajectories; k++) {
+        text << k << "\t" << random_seed + 1 + k;
+        for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+            if (count[column] == 0) continue;
+            if (results[k].completed && results[k].has_mean[column]) text << "\t" << results[k].mean[column];
+            else                                                      text << "\tnan";
+        }
+        text << "\n";
+    }
+    text << "mean\t-";
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (count[column] > 0) text << "\t" << mean[column];
+    }
+    text << "\nerror\t-";
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (count[column] > 0) text << "\t" << error[column];
+    }
+    text << "\n";
+
+    string summary = text.str();
+    async_writer writer;
+    uint file = writer.open_replacing((output_directory.empty() ? string(".") : output_directory) + "/Ensemble.txt");
+    writer.write(file, summary.data(), summary.size());
+    writer.close(file);
+    writer.wait();
+    string errors;
+    if (writer.take_errors(errors)) {
+        print(errors);
+    }
+
+    stringstream means;
+    means << "*******************" << endl;
+    means << "Ensemble means:" << endl;
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (count[column] == 0) continue;
+        means << "  " << mdsystem::get_result_name(column) << " = " << setprecision(6) << mean[column];
+        if (count[column] > 1) {
+            means << " +- " << setprecision(3) << error[column];
+        }
+        means << endl;
+    }
+    print(means.str());
+}
+
+void forked_ensemble::print(const string &text)
+{
+    if (output_callback.func) {
+        output_callback.func(output_callback.param, text);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef  FORKED_ENSEMBLE_H
+#define  FORKED_ENSEMBLE_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "callback.h"
+#include "run_parameters.h"
+#include "mdsystem.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * An ensemble of NVE trajectories branching from one equilibrated state,
+ * for transport coefficients and error bars. The system is equilibrated
+ * once, as the simulation file says, and then a child process is forked
+ * for every trajectory. The children start with the memory of the parent,
+ * shared copy-on-write, so only the pages a child changes (the particles
+ * and its own measurements) take any memory of their own. Every child
+ * draws new velocities with a seed of its own (mdsystem::branch_trajectory)
+ * and writes its results in a directory of its own. The parent collects
+ * the means of the results of every trajectory through a pipe and writes
+ * them with their mean and standard error to Ensemble.txt. The children
+ * run one thread each, as many at a time as there are cores.
+ *
+ * Only on systems with fork, not on Windows.
+ */
+class forked_ensemble
+{
+public:
+    // Constructor
+    forked_ensemble();
+
+    void set_output_callback (callback<void (*)(void*, string)> output_callback_in);
+    void set_parameters      (const run_parameters &parameters_in); // Of the equilibration; the trajectories have the same length
+    void set_num_trajectories(uint num_trajectories_in);
+    void set_random_seed     (uint random_seed_in);                 // Of the equilibration, trajectory k uses random_seed_in + 1 + k
+    void set_num_workers     (uint num_workers_in);                 // Trajectories at a time, 0 for one per core
+    void set_output_directory(const string &output_directory_in);   // Has to exist
+    bool run(string &error);
+
+private:
+    /* What a child sends to the parent when its trajectory is done */
+    struct trajectory_result
+    {
+        uint32 completed;
+        uint32 has_mean[NUM_RESULT_COLUMNS];
+        ftype  mean    [NUM_RESULT_COLUMNS]; // (enum_result_columns)
+    };
+
+    callback<void (*)(void*, string)> output_callback;
+    run_parameters            parameters;
+    vector<trajectory_result> results;  // Of each trajectory
+    uint                      num_trajectories;
+    uint                      random_seed;
+    uint                      num_workers;
+    string                    output_directory;
+
+    string directory(const char *name, int trajectory = -1) const;
+    void   run_trajectory(mdsystem &simulation, uint trajectory, int result_pipe); // In the child
+    void   write_summary();
+    void   print(const string &text);
+};
+
+#endif  /* FORKED_ENSEMBLE_H */
@@ -4,6 +4,7 @@
 
 // Standard includes
 #include <iostream>
+#include <chrono>
 
 // Own includes
 #include "definitions.h"
@@ -45,12 +46,20 @@ mdmainwin::mdmainwin(QWidget *parent) :
     tb->setUndoRedoEnabled(false); /* Don't allow undo */
     tb->setWordWrapMode(QTextOption::WrapAnywhere); /* Use all characters places on each line */
 
+    store_particle_positions = ui->store_particle_possitions_cb->isChecked();
+
+    // Takes the output and the progress of the simulation while it is running
+    progress_timer = new QTimer(this);
+    connect(progress_timer, SIGNAL(timeout()), this, SLOT(poll_simulation()));
+    simulation_finished = false;
+
     // Start simulation directly when application has finished loading
     QTimer::singleShot(0, this, SLOT(on_start_simulation_pb_clicked()));
 }
 
 mdmainwin::~mdmainwin()
 {
+    stop_simulation();
     delete ui;
 }
 
@@ -60,7 +69,7 @@ mdmainwin::~mdmainwin()
 
 void mdmainwin::on_start_simulation_pb_clicked()
 {
-    if (simulation.is_operating()) {
+    if (simulation_thread.joinable() || simulation.is_operating()) {
         // Inform the user that an operation is currently going on
         QMessageBox msg_box;
         msg_box.setText("An operation is currently being executed.");
@@ -81,7 +90,6 @@ void mdmainwin::on_start_simulation_pb_clicked()
     // Start identical simulations each time
     uint random_seed = 0;
 #endif
-    srand(random_seed);
 
     /*
      * Select element (xenon, silver, copper or argon)
@@ -182,27 +190,42 @@ void mdmainwin::on_start_simulation_pb_clicked()
     ftype desired_temp_in = ftype(100.0); // [K]
 #endif
 
+    /*
+     * Select thermostat and filter
+     */
+    uint thermostat_type_in = LASSES_THERMOSTAT;
+    //uint thermostat_type_in = CHING_CHIS_THERMOSTAT; // Smooth scaling thermostat (Berendsen et. al, 1984)
+    //uint thermostat_type_in = LANGEVIN_THERMOSTAT; // Stochastic, friction coefficient 1/thermostat_time
+    uint filter_type_in = KRISTOFERS_FILTER;
+    //uint filter_type_in = EMILS_FILTER;
+
     /*
      * Sampling and filtering of properties
      */
-#if  FILTER == KRISTOFERS_FILTER
-    uint sample_period_in = 5; // Number of timesteps between each sampling of properties
-    ftype default_impulse_response_decay_time_in = ftype(100) * P_SI_FS; //The exponent factor in the impulse response function used to filter the measured values
-    /* Select the number of times to apply the filter every time filtering */
-    //uint default_num_times_filtering_in = 0; // No filtering.
-    uint default_num_times_filtering_in = 1; // Filter once
-    //uint default_num_times_filtering_in = 2; // Double filtering
-    bool slope_compensate_by_default_in = false;
-
-    uint ensemble_size_in = 0; // Is never used
-#elif  FILTER == EMILS_FILTER
-    uint sample_period_in = 5;
-    uint ensemble_size_in = 50; // Number of values used to calculate averages
-
-    uint default_num_times_filtering_in = 0;          // Is never used
-    bool slope_compensate_by_default_in = 0;          // Is never used
-    ftype default_impulse_response_decay_time_in = 0; // Is never used
-#endif
+    uint  sample_period_in;
+    ftype default_impulse_response_decay_time_in;
+    uint  default_num_times_filtering_in;
+    bool  slope_compensate_by_default_in;
+    uint  ensemble_size_in;
+    if (filter_type_in == KRISTOFERS_FILTER) {
+        sample_period_in = 5; // Number of timesteps between each sampling of properties
+        default_impulse_response_decay_time_in = ftype(100) * P_SI_FS; //The exponent factor in the impulse response function used to filter the measured values
+        /* Select the number of times to apply the filter every time filtering */
+        //default_num_times_filtering_in = 0; // No filtering.
+        default_num_times_filtering_in = 1; // Filter once
+        //default_num_times_filtering_in = 2; // Double filtering
+        slope_compensate_by_default_in = false;
+
+        ensemble_size_in = 0; // Is never used
+    }
+    else { // EMILS_FILTER
+        sample_period_in = 5;
+        ensemble_size_in = 50; // Number of values used to calculate averages
+
+        default_num_times_filtering_in = 0;          // Is never used
+        slope_compensate_by_default_in = 0;          // Is never used
+        default_impulse_response_decay_time_in = 0; // Is never used
+    }
 
     /*
      * Simulation specific constants
@@ -211,6 +234,9 @@ void mdmainwin::on_start_simulation_pb_clicked()
     uint  num_time_steps_in  = 500; // Desired (or minimum) total number of timesteps
     uint  num_particles_in   = 5000; // The desired (or maximum) number of particles
     ftype thermostat_time_in = ftype(500) * P_SI_FS;
+    ftype desired_pressure_in = ftype(101325); // [Pa]
+    ftype barostat_time_in   = ftype(1000) * P_SI_FS;
+    ftype compressibility_in = ftype(1e-11); // [1/Pa] Roughly the one of silver
     ftype inner_cutoff_in    = ftype(2.5) * sigma_in; //TODO: Make sure this is 2.0 times sigma
     ftype outer_cutoff_in    = ftype(1.1) * inner_cutoff_in; //Fewer neighbors -> faster, but too thin skin is not good either. TODO: Change skin thickness to a good one
     ftype dEp_tolerance_in   = ftype(1.0); //TODO: Depricate?
@@ -220,6 +246,10 @@ void mdmainwin::on_start_simulation_pb_clicked()
      */
     // Control
     bool thermostat_on_in = true;
+    bool barostat_on_in   = false; // NPT when also the thermostat is on
+    bool energy_minimization_in = false; // Relax the system at 0 K (FIRE) instead of running the simulation
+    bool relax_box_in           = true;  // Also relax the lattice constant when minimizing
+    bool monte_carlo_in         = false; // Equilibrate at desired_temp_in with Monte Carlo before the simulation
     // Measurement
     bool diff_c_on_in   = true;
     bool Cv_on_in       = true;
@@ -239,20 +269,79 @@ void mdmainwin::on_start_simulation_pb_clicked()
 #endif
 
     // Init system and run simulation
-    callback<void (*)(void*        )> event_callback_in (static_process_events       , this);
-    callback<void (*)(void*, string)> output_callback_in(static_write_to_text_browser, this);
-    simulation.set_event_callback (event_callback_in );
-    simulation.set_output_callback(output_callback_in);
-    simulation.init(num_particles_in, sigma_in, epsilon_in, inner_cutoff_in, outer_cutoff_in, mass_in, dt_in, ensemble_size_in, sample_period_in, temperature_in, num_time_steps_in, lattice_constant_in, lattice_type_in, desired_temp_in, thermostat_time_in, dEp_tolerance_in, default_impulse_response_decay_time_in, default_num_times_filtering_in, slope_compensate_by_default_in, thermostat_on_in, diff_c_on_in, Cv_on_in, pressure_on_in, msd_on_in, Ep_on_in, Ek_on_in);
+    simulation.set_progress_channel(true             ); // Polled by poll_simulation
+    simulation.set_random_seed    (random_seed       );
+    simulation.set_trajectory_output(store_particle_positions, 10, ftype(1e-4)); // Every 10th timestep, 1e-4 box sizes
+    simulation.set_checkpointing  (true, 600         ); // Every 10 minutes, and when aborted
+    simulation.set_state_cache    (true, "StateCache"); // Start from an equilibrated state of an earlier run if possible
+    simulation.set_tiling         (true, 200         ); // Or from a smaller one tiled to fill the box
+    std::cout << "Random seed " << random_seed << std::endl;
+
+    /*
+     * The simulation runs on a thread of its own, so that the GUI stays
+     * responsive without the simulation processing its events. The GUI
+     * takes the output and the progress on a timer instead.
+     */
+    simulation_finished = false;
+    simulation_thread = std::thread([=]() {
+        simulation.init(num_particles_in, sigma_in, epsilon_in, inner_cutoff_in, outer_cutoff_in, mass_in, dt_in, ensemble_size_in, sample_period_in, temperature_in, num_time_steps_in, lattice_constant_in, lattice_type_in, desired_temp_in, thermostat_time_in, thermostat_type_in, dEp_tolerance_in, filter_type_in, default_impulse_response_decay_time_in, default_num_times_filtering_in, slope_compensate_by_default_in, thermostat_on_in, diff_c_on_in, Cv_on_in, pressure_on_in, msd_on_in, Ep_on_in, Ek_on_in);
+        if (simulation.is_initialized()) {
+            simulation.set_barostat(barostat_on_in, desired_pressure_in, barostat_time_in, compressibility_in);
+            if (energy_minimization_in) {
+                simulation.run_energy_minimization(1000, ftype(1e-4), relax_box_in, ftype(1e5)); // [eV/A], [Pa]
+            }
+            else {
+                if (monte_carlo_in) {
+                    simulation.run_monte_carlo_equilibration(200, ftype(0.1)); // [Angstrom]
+                }
+                simulation.run_simulation();
+            }
+        }
+        simulation_finished = true;
+    });
+    progress_timer->start(50); // [ms]
+}
+
+void mdmainwin::poll_simulation()
+{
+    // Check first, so that everything published before the end is taken below
+    bool finished = simulation_finished;
+
+    // The output and the latest progress
+    progress_message message;
+    bool             progress_taken = false;
+    uint             phase = PHASE_IDLE;
+    uint             pre_cent_finished = 0;
+    while (simulation.take_progress(message)) {
+        if (message.text_length > 0) {
+            write_to_text_browser(string(message.text, message.text_length));
+        }
+        progress_taken = true;
+        phase = message.phase;
+        pre_cent_finished = message.max_loops_num > 0 ? uint(100 * uint64(message.loop_num) / message.max_loops_num) : 0;
+    }
+    if (progress_taken) {
+        switch (phase) {
+        case PHASE_INITIALIZATION     : ui->statusbar->showMessage("Initializing..."); break;
+        case PHASE_ENERGY_MINIMIZATION: ui->statusbar->showMessage("Minimizing the energy..."); break;
+        case PHASE_MONTE_CARLO        : ui->statusbar->showMessage("Monte Carlo equilibration..."); break;
+        case PHASE_SIMULATION         : ui->statusbar->showMessage("Running simulation... " + QString::number(pre_cent_finished) + " %"); break;
+        default                       : ui->statusbar->showMessage("Idle"); break;
+        }
+    }
+    if (!finished) {
+        return;
+    }
+
+    // The simulation thread is done
+    progress_timer->stop();
+    simulation_thread.join();
     if (simulation.is_initialized()) {
-        simulation.run_simulation();
         ui->statusbar->showMessage("Simulation finished.");
     }
     else {
         ui->statusbar->showMessage("Initialization failed");
     }
-
-    std::cout << "Random seed " << random_seed << std::endl;
     if (ui->close_when_finished_cb->checkState() == Qt::Checked) {
         this->close();
     }
@@ -260,7 +349,7 @@ void mdmainwin::on_start_simulation_pb_clicked()
 
 void mdmainwin::closeEvent(QCloseEvent *event)
 {
-    if (simulation.is_operating()) {
+    if (simulation_thread.joinable() && !simulation_finished) {
         // Ask the user whether to abort the operation or not
         QMessageBox msg_box;
         msg_box.setText("An operation is currently being executed.");
@@ -273,13 +362,30 @@ void mdmainwin::closeEvent(QCloseEvent *event)
             return;
         }
     }
-    simulation.abort_activities();
+    stop_simulation();
 }
 
 ////////////////////////////////////////////////////////////////
 // PRIVATE NON-STATIC MEMBER FUNCTIONS
 ////////////////////////////////////////////////////////////////
 
+void mdmainwin::stop_simulation()
+{
+    simulation.abort_activities();
+
+    // Wait for the simulation thread, taking the output meanwhile since the simulation may wait for that
+    while (simulation_thread.joinable() && !simulation_finished) {
+        progress_message message;
+        while (simulation.take_progress(message)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (simulation_thread.joinable()) {
+        progress_timer->stop();
+        simulation_thread.join();
+    }
+}
+
 void mdmainwin::write_to_text_browser(string output)
 {
     QString qstr = QString::fromStdString(output.c_str());
@@ -291,37 +397,6 @@ void mdmainwin::write_to_text_browser(string output)
     tb->insertPlainText(qstr);
 }
 
-////////////////////////////////////////////////////////////////
-// PRIVATE STATIC MEMBER FUNCTIONS
-////////////////////////////////////////////////////////////////
-
-void mdmainwin::static_write_to_text_browser(void* void_ptr_mainwin, string output)
-{
-    // Cast to the right pointer type
-    mdmainwin *mainwin_ptr = (mdmainwin*)void_ptr_mainwin;
-
-    // Call the non-static version of this function
-    mainwin_ptr->write_to_text_browser(output);
-}
-
-void mdmainwin::static_process_events(void* void_ptr_mainwin)
-{
-    // Cast to the right pointer type
-    mdmainwin *mainwin_ptr = (mdmainwin*)void_ptr_mainwin;
-
-    // Get the pointer to the system
-    mdsystem *sys_ptr = &(mainwin_ptr->simulation);
-
-    if (sys_ptr->is_operating()) {
-        uint pre_cent_finished = 100 * sys_ptr->get_loop_num() / sys_ptr->get_max_loops_num();
-        mainwin_ptr->ui->statusbar->showMessage("Running simulation... " + QString::number(pre_cent_finished) + " %");
-    }
-    else {
-        mainwin_ptr->ui->statusbar->showMessage("Idle");
-    }
-    QApplication::processEvents(QEventLoop::AllEvents);
-}
-
 void mdmainwin::on_sigma_le_editingFinished()
 {
     ui->statusbar->showMessage("Editing sigma finished.");
@@ -464,7 +539,8 @@ void mdmainwin::on_cohesive_energy_cb_clicked(bool checked)
 
 void mdmainwin::on_store_particle_possitions_cb_clicked(bool checked)
 {
-    ui->statusbar->showMessage("Code needed");
+    // Used from the next simulation
+    store_particle_positions = checked;
 }
 
 void mdmainwin::on_settings_bb_accepted()
@@ -4,6 +4,8 @@
 //Standard includes
 //#include <vector>
 //#include <string>
+#include <thread>
+#include <atomic>
 
 // Own includes
 #include "mdsystem.h"
@@ -11,6 +13,7 @@
 
 // Qt includes
 #include <QMainWindow>
+#include <QTimer>
 
 namespace Ui {
     class mdmainwin;
@@ -75,17 +78,20 @@ private slots:
     // Button boxes
     void on_settings_bb_accepted();
     void on_settings_bb_rejected();
+    // Timers
+    void poll_simulation();
 
 private:
     // Private functions
     void write_to_text_browser(string output);
-
-    // Static private functions
-    static void static_write_to_text_browser(void* void_ptr_mainwin, string output);
-    static void static_process_events       (void* void_ptr_mainwin               );
+    void stop_simulation(); // Aborts the simulation and waits for its thread
 
     // Private variables
-    mdsystem simulation;
+    mdsystem          simulation;
+    bool              store_particle_positions;
+    std::thread       simulation_thread;   // Runs the simulation
+    std::atomic<bool> simulation_finished; // Set by the simulation thread when it is done
+    QTimer           *progress_timer;      // Polls the simulation
 
 private:
     Ui::mdmainwin *ui;
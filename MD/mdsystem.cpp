@@ -6,14 +6,141 @@
 #include <stdexcept>
 using std::runtime_error;
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
-using std::endl;
 #include <fstream>
-using std::ofstream;
+#include <thread>
+#include <omp.h>
+using std::endl;
+#ifndef _WIN32
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
 
 // Own includes
 #include "mdsystem.h"
+#include "philox.h"
+
+////////////////////////////////////////////////////////////////
+// RESULTS
+////////////////////////////////////////////////////////////////
+
+/* The names of the columns of the results (enum_result_columns) */
+static const struct
+{
+    const char *name;
+    const char *unit;
+    const char *text_file;
+} result_columns[NUM_RESULT_COLUMNS] = {
+    {"total_energy"         , "eV"     , "TotalEnergy.dat"},
+    {"kinetic_energy"       , "eV"     , "Kinetic.dat"    },
+    {"potential_energy"     , "eV"     , "Potential.dat"  },
+    {"cohesive_energy"      , "eV"     , "cohesive.dat"   },
+    {"temperature"          , "K"      , "Temperature.dat"},
+    {"pressure"             , "Pa"     , "Pressure.dat"   },
+    {"volume"               , "m^3"    , "Volume.dat"     },
+    {"thermostat"           , "1"      , "Thermostat.dat" },
+    {"msd"                  , "m^2"    , "MSD.dat"        },
+    {"Cv"                   , "J/(g*K)", "Cv.dat"         },
+    {"diffusion_coefficient", "m^2/s"  , "diff_coeff.dat" }
+};
+
+/* Number of values converted at a time when writing */
+const uint RESULT_BLOCK_SIZE = 4096;
+
+/*
+ * Runs with at least this many samples are filtered while they run, if the
+ * filter is the two sided exponential decay filter. The filter workspace
+ * is then never needed, and nothing is left to filter after the run.
+ */
+const uint STREAMING_FILTER_MIN_SAMPLES = 1 << 20;
+
+/* The draws of the velocities of a seed, each with random numbers of its own */
+const uint32 VELOCITY_DRAW_INIT        = 0; // Also what domain_decomposition draws
+const uint32 VELOCITY_DRAW_MONTE_CARLO = 1;
+
+////////////////////////////////////////////////////////////////
+// STATE CACHE
+////////////////////////////////////////////////////////////////
+
+/*
+ * The state cache directory holds equilibrated states, two files for each
+ * set of parameters (element, number of particles, lattice and potential):
+ *   <hash>.idx            one line per cached state: the temperature [K]
+ *                         and the name of the state file
+ *   <hash>_<T>K.mdc       the state, in the checkpoint file format
+ * The hash is of the text returned by mdsystem::state_cache_key, which is
+ * also stored in the state files to tell hash collisions apart.
+ */
+
+/*
+ * A cached state is only used within this fraction of the target
+ * temperature. It is rescaled to the target, but the structure of a state
+ * further away, or on the other side of a phase transition, is not that of
+ * the target and would only be equilibrated again.
+ */
+const ftype STATE_CACHE_TEMPERATURE_TOLERANCE = ftype(0.05);
+
+struct cached_state
+{
+    ftype  temperature_in_k;
+    string file_name;
+};
+
+/* 64 bit FNV-1a hash in hexadecimal */
+static string key_hash(const string &key)
+{
+    uint64 hash = 14695981039346656037ULL;
+    for (uint i = 0; i < key.size(); i++) {
+        hash = (hash ^ uint64((unsigned char)key[i])) * 1099511628211ULL;
+    }
+    stringstream text;
+    text << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return text.str();
+}
+
+static vector<cached_state> read_state_cache_index(const string &path)
+{
+    vector<cached_state> states;
+    std::ifstream index(path.c_str());
+    cached_state state;
+    while (index >> state.temperature_in_k >> state.file_name) {
+        states.push_back(state);
+    }
+    return states;
+}
+
+static void make_directory(const string &path)
+{
+#ifndef _WIN32
+    mkdir(path.c_str(), 0777);
+#else
+    _mkdir(path.c_str());
+#endif
+}
+
+template<class T>
+static void add_metadata(vector<string> &metadata, const char *key, T value)
+{
+    stringstream text;
+    text << setprecision(9) << value;
+    metadata.push_back(key);
+    metadata.push_back(text.str());
+}
+
+////////////////////////////////////////////////////////////////
+// TASKS
+////////////////////////////////////////////////////////////////
+
+/* What the tasks of mdsystem::build_verlet_list need, besides the system */
+struct verlet_list_context
+{
+    mdsystem               *system;
+    const sparse_cell_grid *cells;   // 0 when all pairs are tried
+    bool                    store;   // The neighbours are stored, else only counted
+};
 
 ////////////////////////////////////////////////////////////////
 // CONSTRUCTOR
@@ -22,9 +149,32 @@ using std::ofstream;
 mdsystem::mdsystem()
 {
     operating = false;
+    progress_channel_on = false;
+    loop_num = 0;
+    num_time_steps = 0;
     start_operation();
     abort_activities_requested = false;
     system_initialized = false;
+    random_seed = 0;
+    barostat_on = false;
+    compressibility = 0;
+    barostat_factor = 1;
+    measure_every_loop = false;
+    memory_budget = ~uint64(0); // Unlimited
+    continue_run = false;
+    text_export_on = true;
+    store_trajectory = false;
+    trajectory_frame_period = 1;
+    trajectory_precision = ftype(1e-4);
+    checkpointing_on = false;
+    checkpoint_interval = 600;
+    last_checkpoint_time = 0;
+    restored_run = false;
+    pause_loop_num = 0;
+    paused_run = false;
+    state_cache_on = false;
+    tiling_on = false;
+    num_thermalization_steps = 0;
     finish_operation();
 }
 
@@ -46,14 +196,152 @@ void mdsystem::set_output_callback(callback<void (*)(void*, string)> output_call
     finish_operation();
 }
 
-void mdsystem::init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, ftype inner_cutoff_in, ftype outer_cutoff_in, ftype particle_mass_in, ftype dt_in, uint ensemble_size_in, uint sample_period_in, ftype temperature_in, uint num_timesteps_in, ftype lattice_constant_in, uint lattice_type_in, ftype desired_temp_in, ftype thermostat_time_in, ftype dEp_tolerance_in, ftype default_impulse_response_decay_time_in, uint default_num_times_filtering_in, bool slope_compensate_by_default_in, bool thermostat_on_in, bool diff_c_on_in, bool Cv_on_in, bool pressure_on_in, bool msd_on_in, bool Ep_on_in, bool Ek_on_in)
+void mdsystem::set_progress_channel(bool progress_channel_on_in)
 {
-    // The system is *always* operating when running non-const functions
     start_operation();
+    progress_channel_on = progress_channel_on_in;
+    finish_operation();
+}
+
+void mdsystem::set_random_seed(uint random_seed_in)
+{
+    start_operation();
+    random_seed = random_seed_in;
+    finish_operation();
+}
+
+void mdsystem::set_barostat(bool barostat_on_in, ftype desired_pressure_in, ftype barostat_time_in, ftype compressibility_in)
+{
+    start_operation();
+    if (!system_initialized) {
+        output << "The system has to be initialized before the barostat is set" << endl;
+        finish_operation();
+        return;
+    }
+    barostat_on      = barostat_on_in;
+    desired_pressure = desired_pressure_in;
+    barostat_time    = barostat_time_in;
+    compressibility  = compressibility_in;
+
+    // Convert to reduced units
+    // Times /= sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    barostat_time    /= sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    // Pressures *= sigma_in_m * sigma_in_m * sigma_in_m / epsilon_in_j;
+    desired_pressure *= sigma_in_m * sigma_in_m * sigma_in_m / epsilon_in_j;
+    compressibility  /= sigma_in_m * sigma_in_m * sigma_in_m / epsilon_in_j;
+
+    // Prevent unstabilities because of too small barostat_time
+    if (barostat_time < sampling_period * dt) {
+        barostat_time = sampling_period * dt;
+    }
+
+    // The barostat is driven by the virial, so the pressure is measured as well
+    if (barostat_on) {
+        pressure_on = true;
+    }
+    finish_operation();
+}
+
+void mdsystem::set_output_directory(const string &output_directory_in)
+{
+    start_operation();
+    output_directory = output_directory_in;
+    finish_operation();
+}
+
+void mdsystem::set_text_export(bool text_export_on_in)
+{
+    start_operation();
+    text_export_on = text_export_on_in;
+    finish_operation();
+}
+
+void mdsystem::set_trajectory_output(bool store_trajectory_in, uint frame_period_in, ftype relative_precision_in)
+{
+    start_operation();
+    store_trajectory        = store_trajectory_in;
+    trajectory_frame_period = frame_period_in > 0 ? frame_period_in : 1;
+    trajectory_precision    = relative_precision_in;
+    finish_operation();
+}
+
+void mdsystem::set_checkpointing(bool checkpointing_on_in, ftype checkpoint_interval_in)
+{
+    start_operation();
+    checkpointing_on    = checkpointing_on_in;
+    checkpoint_interval = checkpoint_interval_in;
+    finish_operation();
+}
+
+void mdsystem::save_checkpoint(const string &path)
+{
+    start_operation();
+    if (!system_initialized) {
+        output << "The system has to be initialized before a checkpoint can be saved" << endl;
+        finish_operation();
+        return;
+    }
+    write_checkpoint(path);
+    finish_operation();
+}
+
+bool mdsystem::load_checkpoint(const string &path)
+{
+    start_operation();
+    checkpoint_reader state;
+    string error;
+    bool loaded = state.open(path, error);
+    if (loaded) {
+        transfer_state(state);
+        loaded = state.finish(error);
+    }
+    if (!loaded) {
+        output << "Error: " << error << endl;
+        system_initialized = false;
+        finish_operation();
+        return false;
+    }
+
+    // Everything that is not part of the checkpoint is derived from it
+    apply_memory_budget();
+    resize_measurements();
+    continue_run       = false;
+    restored_run       = true;
+    paused_run         = false;
+    system_initialized = true;
+    output << "Checkpoint loaded at timestep " << loop_num << " of " << num_time_steps << endl;
+    finish_operation();
+    return true;
+}
+
+void mdsystem::set_state_cache(bool state_cache_on_in, const string &state_cache_directory_in)
+{
+    start_operation();
+    state_cache_on        = state_cache_on_in;
+    state_cache_directory = state_cache_directory_in;
+    finish_operation();
+}
+
+void mdsystem::set_tiling(bool tiling_on_in, uint num_thermalization_steps_in)
+{
+    start_operation();
+    tiling_on                = tiling_on_in;
+    num_thermalization_steps = num_thermalization_steps_in;
+    finish_operation();
+}
+
+void mdsystem::set_memory_budget(uint64 memory_budget_in)
+{
+    start_operation();
+    memory_budget = memory_budget_in;
+    finish_operation();
+}
+
+void mdsystem::init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, ftype inner_cutoff_in, ftype outer_cutoff_in, ftype particle_mass_in, ftype dt_in, uint ensemble_size_in, uint sample_period_in, ftype temperature_in, uint num_timesteps_in, ftype lattice_constant_in, uint lattice_type_in, ftype desired_temp_in, ftype thermostat_time_in, uint thermostat_type_in, ftype dEp_tolerance_in, uint filter_type_in, ftype default_impulse_response_decay_time_in, uint default_num_times_filtering_in, bool slope_compensate_by_default_in, bool thermostat_on_in, bool diff_c_on_in, bool Cv_on_in, bool pressure_on_in, bool msd_on_in, bool Ep_on_in, bool Ek_on_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation(PHASE_INITIALIZATION);
 
-#if THERMOSTAT == LASSES_THERMOSTAT
-    thermostat_value = 0;
-#endif
     /*
      * Copy in parameters to member variables
      */
@@ -76,12 +364,11 @@ void mdsystem::init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, fty
     default_impulse_response_decay_time = default_impulse_response_decay_time_in;
     // Unitless
     sampling_period  = sample_period_in;
-#if FILTER == KRISTOFERS_FILTER
+    thermostat_type  = thermostat_type_in; // One of the supported thermostats listed in enum_thermostat_types
+    filter_type      = filter_type_in;     // One of the supported filters listed in enum_filter_types
     default_num_times_filtering = default_num_times_filtering_in;
     slope_compensate_by_default = slope_compensate_by_default_in;
-#elif FILTER == EMILS_FILTER
     ensemble_size    = ensemble_size_in;
-#endif
     lattice_type     = lattice_type_in; // One of the supported lattice types listed in enum_lattice_types
     dEp_tolerance    = dEp_tolerance_in;
     diff_c_on        = diff_c_on_in;
@@ -126,31 +413,41 @@ void mdsystem::init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, fty
         thermostat_time = sampling_period * dt;
     }
 
+    // Initial value of the thermostat
+    switch (thermostat_type) {
+    case NO_THERMOSTAT         : thermostat_value = no_thermostat         ::value_when_inactive(); break;
+    case BERENDSEN_THERMOSTAT  : thermostat_value = berendsen_thermostat  ::value_when_inactive(); break;
+    case NOSE_HOOVER_THERMOSTAT: thermostat_value = nose_hoover_thermostat::value_when_inactive(); break;
+    case LANGEVIN_THERMOSTAT   : thermostat_value = langevin_thermostat   ::value_when_inactive(); break;
+    default:
+        output << "Thermostat type unknown" << endl;
+        goto operation_finished;
+    }
+
     // Initializations miscellaneous variables
     loop_num = 0;
-#if FILTER == KRISTOFERS_FILTER
-    num_time_steps = ((num_timesteps_in - 1) / sampling_period + 1) * sampling_period; // Make the smallest multiple of sample_period that has at least the specified size
-    num_sampling_points = num_time_steps/sampling_period + 1;
-    output << "num_time_steps: " << num_time_steps << endl;
-    output << "num_sampling_points: " << num_sampling_points << endl;
-#elif FILTER == EMILS_FILTER
-    num_sampling_points = (num_timesteps_in - 1) / sampling_period + 2;
-    uint num_ensambles = (num_sampling_points - 1) / ensemble_size + 1;
-    num_sampling_points = num_ensambles * ensemble_size;
+    switch (filter_type) {
+    case TWO_SIDED_EXPONENTIAL_DECAY_FILTER:
+        num_sampling_points = two_sided_exponential_decay_filter::num_sampling_points(num_timesteps_in, sampling_period, ensemble_size);
+        break;
+    case ENSEMBLE_AVERAGE_FILTER:
+        num_sampling_points = ensemble_average_filter::num_sampling_points(num_timesteps_in, sampling_period, ensemble_size);
+        break;
+    default:
+        output << "Filter type unknown" << endl;
+        goto operation_finished;
+    }
     num_time_steps = (num_sampling_points - 1)*sampling_period;
     output << "num_time_steps: " << num_time_steps << endl;
     output << "num_sampling_points: " << num_sampling_points << endl;
-    output << "num_ensambles: " << num_ensambles << endl;
-#endif
+    if (filter_type == ENSEMBLE_AVERAGE_FILTER) {
+        output << "num_ensambles: " << num_sampling_points / ensemble_size << endl;
+    }
 
-    insttemp             .resize(num_sampling_points);
-    instEk               .resize(num_sampling_points);
-    instEp               .resize(num_sampling_points);
-    instEc               .resize(num_sampling_points);
-    thermostat_values    .resize(num_sampling_points);
-    msd                  .resize(num_sampling_points);
-    diffusion_coefficient.resize(num_sampling_points);
-    distance_force_sum   .resize(num_sampling_points);
+    continue_run = false;
+    paused_run   = false;
+    apply_memory_budget();
+    resize_measurements();
 
     if (lattice_type == LT_FCC) {
         box_size_in_lattice_constants = int(pow(ftype(num_particles_in / 4.0 ), ftype( 1.0 / 3.0 )));
@@ -167,14 +464,18 @@ void mdsystem::init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, fty
     pos_half_box_size = 0.5f * box_size;
     neg_half_box_size = -pos_half_box_size;
 
-    // Thermostat
+    // Thermostat and barostat
     thermostat_on = thermostat_on_in;
+    barostat_on   = false; // Turned on by set_barostat
+    barostat_factor = 1;
     equilibrium_reached = false;
 
     // Call other initialization functions
-    init_particles();
-    create_verlet_list();
     calculate_potential_energy_cutoff();
+    if (!state_cache_on || !start_from_cached_state()) {
+        init_particles();
+        create_verlet_list();
+    }
 
     // Flag the system as initialized
     system_initialized = true;
@@ -185,62 +486,624 @@ operation_finished:
 }
 
 void mdsystem::run_simulation()
+{
+    run_simulation_until(num_time_steps);
+}
+
+void mdsystem::run_simulation_until(uint pause_loop_num_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation(PHASE_SIMULATION);
+    pause_loop_num = pause_loop_num_in < num_time_steps ? pause_loop_num_in : num_time_steps;
+
+    // Select the thermostat once for the whole run
+    switch (thermostat_type) {
+    case NO_THERMOSTAT         : run_simulation_with_thermostat<no_thermostat         >(); break;
+    case BERENDSEN_THERMOSTAT  : run_simulation_with_thermostat<berendsen_thermostat  >(); break;
+    case NOSE_HOOVER_THERMOSTAT: run_simulation_with_thermostat<nose_hoover_thermostat>(); break;
+    case LANGEVIN_THERMOSTAT   : run_simulation_with_thermostat<langevin_thermostat   >(); break;
+    }
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::extend_simulation(uint num_additional_timesteps_in)
 {
     // The system is *always* operating when running non-const functions
     start_operation();
+
+    if (!system_initialized || loop_num != num_time_steps) {
+        output << "Only a finished simulation can be extended" << endl;
+        finish_operation();
+        return;
+    }
+    if (num_additional_timesteps_in == 0) {
+        finish_operation();
+        return;
+    }
+
+    // The measurements already taken are kept where they are, the new ones are appended
+    switch (filter_type) {
+    case TWO_SIDED_EXPONENTIAL_DECAY_FILTER:
+        num_sampling_points = two_sided_exponential_decay_filter::num_sampling_points(num_time_steps + num_additional_timesteps_in, sampling_period, ensemble_size);
+        break;
+    case ENSEMBLE_AVERAGE_FILTER:
+        num_sampling_points = ensemble_average_filter::num_sampling_points(num_time_steps + num_additional_timesteps_in, sampling_period, ensemble_size);
+        break;
+    }
+    num_time_steps = (num_sampling_points - 1)*sampling_period;
+    output << "num_time_steps: " << num_time_steps << endl;
+    output << "num_sampling_points: " << num_sampling_points << endl;
+    resize_measurements();
+    continue_run = true;
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::run_energy_minimization(uint max_force_calls, ftype force_tolerance_in, bool relax_box, ftype pressure_tolerance_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation(PHASE_ENERGY_MINIMIZATION);
+
+    /*
+     * FIRE, the Fast Inertial Relaxation Engine (Bitzek et. al, 2006). Plain
+     * MD steps where the velocities are steered along the forces as long as
+     * the power is positive and the time step grows, and everything is
+     * stopped and restarted with a shorter time step when going uphill.
+     * With relax_box, the box is also scaled towards zero pressure.
+     */
+    const uint  num_steps_before_speedup = 5;
+    const ftype time_step_increase       = ftype(1.1);
+    const ftype time_step_decrease       = ftype(0.5);
+    const ftype alpha_start              = ftype(0.1);
+    const ftype alpha_decrease           = ftype(0.99);
+    const ftype max_time_step            = 10*dt;
+    const ftype max_relative_box_change  = ftype(0.002);
+    // Isothermal compressibility used to scale the box, the barostat's if given
+    const ftype box_compressibility = compressibility > 0 ? compressibility : ftype(0.01);
+
+    // Convert in parameters to reduced units
+    ftype force_tolerance    = force_tolerance_in * P_RU_EV / P_RU_ANGSTROM; // [eV/Angstrom]
+    ftype pressure_tolerance = pressure_tolerance_in * sigma_in_m * sigma_in_m * sigma_in_m / epsilon_in_j; // [Pa]
+
+    ftype time_step = dt;
+    ftype alpha     = alpha_start;
+    uint  num_steps_since_uphill = 0;
+    uint  num_force_calls;
+    ftype max_sqr_force = 0;
+    ftype P = 0;
+    bool  converged = false;
+
+    // Energies and the virial are needed in every force calculation
+    bool saved_Ep_on       = Ep_on;
+    bool saved_pressure_on = pressure_on;
+    Ep_on = pressure_on = measure_every_loop = true;
+
+    // Start at rest
+    for (uint i = 0; i < num_particles; i++) {
+        particles[i].vel = vec3(0, 0, 0);
+    }
+    calculate_forces<no_thermostat>();
+    for (num_force_calls = 1; num_force_calls < max_force_calls; num_force_calls++) {
+        // Check if the minimization has been requested to abort
+        if (abort_activities_requested) {
+            break;
+        }
+
+        // Check convergence
+        max_sqr_force = 0;
+        for (uint i = 0; i < num_particles; i++) {
+            ftype sqr_force = particles[i].acc.sqr_length();
+            max_sqr_force = sqr_force > max_sqr_force ? sqr_force : max_sqr_force;
+        }
+        ftype V = box_size*box_size*box_size;
+        P = current_distance_force_sum/(3*V); // No kinetic contribution at rest
+        if (max_sqr_force <= force_tolerance*force_tolerance && (!relax_box || fabs(P) <= pressure_tolerance)) {
+            converged = true;
+            break;
+        }
+
+        // Steer the velocities along the forces
+        ftype power = 0;
+        ftype sqr_vel_sum = 0;
+        ftype sqr_force_sum = 0;
+        for (uint i = 0; i < num_particles; i++) {
+            power         += particles[i].acc * particles[i].vel;
+            sqr_vel_sum   += particles[i].vel.sqr_length();
+            sqr_force_sum += particles[i].acc.sqr_length();
+        }
+        if (power > 0) {
+            ftype k = sqr_force_sum > 0 ? alpha * sqrt(sqr_vel_sum / sqr_force_sum) : 0;
+            for (uint i = 0; i < num_particles; i++) {
+                particles[i].vel = (1 - alpha) * particles[i].vel + k * particles[i].acc;
+            }
+            if (++num_steps_since_uphill > num_steps_before_speedup) {
+                time_step = time_step * time_step_increase < max_time_step ? time_step * time_step_increase : max_time_step;
+                alpha *= alpha_decrease;
+            }
+        }
+        else {
+            // Going uphill, stop
+            for (uint i = 0; i < num_particles; i++) {
+                particles[i].vel = vec3(0, 0, 0);
+            }
+            time_step *= time_step_decrease;
+            alpha = alpha_start;
+            num_steps_since_uphill = 0;
+        }
+
+        // Semi-implicit Euler step
+        update_velocities(time_step);
+        update_positions(time_step);
+
+        // Scale the box towards zero pressure
+        if (relax_box) {
+            ftype factor = 1 + box_compressibility * P / 3;
+            factor = factor < 1 - max_relative_box_change ? 1 - max_relative_box_change : factor;
+            factor = factor > 1 + max_relative_box_change ? 1 + max_relative_box_change : factor;
+            scale_box(factor);
+        }
+        calculate_forces<no_thermostat>();
+    }
+
+    Ep_on       = saved_Ep_on;
+    pressure_on = saved_pressure_on;
+    measure_every_loop = false;
+
+    // Lengths * sigma_in_m/P_ANGSTROM [Angstrom]
+    // Energies * epsilon_in_j/P_EV [eV]
+    // Pressures * epsilon_in_j / (sigma_in_m * sigma_in_m * sigma_in_m) [Pa]
+    output << "*******************" << endl;
+    output << (converged ? "Energy minimization converged" : "Energy minimization did not converge") << " after " << num_force_calls << " force calculations." << endl;
+    output << "Max force        [eV/A] = " << setprecision(9) << sqrt(max_sqr_force) * epsilon_in_j/P_SI_EV / (sigma_in_m/P_SI_ANGSTROM) << endl;
+    output << "Pressure         [Pa]   = " << setprecision(9) << P * epsilon_in_j/(sigma_in_m*sigma_in_m*sigma_in_m) << endl;
+    output << "Ep per atom      [eV]   = " << setprecision(9) << current_Ep/num_particles * epsilon_in_j/P_SI_EV << endl;
+    output << "Cohesive energy  [eV]   = " << setprecision(9) << -current_Ep/num_particles * epsilon_in_j/P_SI_EV << endl;
+    output << "Lattice constant [A]    = " << setprecision(9) << box_size/box_size_in_lattice_constants * sigma_in_m/P_SI_ANGSTROM << endl;
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::run_monte_carlo_equilibration(uint num_sweeps, ftype max_displacement_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation(PHASE_MONTE_CARLO);
+
+    /*
+     * Metropolis Monte Carlo with single particle moves, used to get a
+     * configuration in equilibrium at desired_temp faster than by running
+     * MD from the lattice. The box is divided into cells at least one
+     * cutoff wide and an even number per side, so cells of the same of
+     * the eight checkerboard colors never share neighbours and can be swept
+     * in parallel. A move leaving its cell is rejected, which keeps the
+     * proposal symmetric; the grid is shifted randomly every sweep so the
+     * particles can still move anywhere. All random numbers are drawn from
+     * (particle, sweep), so the result does not depend on the number of
+     * threads.
+     */
+    const ftype target_acceptance_min = ftype(0.3);
+    const ftype target_acceptance_max = ftype(0.5);
+    const ftype displacement_change   = ftype(1.1);
+
+    if (desired_temp <= 0) {
+        output << "Monte Carlo equilibration needs a desired temperature above zero." << endl;
+        print_output_and_process_events();
+        finish_operation();
+        return;
+    }
+
+    // Convert in parameters to reduced units
+    ftype max_displacement = max_displacement_in * P_RU_ANGSTROM; // [Angstrom]
+    ftype beta = 1/desired_temp;
+
+    // The checkerboard needs at least four cells per side, smaller boxes are swept serially as one cell
+    uint cells_per_side = uint(box_size/inner_cutoff);
+    cells_per_side = cells_per_side >= 4 ? cells_per_side & ~1u : 1;
+    uint num_colors = cells_per_side > 1 ? 8 : 1;
+
+    sparse_cell_grid grid;
+    grid.build(particles, box_size, cells_per_side, vec3(0, 0, 0));
+    ftype Ep_start = 0;
+    for (uint i = 0; i < num_particles; i++) {
+        Ep_start += local_potential_energy(grid, i, particles[i].pos);
+    }
+    Ep_start /= 2;
+
+    vector<uint > accepted_in_cell;
+    vector<ftype> dEp_in_cell;
+    ftype dEp_sum = 0;
+    uint  accepted_sum = 0;
+    uint  sweep;
+    for (sweep = 0; sweep < num_sweeps; sweep++) {
+        uint accepted_in_sweep = 0;
+
+        // Check if the equilibration has been requested to abort
+        if (abort_activities_requested) {
+            break;
+        }
+
+        // Shift the grid randomly
+        uint32 words[4];
+        philox4x32(sweep, 0xFFFFFFFFu, 0, 0, random_seed, RS_MONTE_CARLO, words);
+        vec3 offset(uniform_from_uint32(words[0]), uniform_from_uint32(words[1]), uniform_from_uint32(words[2]));
+        grid.build(particles, box_size, cells_per_side, offset * grid.cell_size);
+        accepted_in_cell.resize(grid.num_cells()); // Only the occupied cells are swept
+        dEp_in_cell     .resize(grid.num_cells());
+
+        for (uint color = 0; color < num_colors; color++) {
+            #pragma omp parallel for schedule(dynamic)
+            for (int c = 0; c < int(grid.num_cells()); c++) {
+                accepted_in_cell[c] = 0;
+                dEp_in_cell     [c] = 0;
+                if (num_colors > 1 && grid.color_of(c) != color) {
+                    continue;
+                }
+                for (uint k = grid.cell_start[c]; k < grid.cell_start[c + 1]; k++) {
+                    uint i = grid.cell_particles[k];
+                    uint32 r[4];
+                    philox4x32(i, sweep, 0, 0, random_seed, RS_MONTE_CARLO, r);
+                    vec3 trial = particles[i].pos + max_displacement * vec3(2*uniform_from_uint32(r[0]) - 1, 2*uniform_from_uint32(r[1]) - 1, 2*uniform_from_uint32(r[2]) - 1);
+                    modulus_position(trial);
+                    if (grid.key_of(trial, box_size) != grid.cell_keys[c]) {
+                        continue; // Rejected, leaving the cell
+                    }
+                    ftype dEp = local_potential_energy(grid, i, trial) - local_potential_energy(grid, i, particles[i].pos);
+                    if (dEp <= 0 || uniform_from_uint32(r[3]) < exp(-beta * dEp)) {
+                        particles[i].pos = trial;
+                        accepted_in_cell[c]++;
+                        dEp_in_cell     [c] += dEp;
+                    }
+                }
+            }
+            // Summed in cell order to not depend on the number of threads
+            for (uint c = 0; c < grid.num_cells(); c++) {
+                accepted_in_sweep += accepted_in_cell[c];
+                dEp_sum           += dEp_in_cell[c];
+            }
+        }
+        accepted_sum += accepted_in_sweep;
+
+        // Adjust the step length towards the wanted acceptance ratio of this sweep, the earlier ones would slow it down more and more
+        ftype acceptance = ftype(accepted_in_sweep) / ftype(num_particles);
+        if      (acceptance > target_acceptance_max) max_displacement *= displacement_change;
+        else if (acceptance < target_acceptance_min) max_displacement /= displacement_change;
+        if (max_displacement > grid.cell_size/2) max_displacement = grid.cell_size/2;
+
+        process_events();
+    }
+
+    // Continue with MD from the new configuration with velocities for the same temperature, not the ones drawn at init
+    randomize_velocities(desired_temp, VELOCITY_DRAW_MONTE_CARLO);
+    reset_non_modulated_relative_particle_positions();
+    create_verlet_list();
+
+    // Energies * epsilon_in_j/P_EV [eV]
+    output << "*******************" << endl;
+    output << "Monte Carlo equilibration finished after " << sweep << " sweeps." << endl;
+    output << "Acceptance ratio         = " << setprecision(9) << (sweep > 0 ? ftype(accepted_sum) / (ftype(num_particles) * sweep) : 0) << endl;
+    output << "Max displacement [A]     = " << setprecision(9) << max_displacement * sigma_in_m/P_SI_ANGSTROM << endl;
+    output << "Ep per atom before [eV]  = " << setprecision(9) << Ep_start/num_particles * epsilon_in_j/P_SI_EV << endl;
+    output << "Ep per atom after  [eV]  = " << setprecision(9) << (Ep_start + dEp_sum)/num_particles * epsilon_in_j/P_SI_EV << endl;
+    print_output_and_process_events();
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::exchange_temperature(ftype desired_temp_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation();
+
+    /*
+     * The velocities are scaled by sqrt(T_new/T_old), so the replica is at
+     * once in equilibrium at the new temperature as far as the kinetic
+     * energy goes (Sugita & Okamoto, 1999). The thermostat value only
+     * depends on the ratio of the temperatures and stays right.
+     */
+    ftype new_desired_temp = desired_temp_in * P_SI_KB / epsilon_in_j;
+    if (system_initialized && desired_temp > 0 && new_desired_temp > 0) {
+        ftype factor = sqrt(new_desired_temp/desired_temp);
+        #pragma omp parallel for
+        for (int i = 0; i < int(num_particles); i++) {
+            particles[i].vel *= factor;
+        }
+        desired_temp = new_desired_temp;
+    }
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::branch_trajectory(uint random_seed_in)
+{
+    // The system is *always* operating when running non-const functions
+    start_operation();
+
+    if (!system_initialized || loop_num != num_time_steps) {
+        output << "Only a finished run can be branched" << endl;
+        finish_operation();
+        return;
+    }
+
+    /*
+     * The positions are kept and the velocities are drawn again at the
+     * temperature the run was held at, so every branch starts from the same
+     * configuration with a momentum of its own. The branch is at constant
+     * energy, and the next run starts over from timestep 0 with the
+     * mean square displacement measured from here.
+     */
+    ftype temperature = target_temperature();
+    random_seed      = random_seed_in;
+    thermostat_type  = NO_THERMOSTAT;
+    thermostat_value = no_thermostat::value_when_inactive();
+    thermostat_on    = false;
+    barostat_on      = false;
+    barostat_factor  = 1;
+    randomize_velocities(temperature, VELOCITY_DRAW_INIT); // With the new seed
+    reset_non_modulated_relative_particle_positions();
+    equilibrium_reached = false;
+    continue_run = restored_run = paused_run = false;
+    output << "Branched with the random seed " << random_seed << " at " << temperature*epsilon_in_j/P_SI_KB << " K" << endl;
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::prepare_fork()
+{
+    // The system is *always* operating when running non-const functions
+    start_operation();
+
+    // The writer thread is not copied by fork, so it must have nothing left to do
+    writer.wait();
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::continue_after_fork()
+{
+    // The system is *always* operating when running non-const functions
+    start_operation();
+
+    writer.restart_after_fork();
+
+    // Measurements spilled to disk would otherwise be shared with the parent
+    time_series *series[] = {&insttemp, &instEk, &instEp, &instEc, &thermostat_values, &msd, &diffusion_coefficient, &distance_force_sum, &instvolume,
+                             &temperature, &Cv, &pressure, &volume, &Ek, &Ep, &cohesive_energy, &filtered_distance_force_sum, &Cv_filtered_temp, &Cv_unfiltered_var, &Cv_filtered_var};
+    bool all_private = filter_scratch.make_private();
+    for (uint i = 0; i < sizeof(series)/sizeof(series[0]); i++) {
+        all_private = series[i]->make_private() && all_private;
+    }
+    if (!all_private) {
+        output << "Warning: Measurements spilled to disk are shared with the parent process" << endl;
+    }
+
+    // Finish the operation
+    finish_operation();
+}
+
+void mdsystem::abort_activities()
+{
+    /*
+     * This is not an *operation* in that sence since the variable being
+     * changed cannot be locked for writing to a single thread
+     */
+    abort_activities_requested = true;
+}
+
+bool mdsystem::is_initialized() const
+{
+    return system_initialized;
+}
+
+bool mdsystem::is_operating() const
+{
+    return operating;
+}
+
+bool mdsystem::take_progress(progress_message &message)
+{
+    /*
+     * Not an operation either, it is what the application does while the
+     * operations are running on another thread.
+     */
+    return progress.pop(message);
+}
+
+uint mdsystem::get_loop_num() const
+{
+    return loop_num;
+}
+
+uint mdsystem::get_max_loops_num() const
+{
+    return num_time_steps;
+}
+
+ftype mdsystem::get_potential_energy() const
+{
+    return system_initialized ? instEp[current_sample_index]*epsilon_in_j : 0;
+}
+
+ftype mdsystem::get_desired_temperature() const
+{
+    return system_initialized ? desired_temp*epsilon_in_j/P_SI_KB : 0;
+}
+
+bool mdsystem::get_result_mean(uint column, ftype &mean) const
+{
+    /*
+     * The first sixth is left out, like for the Cv that is printed, so that
+     * the start-up of the run and the edge of the filter are not included.
+     */
+    if (!system_initialized || column >= NUM_RESULT_COLUMNS || (column == RC_VOLUME && !barostat_on)) {
+        return false;
+    }
+    uint num_values = result_length(column);
+    uint first      = num_values/6;
+    if (first >= num_values) {
+        return false;
+    }
+    ftype Ep_shift = -instEp[0]; // As in the results file
+    ftype sum = 0;
+    for (uint i = first; i < num_values; i++) {
+        sum += result_value(column, i, Ep_shift);
+    }
+    mean = sum/(num_values - first);
+    return true;
+}
+
+string mdsystem::get_result_name(uint column)
+{
+    if (column >= NUM_RESULT_COLUMNS) {
+        return "";
+    }
+    return string(result_columns[column].name) + " [" + result_columns[column].unit + "]";
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+template<class thermostat_policy>
+void mdsystem::run_simulation_with_thermostat()
+{
+    // Select the filter once for the whole run
+    switch (filter_type) {
+    case TWO_SIDED_EXPONENTIAL_DECAY_FILTER: run_simulation_with_policies<thermostat_policy, two_sided_exponential_decay_filter>(); break;
+    case ENSEMBLE_AVERAGE_FILTER           : run_simulation_with_policies<thermostat_policy, ensemble_average_filter           >(); break;
+    }
+}
+
+template<class thermostat_policy, class filter_policy>
+void mdsystem::run_simulation_with_policies()
+{
     /*
      * All variables define in this function has to defined here since we use
-     * goto's.
+     * return's.
      */
-    // Open the output files. They work like cin
-    ofstream out_filter_test_data1;
-    ofstream out_filter_test_data2;
-    ofstream out_filter_test_data3;
-    ofstream out_etot_data    ;
-    ofstream out_ep_data      ;
-    ofstream out_ek_data      ;
-    ofstream out_cv_data      ;
-    ofstream out_temp_data    ;
-    ofstream out_therm_data   ;
-    ofstream out_msd_data     ;
-    ofstream out_diff_c_data  ;
-    ofstream out_cohe_data    ;
-    ofstream out_pressure_data;
     // For calculating the average specific heat
     ftype Cv_sum;
     uint  Cv_num;
     // For shifting the potential energy
     ftype Ep_shift;
 
-    // Start simulating
-    enter_loop_number(0);
-    calculate_forces();
-    measure_unfiltered_properties();
-    while (loop_num < num_time_steps) {
+    // Start simulating, or continue a paused run, after the last sample of an extended run or where a checkpoint was taken
+    if (paused_run) {
+        // Everything is as it was left, also the trajectory
+        enter_loop_number(loop_num);
+        paused_run = false;
+    }
+    else if (continue_run || restored_run) {
+        scheduler.reset_statistics();
+        enter_loop_number(loop_num);
+        if (continue_run) {
+            calculate_forces<thermostat_policy>(); // A checkpoint holds the accelerations as they were
+        }
+        continue_run = restored_run = false;
+        if (filter_streamed()) {
+            uint num_samples_taken = loop_num/sampling_period + 1 < num_sampling_points ? loop_num/sampling_period + 1 : num_sampling_points;
+            start_streaming_filter(num_samples_taken);
+        }
+        if (store_trajectory) {
+            stringstream file_name;
+            file_name << "Trajectory_from_" << loop_num << ".mdt";
+            open_trajectory(file_name.str().c_str());
+        }
+        last_checkpoint_time = time(NULL);
+    }
+    else {
+        scheduler.reset_statistics();
+        enter_loop_number(0);
+        if (filter_streamed()) {
+            start_streaming_filter(0);
+        }
+        calculate_forces<thermostat_policy>();
+        measure_unfiltered_properties<thermostat_policy>();
+        if (store_trajectory) {
+            open_trajectory("Trajectory.mdt");
+            trajectory.write_frame(loop_num, particles, box_size);
+        }
+        last_checkpoint_time = time(NULL);
+    }
+    while (loop_num < pause_loop_num) {
         // Check if the simulation has been requested to abort
         if (abort_activities_requested) {
-            goto operation_finished;
+            if (checkpointing_on) {
+                write_checkpoint(output_path("Checkpoint.mdc"));
+                output << "Checkpoint written at timestep " << loop_num << endl;
+            }
+            trajectory.close();
+            return;
         }
 
-        if (!sampling_in_this_loop) {
-            calculate_forces();
+        // Checkpoints are taken between the timesteps, where nothing is half done
+        if (checkpointing_on && difftime(time(NULL), last_checkpoint_time) >= checkpoint_interval) {
+            write_checkpoint(output_path("Checkpoint.mdc"));
         }
 
-        // Evolve the system in time
-        leapfrog(); // This function includes the force calculation
+        if (thermostat_policy::uses_baoab) {
+            // Evolve the system in time, forces are always up to date here
+            baoab<thermostat_policy>();
+        }
+        else {
+            if (!sampling_in_this_loop) {
+                calculate_forces<thermostat_policy>();
+            }
 
-        if (sampling_in_this_loop) {
-            measure_unfiltered_properties();
+            // Evolve the system in time
+            leapfrog<thermostat_policy>(); // This function includes the force calculation and the measurements
+        }
+        if (store_trajectory && loop_num % trajectory_frame_period == 0) {
+            trajectory.write_frame(loop_num, particles, box_size);
         }
 
         // Process events
         print_output_and_process_events();
     }
+    if (loop_num < num_time_steps) {
+        paused_run = true;
+        return;
+    }
+    if (trajectory.is_open()) {
+        output << "Trajectory: " << trajectory.num_frames() << " frames";
+        if (trajectory.num_frames() > 0) {
+            output << ", " << ftype(trajectory.num_bytes())/(ftype(num_particles)*trajectory.num_frames()) << " bytes per particle and frame";
+        }
+        output << endl;
+        trajectory.close();
+    }
+    if (state_cache_on && equilibrium_reached) {
+        /*
+         * The state at the end is the one that has been in equilibrium for
+         * the longest time (with dEp_tolerance at 1, equilibrium is already
+         * declared after the second sample). The last timestep is always a
+         * sampling one, so the velocities are in phase with the positions.
+         */
+        cache_equilibrated_state();
+    }
 
     // Now the filtered properties can be calculated
-    calculate_filtered_properties();
+    calculate_filtered_properties<filter_policy>();
     output << "*******************" << endl;
     output << "Simulation completed." << endl;
+    std::streamsize precision = output.precision();
+    if (all_pairs_forces::is_faster(num_particles)) {
+        output << "Forces from all pairs, without Verlet lists" << endl;
+    }
+    else {
+        output << "Forces and Verlet lists in " << blocks.num_cells() << (blocks.num_cells() == 1 ? " block:" : " blocks:") << endl;
+    }
+    for (uint t = 0; t < scheduler.get_num_threads(); t++) {
+        output << "  Thread " << t << ": busy " << setprecision(3) << scheduler.get_busy_time(t) << " s, idle " << scheduler.get_idle_time(t) << " s, "
+               << scheduler.get_num_stolen(t) << " tasks stolen" << endl;
+    }
+    output.precision(precision);
 
     /*
      * TODO: The following code should be moved into another public function.
@@ -255,29 +1118,12 @@ void mdsystem::run_simulation()
     // Pressures * epsilon_in_j / (sigma_in_m * sigma_in_m * sigma_in_m);
     */
     Ep_shift = -instEp[0];
-    output << "Opening output files..." << endl;
-    if (!(open_ofstream_file(out_filter_test_data1, "FilterTest1.dat") &&
-          open_ofstream_file(out_filter_test_data2, "FilterTest2.dat") &&
-          open_ofstream_file(out_filter_test_data3, "FilterTest3.dat") &&
-          open_ofstream_file(out_etot_data    , "TotalEnergy.dat") &&
-          open_ofstream_file(out_ep_data      , "Potential.dat"  ) &&
-          open_ofstream_file(out_ek_data      , "Kinetic.dat"    ) &&
-          open_ofstream_file(out_cv_data      , "Cv.dat"         ) &&
-          open_ofstream_file(out_temp_data    , "Temperature.dat") &&
-          open_ofstream_file(out_therm_data   , "Thermostat.dat" ) &&
-          open_ofstream_file(out_msd_data     , "MSD.dat"        ) &&
-          open_ofstream_file(out_diff_c_data  , "diff_coeff.dat" ) &&
-          open_ofstream_file(out_pressure_data,"Pressure.dat"    ) &&
-          open_ofstream_file(out_cohe_data    , "cohesive.dat"   )
-          )) {
-        cerr << "Error: Output files could not be opened" << endl;
-    }
-    else {
-        output << "Writing to output files..." << endl;
-        print_output_and_process_events();
-
-        /////////Start writing files////////////////////////////////////////////////////////
-
+    report_output_errors(); // Left from the previous run
+    output << "Handing over the results to the writer..." << endl;
+    print_output_and_process_events();
+    write_results(Ep_shift);
+    if (text_export_on) {
+        // Impulse and step responses of the filter
         vector<ftype> dirac_impulse1(num_sampling_points);
         vector<ftype> dirac_impulse2(num_sampling_points);
         vector<ftype> line(num_sampling_points);
@@ -288,144 +1134,24 @@ void mdsystem::run_simulation()
         vector<ftype> filtered_dirac_impulse1;
         vector<ftype> filtered_dirac_impulse2;
         vector<ftype> filtered_line;
-        filter(dirac_impulse1, filtered_dirac_impulse1, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-        filter(dirac_impulse2, filtered_dirac_impulse2, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-        filter(line          , filtered_line          , default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-
-        //Tests
-        for (uint i = 0; i < filtered_dirac_impulse1.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_filter_test_data1  << setprecision(9) << filtered_dirac_impulse1[i] << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < filtered_dirac_impulse2.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_filter_test_data2  << setprecision(9) << filtered_dirac_impulse2[i] << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < filtered_line.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_filter_test_data3  << setprecision(9) << filtered_line[i] << endl;
-            // Process events
-            process_events();
-        }
-        // Lengths * sigma_in_m/P_ANGSTROM [Angstrom]
-        // Energies * epsilon_in_j/P_EV [eV]
-        for (uint i = 0; i < Ek.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_etot_data  << setprecision(9) << (Ek[i] + (Ep[i] + Ep_shift))*epsilon_in_j/P_SI_EV << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < Ek.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_ek_data    << setprecision(9) << Ek[i]*epsilon_in_j/P_SI_EV << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < Ep.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_ep_data    << setprecision(9) << (Ep[i] + Ep_shift)*epsilon_in_j/P_SI_EV << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < cohesive_energy.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_cohe_data  << setprecision(9) << cohesive_energy[i]*epsilon_in_j/P_SI_EV << endl;
-            // Process events
-            process_events();
-        }
-        // Masses * particle_mass_in_kg [kg]
-        // Times * sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j) [s]
-        // Temperatures * epsilon_in_j/P_KB [K]
-        for (uint i = 0; i < temperature.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_temp_data  << setprecision(9) << temperature[i] *epsilon_in_j/P_SI_KB << endl;
-            // Process events
-            process_events();
-        }
-        // Pressures * epsilon_in_j / (sigma_in_m * sigma_in_m * sigma_in_m) [Pa]
-        for (uint i = 0; i < pressure.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_pressure_data<<setprecision(9)<< pressure[i]*epsilon_in_j/(sigma_in_m*sigma_in_m*sigma_in_m)<< endl;
-            // Process events
-            process_events();
-        }
-        // Unitless * 1
-        for (uint i = 0; i < thermostat_values.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_therm_data << setprecision(9) << thermostat_values[i] << endl;
-            // Process events
-            process_events();
-        }
-        // Others
-        for (uint i = 0; i < msd.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_msd_data   << setprecision(9) << msd[i]*sigma_in_m*sigma_in_m << endl;
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < Cv.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_cv_data << setprecision(9) << Cv[i]*P_SI_KB/(1000 * particle_mass_in_kg) << endl; // [J/(g*K)]
-            // Process events
-            process_events();
-        }
-        for (uint i = 0; i < diffusion_coefficient.size(); i++) {
-            if (abort_activities_requested) {
-                break;
-            }
-            out_diff_c_data   << setprecision(9) << diffusion_coefficient[i]*sigma_in_m*sigma_in_m/sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j) << endl;
-            // Process events
-            process_events();
-        }
-
-        /////////Finish writing files///////////////////////////////////////////////////////
+        filter<filter_policy>(dirac_impulse1, filtered_dirac_impulse1, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        filter<filter_policy>(dirac_impulse2, filtered_dirac_impulse2, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        filter<filter_policy>(line          , filtered_line          , default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        uint file;
+        file = open_output_file("FilterTest1.dat"); write_text_values(file, filtered_dirac_impulse1); writer.close(file);
+        file = open_output_file("FilterTest2.dat"); write_text_values(file, filtered_dirac_impulse2); writer.close(file);
+        file = open_output_file("FilterTest3.dat"); write_text_values(file, filtered_line          ); writer.close(file);
 
-        out_etot_data .close();
-        out_ep_data   .close();
-        out_ek_data   .close();
-        out_cv_data   .close();
-        out_temp_data .close();
-        out_therm_data.close();
-        out_msd_data  .close();
-        out_cohe_data .close();
-        out_pressure_data.close();
+        write_text_results(Ep_shift);
     }
-    output << "Writing to output files done." << endl;
+    output << "The results are being written in the background." << endl;
     print_output_and_process_events();
 
 #if  PRINT_OUTPUT_TO_TEXT_BOX
     for (uint i = 0; i < temperature.size();i++) // TODO: NOTE! not all vectors are of the same size (depending on which filter that is used)! Temperature is filtered and is smaller than for example pressure if emils filter is used
     {
         if (abort_activities_requested) {
-            goto operation_finished;
+            return;
         }
 
         // Lengths * sigma_in_m/P_ANGSTROM [Angstrom]
@@ -453,7 +1179,7 @@ void mdsystem::run_simulation()
     Cv_sum = Cv_num = 0;
     for(uint i = uint(Cv.size()/6); i < Cv.size();i++) {
         if (abort_activities_requested) {
-            goto operation_finished;
+            return;
         }
         Cv_sum += Cv[i]*P_SI_KB/(1000 * particle_mass_in_kg);
         Cv_num++;
@@ -465,99 +1191,121 @@ void mdsystem::run_simulation()
     output << "dt="<< dt << endl;
     output << "init_temp= "<<init_temp<<endl;
     output << "Complete" << endl;
-
-operation_finished:
-    // Finish the operation
-    finish_operation();
 }
 
-void mdsystem::abort_activities()
-{
-    /*
-     * This is not an *operation* in that sence since the variable being
-     * changed cannot be locked for writing to a single thread
-     */
-    abort_activities_requested = true;
-}
+void mdsystem::init_particles() {
+    // Allocate space for particles
+    particles.resize(num_particles);
 
-bool mdsystem::is_initialized() const
-{
-    return system_initialized;
+    //Place out particles according to the lattice pattern, one conventional unit cell at a time
+    if (lattice_type == LT_FCC) {
+        const int num_cells = int(box_size_in_lattice_constants*box_size_in_lattice_constants*box_size_in_lattice_constants);
+        #pragma omp parallel for schedule(static)
+        for (int cell = 0; cell < num_cells; cell++) {
+            uint x = uint(cell) % box_size_in_lattice_constants;
+            uint y = uint(cell) / box_size_in_lattice_constants % box_size_in_lattice_constants;
+            uint z = uint(cell) / box_size_in_lattice_constants / box_size_in_lattice_constants;
+            int help_index = 4*cell;
+
+            (particles[help_index + 0]).pos[0] = x*lattice_constant;
+            (particles[help_index + 0]).pos[1] = y*lattice_constant;
+            (particles[help_index + 0]).pos[2] = z*lattice_constant;
+
+            (particles[help_index + 1]).pos[0] = x*lattice_constant;
+            (particles[help_index + 1]).pos[1] = (y + ftype(0.5))*lattice_constant;
+            (particles[help_index + 1]).pos[2] = (z + ftype(0.5))*lattice_constant;
+
+            (particles[help_index + 2]).pos[0] = (x + ftype(0.5))*lattice_constant;
+            (particles[help_index + 2]).pos[1] = y*lattice_constant;
+            (particles[help_index + 2]).pos[2] = (z + ftype(0.5))*lattice_constant;
+
+            (particles[help_index + 3]).pos[0] = (x + ftype(0.5))*lattice_constant;
+            (particles[help_index + 3]).pos[1] = (y + ftype(0.5))*lattice_constant;
+            (particles[help_index + 3]).pos[2] = z*lattice_constant;
+        }
+    }
+    
+    randomize_velocities(init_temp, VELOCITY_DRAW_INIT);
+    reset_non_modulated_relative_particle_positions();
 }
 
-bool mdsystem::is_operating() const
+void mdsystem::randomize_velocities(ftype temperature, uint32 draw)
 {
-    return operating;
-}
+    /*
+     * Maxwell-Boltzmann distributed velocities, keyed by (seed, atom, draw),
+     * so every atom gets the same velocity whatever the number of threads,
+     * and every draw is independent of the others.
+     */
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < int(num_particles); i++) {
+        ftype gaussian[3];
+        philox_gaussian_vec3(random_seed, RS_VELOCITIES, uint32(i), draw, gaussian);
+        particles[i].vel = vec3(gaussian[0], gaussian[1], gaussian[2]);
+    }
 
-uint mdsystem::get_loop_num() const
-{
-    return loop_num;
+    // Compensate for incorrect start temperature and total velocities and finalize the initialization values
+    remove_drift_and_scale_velocities(temperature);
 }
 
-uint mdsystem::get_max_loops_num() const
+void mdsystem::remove_drift_and_scale_velocities(ftype temperature)
 {
-    return num_time_steps;
-}
-
-////////////////////////////////////////////////////////////////
-// PRIVATE FUNCTIONS
-////////////////////////////////////////////////////////////////
-
-void mdsystem::init_particles() {
-    // Allocate space for particles
-    particles.resize(num_particles);
-
-    //Place out particles according to the lattice pattern
-    if (lattice_type == LT_FCC) {
-        for (uint z = 0; z < box_size_in_lattice_constants; z++) {
-            for (uint y = 0; y < box_size_in_lattice_constants; y++) {
-                for (uint x = 0; x < box_size_in_lattice_constants; x++) {
-                    int help_index = 4*(x + box_size_in_lattice_constants*(y + box_size_in_lattice_constants*z));
-
-                    (particles[help_index + 0]).pos[0] = x*lattice_constant;
-                    (particles[help_index + 0]).pos[1] = y*lattice_constant;
-                    (particles[help_index + 0]).pos[2] = z*lattice_constant;
-
-                    (particles[help_index + 1]).pos[0] = x*lattice_constant;
-                    (particles[help_index + 1]).pos[1] = (y + ftype(0.5))*lattice_constant;
-                    (particles[help_index + 1]).pos[2] = (z + ftype(0.5))*lattice_constant;
-
-                    (particles[help_index + 2]).pos[0] = (x + ftype(0.5))*lattice_constant;
-                    (particles[help_index + 2]).pos[1] = y*lattice_constant;
-                    (particles[help_index + 2]).pos[2] = (z + ftype(0.5))*lattice_constant;
-
-                    (particles[help_index + 3]).pos[0] = (x + ftype(0.5))*lattice_constant;
-                    (particles[help_index + 3]).pos[1] = (y + ftype(0.5))*lattice_constant;
-                    (particles[help_index + 3]).pos[2] = z*lattice_constant;
-                } // X
-            } // Y
-        } // Z
+    /*
+     * The sums are taken over blocks of particles in parallel and then
+     * added in the order of the blocks, so the result does not depend on the
+     * number of threads.
+     */
+    const int block_size = 4096;
+    const int num_blocks = int((num_particles + block_size - 1) / block_size);
+    vector<vec3>  block_sum_vel    (num_blocks);
+    vector<ftype> block_sum_sqr_vel(num_blocks);
+    #pragma omp parallel for schedule(static)
+    for (int block = 0; block < num_blocks; block++) {
+        uint first = uint(block) * block_size;
+        uint last  = first + block_size < num_particles ? first + block_size : num_particles;
+        vec3  sum_vel = vec3(0, 0, 0);
+        ftype sum_sqr_vel = 0;
+        for (uint i = first; i < last; i++) {
+            sum_vel     += particles[i].vel;
+            sum_sqr_vel += particles[i].vel.sqr_length();
+        }
+        block_sum_vel    [block] = sum_vel;
+        block_sum_sqr_vel[block] = sum_sqr_vel;
     }
-    
-    //Randomize the velocities
-    vec3 sum_vel = vec3(0, 0, 0);
+    vec3  sum_vel = vec3(0, 0, 0);
     ftype sum_sqr_vel = 0;
-    for (uint i = 0; i < num_particles; i++) {
-        for (uint j = 0; j < 3; j++) {
-            particles[i].vel[j] = 0;
-            for (uint terms = 0; terms < 5; terms++) { //This will effectivelly create a distribution very similar to normal distribution. (If you want to see what the distribution looks like, go to www.wolframalpha.com/input/?i=fourier((sinc(x))^n) and replace n by the number of terms)
-                particles[i].vel[j] += ftype(rand());
-            }
-        }
-        sum_vel     += particles[i].vel;
-        sum_sqr_vel += particles[i].vel.sqr_length();
+    for (int block = 0; block < num_blocks; block++) {
+        sum_vel     += block_sum_vel    [block];
+        sum_sqr_vel += block_sum_sqr_vel[block];
     }
 
-    // Compensate for incorrect start temperature and total velocities and finalize the initialization values
+    // Zero total momentum and exactly the given temperature
     vec3 average_vel = sum_vel/ftype(num_particles);
     ftype vel_variance = sum_sqr_vel/num_particles - average_vel.sqr_length();
-    ftype scale_factor = sqrt(ftype(3.0)  * init_temp  / (vel_variance)); // Termal energy = 1.5 * P_KB * init_temp = 0.5 m v*v
-    for (uint i = 0; i < num_particles; i++) {
-        particles[i].vel = (particles[i].vel - average_vel)* scale_factor;
+    ftype scale_factor = vel_variance > 0 ? sqrt(ftype(3.0) * temperature / vel_variance) : 0;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < int(num_particles); i++) {
+        particles[i].vel = (particles[i].vel - average_vel) * scale_factor;
     }
+}
 
-    reset_non_modulated_relative_particle_positions();
+ftype mdsystem::local_potential_energy(const sparse_cell_grid &grid, uint i, const vec3 &pos) const
+{
+    ftype Ep = 0;
+    int cell = grid.find(grid.key_of(pos, box_size)); // Occupied, pos is in the cell of particle i
+    for (uint m = grid.neighbour_start[cell]; m < grid.neighbour_start[cell + 1]; m++) {
+        uint neighbour = grid.neighbour_cells[m];
+        for (uint k = grid.cell_start[neighbour]; k < grid.cell_start[neighbour + 1]; k++) {
+            uint j = grid.cell_particles[k];
+            if (j == i) continue;
+            ftype sqr_distance = origin_centered_modulus_position_minus(pos, particles[j].pos).sqr_length();
+            if (sqr_distance < sqr_inner_cutoff) {
+                ftype p = 1/sqr_distance;
+                p = p*p*p;
+                Ep += 4 * p * (p - 1) - E_cutoff;
+            }
+        }
+    }
+    return Ep;
 }
 
 void mdsystem::calculate_potential_energy_cutoff()
@@ -568,13 +1316,53 @@ void mdsystem::calculate_potential_energy_cutoff()
     E_cutoff = ftype(4.0) * q * (q - ftype(1.0));
 }
 
+void mdsystem::apply_memory_budget()
+{
+    /*
+     * Shared evenly by value between the unfiltered measurements, the
+     * filtered ones and the filter workspace (which holds every row in
+     * FILTER_LANES lanes).
+     */
+    time_series *series[] = {&insttemp, &instEk, &instEp, &instEc, &thermostat_values, &msd, &diffusion_coefficient, &distance_force_sum, &instvolume,
+                             &temperature, &Cv, &pressure, &volume, &Ek, &Ep, &cohesive_energy, &filtered_distance_force_sum, &Cv_filtered_temp, &Cv_unfiltered_var, &Cv_filtered_var};
+    const uint num_series = sizeof(series)/sizeof(series[0]);
+    const uint num_workspace_series = 3;
+    uint64 budget_per_series = memory_budget/(num_series + num_workspace_series*FILTER_LANES);
+    for (uint i = 0; i < num_series; i++) {
+        series[i]->set_ram_budget(budget_per_series);
+    }
+    filter_scratch.set_ram_budget(budget_per_series*FILTER_LANES);
+}
+
+void mdsystem::resize_measurements()
+{
+    insttemp             .resize(num_sampling_points);
+    instEk               .resize(num_sampling_points);
+    instEp               .resize(num_sampling_points);
+    instEc               .resize(num_sampling_points);
+    thermostat_values    .resize(num_sampling_points);
+    msd                  .resize(num_sampling_points);
+    diffusion_coefficient.resize(num_sampling_points);
+    distance_force_sum   .resize(num_sampling_points);
+    instvolume           .resize(num_sampling_points);
+    if (filter_type == TWO_SIDED_EXPONENTIAL_DECAY_FILTER && !filter_streamed()) {
+        // Cv is always filtered once
+        filter_scratch.prepare(num_sampling_points, default_num_times_filtering > 1 ? default_num_times_filtering : 1, slope_compensate_by_default);
+    }
+}
+
 void mdsystem::update_positions(ftype time_step)
+{
+    move_particles(time_step);
+    update_verlet_list_if_necessary();
+}
+
+void mdsystem::move_particles(ftype time_step)
 {
     for (uint i = 0; i < num_particles; i++) {
         particles[i].pos += time_step * particles[i].vel;
         modulus_position(particles[i].pos);
     }
-    update_verlet_list_if_necessary();
 }
 
 void mdsystem::update_velocities(ftype time_step)
@@ -586,8 +1374,18 @@ void mdsystem::update_velocities(ftype time_step)
 
 void mdsystem::update_verlet_list_if_necessary()
 {
-    // Check if largest displacement too large for not updating the Verlet list
-    ftype sqr_limit = (sqr_outer_cutoff + sqr_inner_cutoff - 2*sqrt(sqr_outer_cutoff*sqr_inner_cutoff));
+    /*
+     * Check if largest displacement too large for not updating the Verlet list.
+     * If the box has been scaled since the list was created, so have all
+     * distances in the list, and thereby the outer cut-off.
+     */
+    ftype sqr_scaled_outer_cutoff = sqr_outer_cutoff * verlet_list_box_scale * verlet_list_box_scale;
+    if (sqr_scaled_outer_cutoff <= sqr_inner_cutoff) {
+        output << "Verlet list updated after box scaling. Simulation " << 100*loop_num/num_time_steps << " % done" <<endl;
+        create_verlet_list();
+        return;
+    }
+    ftype sqr_limit = (sqr_scaled_outer_cutoff + sqr_inner_cutoff - 2*sqrt(sqr_scaled_outer_cutoff*sqr_inner_cutoff));
     uint i;
     // Check if any particle has move to much
     for (i = 0; i < num_particles; i++) {
@@ -605,135 +1403,202 @@ void mdsystem::update_verlet_list_if_necessary()
 
 void mdsystem::create_verlet_list()
 {
-    bool         cells_used;            // Flag to tell is the cell list is used or not
-    uint         box_size_in_cells;     // Given in one dimension TODO: Change name?
-    ftype        cell_size;             // Could be the same as outer_cutoff but perhaps we should think about that...
-    vector<uint> cell_linklist;         // Contains the particle index of the next particle (with decreasing order of the particles) that is in the same cell as the particle the list entry corresponds to. If these is no more particle in the cell, the entry will be 0.
-    vector<uint> cell_list;             // Contains the largest particle index each cell contains. The list is coded as if each cell would contain particle zero (although it is probably not located there!)
-
     // Updating pos_when_verlet_list_created and non_modulated_relative_pos for all particles
-    for (uint i = 0; i < num_particles; i++) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < int(num_particles); i++) {
         update_single_non_modulated_relative_particle_position(i);
         particles[i].pos_when_verlet_list_created = particles[i].pos;
     }
+    verlet_list_box_scale = 1;
+    build_verlet_list();
+}
 
-    // Check if the cells should be used for creating the Verlet list
-    box_size_in_cells = uint(box_size/outer_cutoff);
-    if (box_size_in_cells > 3) {
-        // Cells will be used
-        cells_used = true;
-        cell_size = box_size/box_size_in_cells;
-        create_linked_cells(box_size_in_cells, cell_size, cell_linklist, cell_list);
+void mdsystem::build_verlet_list()
+{
+    /*
+     * Only depends on the positions when the list was created, so that a
+     * restored checkpoint gets exactly the same list (in the same order).
+     */
+    if (all_pairs_forces::is_faster(num_particles)) {
+        // Not used, but the positions when it was created still are
+        verlet_particles_list.clear();
+        verlet_neighbors_list.clear();
+        cross_block_start    .clear();
+        cross_block_list     .clear();
+        return;
     }
-    else {
-        cells_used = false;
-        cell_size = 0; // Not used (make warning shut-up)
+    vector<vec3> positions(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        positions[i] = particles[i].pos_when_verlet_list_created;
     }
 
-    //Creating new verlet_list
-    uint cellindex = 0;
-    uint neighbour_particle_index = 0;
+    // Only the occupied cells, if the cells are used at all
+    sparse_cell_grid cells;
+    uint box_size_in_cells = uint(box_size/outer_cutoff);
+    bool cells_used = box_size_in_cells > 3;
+    if (cells_used) {
+        cells.build(positions, box_size, box_size_in_cells, vec3(0, 0, 0));
+    }
+
+    /*
+     * Two passes over the blocks, both as tasks: the neighbours are first
+     * counted, to know where the list of each particle starts, and then
+     * stored. The lists come out the same as when built serially.
+     */
+    build_blocks(positions);
+    verlet_list_context context = {this, cells_used ? &cells : 0, false};
     verlet_particles_list.resize(num_particles);
-    verlet_particles_list[0] = 0;
-    verlet_neighbors_list.resize(0); //The elements will be push_back'ed to the Verlet list
-    for (uint i = 0; i < num_particles;) { // Loop through all particles
-        // Init this neighbour list and point to the next list
-        verlet_neighbors_list.push_back(0); // Reset number of neighbours
-        int next_particle_list = verlet_particles_list[i] + 1; // Link to the next particle list
-
-        if (cells_used) { //Loop through all neighbour cells
-            // Calculate cell indexes
-            uint cellindex_x = int(particles[i].pos[0]/cell_size);
-            uint cellindex_y = int(particles[i].pos[1]/cell_size);
-            uint cellindex_z = int(particles[i].pos[2]/cell_size);
-            if (cellindex_x == box_size_in_cells || cellindex_y == box_size_in_cells || cellindex_z == box_size_in_cells) { // This actually occationally happens
-                cellindex_x -= cellindex_x == box_size_in_cells;
-                cellindex_y -= cellindex_y == box_size_in_cells;
-                cellindex_z -= cellindex_z == box_size_in_cells;
+    scheduler.run(list_weights, callback<void (*)(void*, uint, uint)>(verlet_list_task, &context));
+    uint64 list_size = 0;
+    list_weights.assign(blocks.num_cells(), 0);
+    for (uint i = 0; i < num_particles; i++) {
+        uint64 num_neighbours = verlet_particles_list[i];
+        verlet_particles_list[i] = list_size;
+        list_size += num_neighbours + 1;
+        list_weights[blocks.particle_cell[i]] += num_neighbours;
+    }
+    verlet_neighbors_list.resize(size_t(list_size));
+    context.store = true;
+    scheduler.run(list_weights, callback<void (*)(void*, uint, uint)>(verlet_list_task, &context));
+    index_cross_block_pairs();
+}
+
+void mdsystem::restore_force_tasks()
+{
+    if (all_pairs_forces::is_faster(num_particles)) {
+        return;
+    }
+    vector<vec3> positions(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        positions[i] = particles[i].pos_when_verlet_list_created;
+    }
+    build_blocks(positions);
+    list_weights.assign(blocks.num_cells(), 0);
+    for (uint i = 0; i < num_particles; i++) {
+        list_weights[blocks.particle_cell[i]] += verlet_neighbors_list[verlet_particles_list[i]];
+    }
+    index_cross_block_pairs();
+}
+
+void mdsystem::index_cross_block_pairs()
+{
+    /*
+     * A block only calculates the forces on its own particles. The pairs in
+     * its Verlet lists with the second particle in another block are also
+     * calculated by the block of that particle, which finds them here.
+     */
+    cross_block_start.assign(num_particles + 1, 0);
+    for (uint i1 = 0; i1 < num_particles; i1++) {
+        for (uint64 j = verlet_particles_list[i1] + 1; j < verlet_particles_list[i1] + verlet_neighbors_list[verlet_particles_list[i1]] + 1; j++) {
+            uint i2 = verlet_neighbors_list[j];
+            if (blocks.particle_cell[i2] != blocks.particle_cell[i1]) {
+                cross_block_start[i2 + 1]++;
             }
-            for (int index_z = int(cellindex_z) - 1; index_z <= int(cellindex_z) + 1; index_z++) {
-                for (int index_y = int(cellindex_y) - 1; index_y <= int(cellindex_y) + 1; index_y++) {
-                    for (int index_x = int(cellindex_x) - 1; index_x <= int(cellindex_x) + 1; index_x++) {
-                        int modulated_x = index_x;
-                        int modulated_y = index_y;
-                        int modulated_z = index_z;
-                        // Control boundaries
-                        if (modulated_x == -1) {
-                            modulated_x = int(box_size_in_cells) - 1;
-                        }
-                        else if (modulated_x == int(box_size_in_cells)) {
-                            modulated_x = 0;
-                        }
-                        if (modulated_y == -1) {
-                            modulated_y = int(box_size_in_cells) - 1;
-                        }
-                        else if (modulated_y == int(box_size_in_cells)) {
-                            modulated_y = 0;
-                        }
-                        if (modulated_z == -1) {
-                            modulated_z = int(box_size_in_cells) - 1;
-                        }
-                        else if (modulated_z == int(box_size_in_cells)) {
-                            modulated_z = 0;
-                        }
-                        cellindex = uint(modulated_x + box_size_in_cells * (modulated_y + box_size_in_cells * modulated_z)); // Calculate neighbouring cell index
-                        neighbour_particle_index = cell_list[cellindex]; // Get the largest particle index of the particles in this cell
-                        while (neighbour_particle_index > i) { // Loop though all particles in the cell with greater index
-                            // TODO: The modulus can be removed if
-                            ftype sqr_distance = origin_centered_modulus_position_minus(particles[i].pos, particles[neighbour_particle_index].pos).sqr_length();
-                            if(sqr_distance < sqr_outer_cutoff) {
-                                verlet_neighbors_list[verlet_particles_list[i]] += 1;
-                                verlet_neighbors_list.push_back(neighbour_particle_index);
-                                next_particle_list++;
-                            }
-                            neighbour_particle_index = cell_linklist[neighbour_particle_index]; // Get the next particle in the cell
-                        }
-                    } // X
-                } // Y
-            } // Z
-        } // if (cells_used)
-        else {
-            for (neighbour_particle_index = i+1; neighbour_particle_index < num_particles; neighbour_particle_index++) { // Loop though all particles with greater index
-                ftype sqr_distance = origin_centered_modulus_position_minus(particles[i].pos, particles[neighbour_particle_index].pos).sqr_length();
-                if(sqr_distance < sqr_outer_cutoff) {
-                    verlet_neighbors_list[verlet_particles_list[i]] += 1;
-                    verlet_neighbors_list.push_back(neighbour_particle_index);
-                    next_particle_list++;
-                }
+        }
+    }
+    for (uint i = 0; i < num_particles; i++) {
+        cross_block_start[i + 1] += cross_block_start[i];
+    }
+    cross_block_list.resize(size_t(cross_block_start[num_particles]));
+    vector<uint64> cross_block_end(cross_block_start.begin(), cross_block_start.end() - 1);
+    for (uint i1 = 0; i1 < num_particles; i1++) {
+        for (uint64 j = verlet_particles_list[i1] + 1; j < verlet_particles_list[i1] + verlet_neighbors_list[verlet_particles_list[i1]] + 1; j++) {
+            uint i2 = verlet_neighbors_list[j];
+            if (blocks.particle_cell[i2] != blocks.particle_cell[i1]) {
+                cross_block_list[size_t(cross_block_end[i2]++)] = i1;
             }
         }
-        i++; // Continue with the next particle (if there exists any)
-        if (i < num_particles) { // Point to the next particle list
-            verlet_particles_list[i] = next_particle_list;
+    }
+
+    // The pairs a block gets from other blocks are work too
+    force_weights = list_weights;
+    for (uint i = 0; i < num_particles; i++) {
+        force_weights[blocks.particle_cell[i]] += cross_block_start[i + 1] - cross_block_start[i];
+    }
+    block_Ep                .assign(blocks.num_cells(), 0);
+    block_distance_force_sum.assign(blocks.num_cells(), 0);
+}
+
+void mdsystem::build_blocks(const vector<vec3> &positions)
+{
+    /*
+     * About eight blocks per thread, so that there is something left to
+     * steal at the end. With one thread there is one block with all the
+     * particles in order, and the forces are summed exactly as in a loop
+     * over the particles.
+     */
+    uint num_threads     = uint(omp_get_max_threads());
+    uint blocks_per_side = 1;
+    while (num_threads > 1 && blocks_per_side*blocks_per_side*blocks_per_side < 8*num_threads) {
+        blocks_per_side++;
+    }
+    blocks.build(positions, box_size, blocks_per_side, vec3(0, 0, 0));
+    if (list_weights.size() != blocks.num_cells()) {
+        // No list built with these blocks yet, the particles will do
+        list_weights.resize(blocks.num_cells());
+        for (uint b = 0; b < blocks.num_cells(); b++) {
+            list_weights[b] = blocks.cell_start[b + 1] - blocks.cell_start[b];
         }
     }
 }
 
-void mdsystem::create_linked_cells(uint box_size_in_cells, ftype cell_size, vector<uint> &cell_linklist, vector<uint> &cell_list) {//Assuming origo in the corner of the bulk, and positions given according to boundaryconditions i.e. between zero and lenght of the bulk.
-    int cellindex = 0;
-    cell_list.resize(box_size_in_cells*box_size_in_cells*box_size_in_cells);
-    cell_linklist.resize(num_particles);
-    for (uint i = 0; i < cell_list.size() ; i++) {
-        cell_list[i] = 0; // Beware! Particle zero is a member of all cells!
+void mdsystem::verlet_list_task(void *context, uint block, uint /*thread*/)
+{
+    const verlet_list_context &c = *static_cast<verlet_list_context*>(context);
+    const mdsystem &system = *c.system;
+    for (uint k = system.blocks.cell_start[block]; k < system.blocks.cell_start[block + 1]; k++) {
+        uint i = system.blocks.cell_particles[k];
+        if (c.store) {
+            uint *list = &c.system->verlet_neighbors_list[size_t(system.verlet_particles_list[i])];
+            list[0] = system.find_verlet_neighbours(i, c.cells, list + 1);
+        }
+        else {
+            c.system->verlet_particles_list[i] = system.find_verlet_neighbours(i, c.cells, 0);
+        }
     }
-    for (uint i = 0; i < num_particles; i++) {
-        uint help_x = int(particles[i].pos[0] / cell_size);
-        uint help_y = int(particles[i].pos[1] / cell_size);
-        uint help_z = int(particles[i].pos[2] / cell_size);
-        if (help_x == box_size_in_cells || help_y == box_size_in_cells || help_z == box_size_in_cells) { // This actually occationally happens
-            help_x -= help_x == box_size_in_cells;
-            help_y -= help_y == box_size_in_cells;
-            help_z -= help_z == box_size_in_cells;
+}
+
+uint mdsystem::find_verlet_neighbours(uint i, const sparse_cell_grid *cells, uint *neighbours) const
+{
+    uint num_neighbours = 0;
+    uint neighbour_particle_index = 0;
+    if (cells) { //Loop through all occupied neighbour cells
+        uint cell = cells->particle_cell[i];
+        for (uint n = cells->neighbour_start[cell]; n < cells->neighbour_start[cell + 1]; n++) {
+            uint neighbour_cell = cells->neighbour_cells[n];
+            for (uint k = cells->cell_start[neighbour_cell + 1]; k > cells->cell_start[neighbour_cell]; k--) { // Loop though all particles in the cell with greater index, largest first
+                neighbour_particle_index = cells->cell_particles[k - 1];
+                if (neighbour_particle_index <= i) {
+                    break;
+                }
+                ftype sqr_distance = origin_centered_modulus_position_minus(particles[i].pos_when_verlet_list_created, particles[neighbour_particle_index].pos_when_verlet_list_created).sqr_length();
+                if(sqr_distance < sqr_outer_cutoff) {
+                    if (neighbours) {
+                        neighbours[num_neighbours] = neighbour_particle_index;
+                    }
+                    num_neighbours++;
+                }
+            }
+        }
+    } // if (cells)
+    else {
+        for (neighbour_particle_index = i+1; neighbour_particle_index < num_particles; neighbour_particle_index++) { // Loop though all particles with greater index
+            ftype sqr_distance = origin_centered_modulus_position_minus(particles[i].pos_when_verlet_list_created, particles[neighbour_particle_index].pos_when_verlet_list_created).sqr_length();
+            if(sqr_distance < sqr_outer_cutoff) {
+                if (neighbours) {
+                    neighbours[num_neighbours] = neighbour_particle_index;
+                }
+                num_neighbours++;
+            }
         }
-        cellindex = help_x + box_size_in_cells * (help_y + box_size_in_cells * help_z);
-        cell_linklist[i] = cell_list[cellindex];
-        cell_list[cellindex] = i;
     }
+    return num_neighbours;
 }
 
 void mdsystem::reset_non_modulated_relative_particle_positions()
 {
-    for (uint i = 0; i < num_particles; i++) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < int(num_particles); i++) {
         reset_single_non_modulated_relative_particle_positions(i);
     }
 }
@@ -769,6 +1634,7 @@ void mdsystem::enter_next_loop()
     enter_loop_number(loop_num + 1);
 }
 
+template<class thermostat_policy>
 void mdsystem::leapfrog()
 {
     /*
@@ -782,58 +1648,208 @@ void mdsystem::leapfrog()
         update_velocities(dt/2);
     }
     else {
-#if THERMOSTAT == CHING_CHIS_THERMOSTAT
-        if (thermostat_on) { // Accelerate particles because of therometer
-            for (uint i = 0; i < num_particles; i++) {
-                particles[i].vel = particles[i].vel * thermostat_value;
-            }
-        }
-#endif
+        scale_velocities_by_thermostat<thermostat_policy>(); // Accelerate particles because of therometer
         update_velocities(dt);
     }
 
-    // Update positions
-    update_positions(dt);
+    // Update positions, the box is scaled before the forces in the new positions
+    move_particles(dt);
+    scale_box_by_barostat();
+    update_verlet_list_if_necessary();
+
+    /*
+     * Now the particle has updated both the velocity and the position, so it is
+     * time to enter the next loop.
+     */
+    enter_next_loop();
+
+    // Update velocities again if needed
+    if (sampling_in_this_loop) {
+        // Calculate the forces in the new positions and then do the usual routine
+        calculate_forces<thermostat_policy>();
+        // Accelerate particles because of therometer
+        scale_velocities_by_thermostat<thermostat_policy>();
+        // Take a half timestep to let the position "catch up" with the velocity
+        update_velocities(dt/2);
+
+        // Also measure unfiltered properties
+        measure_unfiltered_properties<thermostat_policy>();
+    }
+}
+
+template<class thermostat_policy>
+void mdsystem::baoab()
+{
+    /*
+     * Unlike leapfrog, the velocities are always in phase with the positions
+     * and the accelerations are always calculated for the current positions.
+     */
+
+    // B: Half a kick
+    update_velocities(dt/2);
+    // A: Half a drift
+    move_particles(dt/2);
+    // O: Exact solution of the friction and the random force
+    if (thermostat_on) {
+        apply_langevin_noise(exp(-dt/thermostat_time), desired_temp, loop_num, RS_LANGEVIN);
+    }
+    // A: Half a drift
+    move_particles(dt/2);
+    scale_box_by_barostat();
+    update_verlet_list_if_necessary();
+
+    enter_next_loop();
+
+    // B: Half a kick with the forces in the new positions
+    calculate_forces<thermostat_policy>();
+    update_velocities(dt/2);
+
+    if (sampling_in_this_loop) {
+        measure_unfiltered_properties<thermostat_policy>();
+    }
+}
+
+void mdsystem::apply_langevin_noise(ftype c1, ftype temperature, uint32 step, uint32 stream)
+{
+    /*
+     * v = c1*v + c2*R with R drawn from N(0, 1) for every component. The
+     * numbers are keyed by (atom, step), so the blocks can be handed out to
+     * any number of threads.
+     */
+    const int   block_size = 256;
+    const ftype c2 = sqrt((1 - c1*c1) * (temperature > 0 ? temperature : 0));
+    const int   num_blocks = int((num_particles + block_size - 1) / block_size);
+
+    #pragma omp parallel for schedule(static)
+    for (int block = 0; block < num_blocks; block++) {
+        ftype r[3][block_size];
+        uint first = uint(block) * block_size;
+        int  count = int(num_particles - first < uint(block_size) ? num_particles - first : uint(block_size));
+
+        // Independent lanes in structure of arrays layout; vectorized by the compiler
+        for (int j = 0; j < count; j++) {
+            uint32 words[4];
+            philox4x32(first + j, step, 0, 0, random_seed, stream, words);
+            gaussian_vec3_from_uint32(words[0], words[1], words[2], words[3], r[0][j], r[1][j], r[2][j]);
+        }
+        for (int j = 0; j < count; j++) {
+            vec3 &vel = particles[first + j].vel;
+            vel[0] = c1*vel[0] + c2*r[0][j];
+            vel[1] = c1*vel[1] + c2*r[1][j];
+            vel[2] = c1*vel[2] + c2*r[2][j];
+        }
+    }
+}
+
+template<class thermostat_policy>
+void mdsystem::scale_velocities_by_thermostat()
+{
+    // Resolved at compile time; only the multiplicative thermostats do anything here
+    if (thermostat_policy::scales_velocities && thermostat_on) {
+        for (uint i = 0; i < num_particles; i++) {
+            particles[i].vel = particles[i].vel * thermostat_value;
+        }
+    }
+}
 
+template<class thermostat_policy>
+void mdsystem::calculate_forces()
+{
     /*
-     * Now the particle has updated both the velocity and the position, so it is
-     * time to enter the next loop.
+     * The particles of every block are a task, weighted by its pairs in the
+     * last force calculation. A task only writes the accelerations of its
+     * own particles, so a pair with the particles in two blocks is
+     * calculated by both. The result does not depend on which thread ran a
+     * block, and potential energy and virial are summed in block order.
+     * Small systems go through all pairs instead.
      */
-    enter_next_loop();
+    if (all_pairs_forces::is_faster(num_particles)) {
+        calculate_all_pairs_forces<thermostat_policy>();
+        return;
+    }
+    scheduler.run(force_weights, callback<void (*)(void*, uint, uint)>(force_task, this));
+    ftype Ep_sum = 0;
+    ftype distance_force_sum_sum = 0;
+    for (uint block = 0; block < blocks.num_cells(); block++) {
+        Ep_sum                 += block_Ep[block];
+        distance_force_sum_sum += block_distance_force_sum[block];
+    }
+    store_force_properties<thermostat_policy>(Ep_sum, distance_force_sum_sum);
+}
 
-    // Update velocities again if needed
+template<class thermostat_policy>
+void mdsystem::calculate_all_pairs_forces()
+{
+    const bool measure_properties = sampling_in_this_loop || measure_every_loop;
+    ftype Ep_sum = 0;
+    ftype distance_force_sum_sum = 0;
+    all_pairs.calculate(particles, box_size, sqr_inner_cutoff, E_cutoff, measure_properties, Ep_sum, distance_force_sum_sum);
+    if (!Ep_on      ) Ep_sum = 0;
+    if (!pressure_on) distance_force_sum_sum = 0;
+    store_force_properties<thermostat_policy>(Ep_sum, distance_force_sum_sum);
+}
+
+template<class thermostat_policy>
+void mdsystem::store_force_properties(ftype Ep_sum, ftype distance_force_sum_sum)
+{
+    current_Ep                 = Ep_sum;
+    current_distance_force_sum = distance_force_sum_sum;
     if (sampling_in_this_loop) {
-        // Calculate the forces in the new positions and then do the usual routine
-        calculate_forces();
-#if THERMOSTAT == CHING_CHIS_THERMOSTAT
-        // Accelerate particles because of therometer
-        if (thermostat_on) {
-            for (uint i = 0; i < num_particles; i++) {
-                particles[i].vel = particles[i].vel * thermostat_value;
-            }
-        }
-#endif
-        // Take a half timestep to let the position "catch up" with the velocity
-        update_velocities(dt/2);
+        instEp[current_sample_index] = Ep_sum;
+        distance_force_sum[current_sample_index] = distance_force_sum_sum;
+    }
+    //TODO: Move this from here, since it's filtered anyway (Right?)
+    if (sampling_in_this_loop && Ep_on) {
+        instEc[current_sample_index] = -instEp[current_sample_index]/num_particles;
+    }
 
-        // Also measure unfiltered properties
-        measure_unfiltered_properties();
+    // Add acceleration caused by the thermostat
+    if (thermostat_policy::adds_friction && thermostat_on) {
+        for (uint i = 0; i < num_particles; i++) {
+            particles[i].acc -= thermostat_value * particles[i].vel;
+        }
     }
 }
 
-void mdsystem::calculate_forces()
+void mdsystem::force_task(void *system, uint block, uint /*thread*/)
 {
-    // Reset accelrations for all particles
-    for (uint k = 0; k < num_particles; k++) {
-        particles[k].acc = vec3(0, 0, 0);
-    }
-    if (sampling_in_this_loop) {
-        instEp[current_sample_index] = 0;
-        distance_force_sum[current_sample_index] = 0;
-    }
+    static_cast<mdsystem*>(system)->calculate_block_forces(block);
+}
+
+void mdsystem::calculate_block_forces(uint block)
+{
+    const bool measure_properties = sampling_in_this_loop || measure_every_loop;
+    ftype  Ep_sum = 0;
+    ftype  distance_force_sum_sum = 0;
+    uint64 num_pairs = 0;
+
+    for (uint k = blocks.cell_start[block]; k < blocks.cell_start[block + 1]; k++) {
+        particles[blocks.cell_particles[k]].acc = vec3(0, 0, 0);
+    }
+    for (uint k = blocks.cell_start[block]; k < blocks.cell_start[block + 1]; k++) { // Loop through all particles of the block
+        uint i1 = blocks.cell_particles[k];
+
+        // The pairs in the lists of other blocks, only for the force on this particle
+        num_pairs += cross_block_start[i1 + 1] - cross_block_start[i1];
+        for (uint64 c = cross_block_start[i1]; c < cross_block_start[i1 + 1]; c++) {
+            uint i0 = cross_block_list[size_t(c)];
+            vec3 r = origin_centered_modulus_position_minus(particles[i0].pos, particles[i1].pos);
+            ftype sqr_distance = r.sqr_length();
+            if (sqr_distance >= sqr_inner_cutoff) {
+                continue;
+            }
+            ftype sqr_distance_inv = 1/sqr_distance;
+            ftype distance_inv = sqrt(sqr_distance_inv);
+            num_pairs++;
+            ftype p = sqr_distance_inv;
+            p = p*p*p;
+            ftype acceleration = 48  * distance_inv * p * (p - ftype(0.5));
+            vec3 r_hat = r * distance_inv;
+            particles[i1].acc -= acceleration * r_hat;
+        }
 
-    for (uint i1 = 0; i1 < num_particles ; i1++) { // Loop through all particles
-        for (uint j = verlet_particles_list[i1] + 1; j < verlet_particles_list[i1] + verlet_neighbors_list[verlet_particles_list[i1]] + 1 ; j++) {
+        num_pairs += verlet_neighbors_list[verlet_particles_list[i1]];
+        for (uint64 j = verlet_particles_list[i1] + 1; j < verlet_particles_list[i1] + verlet_neighbors_list[verlet_particles_list[i1]] + 1 ; j++) {
             // TODO: automatically detect if a boundary is crossed and compensate for that in this function
             // Calculate the closest distance to the second (possibly) interacting particle
             uint i2 = verlet_neighbors_list[j];
@@ -844,40 +1860,34 @@ void mdsystem::calculate_forces()
             }
             ftype sqr_distance_inv = 1/sqr_distance;
             ftype distance_inv = sqrt(sqr_distance_inv);
+            num_pairs++; // Twice the work of a pair that is skipped
 
             //Calculating acceleration
             ftype p = sqr_distance_inv;
             p = p*p*p;
             ftype acceleration = 48  * distance_inv * p * (p - ftype(0.5));
 
-            // Update accelerations of interacting particles
+            // Update accelerations, the block of the second particle does it if it is another one
             vec3 r_hat = r * distance_inv;
-            particles[i1].acc +=  acceleration * r_hat;
-            particles[i2].acc -=  acceleration * r_hat;
+            particles[i1].acc += acceleration * r_hat;
+            if (blocks.particle_cell[i2] == block) {
+                particles[i2].acc -= acceleration * r_hat;
+            }
 
             // Update properties
             //TODO: Remove these two from force calculation and place them somewhere else
-            if (sampling_in_this_loop) {
-                if (Ep_on      ) instEp[current_sample_index] += 4 * p * (p - 1) - E_cutoff;
-                if (pressure_on) distance_force_sum[current_sample_index] += acceleration / distance_inv;
+            if (measure_properties) {
+                if (Ep_on      ) Ep_sum += 4 * p * (p - 1) - E_cutoff;
+                if (pressure_on) distance_force_sum_sum += acceleration / distance_inv;
             }
         }
     }
-    //TODO: Move this from here, since it's filtered anyway (Right?)
-    if (sampling_in_this_loop && Ep_on) {
-        instEc[current_sample_index] = -instEp[current_sample_index]/num_particles;
-    }
-
-#if THERMOSTAT == LASSES_THERMOSTAT
-    // Add acceleration caused by the thermostat
-    if (thermostat_on) {
-        for (uint i = 0; i < num_particles; i++) {
-            particles[i].acc -= thermostat_value * particles[i].vel;
-        }
-    }
-#endif
+    block_Ep                [block] = Ep_sum;
+    block_distance_force_sum[block] = distance_force_sum_sum;
+    force_weights[block] = num_pairs;
 }
 
+template<class thermostat_policy>
 void mdsystem::measure_unfiltered_properties() {
     /*
      * This functions assumes that fource_calculation() has just been called for
@@ -896,30 +1906,24 @@ void mdsystem::measure_unfiltered_properties() {
     insttemp[current_sample_index] =  sum_sqr_vel / (3 * num_particles);
     if (Ek_on) instEk[current_sample_index] = 0.5f * sum_sqr_vel;
 
-    calculate_thermostate_value();
+    calculate_thermostate_value<thermostat_policy>();
 
     if (msd_on   ) calculate_mean_square_displacement();
     if (diff_c_on) calculate_diffusion_coefficient   ();
+
+    instvolume[current_sample_index] = box_size*box_size*box_size;
+    if (barostat_on) apply_barostat();
+    if (filter_streamed()) stream_sample(current_sample_index);
 }
 
+template<class thermostat_policy>
 void mdsystem::calculate_thermostate_value()
 {
-#if THERMOSTAT == LASSES_THERMOSTAT // Additive
-    const ftype thermostat_value_when_extreme_cooling = 1/dt;
-    const ftype thermostat_value_when_inactive = 0;
-#elif THERMOSTAT == CHING_CHIS_THERMOSTAT // Multiplicative
-    const ftype thermostat_value_when_extreme_cooling = 0;
-    const ftype thermostat_value_when_inactive = 1;
-#endif
+    const ftype thermostat_value_when_extreme_cooling = thermostat_policy::value_when_extreme_cooling(dt);
+    const ftype thermostat_value_when_inactive        = thermostat_policy::value_when_inactive();
 
-    if (thermostat_on && insttemp[current_sample_index] > 0) {
-#if THERMOSTAT == LASSES_THERMOSTAT
-        thermostat_value = (1 - desired_temp/insttemp[current_sample_index]) / (2*thermostat_time);
-        thermostat_value = thermostat_value < 1/dt ? thermostat_value : 1/dt;
-#elif THERMOSTAT == CHING_CHIS_THERMOSTAT
-        ftype arg = 1 +  dt / thermostat_time * (desired_temp / insttemp[current_sample_index] - 1);
-        thermostat_value = arg > 0                 ? sqrt(arg)        : 0   ;
-#endif
+    if (thermostat_policy::enabled && thermostat_on && insttemp[current_sample_index] > 0) {
+        thermostat_value = thermostat_policy::calculate_value(insttemp[current_sample_index], desired_temp, thermostat_time, dt);
         if (thermostat_value != thermostat_value_when_extreme_cooling) {
             if (current_sample_index != 0 && thermostat_values[current_sample_index-1] == thermostat_value_when_extreme_cooling) {
                 output << "Thermostat can relax a bit. " << 100*loop_num/num_time_steps << " % done." << endl;
@@ -931,7 +1935,7 @@ void mdsystem::calculate_thermostate_value()
     }
     else {
         thermostat_value = thermostat_value_when_inactive;
-        if (thermostat_on) {
+        if (thermostat_policy::enabled && thermostat_on) {
             if (current_sample_index == 0) {
                 output << "Thermostat does not function at 0 K" << endl;
             }
@@ -945,24 +1949,109 @@ void mdsystem::calculate_thermostate_value()
     thermostat_values[current_sample_index] = thermostat_value;
 }
 
+void mdsystem::apply_barostat()
+{
+    /*
+     * Berendsen barostat (Berendsen et. al, 1984); the box and all positions
+     * are scaled towards the desired pressure once every sampling period.
+     * The forces of the current positions have already been used for the
+     * measurements and are used for the next kick, so the scaling waits
+     * until after the next drift, before the forces are calculated again.
+     */
+    ftype V = instvolume[current_sample_index];
+    ftype P = num_particles*insttemp[current_sample_index]/V + distance_force_sum[current_sample_index]/(3*V);
+    ftype arg = 1 - compressibility * sampling_period * dt / barostat_time * (desired_pressure - P);
+    ftype factor = pow(arg > 0 ? arg : 0, ftype(1.0/3.0));
+
+    // Limit the scaling, a badly chosen compressibility should not blow the system apart
+    const ftype max_relative_change = ftype(0.01);
+    factor = factor < 1 - max_relative_change ? 1 - max_relative_change : factor;
+    factor = factor > 1 + max_relative_change ? 1 + max_relative_change : factor;
+
+    barostat_factor = factor;
+}
+
+void mdsystem::scale_box_by_barostat()
+{
+    if (barostat_factor != 1) {
+        scale_box(barostat_factor);
+        barostat_factor = 1;
+    }
+}
+
+void mdsystem::scale_box(ftype factor)
+{
+    box_size *= factor;
+    pos_half_box_size = 0.5f * box_size;
+    neg_half_box_size = -pos_half_box_size;
+
+    /*
+     * Scale all reference positions as well. Thereby only the thermal motion
+     * is counted as displacement, both in the Verlet list criterion and in
+     * the mean square displacement.
+     */
+    for (uint i = 0; i < num_particles; i++) {
+        particles[i].pos                                                *= factor;
+        particles[i].pos_when_verlet_list_created                       *= factor;
+        particles[i].pos_when_non_modulated_relative_pos_was_calculated *= factor;
+        modulus_position(particles[i].pos); // Rounding may put a particle on the far edge
+    }
+    verlet_list_box_scale *= factor;
+}
+
+template<class filter_policy>
 void mdsystem::calculate_filtered_properties()
 {
-    filter(insttemp, temperature, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-    if (Cv_on) calculate_specific_heat();            
+    // All the properties are filtered together, each in its own SIMD lane, unless they already have been
+    if (filter_streamed()) {
+        finish_streaming_filter();
+    }
+    else {
+        filter_channel channels[7];
+        uint num_channels = list_filter_channels(channels);
+        filter_channels<filter_policy>(channels, num_channels);
+    }
+
+    if (Cv_on) calculate_specific_heat<filter_policy>(Cv_impulse_response_decay_time());
     if (pressure_on) calculate_pressure();
+}
+
+uint mdsystem::list_filter_channels(filter_channel *channels)
+{
+    uint num_channels = 0;
+    channels[num_channels++] = filter_channel(insttemp, temperature, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+    if (Cv_on) {
+        channels[num_channels++] = filter_channel(insttemp, Cv_filtered_temp, Cv_impulse_response_decay_time(), 1, false);
+    }
+    if (pressure_on) {
+        channels[num_channels++] = filter_channel(distance_force_sum, filtered_distance_force_sum, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        if (barostat_on) {
+            // The volume varies, filter it the same way
+            channels[num_channels++] = filter_channel(instvolume, volume, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        }
+    }
     if (Ep_on) {
-        filter(instEp, Ep             , default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-        filter(instEc, cohesive_energy, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        channels[num_channels++] = filter_channel(instEp, Ep             , default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+        channels[num_channels++] = filter_channel(instEc, cohesive_energy, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+    }
+    if (Ek_on) {
+        channels[num_channels++] = filter_channel(instEk, Ek, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
     }
-    if (Ek_on) filter(instEk, Ek, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
+    return num_channels;
+}
+
+ftype mdsystem::Cv_impulse_response_decay_time() const
+{
+    // The temperature filtering used for the local variance when calculating Cv
+    return ftype(2000)*P_RU_FS;
 }
 
-void mdsystem::calculate_specific_heat() {
-    ftype impulse_response_decay_time = ftype(2000)*P_RU_FS;
+template<class filter_policy>
+void mdsystem::calculate_specific_heat(ftype impulse_response_decay_time) {
     ftype num_times_filtering = 1;
+#if 0
     bool  slope_compensate = false;
     vector<ftype> filtered_temp;
-#if 0
     vector<ftype> unfiltered_temp2(insttemp.size());
     vector<ftype> filtered_temp2;
 
@@ -970,8 +2059,8 @@ void mdsystem::calculate_specific_heat() {
     for (uint i = 0; i < insttemp.size(); i++){
         unfiltered_temp2[i] = insttemp[i]*insttemp[i];
     }
-    filter(insttemp        , filtered_temp , impulse_response_decay_time, num_times_filtering);
-    filter(unfiltered_temp2, filtered_temp2, impulse_response_decay_time, num_times_filtering);
+    filter<filter_policy>(insttemp        , filtered_temp , impulse_response_decay_time, num_times_filtering, slope_compensate);
+    filter<filter_policy>(unfiltered_temp2, filtered_temp2, impulse_response_decay_time, num_times_filtering, slope_compensate);
 
     // Calculate Cv
     Cv.resize(filtered_temp.size());
@@ -979,16 +2068,21 @@ void mdsystem::calculate_specific_heat() {
         Cv[i] = ftype(1.0)/(ftype(2.0/3.0) - num_particles*(filtered_temp2[i]/(filtered_temp[i]*filtered_temp[i]) - 1));
     }
 #else
-    vector<ftype> unfiltered_var(insttemp.size());
-    vector<ftype> filtered_var;
-
-    // Calculate local variance of insttemp
-    filter(insttemp, filtered_temp, impulse_response_decay_time, num_times_filtering, slope_compensate);
-    for (uint i = 0; i < insttemp.size(); i++){
-        //unfiltered_var[i] = insttemp[i]*insttemp[i] - filtered_temp[i]*filtered_temp[i];
-        unfiltered_var[i] = (insttemp[i] - filtered_temp[i])*(insttemp[i] - filtered_temp[i]);
+    // Calculate local variance of insttemp (already filtered into Cv_filtered_temp)
+    time_series &filtered_temp  = Cv_filtered_temp;
+    time_series &unfiltered_var = Cv_unfiltered_var;
+    time_series &filtered_var   = Cv_filtered_var;
+    if (!filter_streamed()) { // Else already filtered while the run went
+        unfiltered_var.resize(insttemp.size());
+        for (uint i = 0; i < insttemp.size(); i++){
+            // The filtered temperature is shorter if the filter averages ensembles
+            uint j = uint(uint64(i)*filtered_temp.size()/insttemp.size());
+            //unfiltered_var[i] = insttemp[i]*insttemp[i] - filtered_temp[j]*filtered_temp[j];
+            unfiltered_var[i] = (insttemp[i] - filtered_temp[j])*(insttemp[i] - filtered_temp[j]);
+        }
+        filter_channel channel(unfiltered_var, filtered_var, impulse_response_decay_time, uint(num_times_filtering), false);
+        filter_channels<filter_policy>(&channel, 1);
     }
-    filter(unfiltered_var, filtered_var, impulse_response_decay_time, num_times_filtering, false);
 
     // Calculate Cv
     Cv.resize(filtered_temp.size());
@@ -1000,11 +2094,9 @@ void mdsystem::calculate_specific_heat() {
 
 void mdsystem::calculate_pressure() {
     ftype V = box_size*box_size*box_size;
-    vector<ftype> filtered_distance_force_sum;
-    filter(distance_force_sum, filtered_distance_force_sum, default_impulse_response_decay_time, default_num_times_filtering, slope_compensate_by_default);
-
     pressure.resize(filtered_distance_force_sum.size());
     for (uint i = 0; i < pressure.size(); i++) {
+        if (barostat_on) V = volume[i];
         pressure[i] = num_particles*temperature[i]/V + filtered_distance_force_sum[i]/(3*V);
     }
 }
@@ -1046,100 +2138,590 @@ void mdsystem::calculate_diffusion_coefficient()
     }
 }
 
+template<class filter_policy>
 void mdsystem::filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype impulse_response_decay_time, uint num_times, bool slope_compensate)
 {
-#if FILTER == KRISTOFERS_FILTER
-    if (num_times < 0) {
-        throw invalid_argument("Negative number of times filtering");
+    filter_policy::filter(unfiltered, filtered, dt*sampling_period, impulse_response_decay_time, num_times, slope_compensate, ensemble_size);
+}
+
+template<class filter_policy>
+void mdsystem::filter_channels(const filter_channel *channels, uint num_channels)
+{
+    filter_policy::filter_channels(channels, num_channels, dt*sampling_period, ensemble_size, filter_scratch);
+}
+
+bool mdsystem::filter_streamed() const
+{
+    return filter_type == TWO_SIDED_EXPONENTIAL_DECAY_FILTER && num_sampling_points >= STREAMING_FILTER_MIN_SAMPLES;
+}
+
+void mdsystem::start_streaming_filter(uint num_samples_taken)
+{
+    /*
+     * The channels are the same as when filtering after the run, so the
+     * results match that to float tolerance. A run that is restored or
+     * extended filters its stored samples again first, which gives exactly
+     * the same streams as if it had never stopped.
+     */
+    filter_channel channels[7];
+    uint num_channels = list_filter_channels(channels);
+    filter_streams.clear();
+    for (uint c = 0; c < num_channels; c++) {
+        filter_streams.push_back(two_sided_exponential_decay_filter_stream(dt*sampling_period, channels[c].impulse_response_decay_time, channels[c].num_times, channels[c].slope_compensate));
+        channels[c].filtered->resize(num_sampling_points);
+    }
+    if (Cv_on) {
+        filter_streams.push_back(two_sided_exponential_decay_filter_stream(dt*sampling_period, Cv_impulse_response_decay_time(), 1, false));
+        Cv_unfiltered_var.resize(num_sampling_points);
+        Cv_filtered_var  .resize(num_sampling_points);
+    }
+    num_streamed.assign(filter_streams.size(), 0);
+    for (uint i = 0; i < num_samples_taken; i++) {
+        stream_sample(i);
+    }
+}
+
+void mdsystem::stream_sample(uint index)
+{
+    filter_channel channels[7];
+    uint num_channels = list_filter_channels(channels);
+    for (uint c = 0; c < num_channels; c++) {
+        streamed_values.clear();
+        filter_streams[c].push((*channels[c].unfiltered)[index], streamed_values);
+        write_streamed(c, *channels[c].filtered);
     }
+}
 
-    uint vector_size = unfiltered.size();
-    filtered.resize(vector_size);
+void mdsystem::write_streamed(uint stream, time_series &filtered)
+{
+    for (uint k = 0; k < streamed_values.size(); k++) {
+        uint i = num_streamed[stream]++;
+        filtered[i] = streamed_values[k];
+        if (&filtered == &Cv_filtered_temp) {
+            // The local variance of the temperature can be filtered as soon as the temperature is
+            Cv_unfiltered_var[i] = (insttemp[i] - filtered[i])*(insttemp[i] - filtered[i]);
+            streamed_var.clear();
+            filter_streams.back().push(Cv_unfiltered_var[i], streamed_var);
+            for (uint v = 0; v < streamed_var.size(); v++) {
+                Cv_filtered_var[num_streamed.back()++] = streamed_var[v];
+            }
+        }
+    }
+}
 
-    if (num_times == 0) {
-        for (uint i = 0; i < vector_size; i++) {
-            filtered[i] = unfiltered[i];
+void mdsystem::finish_streaming_filter()
+{
+    filter_channel channels[7];
+    uint num_channels = list_filter_channels(channels);
+    for (uint c = 0; c < num_channels; c++) {
+        streamed_values.clear();
+        filter_streams[c].finish(streamed_values);
+        write_streamed(c, *channels[c].filtered);
+    }
+    if (Cv_on) {
+        // Last, when all of the temperature has been filtered
+        streamed_var.clear();
+        filter_streams.back().finish(streamed_var);
+        for (uint v = 0; v < streamed_var.size(); v++) {
+            Cv_filtered_var[num_streamed.back()++] = streamed_var[v];
         }
-        return;
     }
+}
 
-    ftype f = exp(-dt*sampling_period/impulse_response_decay_time);
-    ftype k = 1 - f;
-    ftype x, y, w;
-    vector<ftype> total_weight(vector_size);
-    const vector<ftype> *source;
-    vector<ftype> *destination;
-    vector<ftype> temp_vec(num_times > 1 ? vector_size : 0);
-    vector<ftype> filtered_index(vector_size);
-
-    source = &unfiltered;
-    for (; num_times > 0; num_times--) {
-        destination = (num_times & 1) ? &filtered : &temp_vec;
-        // Left side exponential decay
-        x = y = w = 0;
-        for (int i = 0; i < int(vector_size); i++) {
-            x *= f;
-            y *= f;
-            w *= f;
-            x += k*i           ;
-            y += k*(*source)[i];
-            w += k             ;
-            filtered_index[i] = x;
-            (*destination)[i] = y;
-            total_weight  [i] = w;
-        }
-
-        // Right side exponential decay
-        x = y = w = 0;
-        for (int i = int(vector_size) - 1; i >= 0; i--) {
-            x *= f;
-            y *= f;
-            w *= f;
-            filtered_index[i] += x;
-            (*destination)[i] += y;
-            total_weight  [i] += w;
-            x += k*i           ;
-            y += k*(*source)[i];
-            w += k             ;
-
-            // Compensate for weights at the same time
-            (*destination)[i] /= total_weight[i];
-            filtered_index[i] /= total_weight[i];
-        }
-
-        if (slope_compensate) {
-            vector<ftype> dy_dx(vector_size);
-            dy_dx[0] = (4*((*destination)[1]-(*destination)[0])+(*destination)[0]-(*destination)[2])/
-                       (4*(filtered_index[1]-filtered_index[0])+filtered_index[0]-filtered_index[2]);
-            for (int i = 1; i < int(vector_size) - 1; i++) {
-                dy_dx[i] = ((*destination)[i+1]-(*destination)[i-1])/
-                        (filtered_index[i+1]-filtered_index[i-1]);
+/*
+ * The results file (Results.mdr) holds the results in SI units, column by
+ * column, in the byte order of the machine that wrote it:
+ *   "MDRESULT", the format version (uint32) and the size of a value (uint32)
+ *   the number of metadata entries (uint32), then the key and value of each
+ *   the number of columns (uint32), then the name, the unit and the number
+ *   of values (uint64) of each
+ *   the values of all columns, one column after the other
+ * Strings are stored as their length (uint32) followed by the characters.
+ */
+void mdsystem::write_results(ftype Ep_shift)
+{
+    const uint32 format_version = 1;
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+
+    vector<string> metadata;
+    add_metadata(metadata, "num_particles"                  , num_particles);
+    add_metadata(metadata, "num_time_steps"                 , num_time_steps);
+    add_metadata(metadata, "dt [s]"                         , dt*time_unit);
+    add_metadata(metadata, "sampling_period"                , sampling_period);
+    add_metadata(metadata, "ensemble_size"                  , ensemble_size);
+    add_metadata(metadata, "box_size [m]"                   , box_size*sigma_in_m);
+    add_metadata(metadata, "sigma [m]"                      , sigma_in_m);
+    add_metadata(metadata, "epsilon [J]"                    , epsilon_in_j);
+    add_metadata(metadata, "particle_mass [kg]"             , particle_mass_in_kg);
+    add_metadata(metadata, "thermostat_type"                , thermostat_type);
+    add_metadata(metadata, "filter_type"                    , filter_type);
+    add_metadata(metadata, "impulse_response_decay_time [s]", default_impulse_response_decay_time*time_unit);
+    add_metadata(metadata, "random_seed"                    , random_seed);
+
+    uint file = open_output_file("Results.mdr");
+    writer.write(file, "MDRESULT", 8);
+    writer.write_uint32(file, format_version);
+    writer.write_uint32(file, uint32(sizeof(ftype)));
+    writer.write_uint32(file, uint32(metadata.size()/2));
+    for (uint i = 0; i < metadata.size(); i++) {
+        writer.write_string(file, metadata[i]);
+    }
+    uint32 num_columns = 0;
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        num_columns += column != RC_VOLUME || barostat_on;
+    }
+    writer.write_uint32(file, num_columns);
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (column == RC_VOLUME && !barostat_on) continue;
+        writer.write_string(file, result_columns[column].name);
+        writer.write_string(file, result_columns[column].unit);
+        writer.write_uint64(file, result_length(column));
+    }
+    vector<ftype> block;
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (column == RC_VOLUME && !barostat_on) continue;
+        uint num_values = result_length(column);
+        for (uint first = 0; first < num_values; first += RESULT_BLOCK_SIZE) {
+            uint last = first + RESULT_BLOCK_SIZE < num_values ? first + RESULT_BLOCK_SIZE : num_values;
+            block.clear();
+            for (uint i = first; i < last; i++) {
+                block.push_back(result_value(column, i, Ep_shift));
             }
-            dy_dx[vector_size-1] = (4*((*destination)[vector_size-1]-(*destination)[vector_size-2])-(*destination)[vector_size-1]+(*destination)[vector_size-3])/
-                                   (4*(filtered_index[vector_size-1]-filtered_index[vector_size-2])-filtered_index[vector_size-1]+filtered_index[vector_size-3]);
-            for (int i = 0; i < int(vector_size); i++) {
-                (*destination)[i] += (i-filtered_index[i])*dy_dx[i];
+            writer.write(file, &block[0], block.size()*sizeof(ftype));
+        }
+    }
+    writer.close(file);
+}
+
+void mdsystem::write_text_results(ftype Ep_shift)
+{
+    // The same values as in the results file, one file per column
+    vector<ftype> block;
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (column == RC_VOLUME && !barostat_on) continue;
+        uint file = open_output_file(result_columns[column].text_file);
+        uint num_values = result_length(column);
+        for (uint first = 0; first < num_values; first += RESULT_BLOCK_SIZE) {
+            uint last = first + RESULT_BLOCK_SIZE < num_values ? first + RESULT_BLOCK_SIZE : num_values;
+            block.clear();
+            for (uint i = first; i < last; i++) {
+                block.push_back(result_value(column, i, Ep_shift));
             }
+            write_text_values(file, block);
         }
+        writer.close(file);
+    }
+}
+
+void mdsystem::write_text_values(uint file, const vector<ftype> &values)
+{
+    stringstream text;
+    text << setprecision(9);
+    for (uint i = 0; i < values.size(); i++) {
+        text << values[i] << '\n';
+    }
+    string characters = text.str();
+    writer.write(file, characters.data(), characters.size());
+}
+
+uint mdsystem::result_length(uint column) const
+{
+    switch (column) {
+    case RC_TOTAL_ENERGY          : return Ek.size();
+    case RC_KINETIC_ENERGY        : return Ek.size();
+    case RC_POTENTIAL_ENERGY      : return Ep.size();
+    case RC_COHESIVE_ENERGY       : return cohesive_energy.size();
+    case RC_TEMPERATURE           : return temperature.size();
+    case RC_PRESSURE              : return pressure.size();
+    case RC_VOLUME                : return volume.size();
+    case RC_THERMOSTAT            : return thermostat_values.size();
+    case RC_MSD                   : return msd.size();
+    case RC_CV                    : return Cv.size();
+    case RC_DIFFUSION_COEFFICIENT : return diffusion_coefficient.size();
+    }
+    return 0;
+}
+
+ftype mdsystem::result_value(uint column, uint i, ftype Ep_shift) const
+{
+    switch (column) {
+    // Lengths * sigma_in_m/P_ANGSTROM [Angstrom]
+    // Energies * epsilon_in_j/P_EV [eV]
+    case RC_TOTAL_ENERGY          : return (Ek[i] + (Ep[i] + Ep_shift))*epsilon_in_j/P_SI_EV;
+    case RC_KINETIC_ENERGY        : return Ek[i]*epsilon_in_j/P_SI_EV;
+    case RC_POTENTIAL_ENERGY      : return (Ep[i] + Ep_shift)*epsilon_in_j/P_SI_EV;
+    case RC_COHESIVE_ENERGY       : return cohesive_energy[i]*epsilon_in_j/P_SI_EV;
+    // Masses * particle_mass_in_kg [kg]
+    // Times * sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j) [s]
+    // Temperatures * epsilon_in_j/P_KB [K]
+    case RC_TEMPERATURE           : return temperature[i] *epsilon_in_j/P_SI_KB;
+    // Pressures * epsilon_in_j / (sigma_in_m * sigma_in_m * sigma_in_m) [Pa]
+    case RC_PRESSURE              : return pressure[i]*epsilon_in_j/(sigma_in_m*sigma_in_m*sigma_in_m);
+    // Volumes * sigma_in_m * sigma_in_m * sigma_in_m [m^3]
+    case RC_VOLUME                : return volume[i]*sigma_in_m*sigma_in_m*sigma_in_m;
+    // Unitless * 1
+    case RC_THERMOSTAT            : return thermostat_values[i];
+    // Others
+    case RC_MSD                   : return msd[i]*sigma_in_m*sigma_in_m;
+    case RC_CV                    : return Cv[i]*P_SI_KB/(1000 * particle_mass_in_kg); // [J/(g*K)]
+    case RC_DIFFUSION_COEFFICIENT : return diffusion_coefficient[i]*sigma_in_m*sigma_in_m/sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    }
+    return 0;
+}
+
+string mdsystem::output_path(const char *file_name) const
+{
+    return output_directory.empty() ? string(file_name) : output_directory + "/" + file_name;
+}
+
+void mdsystem::open_trajectory(const char *file_name)
+{
+    string path = output_path(file_name);
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    trajectory.open(writer, path, num_particles, trajectory_frame_period, TRAJECTORY_DEFAULT_KEYFRAME_PERIOD, trajectory_precision, sigma_in_m, dt*time_unit);
+}
 
-        source = destination;
+uint mdsystem::open_output_file(const char *file_name)
+{
+    return writer.open(output_path(file_name));
+}
+
+void mdsystem::report_output_errors()
+{
+    string errors;
+    if (writer.take_errors(errors)) {
+        output << errors;
     }
-#elif FILTER == EMILS_FILTER
-    filtered.resize(unfiltered.size()/ensemble_size);
-    for(uint i = 0; i < filtered.size(); i++){
-        ftype sum = 0;
-        for(uint j = 0; j < ensemble_size; j++){
-            sum += unfiltered[i*ensemble_size+j];
+}
+
+/*
+ * Everything that changes during a run or is needed to continue it. The
+ * output settings are left out, they belong to the program that runs the
+ * simulation. The Verlet list is rebuilt from the positions when it was
+ * created, unless the box has been scaled since then; the list could then
+ * come out differently and is stored instead.
+ */
+template<class archive>
+void mdsystem::transfer_state(archive &state)
+{
+    // Conversion units
+    state.value(particle_mass_in_kg);
+    state.value(epsilon_in_j);
+    state.value(sigma_in_m);
+    // The time
+    state.value(dt);
+    state.value(loop_num);
+    state.value(num_time_steps);
+    // The particles
+    state.value(num_particles);
+    state.value(lattice_type);
+    state.values(particles);
+    state.value(init_temp);
+    state.value(lattice_constant);
+    state.value(box_size_in_lattice_constants);
+    // The box
+    state.value(box_size);
+    state.value(pos_half_box_size);
+    state.value(neg_half_box_size);
+    // Lennard Jones potential
+    state.value(dEp_tolerance);
+    state.value(equilibrium_reached);
+    state.value(sample_index_when_equilibrium_reached);
+    state.value(outer_cutoff);
+    state.value(inner_cutoff);
+    state.value(E_cutoff);
+    // Verlet list
+    state.value(verlet_list_box_scale);
+    state.value(sqr_inner_cutoff);
+    state.value(sqr_outer_cutoff);
+    bool verlet_list_stored = verlet_list_box_scale != 1;
+    state.value(verlet_list_stored);
+    if (verlet_list_stored) {
+        state.values(verlet_particles_list);
+        state.values(verlet_neighbors_list);
+        if (archive::loading) {
+            restore_force_tasks();
         }
-        filtered[i] = sum / ensemble_size;
     }
-#endif
+    else if (archive::loading) {
+        build_verlet_list();
+    }
+    // Graphs & measurements, the samples after the current one are not taken yet
+    state.value(ensemble_size);
+    state.value(sampling_period);
+    state.value(num_sampling_points);
+    state.value(measure_every_loop);
+    state.value(current_Ep);
+    state.value(current_distance_force_sum);
+    uint num_samples_taken = loop_num/sampling_period + 1 < num_sampling_points ? loop_num/sampling_period + 1 : num_sampling_points;
+    state.series(insttemp             , num_samples_taken);
+    state.series(instEk               , num_samples_taken);
+    state.series(instEp               , num_samples_taken);
+    state.series(instEc               , num_samples_taken);
+    state.series(thermostat_values    , num_samples_taken);
+    state.series(msd                  , num_samples_taken);
+    state.series(diffusion_coefficient, num_samples_taken);
+    state.series(distance_force_sum   , num_samples_taken);
+    state.series(instvolume           , num_samples_taken);
+    // Filtering
+    state.value(filter_type);
+    state.value(default_impulse_response_decay_time);
+    state.value(default_num_times_filtering);
+    state.value(slope_compensate_by_default);
+    // Control (the random numbers are keyed by the seed and the timestep, so the seed is their whole state)
+    state.value(thermostat_type);
+    state.value(thermostat_value);
+    state.value(desired_temp);
+    state.value(thermostat_time);
+    state.value(desired_pressure);
+    state.value(barostat_time);
+    state.value(compressibility);
+    state.value(barostat_factor);
+    state.value(random_seed);
+    // Flags
+    state.value(thermostat_on);
+    state.value(barostat_on);
+    state.value(diff_c_on);
+    state.value(Cv_on);
+    state.value(pressure_on);
+    state.value(msd_on);
+    state.value(Ep_on);
+    state.value(Ek_on);
+}
+
+void mdsystem::write_checkpoint(const string &path)
+{
+    // The state is copied into the writer's buffers right away, the disk is left to the writer thread
+    checkpoint_writer state(writer, writer.open_replacing(path));
+    transfer_state(state);
+    state.finish();
+    last_checkpoint_time = time(NULL);
+}
+
+string mdsystem::state_cache_key(uint num_particles_in) const
+{
+    // Everything that decides what the equilibrium looks like, except for the temperature
+    stringstream key;
+    key << setprecision(9)
+        << "sigma [m]="           << sigma_in_m
+        << " epsilon [J]="        << epsilon_in_j
+        << " particle_mass [kg]=" << particle_mass_in_kg
+        << " num_particles="      << num_particles_in
+        << " lattice_type="       << lattice_type
+        << " lattice_constant="   << lattice_constant
+        << " inner_cutoff="       << inner_cutoff
+        << " outer_cutoff="       << outer_cutoff;
+    return key.str();
+}
+
+ftype mdsystem::target_temperature() const
+{
+    return thermostat_on ? desired_temp : init_temp;
+}
+
+bool mdsystem::read_cached_state(uint cached_num_particles, ftype cached_box_size, vector<vec3> &positions, vector<vec3> &velocities, ftype &temperature_in_k)
+{
+    string key  = state_cache_key(cached_num_particles);
+    string hash = key_hash(key);
+    vector<cached_state> states = read_state_cache_index(state_cache_directory + "/" + hash + ".idx");
+    if (states.empty()) {
+        return false;
+    }
+
+    // The closest temperature, if it is close enough
+    ftype target_in_k = target_temperature()*epsilon_in_j/P_SI_KB;
+    uint  closest = 0;
+    for (uint i = 1; i < states.size(); i++) {
+        if (fabs(states[i].temperature_in_k - target_in_k) < fabs(states[closest].temperature_in_k - target_in_k)) {
+            closest = i;
+        }
+    }
+    if (fabs(states[closest].temperature_in_k - target_in_k) > STATE_CACHE_TEMPERATURE_TOLERANCE*target_in_k) {
+        output << "No cached state of " << cached_num_particles << " particles within " << STATE_CACHE_TEMPERATURE_TOLERANCE*100 << " % of "
+               << target_in_k << " K, the closest is at " << states[closest].temperature_in_k << " K" << endl;
+        return false;
+    }
+
+    checkpoint_reader state;
+    string error;
+    string stored_key;
+    ftype  stored_temperature = 0;
+    ftype  stored_box_size    = 0;
+    if (state.open(state_cache_directory + "/" + states[closest].file_name, error)) {
+        state.text  (stored_key);
+        state.value (stored_temperature);
+        state.value (stored_box_size);
+        state.values(positions);
+        state.values(velocities);
+        state.finish(error);
+    }
+    if (!error.empty() || stored_key != key || stored_box_size != cached_box_size || positions.size() != cached_num_particles || velocities.size() != cached_num_particles) {
+        output << "The cached state " << states[closest].file_name << " could not be used. " << error << endl;
+        return false;
+    }
+    temperature_in_k = states[closest].temperature_in_k;
+    return true;
+}
+
+bool mdsystem::start_from_cached_state()
+{
+    vector<vec3> positions, velocities;
+    ftype        cached_temperature_in_k = 0;
+    if (!read_cached_state(num_particles, box_size, positions, velocities, cached_temperature_in_k)) {
+        return tiling_on && tile_cached_state();
+    }
+
+    // The equilibrated positions with the velocities scaled to the target temperature
+    particles.resize(num_particles);
+    ftype sum_sqr_vel = 0;
+    for (uint i = 0; i < num_particles; i++) {
+        sum_sqr_vel += velocities[i].sqr_length();
+    }
+    ftype scale_factor = sum_sqr_vel > 0 ? sqrt(3 * num_particles * target_temperature() / sum_sqr_vel) : 0;
+    for (uint i = 0; i < num_particles; i++) {
+        particles[i].pos = positions[i];
+        particles[i].vel = velocities[i] * scale_factor;
+        particles[i].acc = vec3(0, 0, 0);
+    }
+    reset_non_modulated_relative_particle_positions();
+    create_verlet_list();
+    output << "Starting from the equilibrated state at " << cached_temperature_in_k << " K in the state cache" << endl;
+    return true;
+}
+
+bool mdsystem::tile_cached_state()
+{
+    /*
+     * The largest cached box whose side goes a whole number of times into
+     * the side of this one. The lattice constant is in the key, so it has
+     * the same density.
+     */
+    vector<vec3> positions, velocities;
+    ftype        cached_temperature_in_k = 0;
+    uint         small_size = box_size_in_lattice_constants / 2; // In lattice constants
+    while (small_size > 0) {
+        if (box_size_in_lattice_constants % small_size == 0 &&
+            read_cached_state(4*small_size*small_size*small_size, lattice_constant*small_size, positions, velocities, cached_temperature_in_k)) { // FCC
+            break;
+        }
+        small_size--;
+    }
+    if (small_size == 0) {
+        return false;
+    }
+
+    /*
+     * Replica r of the small box gets the particles r*num_small_particles
+     * and on, written in one streaming pass over all particles.
+     */
+    const uint  num_small_particles = uint(positions.size());
+    const uint  num_replicas_per_side = box_size_in_lattice_constants / small_size;
+    const ftype small_box_size = lattice_constant*small_size;
+    particles.resize(num_particles);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < int(num_particles); i++) {
+        uint replica = uint(i) / num_small_particles;
+        uint k       = uint(i) % num_small_particles;
+        vec3 shift = small_box_size * vec3(ftype(replica % num_replicas_per_side),
+                                           ftype(replica / num_replicas_per_side % num_replicas_per_side),
+                                           ftype(replica / num_replicas_per_side / num_replicas_per_side));
+        particles[i].pos = positions[k] + shift;
+        modulus_position(particles[i].pos);
+        particles[i].vel = velocities[k];
+        particles[i].acc = vec3(0, 0, 0);
+    }
+
+    // New random velocities for every particle, so that the replicas do not move in step
+    apply_langevin_noise(0, target_temperature(), 0, RS_TILING);
+    remove_drift_and_scale_velocities(target_temperature());
+    reset_non_modulated_relative_particle_positions();
+    create_verlet_list();
+    output << "Tiled the equilibrated state of " << num_small_particles << " particles at " << cached_temperature_in_k << " K "
+           << num_replicas_per_side << "x" << num_replicas_per_side << "x" << num_replicas_per_side << " times" << endl;
+
+    thermalize_tiled_state();
+    return true;
+}
+
+void mdsystem::thermalize_tiled_state()
+{
+    /*
+     * Langevin dynamics (BAOAB) at the target temperature lets the positions
+     * of the replicas drift apart. The coupling is strong since the tiled
+     * state is already close to equilibrium. The noise has a stream of its
+     * own, so it is not repeated by the run after it.
+     */
+    const ftype c1 = exp(ftype(-1.0/50)); // Relaxation time of 50 timesteps
+    sampling_in_this_loop = false;
+    calculate_forces<no_thermostat>();
+    for (uint step = 1; step <= num_thermalization_steps; step++) {
+        if (abort_activities_requested) {
+            break;
+        }
+        update_velocities(dt/2);
+        move_particles(dt/2);
+        apply_langevin_noise(c1, target_temperature(), step, RS_TILING);
+        move_particles(dt/2);
+        update_verlet_list_if_necessary();
+        calculate_forces<no_thermostat>();
+        update_velocities(dt/2);
+        print_output_and_process_events();
+    }
+    reset_non_modulated_relative_particle_positions();
+    output << "Thermalized for " << num_thermalization_steps << " timesteps" << endl;
 }
 
-ofstream* mdsystem::open_ofstream_file(ofstream &o, const char* path) const
+void mdsystem::cache_equilibrated_state()
 {
-    o.open(path);
-    return &o;
+    if (barostat_on) {
+        return; // The box is no longer the one given by the parameters
+    }
+
+    string key  = state_cache_key(num_particles);
+    string hash = key_hash(key);
+    ftype  temperature_in_k = insttemp[current_sample_index]*epsilon_in_j/P_SI_KB;
+    string index_path = state_cache_directory + "/" + hash + ".idx";
+    vector<cached_state> states = read_state_cache_index(index_path);
+
+    // A state within 2 % of the temperature is replaced, to not fill the cache with almost equal states
+    uint i = 0;
+    while (i < states.size() && fabs(states[i].temperature_in_k - temperature_in_k) > ftype(0.02)*temperature_in_k) {
+        i++;
+    }
+    if (i == states.size()) {
+        stringstream file_name;
+        file_name << hash << "_" << uint(temperature_in_k + ftype(0.5)) << "K.mdc";
+        states.push_back(cached_state());
+        states[i].file_name = file_name.str();
+    }
+    states[i].temperature_in_k = temperature_in_k;
+    make_directory(state_cache_directory);
+
+    // The state file first, the writer keeps the order, so the index never points to an unfinished file
+    vector<vec3> positions(num_particles), velocities(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        positions [i] = particles[i].pos;
+        velocities[i] = particles[i].vel;
+    }
+    checkpoint_writer state(writer, writer.open_replacing(state_cache_directory + "/" + states[i].file_name));
+    state.text  (key);
+    state.value (insttemp[current_sample_index]);
+    state.value (box_size);
+    state.values(positions);
+    state.values(velocities);
+    state.finish();
+
+    // Then the index
+    stringstream index;
+    index << setprecision(9);
+    for (i = 0; i < states.size(); i++) {
+        index << states[i].temperature_in_k << ' ' << states[i].file_name << '\n';
+    }
+    string text = index.str();
+    uint file = writer.open_replacing(index_path);
+    writer.write(file, text.data(), text.size());
+    writer.close(file);
+    output << "Equilibrated state at " << temperature_in_k << " K added to the state cache" << endl;
 }
 
 void mdsystem::modulus_position(vec3 &pos) const
@@ -1249,7 +2831,12 @@ void mdsystem::process_events()
 
 void mdsystem::print_output()
 {
-    if (output.str().empty()) {
+    if (progress_channel_on) {
+        publish_progress(false);
+        return;
+    }
+
+    if (output.tellp() <= 0) {
         // Nothing to write
         return;
     }
@@ -1261,20 +2848,72 @@ void mdsystem::print_output()
     output.str("");
 }
 
-void mdsystem::start_operation()
+void mdsystem::publish_progress(bool wait)
+{
+    /*
+     * The output is split into messages. What does not fit in the ring
+     * stays until the next time, unless asked to wait for the application
+     * to take the messages. A message with only the progress is published
+     * when the application has taken everything else, so it never fills
+     * the ring and never delays the simulation. When waiting, it is always
+     * published, so the application sees the end of every operation.
+     */
+    if (output.tellp() > 0) {
+        unpublished_output += output.str();
+        output.str("");
+    }
+    progress_message message;
+    message.phase         = phase;
+    message.loop_num      = loop_num;
+    message.max_loops_num = num_time_steps;
+    size_t num_published = 0;
+    while (num_published < unpublished_output.size()) {
+        size_t length = unpublished_output.size() - num_published;
+        message.text_length = uint(length < PROGRESS_TEXT_SIZE ? length : PROGRESS_TEXT_SIZE);
+        memcpy(message.text, unpublished_output.data() + num_published, message.text_length);
+        if (progress.push(message)) {
+            num_published += message.text_length;
+        }
+        else if (wait) {
+            std::this_thread::yield();
+        }
+        else {
+            break;
+        }
+    }
+    unpublished_output.erase(0, num_published);
+    if (unpublished_output.empty() && (progress.empty() || wait)) {
+        message.text_length = 0;
+        while (!progress.push(message) && wait) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void mdsystem::start_operation(uint phase_in)
 {
+    // One operation at a time, other threads wait here for it to be finished
+    std::unique_lock<std::mutex> lock(operation_mutex);
     while (operating) {
-        // Wait for the other operation to finish
-        process_events();
+        operation_finished.wait(lock);
     }
     operating = true;
+    phase     = phase_in;
 }
 
 void mdsystem::finish_operation()
 {
-    print_output();
+    phase = PHASE_IDLE;
+    if (progress_channel_on) {
+        publish_progress(true);
+    }
+    else {
+        print_output();
+    }
+    std::lock_guard<std::mutex> lock(operation_mutex);
     if (!operating) {
         throw runtime_error("Tried to finish operation that was never started");
     }
     operating = false;
+    operation_finished.notify_all();
 }
@@ -5,6 +5,9 @@
 #include <vector>
 #include <time.h>
 #include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 using namespace std;
 
 // Own includes
@@ -12,6 +15,17 @@ using namespace std;
 #include "callback.h"
 #include "base_float_vec3.h"
 #include "particle.h"
+#include "thermostats.h"
+#include "filters.h"
+#include "cell_grid.h"
+#include "sparse_cell_grid.h"
+#include "task_scheduler.h"
+#include "all_pairs_forces.h"
+#include "time_series.h"
+#include "async_writer.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+#include "spsc_ring.h"
 
 enum enum_lattice_types
 {
@@ -20,6 +34,46 @@ enum enum_lattice_types
     NUM_LATTICE_TYPES
 };
 
+enum enum_phases
+{
+    PHASE_IDLE,
+    PHASE_INITIALIZATION,
+    PHASE_ENERGY_MINIMIZATION,
+    PHASE_MONTE_CARLO,
+    PHASE_SIMULATION,
+    NUM_PHASES
+};
+
+/* The columns of the results, written after each run */
+enum enum_result_columns
+{
+    RC_TOTAL_ENERGY,
+    RC_KINETIC_ENERGY,
+    RC_POTENTIAL_ENERGY,
+    RC_COHESIVE_ENERGY,
+    RC_TEMPERATURE,
+    RC_PRESSURE,
+    RC_VOLUME, // Only with the barostat
+    RC_THERMOSTAT,
+    RC_MSD,
+    RC_CV,
+    RC_DIFFUSION_COEFFICIENT,
+    NUM_RESULT_COLUMNS
+};
+
+/* What an operation has done, published while it is running (see take_progress) */
+const uint PROGRESS_TEXT_SIZE = 240;
+const uint PROGRESS_RING_SIZE = 256; // Messages
+
+struct progress_message
+{
+    uint phase;         // (enum_phases)
+    uint loop_num;
+    uint max_loops_num;
+    uint text_length;   // The number of characters of the output in text
+    char text[PROGRESS_TEXT_SIZE];
+};
+
 class mdsystem
 {
  public:
@@ -32,26 +86,57 @@ class mdsystem
     // Functions that affect the system
     void set_event_callback (callback<void (*)(void*        )> event_callback_in );
     void set_output_callback(callback<void (*)(void*, string)> output_callback_in);
-    void init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, ftype inner_cutoff_in, ftype outer_cutoff_in, ftype particle_mass_in, ftype dt_in, uint ensemble_size_in, uint sample_period_in, ftype temperature_in, uint num_timesteps_in, ftype lattice_constant_in, uint lattice_type_in, ftype desired_temp_in, ftype thermostat_time_in, ftype dEp_tolerance_in, ftype default_impulse_response_decay_time_in, uint default_num_times_filtering_in, bool slope_compensate_by_default_in, bool thermostat_on_in, bool diff_c_on_in, bool Cv_on_in, bool pressure_on_in, bool msd_on_in, bool Ep_on_in, bool Ek_on_in);
+    void set_progress_channel(bool progress_channel_on_in); // Publish the output and the progress for take_progress instead of calling the output callback
+    void set_random_seed    (uint random_seed_in);
+    void set_barostat       (bool barostat_on_in, ftype desired_pressure_in, ftype barostat_time_in, ftype compressibility_in); // Call after init, which turns the barostat off
+    void set_memory_budget  (uint64 memory_budget_in); // Bytes of RAM for the measurements, the rest is spilled to disk. Call before init
+    void set_output_directory(const string &output_directory_in); // Where the results are written after each run
+    void set_text_export    (bool text_export_on_in);  // If the results are written as text files as well as in the results file
+    void set_trajectory_output(bool store_trajectory_in, uint frame_period_in, ftype relative_precision_in); // Positions every frame_period_in timesteps, quantized to relative_precision_in of the box size
+    void set_checkpointing  (bool checkpointing_on_in, ftype checkpoint_interval_in); // Checkpoint.mdc is replaced every checkpoint_interval_in seconds (wall-clock) during runs, and when a run is aborted
+    void save_checkpoint    (const string &path); // Written in the background
+    void set_state_cache    (bool state_cache_on_in, const string &state_cache_directory_in); // Start from cached equilibrated states near the target temperature and add new ones. Call before init
+    void set_tiling         (bool tiling_on_in, uint num_thermalization_steps_in); // Without a cached state of the same size, tile a cached smaller box and thermalize it. Call before init
+    bool load_checkpoint    (const string &path); // Instead of init, the next run_simulation continues exactly where the checkpoint was taken
+    void init(uint num_particles_in, ftype sigma_in, ftype epsilon_in, ftype inner_cutoff_in, ftype outer_cutoff_in, ftype particle_mass_in, ftype dt_in, uint ensemble_size_in, uint sample_period_in, ftype temperature_in, uint num_timesteps_in, ftype lattice_constant_in, uint lattice_type_in, ftype desired_temp_in, ftype thermostat_time_in, uint thermostat_type_in, ftype dEp_tolerance_in, uint filter_type_in, ftype default_impulse_response_decay_time_in, uint default_num_times_filtering_in, bool slope_compensate_by_default_in, bool thermostat_on_in, bool diff_c_on_in, bool Cv_on_in, bool pressure_on_in, bool msd_on_in, bool Ep_on_in, bool Ek_on_in);
     void run_simulation();
+    void run_simulation_until(uint pause_loop_num_in); // Pauses after that timestep, the next run continues. The results are written at the end
+    void extend_simulation(uint num_additional_timesteps_in); // The next run_simulation continues where the last one ended
+    void run_energy_minimization(uint max_force_calls, ftype force_tolerance_in, bool relax_box, ftype pressure_tolerance_in);
+    void run_monte_carlo_equilibration(uint num_sweeps, ftype max_displacement_in);
+    void exchange_temperature(ftype desired_temp_in); // [K] New desired temperature, and the velocities scaled to it (replica exchange)
+    void branch_trajectory  (uint random_seed_in);   // After a finished run, the next run is an NVE run from its last state with velocities drawn with the new seed
+    void prepare_fork       ();                      // Waits until the output is written, so that the system can be used in a process forked after it
+    void continue_after_fork();                      // First thing in the forked process
     void abort_activities();
     // Functins that not affect the system
     bool is_initialized() const;
     bool is_operating() const;
+    bool take_progress(progress_message &message); // May be called by one other thread during the operations, which wait for it when the ring is full at their end
     uint get_loop_num() const;
     uint get_max_loops_num() const;
+    ftype get_potential_energy() const;    // [J] At the latest sample
+    ftype get_desired_temperature() const; // [K]
+    bool get_result_mean(uint column, ftype &mean) const; // (enum_result_columns) Over the last 5/6 of the latest run, in the units of the results file
+    static string get_result_name(uint column);           // "name [unit]"
 
 private:
     /*********************
      * Private variables *
      *********************/
     // Thread safety
-    bool operating;
+    std::atomic<bool>       operating;
+    std::mutex              operation_mutex;
+    std::condition_variable operation_finished;
     // Comunication with the application
     callback<void (*)(void*        )> event_callback ;
     callback<void (*)(void*, string)> output_callback;
-    bool abort_activities_requested;
+    std::atomic<bool> abort_activities_requested;
     stringstream output;
+    bool   progress_channel_on; // If the output is published in the progress ring
+    uint   phase;               // (enum_phases) Of the current operation
+    string unpublished_output;  // Output that did not fit in the progress ring yet
+    spsc_ring<progress_message, PROGRESS_RING_SIZE> progress;
     bool system_initialized;
     // Conversion between reduced units and SI units
     // NOTE! DO NOT USE THESE VARIABLES FOR OTHER THAN CONVERSIONS!
@@ -75,40 +160,92 @@ private:
     ftype pos_half_box_size; // Half box side
     ftype neg_half_box_size; // Negated half box side
     // Verlet list
-    vector<uint> verlet_particles_list; // List of integernumber, each index points to an element in the verlet_neighbors_list which is the first neighbor to corresponding particle.
-    vector<uint> verlet_neighbors_list; // List with index numbers to neighbors.
+    vector<uint64> verlet_particles_list; // List of integernumber, each index points to an element in the verlet_neighbors_list which is the first neighbor to corresponding particle.
+    vector<uint>   verlet_neighbors_list; // List with index numbers to neighbors.
+    ftype        verlet_list_box_scale; // Box size relative to the box size when the Verlet list was created
     ftype        sqr_inner_cutoff;      // Square of the inner cut-off radius in the Verlet list
     ftype        sqr_outer_cutoff;      // Square of the outer cut-off radius in the Verlet list
+    // Load balancing of the Verlet list and the forces, as tasks over blocks of the box
+    task_scheduler scheduler;
+    cell_grid      blocks;                   // The particles by block, from the positions when the Verlet list was created
+    vector<uint64> list_weights;             // Neighbours found in each block when the Verlet list was last built
+    vector<uint64> force_weights;            // Pairs of each block in the last force calculation
+    vector<uint64> cross_block_start;        // Index in cross_block_list of the first pair of each particle as the second particle, with the first one in another block, one extra entry at the end
+    vector<uint>   cross_block_list;         // The first particles of those pairs, by increasing index
+    vector<ftype>  block_Ep;                 // Of the pairs of each block in the last force calculation, summed in block order
+    vector<ftype>  block_distance_force_sum;
+    all_pairs_forces all_pairs;              // Instead of the Verlet list and the blocks for small systems
     // Graphs & measurements
     uint          ensemble_size;        // Number of values used to calculate averages
     uint          sampling_period;      // Number of timesteps between each measurement
     uint          num_sampling_points;  // The number of samples taken for each property
     uint          current_sample_index; // The index of the current sample that has been/is being taken
+    uint64        memory_budget;        // Bytes of RAM the measurements may use before they are spilled to disk
+    bool          continue_run;         // If the next run continues the last one (see extend_simulation)
     bool          sampling_in_this_loop;// If the properties are supposed to be measured in the current loop or not
+    bool          measure_every_loop;   // If the potential energy and the pressure are supposed to be calculated in every loop
+    ftype         current_Ep;                 // Potential energy from the latest force calculation
+    ftype         current_distance_force_sum; // Sum of distance times force from the latest force calculation
     // Unfiltered measurements
-    vector<ftype> instEk;               // Instat kinetic energy
-    vector<ftype> instEp;               // Instat potential energy
-    vector<ftype> instEc;               // Instat cohesive energy
-    vector<ftype> insttemp;             // Instant temperature
-    vector<ftype> diffusion_coefficient;
-    vector<ftype> distance_force_sum;   // Used to calculate the pressure
-    vector<ftype> msd;                  // Mean square distance
-    vector<ftype> thermostat_values;    // To store the values of the thermostat
+    time_series   instEk;               // Instat kinetic energy
+    time_series   instEp;               // Instat potential energy
+    time_series   instEc;               // Instat cohesive energy
+    time_series   insttemp;             // Instant temperature
+    time_series   diffusion_coefficient;
+    time_series   distance_force_sum;   // Used to calculate the pressure
+    time_series   msd;                  // Mean square distance
+    time_series   thermostat_values;    // To store the values of the thermostat
+    time_series   instvolume;           // Volume of the box
     // Filtered measurements
-    vector<ftype> temperature;          // Temperature
-    vector<ftype> Cv;                   // Heat capacity
-    vector<ftype> pressure;             // Pressure
-    vector<ftype> Ek;                   // Kinetic energy
-    vector<ftype> Ep;                   // Potential energy
-    vector<ftype> cohesive_energy;      // Negative potential energy per atom
+    time_series   temperature;          // Temperature
+    time_series   Cv;                   // Heat capacity
+    time_series   pressure;             // Pressure
+    time_series   volume;               // Volume of the box
+    time_series   Ek;                   // Kinetic energy
+    time_series   Ep;                   // Potential energy
+    time_series   cohesive_energy;      // Negative potential energy per atom
+    time_series   filtered_distance_force_sum;
+    time_series   Cv_filtered_temp;     // Temperature filtered for the local variance
+    time_series   Cv_unfiltered_var;    // Local variance of the temperature
+    time_series   Cv_filtered_var;
     // Filtering
+    uint          filter_type;         // (enum_filter_types)
     ftype         default_impulse_response_decay_time;
     uint          default_num_times_filtering; // The number of times the filter should be applied every time filtering
     bool          slope_compensate_by_default; // If the filter should compensate for slope in the edges of the graphs by default or not
+    filter_workspace filter_scratch;   // Reused between filterings
+    vector<two_sided_exponential_decay_filter_stream> filter_streams; // For each channel of list_filter_channels and then the local variance of the temperature, when filter_streamed
+    vector<uint>  num_streamed;        // Filtered samples written by each stream
+    vector<ftype> streamed_values;     // The filtered samples a stream just made ready
+    vector<ftype> streamed_var;
+    // Output
+    string        output_directory;    // Empty for the working directory
+    bool          text_export_on;      // If every result is also written in a text file of its own
+    async_writer  writer;              // Writes the output files in the background
+    bool          store_trajectory;    // If the particle positions are written during the runs
+    uint          trajectory_frame_period;
+    ftype         trajectory_precision; // Relative to the box size
+    trajectory_writer trajectory;
+    bool          checkpointing_on;    // If checkpoints are written during the runs
+    ftype         checkpoint_interval; // [s] of wall-clock time
+    time_t        last_checkpoint_time;
+    bool          restored_run;        // If the next run continues from a loaded checkpoint
+    uint          pause_loop_num;      // The timestep the current run stops after
+    bool          paused_run;          // If the next run continues a paused one (see run_simulation_until)
+    bool          state_cache_on;      // If equilibrated states are reused between runs
+    string        state_cache_directory;
+    bool          tiling_on;           // If a smaller cached box may be tiled to fill the box
+    uint          num_thermalization_steps; // Timesteps of Langevin dynamics after the tiling
     // Constrol
+    uint          thermostat_type;   // (enum_thermostat_types)
     ftype         thermostat_value;  // Varying parameter telling how the velocities should change to adjust the temperature
     ftype         desired_temp;      // The temperature the system strives to obtain
     ftype         thermostat_time;   // The half time for the existing temperature deviation
+    ftype         desired_pressure;  // The pressure the barostat strives to obtain
+    ftype         barostat_time;     // The relaxation time of the barostat
+    ftype         compressibility;   // The isothermal compressibility assumed by the barostat
+    ftype         barostat_factor;   // Scaling of the box from the last measurement, done after the next drift
+    uint          random_seed;       // Key of the counter based random numbers
     // Lennard Jones potential
     ftype dEp_tolerance;      //equilibrium is reached when abs((Ep(current)-Ep(previous))/Ep(current)) is below this value
     bool  equilibrium_reached;
@@ -118,6 +255,7 @@ private:
     ftype E_cutoff;
     // Flags
     bool thermostat_on;
+    bool barostat_on;
     bool diff_c_on;
     bool Cv_on;
     bool pressure_on;
@@ -130,34 +268,86 @@ private:
      *********************/
     // Initialization
     void init_particles();
+    void randomize_velocities(ftype temperature, uint32 draw);
+    void remove_drift_and_scale_velocities(ftype temperature);
     void calculate_potential_energy_cutoff();
+    void apply_memory_budget();
+    void resize_measurements();
     // Verlet list
     void update_verlet_list_if_necessary();
     void create_verlet_list();
-    void create_linked_cells(uint box_size_in_cells, ftype cell_size, vector<uint> &cell_linklist, vector<uint> &cell_list);
+    void build_verlet_list(); // From pos_when_verlet_list_created
+    uint find_verlet_neighbours(uint i, const sparse_cell_grid *cells, uint *neighbours) const; // Returns the number of neighbours, only counted if neighbours is 0, all pairs without cells
+    void build_blocks(const vector<vec3> &positions);
+    void restore_force_tasks();      // The blocks and their weights for a Verlet list from a checkpoint
+    void index_cross_block_pairs();  // The pairs each block also needs from the Verlet lists of other blocks
+    static void verlet_list_task(void *context, uint block, uint thread);
     void reset_non_modulated_relative_particle_positions();
     inline void reset_single_non_modulated_relative_particle_positions(uint i);
     void update_non_modulated_relative_particle_positions();
     inline void update_single_non_modulated_relative_particle_position(uint i);
+    // Policy dispatch (done once per run)
+    template<class thermostat_policy                    > void run_simulation_with_thermostat();
+    template<class thermostat_policy, class filter_policy> void run_simulation_with_policies  ();
     // Simulation
-    void leapfrog();
+    template<class thermostat_policy> void leapfrog();
+    template<class thermostat_policy> void baoab();
     void update_positions(ftype time_step);
+    void move_particles(ftype time_step);
     void update_velocities(ftype time_step);
-    void calculate_forces();
+    template<class thermostat_policy> void scale_velocities_by_thermostat();
+    void apply_langevin_noise(ftype c1, ftype temperature, uint32 step, uint32 stream); // v = c1*v + sqrt((1 - c1^2)*temperature)*R
+    template<class thermostat_policy> void calculate_forces();
+    static void force_task(void *system, uint block, uint thread);
+    void calculate_block_forces(uint block);
+    template<class thermostat_policy> void calculate_all_pairs_forces();
+    template<class thermostat_policy> void store_force_properties(ftype Ep_sum, ftype distance_force_sum_sum); // And adds the friction of the thermostat
     void enter_loop_number(uint loop_to_enter);
     void enter_next_loop();
     // Measurements
-    void measure_unfiltered_properties();
-    void calculate_thermostate_value();
-    void calculate_filtered_properties();
-    void calculate_specific_heat();
+    template<class thermostat_policy> void measure_unfiltered_properties();
+    template<class thermostat_policy> void calculate_thermostate_value();
+    void apply_barostat();
+    void scale_box_by_barostat();
+    // Monte Carlo
+    ftype local_potential_energy(const sparse_cell_grid &grid, uint i, const vec3 &pos) const;
+    void scale_box(ftype factor);
+    template<class filter_policy> void calculate_filtered_properties();
+    template<class filter_policy> void calculate_specific_heat(ftype impulse_response_decay_time);
     void calculate_pressure();
     void calculate_mean_square_displacement();
     void calculate_diffusion_coefficient();
     // Filtering
-    void filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype default_impulse_response_decay_time, uint num_times, bool slope_compensate);
+    template<class filter_policy> void filter(const vector<ftype> &unfiltered, vector<ftype> &filtered, ftype default_impulse_response_decay_time, uint num_times, bool slope_compensate);
+    template<class filter_policy> void filter_channels(const filter_channel *channels, uint num_channels);
+    bool  filter_streamed() const;     // If the measurements are filtered as they are taken instead of after the run
+    ftype Cv_impulse_response_decay_time() const;
+    uint  list_filter_channels(filter_channel *channels); // The measurements that are filtered together, returns how many
+    void  start_streaming_filter(uint num_samples_taken); // The samples already taken are filtered again
+    void  stream_sample(uint index);
+    void  write_streamed(uint stream, time_series &filtered);
+    void  finish_streaming_filter();
     // Output
-    ofstream* open_ofstream_file(ofstream &o, const char* path) const;
+    string output_path(const char *file_name) const;
+    uint  open_output_file(const char *file_name);
+    void  open_trajectory(const char *file_name);
+    void  write_results(ftype Ep_shift);
+    void  write_text_results(ftype Ep_shift);
+    void  write_text_values(uint file, const vector<ftype> &values);
+    uint  result_length(uint column) const;
+    ftype result_value (uint column, uint i, ftype Ep_shift) const;
+    void  report_output_errors();
+    // Checkpoints
+    template<class archive> void transfer_state(archive &state);
+    void  write_checkpoint(const string &path);
+    // State cache
+    string state_cache_key(uint num_particles_in) const;
+    ftype  target_temperature() const;
+    bool   read_cached_state(uint cached_num_particles, ftype cached_box_size, vector<vec3> &positions, vector<vec3> &velocities, ftype &temperature_in_k);
+    bool   start_from_cached_state(); // Also creates the Verlet list
+    bool   tile_cached_state();
+    void   thermalize_tiled_state();
+    void   cache_equilibrated_state();
 
     // Arithmetic operations
     void modulus_position                      (vec3 &pos           ) const;
@@ -168,9 +358,10 @@ private:
     void print_output_and_process_events();
     void process_events();
     void print_output();
+    void publish_progress(bool wait); // Waits for the application to take the messages if the ring is full
 
     // Thread safety
-    void start_operation();
+    void start_operation(uint phase_in = PHASE_IDLE);
     void finish_operation();
 };
 
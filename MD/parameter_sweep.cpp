@@ -0,0 +1,304 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <cerrno>
+#include <omp.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
+
+// Own includes
+#include "parameter_sweep.h"
+#include "work_stealing_pool.h"
+#include "async_writer.h"
+
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+/* False if the directory neither exists nor could be created */
+static bool make_directory(const string &path)
+{
+#ifndef _WIN32
+    return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#else
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#endif
+}
+
+/* The output of one run goes to Output.txt in its directory */
+static void write_to_file(void* ptr, string output)
+{
+    *(std::ofstream*)ptr << output << std::flush;
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+parameter_sweep::parameter_sweep()
+{
+    first_seed   = 0;
+    num_seeds    = 1;
+    num_workers  = 0;
+    num_points   = 0;
+    num_cores    = 1;
+    num_started  = 0;
+    num_finished = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void parameter_sweep::set_output_callback(callback<void (*)(void*, string)> output_callback_in)
+{
+    output_callback = output_callback_in;
+}
+
+void parameter_sweep::set_simulation(const string &path_in, const string &elements_directory_in)
+{
+    path               = path_in;
+    elements_directory = elements_directory_in;
+}
+
+void parameter_sweep::add_axis(const string &name, const vector<string> &expressions)
+{
+    axis new_axis;
+    new_axis.name        = name;
+    new_axis.expressions = expressions;
+    axes.push_back(new_axis);
+}
+
+void parameter_sweep::set_seeds(uint first_seed_in, uint num_seeds_in)
+{
+    first_seed = first_seed_in;
+    num_seeds  = num_seeds_in > 0 ? num_seeds_in : 1;
+}
+
+void parameter_sweep::set_num_workers(uint num_workers_in)
+{
+    num_workers = num_workers_in;
+}
+
+void parameter_sweep::set_output_directory(const string &output_directory_in)
+{
+    output_directory = output_directory_in;
+}
+
+bool parameter_sweep::run(string &error)
+{
+    // The grid, with the first axis changing slowest
+    num_points = 1;
+    for (uint a = 0; a < axes.size(); a++) {
+        if (axes[a].expressions.empty()) {
+            error = axes[a].name + " has no values";
+            return false;
+        }
+        num_points *= axes[a].expressions.size();
+    }
+    if (!output_directory.empty() && !make_directory(output_directory)) {
+        error = "The output directory " + output_directory + " could not be created";
+        return false;
+    }
+
+    // Read every point first, so that a mistake in the grid is found at once
+    runs.clear();
+    for (uint point = 0; point < num_points; point++) {
+        settings point_settings;
+        for (uint a = 0; a < axes.size(); a++) {
+            point_settings.set_override(axes[a].name, point_expression(point, a));
+        }
+        run_parameters parameters;
+        if (!point_settings.read(path, elements_directory, error) || !read_run_parameters(point_settings, parameters, error)) {
+            error = point_description(point) + ": " + error;
+            return false;
+        }
+        for (uint s = 0; s < num_seeds; s++) {
+            stringstream directory;
+            directory << (output_directory.empty() ? string(".") : output_directory) << "/Point" << point << "_Seed" << first_seed + s;
+            sweep_run new_run;
+            new_run.point      = point;
+            new_run.seed       = first_seed + s;
+            new_run.parameters = parameters;
+            new_run.directory  = directory.str();
+            new_run.completed  = false;
+            for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+                new_run.has_mean[column] = false;
+                new_run.mean    [column] = 0;
+            }
+            runs.push_back(new_run);
+        }
+    }
+
+    // The runs are submitted by point, so the seeds of a point tend to finish together
+    num_cores    = uint(omp_get_num_procs());
+    num_started  = 0;
+    num_finished = 0;
+    int num_threads_before = omp_get_max_threads();
+    {
+        work_stealing_pool pool(num_workers > 0 ? num_workers : (num_cores < runs.size() ? num_cores : uint(runs.size())));
+        num_workers = pool.get_num_workers();
+        stringstream text;
+        text << runs.size() << " runs (" << num_points << " points, " << num_seeds << " seeds) on " << num_workers << " workers" << endl;
+        print(text.str());
+        for (uint i = 0; i < runs.size(); i++) {
+            sweep_run *next_run = &runs[i];
+            pool.submit([this, next_run]() { run_one(*next_run); });
+        }
+        pool.run();
+    }
+    omp_set_num_threads(num_threads_before); // The calling thread was one of the workers
+
+    write_summary();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+string parameter_sweep::point_expression(uint point, uint axis_index) const
+{
+    uint stride = 1;
+    for (uint a = axis_index + 1; a < axes.size(); a++) {
+        stride *= axes[a].expressions.size();
+    }
+    return axes[axis_index].expressions[(point/stride) % axes[axis_index].expressions.size()];
+}
+
+string parameter_sweep::point_description(uint point) const
+{
+    string description;
+    for (uint a = 0; a < axes.size(); a++) {
+        description += (a > 0 ? ", " : "") + axes[a].name + " = " + point_expression(point, a);
+    }
+    return description.empty() ? string("The simulation") : description;
+}
+
+void parameter_sweep::run_one(sweep_run &run)
+{
+    /*
+     * The cores are shared between the runs that are left; while the queues
+     * are full, every run gets one thread, and the last runs get more.
+     */
+    uint num_left       = runs.size() - num_started++;
+    uint num_concurrent = num_left < num_workers ? num_left : num_workers;
+    uint num_threads    = num_cores/num_concurrent > 0 ? num_cores/num_concurrent : 1;
+    omp_set_num_threads(int(num_threads));
+    double start_time = omp_get_wtime();
+
+    make_directory(run.directory);
+    std::ofstream log((run.directory + "/Output.txt").c_str());
+    {
+        mdsystem simulation;
+        simulation.set_output_callback(callback<void (*)(void*, string)>(write_to_file, &log));
+        simulation.set_output_directory(run.directory);
+        simulation.set_random_seed(run.seed);
+        if (run_with_parameters(simulation, run.parameters)) {
+            run.completed = true;
+            for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+                run.has_mean[column] = simulation.get_result_mean(column, run.mean[column]);
+            }
+        }
+    } // Waits for the results to be written
+
+    stringstream text;
+    text << "Run " << ++num_finished << "/" << runs.size() << (run.completed ? " done: " : " FAILED: ")
+         << point_description(run.point) << ", seed " << run.seed << " ("
+         << num_threads << (num_threads == 1 ? " thread, " : " threads, ")
+         << setprecision(3) << omp_get_wtime() - start_time << " s)" << endl;
+    print(text.str());
+}
+
+void parameter_sweep::write_summary()
+{
+    /*
+     * One line per point: the values of the axes, the number of completed
+     * runs, and the mean and error bar of every result. The error bar is
+     * the standard error of the mean over the seeds, nan with one seed.
+     * Results that no run has, like the volume without the barostat, are
+     * left out.
+     */
+    bool column_used[NUM_RESULT_COLUMNS];
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        column_used[column] = false;
+        for (uint i = 0; i < runs.size(); i++) {
+            column_used[column] = column_used[column] || runs[i].has_mean[column];
+        }
+    }
+    stringstream text;
+    text << setprecision(9);
+    text << "#";
+    for (uint a = 0; a < axes.size(); a++) {
+        text << axes[a].name << "\t";
+    }
+    text << "runs";
+    for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+        if (column_used[column]) text << "\t" << mdsystem::get_result_name(column) << "\terror";
+    }
+    text << "\n";
+    for (uint point = 0; point < num_points; point++) {
+        uint num_completed = 0;
+        for (uint i = 0; i < runs.size(); i++) {
+            num_completed += runs[i].point == point && runs[i].completed;
+        }
+        for (uint a = 0; a < axes.size(); a++) {
+            text << point_expression(point, a) << "\t";
+        }
+        text << num_completed;
+        for (uint column = 0; column < NUM_RESULT_COLUMNS; column++) {
+            if (!column_used[column]) continue;
+            ftype sum = 0;
+            uint  n   = 0;
+            for (uint i = 0; i < runs.size(); i++) {
+                if (runs[i].point == point && runs[i].has_mean[column]) {
+                    sum += runs[i].mean[column];
+                    n++;
+                }
+            }
+            if (n == 0) {
+                text << "\tnan\tnan";
+                continue;
+            }
+            ftype mean = sum/n;
+            ftype sqr_deviation_sum = 0;
+            for (uint i = 0; i < runs.size(); i++) {
+                if (runs[i].point == point && runs[i].has_mean[column]) {
+                    sqr_deviation_sum += (runs[i].mean[column] - mean)*(runs[i].mean[column] - mean);
+                }
+            }
+            text << "\t" << mean << "\t";
+            if (n > 1) text << sqrt(sqr_deviation_sum/(n - 1)/n);
+            else       text << "nan";
+        }
+        text << "\n";
+    }
+
+    string summary = text.str();
+    async_writer writer;
+    uint file = writer.open_replacing((output_directory.empty() ? string(".") : output_directory) + "/Summary.txt");
+    writer.write(file, summary.data(), summary.size());
+    writer.close(file);
+    writer.wait();
+    string errors;
+    if (writer.take_errors(errors)) {
+        print(errors);
+    }
+    print(summary);
+}
+
+void parameter_sweep::print(const string &text)
+{
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (output_callback.func) {
+        output_callback.func(output_callback.param, text);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef  PARAMETER_SWEEP_H
+#define  PARAMETER_SWEEP_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "callback.h"
+#include "run_parameters.h"
+#include "mdsystem.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Runs a simulation file for every point of a grid of settings and for a
+ * number of random seeds, for example a melting curve over temperatures
+ * and lattice constants. Every run is an mdsystem of its own, and the runs
+ * are scheduled on a work_stealing_pool with one worker per core. When
+ * fewer runs than workers are left, the remaining runs get more OpenMP
+ * threads each. Every run writes its results in a directory of its own,
+ * and Summary.txt gets the mean of every result over the seeds at each
+ * point, with the standard error of that mean as the error bar.
+ */
+class parameter_sweep
+{
+public:
+    // Constructor
+    parameter_sweep();
+
+    void set_output_callback(callback<void (*)(void*, string)> output_callback_in); // May be called from any of the workers, one at a time
+    void set_simulation     (const string &path_in, const string &elements_directory_in);
+    void add_axis           (const string &name, const vector<string> &expressions); // The setting and the values it takes, like "Initial temperature" and "600 K"
+    void set_seeds          (uint first_seed_in, uint num_seeds_in);
+    void set_num_workers    (uint num_workers_in);          // 0 for one per core
+    void set_output_directory(const string &output_directory_in); // Created if it does not exist
+    bool run(string &error); // All settings are read before anything runs
+
+private:
+    struct axis
+    {
+        string         name;
+        vector<string> expressions;
+    };
+    struct sweep_run
+    {
+        uint           point;      // Index in the grid
+        uint           seed;
+        run_parameters parameters;
+        string         directory;  // Of the results
+        bool           completed;
+        bool           has_mean[NUM_RESULT_COLUMNS];
+        ftype          mean    [NUM_RESULT_COLUMNS];
+    };
+
+    callback<void (*)(void*, string)> output_callback;
+    std::mutex        output_mutex;
+    string            path;
+    string            elements_directory;
+    vector<axis>      axes;
+    uint              first_seed;
+    uint              num_seeds;
+    uint              num_workers;
+    string            output_directory;
+    vector<sweep_run> runs;
+    uint              num_points;
+    uint              num_cores;
+    std::atomic<uint> num_started;
+    std::atomic<uint> num_finished;
+
+    string point_expression(uint point, uint axis_index) const; // The value of an axis at a point of the grid
+    string point_description(uint point) const;
+    void   run_one(sweep_run &run);
+    void   write_summary();
+    void   print(const string &text);
+};
+
+#endif  /* PARAMETER_SWEEP_H */
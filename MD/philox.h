@@ -0,0 +1,78 @@
+#ifndef  PHILOX_H
+#define  PHILOX_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// COUNTER BASED RANDOM NUMBERS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Philox4x32-10 (Salmon et. al, 2011). The generator has no state; the four
+ * output words are a pure function of the counter and the key, so any atom
+ * can draw its numbers for any time step in any thread, in any order, and
+ * always get the same result.
+ */
+
+/* Random streams, used as second key word to keep the uses independent */
+enum enum_random_streams
+{
+    RS_LANGEVIN         = 0x4c616e67, // "Lang"
+    RS_MONTE_CARLO      = 0x4d6f6e74, // "Mont"
+    RS_TILING           = 0x54696c65, // "Tile"
+    RS_VELOCITIES       = 0x56656c6f, // "Velo"
+    RS_REPLICA_EXCHANGE = 0x5265706c  // "Repl"
+};
+
+inline void philox4x32(uint32 c0, uint32 c1, uint32 c2, uint32 c3, uint32 k0, uint32 k1, uint32 out[4])
+{
+    for (int round = 0; round < 10; round++) {
+        uint64 p0 = uint64(0xD2511F53u) * c0;
+        uint64 p1 = uint64(0xCD9E8D57u) * c2;
+        uint32 hi0 = uint32(p0 >> 32), lo0 = uint32(p0);
+        uint32 hi1 = uint32(p1 >> 32), lo1 = uint32(p1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* Maps a random word to the open interval (0, 1) */
+inline ftype uniform_from_uint32(uint32 x)
+{
+    return (ftype(x >> 8) + ftype(0.5)) * ftype(1.0/16777216.0);
+}
+
+/* Three standard normal distributed numbers from four random words (Box-Muller) */
+inline void gaussian_vec3_from_uint32(uint32 r0, uint32 r1, uint32 r2, uint32 r3, ftype &n0, ftype &n1, ftype &n2)
+{
+    ftype radius1 = sqrt(-2 * log(uniform_from_uint32(r0)));
+    ftype radius2 = sqrt(-2 * log(uniform_from_uint32(r2)));
+    ftype angle1  = ftype(2 * M_PI) * uniform_from_uint32(r1);
+    ftype angle2  = ftype(2 * M_PI) * uniform_from_uint32(r3);
+    n0 = radius1 * cos(angle1);
+    n1 = radius1 * sin(angle1);
+    n2 = radius2 * cos(angle2);
+}
+
+/* Three standard normal distributed numbers for (id, step) */
+inline void philox_gaussian_vec3(uint32 seed, uint32 stream, uint32 id, uint32 step, ftype out[3])
+{
+    uint32 r[4];
+    philox4x32(id, step, 0, 0, seed, stream, r);
+    gaussian_vec3_from_uint32(r[0], r[1], r[2], r[3], out[0], out[1], out[2]);
+}
+
+#endif  /* PHILOX_H */
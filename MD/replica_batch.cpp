@@ -0,0 +1,445 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <omp.h>
+
+// Own includes
+#include "replica_batch.h"
+#include "mdsystem.h"
+#include "simd.h"
+#include "philox.h"
+#include "async_writer.h"
+
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+/* The results of the batch, from the columns of the results of mdsystem */
+static const uint batch_columns[] = {RC_TOTAL_ENERGY, RC_KINETIC_ENERGY, RC_POTENTIAL_ENERGY, RC_COHESIVE_ENERGY, RC_TEMPERATURE, RC_PRESSURE};
+static const uint num_batch_columns = sizeof(batch_columns)/sizeof(batch_columns[0]);
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+replica_batch::replica_batch()
+{
+    num_replicas  = 0;
+    num_lanes     = 0;
+    num_particles = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void replica_batch::set_output_callback(callback<void (*)(void*, string)> output_callback_in)
+{
+    output_callback = output_callback_in;
+}
+
+void replica_batch::set_output_directory(const string &output_directory_in)
+{
+    output_directory = output_directory_in;
+}
+
+bool replica_batch::init(const run_parameters &parameters, uint first_seed, uint num_replicas_in, string &error)
+{
+    const run_parameters &p = parameters;
+    if (num_replicas_in == 0) {
+        error = "The batch needs at least one replica";
+        return false;
+    }
+    if (p.barostat_on || p.energy_minimization || p.monte_carlo) {
+        error = "The batch has no barostat, energy minimization or Monte Carlo";
+        return false;
+    }
+    if (p.thermostat_on && p.thermostat_type != LANGEVIN_THERMOSTAT) {
+        error = "The batch only has the Langevin thermostat";
+        return false;
+    }
+
+    // Conversion units
+    particle_mass_in_kg = p.mass;
+    sigma_in_m          = p.sigma;
+    epsilon_in_j        = p.epsilon;
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+
+    // Reduced units, as in mdsystem
+    ftype inner_cutoff = p.inner_cutoff/sigma_in_m;
+    lattice_constant = p.lattice_constant/sigma_in_m;
+    box_size_in_lattice_constants = uint(pow(ftype(p.num_particles / 4.0), ftype(1.0 / 3.0)));
+    num_particles   = 4*box_size_in_lattice_constants*box_size_in_lattice_constants*box_size_in_lattice_constants;
+    box_size        = lattice_constant*box_size_in_lattice_constants;
+    dt              = p.dt/time_unit;
+    sqr_cutoff      = inner_cutoff*inner_cutoff;
+    init_temp       = p.temperature  * P_SI_KB / epsilon_in_j;
+    desired_temp    = p.desired_temp * P_SI_KB / epsilon_in_j;
+    thermostat_time = p.thermostat_time/time_unit;
+    langevin_on     = p.thermostat_on;
+    sampling_period = p.sample_period > 0 ? p.sample_period : 1;
+    num_samples     = p.num_time_steps/sampling_period + 1;
+    num_time_steps  = (num_samples - 1)*sampling_period;
+    if (num_particles < 2) {
+        error = "The batch needs at least two particles per replica";
+        return false;
+    }
+    if (thermostat_time < sampling_period * dt) {
+        thermostat_time = sampling_period * dt;
+    }
+    ftype q = 1/sqr_cutoff;
+    q = q * q * q;
+    E_cutoff = ftype(4.0) * q * (q - ftype(1.0));
+
+    // Whole SIMD registers of replicas
+    num_replicas = num_replicas_in;
+    num_lanes    = (num_replicas + SIMD_WIDTH - 1)/SIMD_WIDTH*SIMD_WIDTH;
+    seeds.resize(num_lanes);
+    for (uint lane = 0; lane < num_lanes; lane++) {
+        seeds[lane] = first_seed + (lane < num_replicas ? lane : num_replicas - 1);
+    }
+    for (uint c = 0; c < 3; c++) {
+        pos[c].assign(num_particles*num_lanes, 0);
+        vel[c].assign(num_particles*num_lanes, 0);
+        acc[c].assign(num_particles*num_lanes, 0);
+    }
+    sample_Ep    .assign(num_samples*num_lanes, 0);
+    sample_virial.assign(num_samples*num_lanes, 0);
+    sample_temp  .assign(num_samples*num_lanes, 0);
+    init_particles();
+
+    stringstream text;
+    text << num_replicas << " replicas of " << num_particles << " particles in " << num_lanes/SIMD_WIDTH
+         << (num_lanes/SIMD_WIDTH == 1 ? " group" : " groups") << " of " << SIMD_WIDTH << ", "
+         << num_time_steps << " timesteps" << (langevin_on ? " with the Langevin thermostat" : "") << endl;
+    print(text.str());
+    return true;
+}
+
+void replica_batch::run()
+{
+    if (num_lanes == 0) {
+        return;
+    }
+    double start_time = omp_get_wtime();
+    calculate_forces(true, 0);
+    measure_temperature(0);
+    for (uint loop_num = 0; loop_num < num_time_steps; ) {
+        if (langevin_on) {
+            // BAOAB, as in mdsystem
+            kick (dt/2);
+            drift(dt/2);
+            apply_langevin_noise(loop_num);
+            drift(dt/2);
+        }
+        else {
+            // Velocity Verlet
+            kick (dt/2);
+            drift(dt);
+        }
+        loop_num++;
+        bool sampling = loop_num % sampling_period == 0;
+        calculate_forces(sampling, loop_num/sampling_period);
+        kick(dt/2);
+        if (sampling) {
+            measure_temperature(loop_num/sampling_period);
+        }
+    }
+    double run_time = omp_get_wtime() - start_time;
+    write_results();
+    print_summary(run_time);
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void replica_batch::init_particles()
+{
+    // The FCC lattice of mdsystem, the same in every replica
+    const uint n = box_size_in_lattice_constants;
+    const ftype offsets[4][3] = {{0, 0, 0}, {0, 0.5, 0.5}, {0.5, 0, 0.5}, {0.5, 0.5, 0}};
+    for (uint cell = 0; cell < n*n*n; cell++) {
+        uint cell_pos[3] = {cell % n, cell / n % n, cell / n / n};
+        for (uint k = 0; k < 4; k++) {
+            for (uint c = 0; c < 3; c++) {
+                for (uint lane = 0; lane < num_lanes; lane++) {
+                    pos[c][(4*cell + k)*num_lanes + lane] = (cell_pos[c] + offsets[k][c])*lattice_constant;
+                }
+            }
+        }
+    }
+
+    // Maxwell-Boltzmann distributed velocities, drawn as in mdsystem with the seed of the replica
+    for (uint lane = 0; lane < num_lanes; lane++) {
+        ftype sum_vel[3] = {0, 0, 0};
+        ftype sum_sqr_vel = 0;
+        for (uint i = 0; i < num_particles; i++) {
+            ftype gaussian[3];
+            philox_gaussian_vec3(seeds[lane], RS_VELOCITIES, uint32(i), 0, gaussian);
+            for (uint c = 0; c < 3; c++) {
+                vel[c][i*num_lanes + lane] = gaussian[c];
+                sum_vel[c]  += gaussian[c];
+                sum_sqr_vel += gaussian[c]*gaussian[c];
+            }
+        }
+
+        // Zero total momentum and exactly the initial temperature
+        ftype average_vel[3];
+        ftype vel_variance = sum_sqr_vel/num_particles;
+        for (uint c = 0; c < 3; c++) {
+            average_vel[c] = sum_vel[c]/num_particles;
+            vel_variance  -= average_vel[c]*average_vel[c];
+        }
+        ftype scale_factor = vel_variance > 0 ? sqrt(ftype(3.0) * init_temp / vel_variance) : 0;
+        for (uint i = 0; i < num_particles; i++) {
+            for (uint c = 0; c < 3; c++) {
+                vel[c][i*num_lanes + lane] = (vel[c][i*num_lanes + lane] - average_vel[c]) * scale_factor;
+            }
+        }
+    }
+}
+
+void replica_batch::calculate_forces(bool measure, uint sample)
+{
+    /*
+     * The same interaction in all replicas of a group at once. Every pair
+     * is visited once, in the same order in every replica, so a replica
+     * gets the same forces whatever group it is in.
+     */
+    const uint num_groups = num_lanes/SIMD_WIDTH;
+    const simd_ftype zero(0);
+    const simd_ftype box(box_size);
+    const simd_ftype pos_half_box(box_size/2);
+    const simd_ftype neg_half_box(-box_size/2);
+    const simd_ftype cutoff(sqr_cutoff);
+    const simd_ftype cutoff_energy(E_cutoff);
+
+    #pragma omp parallel for schedule(static) if (num_groups > 1)
+    for (int group = 0; group < int(num_groups); group++) {
+        const uint lane = uint(group)*SIMD_WIDTH;
+        for (uint i = 0; i < num_particles; i++) {
+            for (uint c = 0; c < 3; c++) {
+                zero.store(&acc[c][i*num_lanes + lane]);
+            }
+        }
+        simd_ftype Ep_sum     = zero;
+        simd_ftype virial_sum = zero;
+        for (uint i = 0; i < num_particles; i++) {
+            const uint index_i = i*num_lanes + lane;
+            simd_ftype pos_i[3], acc_i[3];
+            for (uint c = 0; c < 3; c++) {
+                pos_i[c] = simd_ftype::load(&pos[c][index_i]);
+                acc_i[c] = simd_ftype::load(&acc[c][index_i]);
+            }
+            for (uint j = i + 1; j < num_particles; j++) {
+                const uint index_j = j*num_lanes + lane;
+
+                // The closest image of the second particle
+                simd_ftype r[3];
+                for (uint c = 0; c < 3; c++) {
+                    r[c] = pos_i[c] - simd_ftype::load(&pos[c][index_j]);
+                    r[c] = select(less_than(pos_half_box, r[c]), r[c] - box, r[c]);
+                    r[c] = select(less_than(r[c], neg_half_box), r[c] + box, r[c]);
+                }
+                simd_ftype sqr_distance = r[0]*r[0] + r[1]*r[1] + r[2]*r[2];
+                simd_ftype inside       = less_than(sqr_distance, cutoff);
+                if (!any_set(inside)) {
+                    continue;
+                }
+
+                // The force over the distance, zero outside the cutoff
+                simd_ftype sqr_distance_inv = simd_ftype(1)/sqr_distance;
+                simd_ftype p = sqr_distance_inv*sqr_distance_inv*sqr_distance_inv;
+                simd_ftype force_over_distance = select(inside, simd_ftype(48)*sqr_distance_inv*p*(p - simd_ftype(0.5)), zero);
+                for (uint c = 0; c < 3; c++) {
+                    simd_ftype force = force_over_distance*r[c];
+                    acc_i[c] = acc_i[c] + force;
+                    (simd_ftype::load(&acc[c][index_j]) - force).store(&acc[c][index_j]);
+                }
+                if (measure) {
+                    Ep_sum     = Ep_sum + select(inside, simd_ftype(4)*p*(p - simd_ftype(1)) - cutoff_energy, zero);
+                    virial_sum = virial_sum + force_over_distance*sqr_distance;
+                }
+            }
+            for (uint c = 0; c < 3; c++) {
+                acc_i[c].store(&acc[c][index_i]);
+            }
+        }
+        if (measure) {
+            Ep_sum    .store(&sample_Ep    [sample*num_lanes + lane]);
+            virial_sum.store(&sample_virial[sample*num_lanes + lane]);
+        }
+    }
+}
+
+void replica_batch::measure_temperature(uint sample)
+{
+    const uint num_groups = num_lanes/SIMD_WIDTH;
+    for (uint group = 0; group < num_groups; group++) {
+        const uint lane = group*SIMD_WIDTH;
+        simd_ftype sum_sqr_vel(0);
+        for (uint i = 0; i < num_particles; i++) {
+            for (uint c = 0; c < 3; c++) {
+                simd_ftype v = simd_ftype::load(&vel[c][i*num_lanes + lane]);
+                sum_sqr_vel = sum_sqr_vel + v*v;
+            }
+        }
+        (sum_sqr_vel/simd_ftype(ftype(3 * num_particles))).store(&sample_temp[sample*num_lanes + lane]);
+    }
+}
+
+void replica_batch::kick(ftype time_step)
+{
+    const simd_ftype step(time_step);
+    for (uint c = 0; c < 3; c++) {
+        for (uint k = 0; k < num_particles*num_lanes; k += SIMD_WIDTH) {
+            (simd_ftype::load(&vel[c][k]) + step*simd_ftype::load(&acc[c][k])).store(&vel[c][k]);
+        }
+    }
+}
+
+void replica_batch::drift(ftype time_step)
+{
+    // Moves the particles and puts them back in the box
+    const simd_ftype step(time_step);
+    const simd_ftype zero(0);
+    const simd_ftype box(box_size);
+    for (uint c = 0; c < 3; c++) {
+        for (uint k = 0; k < num_particles*num_lanes; k += SIMD_WIDTH) {
+            simd_ftype x = simd_ftype::load(&pos[c][k]) + step*simd_ftype::load(&vel[c][k]);
+            x = select(less_than(x, zero), x + box, x);
+            x = select(less_than(x, box), x, x - box);
+            x.store(&pos[c][k]);
+        }
+    }
+}
+
+void replica_batch::apply_langevin_noise(uint32 step)
+{
+    // v = c1*v + c2*R, with the random numbers of mdsystem::apply_langevin_noise for the seed of each replica
+    const ftype c1 = exp(-dt/thermostat_time);
+    const ftype c2 = sqrt((1 - c1*c1) * (desired_temp > 0 ? desired_temp : 0));
+    for (uint i = 0; i < num_particles; i++) {
+        for (uint lane = 0; lane < num_lanes; lane++) {
+            ftype gaussian[3];
+            philox_gaussian_vec3(seeds[lane], RS_LANGEVIN, i, step, gaussian);
+            for (uint c = 0; c < 3; c++) {
+                ftype &v = vel[c][i*num_lanes + lane];
+                v = c1*v + c2*gaussian[c];
+            }
+        }
+    }
+}
+
+ftype replica_batch::result_value(uint column, uint sample, uint lane) const
+{
+    // The potential energy is shifted as in the results of mdsystem, by the first sample
+    uint  i   = sample*num_lanes + lane;
+    ftype V   = box_size*box_size*box_size;
+    ftype Ek  = ftype(1.5)*num_particles*sample_temp[i];
+    ftype Ep  = sample_Ep[i] - sample_Ep[lane];
+    switch (column) {
+    case RC_TOTAL_ENERGY    : return (Ek + Ep)*epsilon_in_j/P_SI_EV;
+    case RC_KINETIC_ENERGY  : return Ek*epsilon_in_j/P_SI_EV;
+    case RC_POTENTIAL_ENERGY: return Ep*epsilon_in_j/P_SI_EV;
+    case RC_COHESIVE_ENERGY : return -sample_Ep[i]/num_particles*epsilon_in_j/P_SI_EV;
+    case RC_TEMPERATURE     : return sample_temp[i]*epsilon_in_j/P_SI_KB;
+    case RC_PRESSURE        : return (num_particles*sample_temp[i]/V + sample_virial[i]/(3*V))*epsilon_in_j/(sigma_in_m*sigma_in_m*sigma_in_m);
+    }
+    return 0;
+}
+
+void replica_batch::write_results()
+{
+    // The mean over the replicas of every sample and its standard error
+    ftype time_unit = sqrt(particle_mass_in_kg * sigma_in_m * sigma_in_m / epsilon_in_j);
+    stringstream text;
+    text << setprecision(9) << "# time [s]";
+    for (uint k = 0; k < num_batch_columns; k++) {
+        text << "\t" << mdsystem::get_result_name(batch_columns[k]) << "\terror";
+    }
+    text << "\n";
+    for (uint sample = 0; sample < num_samples; sample++) {
+        text << sample*sampling_period*dt*time_unit;
+        for (uint k = 0; k < num_batch_columns; k++) {
+            ftype sum = 0;
+            for (uint lane = 0; lane < num_replicas; lane++) {
+                sum += result_value(batch_columns[k], sample, lane);
+            }
+            ftype mean = sum/num_replicas;
+            ftype sqr_deviation_sum = 0;
+            for (uint lane = 0; lane < num_replicas; lane++) {
+                ftype deviation = result_value(batch_columns[k], sample, lane) - mean;
+                sqr_deviation_sum += deviation*deviation;
+            }
+            text << "\t" << mean << "\t";
+            if (num_replicas > 1) text << sqrt(sqr_deviation_sum/(num_replicas - 1)/num_replicas);
+            else                  text << "nan";
+        }
+        text << "\n";
+    }
+
+    string contents = text.str();
+    async_writer writer;
+    uint file = writer.open_replacing((output_directory.empty() ? string(".") : output_directory) + "/Batch.txt");
+    writer.write(file, contents.data(), contents.size());
+    writer.close(file);
+    writer.wait();
+    string errors;
+    if (writer.take_errors(errors)) {
+        print(errors);
+    }
+}
+
+void replica_batch::print_summary(double run_time)
+{
+    /*
+     * The mean of every replica over the run, without the first sixth like
+     * mdsystem::get_result_mean, and the mean and standard error of those.
+     */
+    uint first = num_samples/6;
+    stringstream text;
+    text << "*******************" << endl;
+    text << "Batch means:" << endl;
+    for (uint k = 0; k < num_batch_columns; k++) {
+        vector<ftype> means(num_replicas, 0);
+        ftype sum = 0;
+        for (uint lane = 0; lane < num_replicas; lane++) {
+            for (uint sample = first; sample < num_samples; sample++) {
+                means[lane] += result_value(batch_columns[k], sample, lane);
+            }
+            means[lane] /= num_samples - first;
+            sum += means[lane];
+        }
+        ftype mean = sum/num_replicas;
+        ftype sqr_deviation_sum = 0;
+        for (uint lane = 0; lane < num_replicas; lane++) {
+            sqr_deviation_sum += (means[lane] - mean)*(means[lane] - mean);
+        }
+        text << "  " << mdsystem::get_result_name(batch_columns[k]) << " = " << setprecision(6) << mean;
+        if (num_replicas > 1) {
+            text << " +- " << setprecision(3) << sqrt(sqr_deviation_sum/(num_replicas - 1)/num_replicas);
+        }
+        text << endl;
+    }
+    text << "Throughput: " << setprecision(4) << run_time << " s";
+    if (run_time > 0) {
+        text << ", " << double(num_time_steps)*num_replicas/run_time << " replica timesteps/s, "
+             << double(num_time_steps)*num_replicas*num_particles/run_time << " particle timesteps/s";
+    }
+    text << endl;
+    print(text.str());
+}
+
+void replica_batch::print(const string &text)
+{
+    if (output_callback.func) {
+        output_callback.func(output_callback.param, text);
+    }
+}
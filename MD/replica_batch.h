@@ -0,0 +1,96 @@
+#ifndef  REPLICA_BATCH_H
+#define  REPLICA_BATCH_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "callback.h"
+#include "run_parameters.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Many independent copies of one small system, advanced in lockstep with
+ * the copy as the SIMD lane. A system of a hundred atoms is far too small
+ * to spread over threads or SIMD lanes on its own, but the same pair of
+ * atoms in 16 copies is 16 independent pair interactions. All copies are
+ * stored together, structure of arrays with the copies innermost
+ * (pos[c][i*num_lanes + lane]), so one code path for the forces and the
+ * integration handles all of them, a SIMD register of copies at a time.
+ * The groups of copies are spread over the cores.
+ *
+ * The copies only differ in their random seeds (the velocities and the
+ * Langevin noise, drawn the same way as in mdsystem). All pairs are
+ * interacting through the Lennard-Jones potential with the minimum image
+ * convention, as in mdsystem; there is no Verlet list. The integration is
+ * velocity Verlet, or BAOAB with the Langevin thermostat. Batch.txt gets
+ * the mean over the copies of every sample, with the standard error of
+ * that mean as the error bar.
+ */
+class replica_batch
+{
+public:
+    // Constructor
+    replica_batch();
+
+    void set_output_callback (callback<void (*)(void*, string)> output_callback_in);
+    void set_output_directory(const string &output_directory_in);
+    bool init(const run_parameters &parameters, uint first_seed, uint num_replicas_in, string &error); // Replica k gets the seed first_seed + k
+    void run ();
+
+private:
+    callback<void (*)(void*, string)> output_callback;
+    string output_directory;
+    // Conversion between reduced units and SI units
+    ftype particle_mass_in_kg;
+    ftype epsilon_in_j;
+    ftype sigma_in_m;
+    // The system, in reduced units
+    uint  num_replicas;
+    uint  num_lanes;         // num_replicas rounded up to whole SIMD registers; the extra lanes repeat the last replica
+    uint  num_particles;
+    ftype lattice_constant;
+    uint  box_size_in_lattice_constants;
+    ftype box_size;
+    ftype dt;
+    ftype sqr_cutoff;
+    ftype E_cutoff;
+    bool  langevin_on;
+    ftype init_temp;
+    ftype desired_temp;
+    ftype thermostat_time;
+    uint  num_time_steps;
+    uint  sampling_period;
+    uint  num_samples;
+    vector<uint>  seeds;     // Of each lane
+    vector<ftype> pos[3];    // [i*num_lanes + lane]
+    vector<ftype> vel[3];
+    vector<ftype> acc[3];
+    // Per lane and sample [sample*num_lanes + lane]
+    vector<ftype> sample_Ep;
+    vector<ftype> sample_virial; // Sum of distance times force
+    vector<ftype> sample_temp;
+
+    void  init_particles();
+    void  calculate_forces(bool measure, uint sample);
+    void  measure_temperature(uint sample);
+    void  kick (ftype time_step);
+    void  drift(ftype time_step);
+    void  apply_langevin_noise(uint32 step);
+    bool  has_column(uint column) const;
+    ftype result_value(uint column, uint sample, uint lane) const; // In SI units
+    void  write_results();
+    void  print_summary(double run_time);
+    void  print(const string &text);
+};
+
+#endif  /* REPLICA_BATCH_H */
@@ -0,0 +1,307 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <iomanip>
+#include <cmath>
+#include <omp.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
+
+// Own includes
+#include "replica_exchange.h"
+#include "work_stealing_pool.h"
+#include "async_writer.h"
+#include "philox.h"
+
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+static void make_directory(const string &path)
+{
+#ifndef _WIN32
+    mkdir(path.c_str(), 0777);
+#else
+    _mkdir(path.c_str());
+#endif
+}
+
+/* The output of one replica goes to Output.txt in its directory */
+static void write_to_file(void* ptr, string output)
+{
+    *(std::ofstream*)ptr << output << std::flush;
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR AND DESTRUCTOR
+////////////////////////////////////////////////////////////////
+
+replica_exchange::replica_exchange()
+{
+    exchange_period = 100;
+    random_seed     = 0;
+    num_workers     = 0;
+}
+
+replica_exchange::~replica_exchange()
+{
+    delete_replicas();
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void replica_exchange::set_output_callback(callback<void (*)(void*, string)> output_callback_in)
+{
+    output_callback = output_callback_in;
+}
+
+void replica_exchange::add_replica(const run_parameters &parameters_in)
+{
+    parameters.push_back(parameters_in);
+}
+
+void replica_exchange::set_exchange_period(uint num_timesteps)
+{
+    exchange_period = num_timesteps;
+}
+
+void replica_exchange::set_random_seed(uint random_seed_in)
+{
+    random_seed = random_seed_in;
+}
+
+void replica_exchange::set_num_workers(uint num_workers_in)
+{
+    num_workers = num_workers_in;
+}
+
+void replica_exchange::set_output_directory(const string &output_directory_in)
+{
+    output_directory = output_directory_in;
+}
+
+bool replica_exchange::run(string &error)
+{
+    uint num_replicas = parameters.size();
+    if (num_replicas < 2) {
+        error = "Replica exchange needs at least two temperatures";
+        return false;
+    }
+    for (uint k = 0; k < num_replicas; k++) {
+        const run_parameters &p = parameters[k];
+        if (!p.thermostat_on || p.thermostat_type == NO_THERMOSTAT || p.barostat_on || p.energy_minimization) {
+            error = "Replica exchange needs the thermostat on, and no barostat or energy minimization";
+            return false;
+        }
+        if (k > 0 && p.desired_temp <= parameters[k - 1].desired_temp) {
+            error = "The temperatures of the replicas have to increase";
+            return false;
+        }
+        if (p.num_particles != parameters[0].num_particles || p.sample_period != parameters[0].sample_period || p.num_time_steps != parameters[0].num_time_steps) {
+            error = "The replicas differ in more than the temperature";
+            return false;
+        }
+        parameters[k].Ep_on = true; // The exchanges need the potential energy
+    }
+
+    // The exchanges are made on sampling timesteps, where the potential energy is measured
+    uint sample_period = parameters[0].sample_period;
+    uint period = (exchange_period + sample_period - 1)/sample_period*sample_period;
+    if (period == 0) {
+        period = sample_period;
+    }
+
+    delete_replicas();
+    replica_time.assign(num_replicas, 0);
+    num_attempts.assign(num_replicas - 1, 0);
+    num_accepted.assign(num_replicas - 1, 0);
+    replica_at.resize(num_replicas);
+    exchanges.str("");
+    exchanges << "# timestep";
+    for (uint t = 0; t < num_replicas; t++) {
+        replica_at[t] = t;
+        exchanges << "\t" << setprecision(6) << parameters[t].desired_temp << " K";
+    }
+    exchanges << "\n0";
+    for (uint t = 0; t < num_replicas; t++) {
+        exchanges << "\t" << t;
+    }
+    exchanges << "\n";
+    for (uint k = 0; k < num_replicas; k++) {
+        make_directory(replica_directory(k));
+        logs    .push_back(new std::ofstream((replica_directory(k) + "/Output.txt").c_str()));
+        replicas.push_back(new mdsystem);
+        replicas[k]->set_output_callback(callback<void (*)(void*, string)>(write_to_file, logs[k]));
+        replicas[k]->set_output_directory(replica_directory(k));
+        replicas[k]->set_random_seed(random_seed + k);
+    }
+
+    // Every replica gets its share of the cores
+    uint num_cores = uint(omp_get_num_procs());
+    int  num_threads_before = omp_get_max_threads();
+    work_stealing_pool pool(num_workers > 0 ? num_workers : (num_cores < num_replicas ? num_cores : num_replicas));
+    uint num_concurrent = pool.get_num_workers() < num_replicas ? pool.get_num_workers() : num_replicas;
+    uint num_threads    = num_cores/num_concurrent > 0 ? num_cores/num_concurrent : 1;
+    {
+        stringstream text;
+        text << num_replicas << " replicas from " << setprecision(6) << parameters[0].desired_temp << " K to "
+             << parameters[num_replicas - 1].desired_temp << " K on " << pool.get_num_workers() << " workers, "
+             << num_threads << (num_threads == 1 ? " thread" : " threads") << " each, exchanges every " << period << " timesteps" << endl;
+        print(text.str());
+    }
+
+    // Init
+    vector<char> initialized(num_replicas, 0);
+    for (uint k = 0; k < num_replicas; k++) {
+        pool.submit([this, k, num_threads, &initialized]() {
+            omp_set_num_threads(int(num_threads));
+            initialized[k] = init_with_parameters(*replicas[k], parameters[k]);
+            if (initialized[k] && parameters[k].monte_carlo) {
+                replicas[k]->run_monte_carlo_equilibration(200, ftype(0.1)); // [Angstrom]
+            }
+        });
+    }
+    pool.run();
+    for (uint k = 0; k < num_replicas; k++) {
+        if (!initialized[k]) {
+            error = "Replica " + replica_directory(k) + " could not be initialized, see its Output.txt";
+            omp_set_num_threads(num_threads_before);
+            return false;
+        }
+    }
+
+    // Simulate one exchange period at a time
+    uint num_time_steps = replicas[0]->get_max_loops_num();
+    uint exchange_num   = 0;
+    for (uint pause_loop_num = period; ; pause_loop_num += period) {
+        if (pause_loop_num > num_time_steps) {
+            pause_loop_num = num_time_steps;
+        }
+        for (uint k = 0; k < num_replicas; k++) {
+            pool.submit([this, k, num_threads, pause_loop_num]() {
+                omp_set_num_threads(int(num_threads));
+                double start_time = omp_get_wtime();
+                replicas[k]->run_simulation_until(pause_loop_num);
+                replica_time[k] += omp_get_wtime() - start_time;
+            });
+        }
+        pool.run();
+        if (pause_loop_num == num_time_steps) {
+            break;
+        }
+        attempt_exchanges(exchange_num++);
+        exchanges << pause_loop_num;
+        for (uint t = 0; t < num_replicas; t++) {
+            exchanges << "\t" << replica_at[t];
+        }
+        exchanges << "\n";
+    }
+    omp_set_num_threads(num_threads_before); // The calling thread was one of the workers
+
+    // Close the logs and wait for the results to be written
+    delete_replicas();
+    string contents = exchanges.str();
+    async_writer writer;
+    uint file = writer.open_replacing((output_directory.empty() ? string(".") : output_directory) + "/Exchanges.txt");
+    writer.write(file, contents.data(), contents.size());
+    writer.close(file);
+    writer.wait();
+    string errors;
+    if (writer.take_errors(errors)) {
+        print(errors);
+    }
+    print_statistics(num_time_steps);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+string replica_exchange::replica_directory(uint replica) const
+{
+    stringstream directory;
+    directory << (output_directory.empty() ? string(".") : output_directory) << "/Replica" << replica;
+    return directory.str();
+}
+
+void replica_exchange::attempt_exchanges(uint exchange_num)
+{
+    // The even pairs (0-1, 2-3, ...) and the odd pairs (1-2, 3-4, ...) take turns
+    for (uint t = exchange_num % 2; t + 1 < replica_at.size(); t += 2) {
+        mdsystem &cold = *replicas[replica_at[t    ]];
+        mdsystem &hot  = *replicas[replica_at[t + 1]];
+        ftype cold_temp = cold.get_desired_temperature();
+        ftype hot_temp  = hot .get_desired_temperature();
+        ftype delta = (1/(P_SI_KB*cold_temp) - 1/(P_SI_KB*hot_temp)) * (cold.get_potential_energy() - hot.get_potential_energy());
+        uint32 words[4];
+        philox4x32(exchange_num, t, 0, 0, random_seed, RS_REPLICA_EXCHANGE, words);
+        num_attempts[t]++;
+        if (delta >= 0 || uniform_from_uint32(words[0]) < exp(delta)) {
+            cold.exchange_temperature(hot_temp);
+            hot .exchange_temperature(cold_temp);
+            uint replica      = replica_at[t];
+            replica_at[t]     = replica_at[t + 1];
+            replica_at[t + 1] = replica;
+            num_accepted[t]++;
+        }
+    }
+}
+
+void replica_exchange::print_statistics(uint num_time_steps)
+{
+    stringstream text;
+    text << "*******************" << endl;
+    text << "Exchanges accepted:" << endl;
+    for (uint t = 0; t + 1 < parameters.size(); t++) {
+        text << "  " << setprecision(6) << parameters[t].desired_temp << " K <-> " << parameters[t + 1].desired_temp << " K: "
+             << num_accepted[t] << "/" << num_attempts[t];
+        if (num_attempts[t] > 0) {
+            text << " (" << setprecision(3) << 100.0*num_accepted[t]/num_attempts[t] << " %)";
+        }
+        text << endl;
+    }
+    text << "Throughput:" << endl;
+    for (uint k = 0; k < parameters.size(); k++) {
+        text << "  Replica" << k << ": " << setprecision(4) << replica_time[k] << " s, ";
+        if (replica_time[k] > 0) {
+            text << num_time_steps/replica_time[k] << " timesteps/s, "
+                 << double(num_time_steps)*parameters[k].num_particles/replica_time[k] << " particle timesteps/s";
+        }
+        text << endl;
+    }
+    text << "Final temperatures:";
+    for (uint t = 0; t < replica_at.size(); t++) {
+        text << " Replica" << replica_at[t] << " " << setprecision(6) << parameters[t].desired_temp << " K" << (t + 1 < replica_at.size() ? "," : "");
+    }
+    text << endl;
+    print(text.str());
+}
+
+void replica_exchange::print(const string &text)
+{
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (output_callback.func) {
+        output_callback.func(output_callback.param, text);
+    }
+}
+
+void replica_exchange::delete_replicas()
+{
+    // The replicas wait for their results to be written before the logs are closed
+    for (uint k = 0; k < replicas.size(); k++) {
+        delete replicas[k];
+    }
+    for (uint k = 0; k < logs.size(); k++) {
+        delete logs[k];
+    }
+    replicas.clear();
+    logs.clear();
+}
@@ -0,0 +1,80 @@
+#ifndef  REPLICA_EXCHANGE_H
+#define  REPLICA_EXCHANGE_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <mutex>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "callback.h"
+#include "run_parameters.h"
+#include "mdsystem.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Replica exchange molecular dynamics, or parallel tempering (Sugita &
+ * Okamoto, 1999). The same system is simulated at a ladder of temperatures,
+ * one mdsystem per temperature, side by side on a work_stealing_pool. Every
+ * exchange period, neighbouring temperatures i and j try to swap replicas,
+ * and the swap is accepted with the probability
+ *   min(1, exp((1/kT_i - 1/kT_j)(Ep_i - Ep_j)))
+ * from the potential energies of the latest samples. The even and the odd
+ * pairs take turns. A swap only exchanges the temperatures of the two
+ * replicas and scales their velocities, the particles stay where they are.
+ * A replica stuck in a metastable state at a low temperature can so get
+ * out of it at a higher one, which matters for melting and solidification.
+ *
+ * Every replica writes its results in a directory of its own; the results
+ * follow the replica, not the temperature. Exchanges.txt tells which
+ * replica was at which temperature after every exchange.
+ */
+class replica_exchange
+{
+public:
+    // Constructor and destructor
+    replica_exchange();
+    ~replica_exchange();
+
+    void set_output_callback(callback<void (*)(void*, string)> output_callback_in);
+    void add_replica        (const run_parameters &parameters); // One per temperature (desired_temp), in increasing order
+    void set_exchange_period(uint num_timesteps);               // Rounded up to whole sampling periods
+    void set_random_seed    (uint random_seed_in);              // Replica k uses random_seed_in + k
+    void set_num_workers    (uint num_workers_in);              // 0 for one per core
+    void set_output_directory(const string &output_directory_in); // Has to exist
+    bool run(string &error);
+
+private:
+    callback<void (*)(void*, string)> output_callback;
+    std::mutex               output_mutex;
+    vector<run_parameters>   parameters;     // Of each replica
+    vector<mdsystem*>        replicas;
+    vector<std::ofstream*>   logs;           // Output.txt of each replica
+    vector<double>           replica_time;   // [s] Of wall-clock time spent simulating each replica
+    vector<uint>             replica_at;     // The replica at each temperature
+    vector<uint>             num_attempts;   // Of each pair of neighbouring temperatures
+    vector<uint>             num_accepted;
+    std::stringstream        exchanges;      // Contents of Exchanges.txt
+    uint                     exchange_period;
+    uint                     random_seed;
+    uint                     num_workers;
+    string                   output_directory;
+
+    string replica_directory(uint replica) const;
+    void   attempt_exchanges(uint exchange_num);
+    void   print_statistics(uint num_time_steps);
+    void   print(const string &text);
+    void   delete_replicas();
+};
+
+#endif  /* REPLICA_EXCHANGE_H */
@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Own includes
+#include "run_parameters.h"
+#include "mdsystem.h"
+
+////////////////////////////////////////////////////////////////
+// FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool read_run_parameters(const settings &run_settings, run_parameters &parameters, string &error)
+{
+    run_parameters &p = parameters;
+
+    // Element
+    p.sigma            = run_settings.number("Sigma"           , 0);
+    p.epsilon          = run_settings.number("Epsilon"         , 0);
+    p.mass             = run_settings.number("Mass"            , 0);
+    p.lattice_constant = run_settings.number("Lattice constant", 0);
+    if (p.sigma <= 0 || p.epsilon <= 0 || p.mass <= 0 || p.lattice_constant <= 0) {
+        error = "Sigma, Epsilon, Mass and Lattice constant are needed (from the element file)";
+        return false;
+    }
+    string lattice_type = run_settings.text("Lattice type", "FCC");
+    if (lattice_type != "FCC") {
+        error = "Unknown lattice type " + lattice_type;
+        return false;
+    }
+    p.lattice_type = LT_FCC;
+
+    // Ensemble, the flags below can still turn the thermostat on or off
+    string constants = run_settings.text("Constants", "NVT");
+    if (constants != "NVE" && constants != "NVT" && constants != "NPE" && constants != "NPT") {
+        error = "Constants has to be NVE, NVT, NPE or NPT";
+        return false;
+    }
+    p.thermostat_on = run_settings.flag("Thermostat on", constants[2] == 'T');
+    p.barostat_on   = constants[1] == 'P';
+
+    // Thermostat and filter
+    string thermostat = run_settings.text("Thermostat type", "Nose-Hoover");
+    if      (thermostat == "None"       ) p.thermostat_type = NO_THERMOSTAT;
+    else if (thermostat == "Berendsen"  ) p.thermostat_type = BERENDSEN_THERMOSTAT;
+    else if (thermostat == "Nose-Hoover") p.thermostat_type = NOSE_HOOVER_THERMOSTAT;
+    else if (thermostat == "Langevin"   ) p.thermostat_type = LANGEVIN_THERMOSTAT;
+    else {
+        error = "Thermostat type has to be None, Berendsen, Nose-Hoover or Langevin";
+        return false;
+    }
+    string filter = run_settings.text("Filter", "Exponential decay");
+    if      (filter == "Exponential decay") p.filter_type = TWO_SIDED_EXPONENTIAL_DECAY_FILTER;
+    else if (filter == "Ensemble average" ) p.filter_type = ENSEMBLE_AVERAGE_FILTER;
+    else {
+        error = "Filter has to be Exponential decay or Ensemble average";
+        return false;
+    }
+
+    // The rest, with the defaults of the GUI
+    p.dt                  = run_settings.number("dt"                         , ftype(1.0) * P_SI_FS);
+    p.temperature         = run_settings.number("Initial temperature"        , 300);
+    p.desired_temp        = run_settings.number("Desired temperature"        , p.temperature);
+    p.desired_pressure    = run_settings.number("Desired pressure"           , 101325);
+    p.thermostat_time     = run_settings.number("Thermostat time"            , ftype(500) * P_SI_FS);
+    p.barostat_time       = run_settings.number("Barostat time"              , ftype(1000) * P_SI_FS);
+    p.compressibility     = run_settings.number("Compressibility"            , ftype(1e-11));
+    p.decay_time          = run_settings.number("Impulse response decay time", ftype(100) * P_SI_FS);
+    p.inner_cutoff        = run_settings.number("Inner cutoff"               , ftype(2.5) * p.sigma);
+    p.outer_cutoff        = run_settings.number("Outer cutoff"               , ftype(1.1) * p.inner_cutoff);
+    p.dEp_tolerance       = run_settings.number("dEp tolerance"              , ftype(1.0));
+    p.num_particles       = uint(run_settings.number("Number of particles"   , 5000));
+    p.sample_period       = uint(run_settings.number("Sampling period"       , 5));
+    p.num_time_steps      = uint(run_settings.number("Number of timesteps"   , 500));
+    p.ensemble_size       = uint(run_settings.number("Ensemble size"         , 50));
+    p.num_times_filtering = uint(run_settings.number("Number of filterings"  , 1));
+    p.energy_minimization = run_settings.flag("Energy minimization on", false);
+    p.relax_box           = run_settings.flag("Relax box on"          , true);
+    p.monte_carlo         = run_settings.flag("Monte Carlo on"        , false);
+    p.diff_c_on           = run_settings.flag("Diff c on"  , true);
+    p.Cv_on               = run_settings.flag("Cv on"      , true);
+    p.pressure_on         = run_settings.flag("Pressure on", true);
+    p.msd_on              = run_settings.flag("MSD on"     , true);
+    p.Ep_on               = run_settings.flag("Ep on"      , true);
+    p.Ep_on               = run_settings.flag("Ec on"      , false) || p.Ep_on; // The cohesive energy comes with the potential energy
+    p.Ek_on               = run_settings.flag("Ek on"      , true);
+    p.positions_on        = run_settings.flag("Particle positions on", false);
+    if (p.filter_type == TWO_SIDED_EXPONENTIAL_DECAY_FILTER) {
+        p.ensemble_size = 0; // Is never used
+    }
+    return true;
+}
+
+bool init_with_parameters(mdsystem &simulation, const run_parameters &parameters)
+{
+    const run_parameters &p = parameters;
+    simulation.set_trajectory_output(p.positions_on, 10, ftype(1e-4)); // Every 10th timestep, 1e-4 box sizes
+    simulation.init(p.num_particles, p.sigma, p.epsilon, p.inner_cutoff, p.outer_cutoff, p.mass, p.dt, p.ensemble_size, p.sample_period, p.temperature, p.num_time_steps, p.lattice_constant, p.lattice_type, p.desired_temp, p.thermostat_time, p.thermostat_type, p.dEp_tolerance, p.filter_type, p.decay_time, p.num_times_filtering, false, p.thermostat_on, p.diff_c_on, p.Cv_on, p.pressure_on, p.msd_on, p.Ep_on, p.Ek_on);
+    if (!simulation.is_initialized()) {
+        return false;
+    }
+    simulation.set_barostat(p.barostat_on, p.desired_pressure, p.barostat_time, p.compressibility);
+    return true;
+}
+
+bool run_with_parameters(mdsystem &simulation, const run_parameters &parameters)
+{
+    const run_parameters &p = parameters;
+    if (!init_with_parameters(simulation, p)) {
+        return false;
+    }
+    if (p.energy_minimization) {
+        simulation.run_energy_minimization(1000, ftype(1e-4), p.relax_box, ftype(1e5)); // [eV/A], [Pa]
+    }
+    else {
+        if (p.monte_carlo) {
+            simulation.run_monte_carlo_equilibration(200, ftype(0.1)); // [Angstrom]
+        }
+        simulation.run_simulation();
+    }
+    return true;
+}
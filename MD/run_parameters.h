@@ -0,0 +1,80 @@
+#ifndef  RUN_PARAMETERS_H
+#define  RUN_PARAMETERS_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <string>
+using std::string;
+
+#include "definitions.h"
+#include "settings.h"
+
+class mdsystem;
+
+////////////////////////////////////////////////////////////////
+// STRUCT
+////////////////////////////////////////////////////////////////
+
+/*
+ * Everything that is given to mdsystem for one run, in SI units. The
+ * settings that are not in the files get the defaults of the GUI.
+ */
+struct run_parameters
+{
+    // Element
+    ftype sigma;
+    ftype epsilon;
+    ftype mass;
+    ftype lattice_constant;
+    uint  lattice_type;        // (enum_lattice_types)
+    // Simulation
+    uint  num_particles;
+    uint  num_time_steps;
+    ftype dt;
+    ftype temperature;         // Initial temperature
+    ftype desired_temp;
+    ftype inner_cutoff;
+    ftype outer_cutoff;
+    ftype dEp_tolerance;
+    // Sampling and filtering
+    uint  sample_period;
+    uint  ensemble_size;
+    uint  filter_type;         // (enum_filter_types)
+    ftype decay_time;          // Impulse response decay time of the filter
+    uint  num_times_filtering;
+    // Control
+    bool  thermostat_on;
+    uint  thermostat_type;     // (enum_thermostat_types)
+    ftype thermostat_time;
+    bool  barostat_on;
+    ftype desired_pressure;
+    ftype barostat_time;
+    ftype compressibility;
+    bool  energy_minimization; // Relax the system at 0 K instead of running the simulation
+    bool  relax_box;
+    bool  monte_carlo;         // Equilibrate with Monte Carlo before the simulation
+    // Measurement
+    bool  diff_c_on;
+    bool  Cv_on;
+    bool  pressure_on;
+    bool  msd_on;
+    bool  Ep_on;
+    bool  Ek_on;
+    bool  positions_on;        // Write the trajectory
+};
+
+////////////////////////////////////////////////////////////////
+// FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool read_run_parameters(const settings &run_settings, run_parameters &parameters, string &error);
+
+/* init and the barostat. False if init failed */
+bool init_with_parameters(mdsystem &simulation, const run_parameters &parameters);
+
+/* init followed by the energy minimization or the (Monte Carlo and) simulation. False if init failed */
+bool run_with_parameters(mdsystem &simulation, const run_parameters &parameters);
+
+#endif  /* RUN_PARAMETERS_H */
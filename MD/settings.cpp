@@ -1,5 +1,312 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+// Own includes
 #include "settings.h"
 
+////////////////////////////////////////////////////////////////
+// UNITS
+////////////////////////////////////////////////////////////////
+
+struct unit
+{
+    const char *name;
+    ftype       value; // [SI units]
+};
+
+static const unit units[] = {
+    {"m"       , 1                    },
+    {"nm"      , ftype(1e-9)          },
+    {"A"       , P_SI_ANGSTROM        },
+    {"Angstrom", P_SI_ANGSTROM        },
+    {"J"       , 1                    },
+    {"eV"      , P_SI_EV              },
+    {"erg"     , P_SI_ERG             },
+    {"kg"      , 1                    },
+    {"u"       , P_SI_U               },
+    {"s"       , 1                    },
+    {"ps"      , ftype(1e-12)         },
+    {"fs"      , P_SI_FS              },
+    {"K"       , 1                    },
+    {"Pa"      , 1                    },
+    {"bar"     , ftype(1e5)           },
+    {"atm"     , ftype(101325)        },
+    {"1/Pa"    , 1                    }
+};
+
+/* The unit of numbers given without one, either a unit or another setting */
+static const char *const default_units[][2] = {
+    {"sigma"                      , "A"           },
+    {"epsilon"                    , "eV"          },
+    {"mass"                       , "u"           },
+    {"lattice constant"           , "A"           },
+    {"dt"                         , "fs"          },
+    {"thermostat time"            , "fs"          },
+    {"barostat time"              , "fs"          },
+    {"impulse response decay time", "fs"          },
+    {"inner cutoff"               , "sigma"       },
+    {"outer cutoff"               , "inner cutoff"}
+};
+
+static string trim(const string &s)
+{
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == string::npos) {
+        return "";
+    }
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+static string to_lower(string s)
+{
+    for (uint i = 0; i < s.size(); i++) {
+        s[i] = char(tolower((unsigned char)s[i]));
+    }
+    return s;
+}
+
+static bool find_unit(const string &name, ftype &value)
+{
+    for (uint i = 0; i < sizeof(units)/sizeof(units[0]); i++) {
+        if (name == units[i].name) {
+            value = units[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
 settings::settings()
 {
 }
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void settings::set_override(const string &name, const string &expression)
+{
+    overrides[to_lower(trim(name))] = trim(expression);
+}
+
+bool settings::read(const string &path, const string &elements_directory, string &error)
+{
+    values.clear();
+    names.clear();
+    string directory = elements_directory;
+    if (directory.empty()) {
+        // Resources/Simulations/<file> uses Resources/Elements
+        size_t slash = path.find_last_of("/\\");
+        directory = (slash == string::npos ? string(".") : path.substr(0, slash)) + "/../Elements";
+    }
+    if (!read_file(path, directory, error)) {
+        return false;
+    }
+    // The overridden settings that were not in the files come last
+    for (map<string, string>::const_iterator i = overrides.begin(); i != overrides.end(); i++) {
+        if (values.find(i->first) != values.end()) {
+            continue;
+        }
+        setting value;
+        if (!evaluate(i->first, i->second, value, error)) {
+            error = "Override of " + i->first + ": " + error;
+            return false;
+        }
+        names.push_back(i->first);
+        values[i->first] = value;
+    }
+    return true;
+}
+
+bool settings::has(const string &name) const
+{
+    return values.find(to_lower(name)) != values.end();
+}
+
+ftype settings::number(const string &name, ftype default_value) const
+{
+    map<string, setting>::const_iterator i = values.find(to_lower(name));
+    if (i == values.end() || !i->second.is_number) {
+        return default_value;
+    }
+    i->second.used = true;
+    return i->second.number;
+}
+
+bool settings::flag(const string &name, bool default_value) const
+{
+    return number(name, default_value ? 1 : 0) != 0;
+}
+
+string settings::text(const string &name, const string &default_value) const
+{
+    map<string, setting>::const_iterator i = values.find(to_lower(name));
+    if (i == values.end() || i->second.is_number) {
+        return default_value;
+    }
+    i->second.used = true;
+    return i->second.text;
+}
+
+vector<string> settings::unused_names() const
+{
+    vector<string> unused;
+    for (uint i = 0; i < names.size(); i++) {
+        if (!values.find(to_lower(names[i]))->second.used) {
+            unused.push_back(names[i]);
+        }
+    }
+    return unused;
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool settings::read_file(const string &path, const string &elements_directory, string &error)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + " could not be opened";
+        return false;
+    }
+    string line;
+    uint   line_num = 0;
+    while (getline(file, line)) {
+        line_num++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        std::stringstream location;
+        location << path << ":" << line_num << ": ";
+        size_t separator = line.find_first_of(":=");
+        string name       = separator == string::npos ? "" : trim(line.substr(0, separator));
+        string expression = separator == string::npos ? "" : trim(line.substr(separator + 1));
+        if (name.empty() || expression.empty()) {
+            error = location.str() + "Expected \"Name: value\"";
+            return false;
+        }
+        string key = to_lower(name);
+        map<string, string>::const_iterator overridden = overrides.find(key);
+        if (overridden != overrides.end()) {
+            expression = overridden->second;
+        }
+        setting value;
+        if (!evaluate(name, expression, value, error)) {
+            error = location.str() + error;
+            return false;
+        }
+        if (values.find(key) == values.end()) {
+            names.push_back(name);
+        }
+        values[key] = value;
+
+        if (key == "element") {
+            values[key].used = true;
+            if (value.is_number) {
+                error = location.str() + "Expected the name of an element";
+                return false;
+            }
+            if (!read_file(elements_directory + "/" + value.text + ".txt", elements_directory, error)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool settings::evaluate(const string &name, const string &expression, setting &value, string &error) const
+{
+    value.is_number = true;
+    value.number    = 1;
+    value.used      = false;
+    bool plain = true; // Only numbers without units, which get the default unit
+
+    std::stringstream factors(expression);
+    string factor;
+    uint   num_factors = 0;
+    while (getline(factors, factor, '*')) {
+        factor = trim(factor);
+        num_factors++;
+        bool negated = false;
+        while (!factor.empty() && factor[0] == '!') {
+            negated = !negated;
+            factor = trim(factor.substr(1));
+        }
+
+        ftype factor_value;
+        char *end;
+        double number = strtod(factor.c_str(), &end);
+        map<string, setting>::const_iterator earlier = values.find(to_lower(factor));
+        if (to_lower(factor) == "true" || to_lower(factor) == "false") {
+            factor_value = to_lower(factor) == "true" ? 1 : 0;
+        }
+        else if (end != factor.c_str()) {
+            factor_value = ftype(number);
+            string unit_name = trim(end);
+            if (!unit_name.empty()) {
+                ftype unit_value;
+                if (!find_unit(unit_name, unit_value)) {
+                    error = "Unknown unit " + unit_name;
+                    return false;
+                }
+                factor_value *= unit_value;
+                plain = false;
+            }
+        }
+        else if (earlier != values.end() && earlier->second.is_number) {
+            earlier->second.used = true;
+            factor_value = earlier->second.number;
+            plain = false;
+        }
+        else if (num_factors == 1 && !negated && expression.find('*') == string::npos && !factor.empty()) {
+            // A single word
+            value.is_number = false;
+            value.text      = factor;
+            return true;
+        }
+        else {
+            error = "Unknown setting " + factor;
+            return false;
+        }
+        if (negated) {
+            factor_value = factor_value == 0 ? 1 : 0;
+        }
+        value.number *= factor_value;
+    }
+
+    if (plain) {
+        for (uint i = 0; i < sizeof(default_units)/sizeof(default_units[0]); i++) {
+            if (to_lower(name) != default_units[i][0]) {
+                continue;
+            }
+            ftype unit_value;
+            map<string, setting>::const_iterator relative_to = values.find(default_units[i][1]);
+            if (find_unit(default_units[i][1], unit_value)) {
+                value.number *= unit_value;
+            }
+            else if (relative_to != values.end() && relative_to->second.is_number) {
+                relative_to->second.used = true;
+                value.number *= relative_to->second.number;
+            }
+            else {
+                error = name + " is in " + default_units[i][1] + ", which has to be given before it";
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -1,10 +1,66 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <map>
+#include <string>
+#include <vector>
+using std::map;
+using std::string;
+using std::vector;
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * The settings of a simulation, read from the files in Resources. There is
+ * one setting per line, "Name: value" or "Name = value", and everything
+ * after a # is a comment. A value is a product of factors separated by *:
+ *   a number, optionally followed by a unit (0.34 eV, 1 atm)
+ *   the name of a setting given earlier (0.9 * Initial temperature)
+ *   true, false or a factor negated by ! (for the flags)
+ * or a single word (NVE, FCC, Silver). Numbers are stored in SI units;
+ * numbers without a unit get the usual unit of the setting, so "Sigma: 2.65"
+ * is in Angstrom and "Inner cutoff: 2.5" is in sigma. "Element: Silver"
+ * reads the element file Silver.txt at that point of the file. An override
+ * replaces the value of a setting where it is given, so that the settings
+ * after it that refer to it follow (see parameter_sweep).
+ */
 class settings
 {
 public:
+    // Constructor
     settings();
+
+    void set_override(const string &name, const string &expression); // Call before read
+    bool read(const string &path, const string &elements_directory, string &error);
+
+    bool   has   (const string &name) const;
+    ftype  number(const string &name, ftype default_value) const; // [SI units]
+    bool   flag  (const string &name, bool default_value) const;
+    string text  (const string &name, const string &default_value) const;
+    vector<string> unused_names() const; // Given in the files but never asked for
+
+private:
+    struct setting
+    {
+        bool         is_number;
+        ftype        number;
+        string       text;
+        mutable bool used;
+    };
+    map<string, setting> values; // By the name in lower case
+    vector<string>       names;  // As written, in the order they were given
+    map<string, string>  overrides; // Expressions by the name in lower case
+
+    bool read_file(const string &path, const string &elements_directory, string &error);
+    bool evaluate (const string &name, const string &expression, setting &value, string &error) const;
 };
 
 #endif // SETTINGS_H
@@ -0,0 +1,112 @@
+#ifndef  SIMD_H
+#define  SIMD_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include "definitions.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define  SIMD_SSE2  1
+#else
+#define  SIMD_SSE2  0
+#endif
+
+////////////////////////////////////////////////////////////////
+// SIMD REGISTER OF FTYPE
+////////////////////////////////////////////////////////////////
+
+/*
+ * One SIMD register of ftype values (SSE2, or a single value when not
+ * available). Every operation is an ordinary IEEE operation per lane, so
+ * code written with it gives exactly the same results as the same code
+ * written for one ftype at a time.
+ */
+
+#if SIMD_SSE2 && !USE_DOUBLE_PRECISION
+
+const uint SIMD_WIDTH = 4;
+
+struct simd_ftype
+{
+    __m128 v;
+
+    simd_ftype() {}
+    simd_ftype(__m128 v_in) : v(v_in) {}
+    explicit simd_ftype(ftype x) : v(_mm_set1_ps(x)) {}
+
+    static simd_ftype load (const ftype *p)       { return simd_ftype(_mm_loadu_ps(p)); }
+    void              store(      ftype *p) const { _mm_storeu_ps(p, v); }
+    // All bits set in the lanes where the flag is set
+    static simd_ftype mask (const bool *flags)    { return simd_ftype(_mm_castsi128_ps(_mm_setr_epi32(-int(flags[0]), -int(flags[1]), -int(flags[2]), -int(flags[3])))); }
+    // Element i of each of the arrays, one per lane
+    static simd_ftype gather(const ftype *const *arrays, uint i) { return simd_ftype(_mm_setr_ps(arrays[0][i], arrays[1][i], arrays[2][i], arrays[3][i])); }
+};
+
+inline simd_ftype operator+(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_add_ps(a.v, b.v)); }
+inline simd_ftype operator-(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_sub_ps(a.v, b.v)); }
+inline simd_ftype operator*(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_mul_ps(a.v, b.v)); }
+inline simd_ftype operator/(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_div_ps(a.v, b.v)); }
+inline simd_ftype select(const simd_ftype &mask, const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))); }
+inline simd_ftype less_than(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_cmplt_ps(a.v, b.v)); } // Mask
+inline bool       any_set  (const simd_ftype &mask) { return _mm_movemask_ps(mask.v) != 0; }
+
+#elif SIMD_SSE2
+
+const uint SIMD_WIDTH = 2;
+
+struct simd_ftype
+{
+    __m128d v;
+
+    simd_ftype() {}
+    simd_ftype(__m128d v_in) : v(v_in) {}
+    explicit simd_ftype(ftype x) : v(_mm_set1_pd(x)) {}
+
+    static simd_ftype load (const ftype *p)       { return simd_ftype(_mm_loadu_pd(p)); }
+    void              store(      ftype *p) const { _mm_storeu_pd(p, v); }
+    // All bits set in the lanes where the flag is set
+    static simd_ftype mask (const bool *flags)    { return simd_ftype(_mm_castsi128_pd(_mm_setr_epi32(-int(flags[0]), -int(flags[0]), -int(flags[1]), -int(flags[1])))); }
+    // Element i of each of the arrays, one per lane
+    static simd_ftype gather(const ftype *const *arrays, uint i) { return simd_ftype(_mm_setr_pd(arrays[0][i], arrays[1][i])); }
+};
+
+inline simd_ftype operator+(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_add_pd(a.v, b.v)); }
+inline simd_ftype operator-(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_sub_pd(a.v, b.v)); }
+inline simd_ftype operator*(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_mul_pd(a.v, b.v)); }
+inline simd_ftype operator/(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_div_pd(a.v, b.v)); }
+inline simd_ftype select(const simd_ftype &mask, const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v))); }
+inline simd_ftype less_than(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(_mm_cmplt_pd(a.v, b.v)); } // Mask
+inline bool       any_set  (const simd_ftype &mask) { return _mm_movemask_pd(mask.v) != 0; }
+
+#else
+
+const uint SIMD_WIDTH = 1;
+
+struct simd_ftype
+{
+    ftype v;
+    bool  m; // Used as mask
+
+    simd_ftype() {}
+    explicit simd_ftype(ftype x) : v(x), m(false) {}
+
+    static simd_ftype load (const ftype *p)       { return simd_ftype(*p); }
+    void              store(      ftype *p) const { *p = v; }
+    static simd_ftype mask (const bool *flags)    { simd_ftype r(0); r.m = flags[0]; return r; }
+    static simd_ftype gather(const ftype *const *arrays, uint i) { return simd_ftype(arrays[0][i]); }
+};
+
+inline simd_ftype operator+(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(a.v + b.v); }
+inline simd_ftype operator-(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(a.v - b.v); }
+inline simd_ftype operator*(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(a.v * b.v); }
+inline simd_ftype operator/(const simd_ftype &a, const simd_ftype &b) { return simd_ftype(a.v / b.v); }
+inline simd_ftype select(const simd_ftype &mask, const simd_ftype &a, const simd_ftype &b) { return mask.m ? a : b; }
+inline simd_ftype less_than(const simd_ftype &a, const simd_ftype &b) { simd_ftype r(0); r.m = a.v < b.v; return r; } // Mask
+inline bool       any_set  (const simd_ftype &mask) { return mask.m; }
+
+#endif
+
+#endif  /* SIMD_H */
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <algorithm>
+#include <utility>
+
+// Own includes
+#include "sparse_cell_grid.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+sparse_cell_grid::sparse_cell_grid()
+{
+    cells_per_side = 0;
+    cell_size = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void sparse_cell_grid::build(const vector<particle> &particles, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    uint num_particles = uint(particles.size());
+    start_build(num_particles, box_size, cells_per_side_in, offset_in);
+    vector<uint64> particle_keys(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        particle_keys[i] = key_of(particles[i].pos, box_size);
+    }
+    sort_by_cell(particle_keys);
+    find_neighbours();
+}
+
+void sparse_cell_grid::build(const vector<vec3> &positions, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    uint num_particles = uint(positions.size());
+    start_build(num_particles, box_size, cells_per_side_in, offset_in);
+    vector<uint64> particle_keys(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        particle_keys[i] = key_of(positions[i], box_size);
+    }
+    sort_by_cell(particle_keys);
+    find_neighbours();
+}
+
+uint sparse_cell_grid::num_cells() const
+{
+    return uint(cell_keys.size());
+}
+
+uint64 sparse_cell_grid::key_of(const vec3 &pos, ftype box_size) const
+{
+    int index[3];
+    for (int d = 0; d < 3; d++) {
+        ftype p = pos[d] - offset[d];
+        if (p < 0) p += box_size;
+        index[d] = int(p/cell_size);
+        if (index[d] >= int(cells_per_side)) index[d] = int(cells_per_side) - 1; // This actually occationally happens
+        if (index[d] < 0) index[d] = 0;
+    }
+    return uint64(index[0]) + cells_per_side*(uint64(index[1]) + cells_per_side*uint64(index[2]));
+}
+
+int sparse_cell_grid::find(uint64 key) const
+{
+    vector<uint64>::const_iterator found = std::lower_bound(cell_keys.begin(), cell_keys.end(), key);
+    return found != cell_keys.end() && *found == key ? int(found - cell_keys.begin()) : -1;
+}
+
+uint sparse_cell_grid::color_of(uint cell) const
+{
+    uint64 key = cell_keys[cell];
+    uint64 x = key % cells_per_side;
+    uint64 y = key / cells_per_side % cells_per_side;
+    uint64 z = key / cells_per_side / cells_per_side;
+    return uint((x & 1) + 2*(y & 1) + 4*(z & 1));
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void sparse_cell_grid::start_build(uint num_particles, ftype box_size, uint cells_per_side_in, vec3 offset_in)
+{
+    cells_per_side = cells_per_side_in;
+    cell_size      = box_size/cells_per_side;
+    offset         = offset_in;
+    particle_cell .resize(num_particles);
+    cell_particles.resize(num_particles);
+}
+
+void sparse_cell_grid::sort_by_cell(vector<uint64> &particle_keys)
+{
+    // Sorted by key and then by index, and the keys that occur are the occupied cells
+    uint num_particles = uint(particle_keys.size());
+    vector<std::pair<uint64, uint> > sorted(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        sorted[i] = std::make_pair(particle_keys[i], i);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    cell_keys .clear();
+    cell_start.clear();
+    for (uint k = 0; k < num_particles; k++) {
+        if (k == 0 || sorted[k].first != sorted[k - 1].first) {
+            cell_keys .push_back(sorted[k].first);
+            cell_start.push_back(k);
+        }
+        cell_particles[k] = sorted[k].second;
+        particle_cell[sorted[k].second] = uint(cell_keys.size() - 1);
+    }
+    cell_start.push_back(num_particles);
+}
+
+void sparse_cell_grid::find_neighbours()
+{
+    /*
+     * Every cell next to an occupied cell is looked up among the occupied
+     * ones, each only once when there are less than three cells per side.
+     */
+    const int n = int(cells_per_side);
+    neighbour_start.resize(cell_keys.size() + 1);
+    neighbour_cells.clear();
+    for (uint c = 0; c < cell_keys.size(); c++) {
+        neighbour_start[c] = uint(neighbour_cells.size());
+        int x = int(cell_keys[c] % n);
+        int y = int(cell_keys[c] / n % n);
+        int z = int(cell_keys[c] / n / n);
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (n == 1 && (dx != 0 || dy != 0 || dz != 0)) continue; // The cell itself
+                    if (n == 2 && (dx < 0  || dy < 0  || dz < 0 )) continue; // The same cells as at +1
+                    int nx = (x + dx + n) % n;
+                    int ny = (y + dy + n) % n;
+                    int nz = (z + dz + n) % n;
+                    int neighbour = find(uint64(nx) + uint64(n)*(uint64(ny) + uint64(n)*uint64(nz)));
+                    if (neighbour >= 0) {
+                        neighbour_cells.push_back(uint(neighbour));
+                    }
+                }
+            }
+        }
+    }
+    neighbour_start[cell_keys.size()] = uint(neighbour_cells.size());
+}
@@ -0,0 +1,58 @@
+#ifndef  SPARSE_CELL_GRID_H
+#define  SPARSE_CELL_GRID_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+#include "particle.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * The particles sorted into cubic cells like in cell_grid, but only the
+ * cells with particles in them are stored, sorted by their index in the
+ * full grid (the key). Every occupied cell has a table of the occupied
+ * cells next to it, so going through the 27 cells around a particle never
+ * visits empty space, and the memory grows with the volume the particles
+ * take up instead of with the box. A cluster or a slab in a large box of
+ * vacuum only needs the cells around it.
+ */
+class sparse_cell_grid
+{
+public:
+    uint           cells_per_side;
+    ftype          cell_size;
+    vec3           offset;          // Position of the corner of the cell with key 0
+    vector<uint64> cell_keys;       // x + n*(y + n*z) of every occupied cell, increasing
+    vector<uint>   cell_start;      // Index in cell_particles of the first particle of each occupied cell, one extra entry at the end
+    vector<uint>   cell_particles;  // Particle indexes, cell by cell, increasing in every cell
+    vector<uint>   particle_cell;   // The occupied cell of each particle
+    vector<uint>   neighbour_start; // Index in neighbour_cells of the first neighbour of each occupied cell, one extra entry at the end
+    vector<uint>   neighbour_cells; // The occupied cells around each occupied cell, itself included, in the order z, y, x from -1 to 1
+
+    // Constructor
+    sparse_cell_grid();
+
+    // Sorts the particles into the cells they are in, of cells_per_side^3 covering the box
+    void build(const vector<particle> &particles, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+    void build(const vector<vec3>     &positions, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+
+    uint   num_cells() const;                          // Occupied
+    uint64 key_of(const vec3 &pos, ftype box_size) const;
+    int    find(uint64 key) const;                     // The occupied cell with the key, -1 if it is empty
+    uint   color_of(uint cell) const;                  // 0-7, as cell_grid::color_of
+
+private:
+    void start_build(uint num_particles, ftype box_size, uint cells_per_side_in, vec3 offset_in);
+    void sort_by_cell(vector<uint64> &particle_keys);
+    void find_neighbours();
+};
+
+#endif  /* SPARSE_CELL_GRID_H */
@@ -0,0 +1,72 @@
+#ifndef  SPSC_RING_H
+#define  SPSC_RING_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <atomic>
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Lock-free ring buffer for one producer thread and one consumer thread.
+ * Neither side ever waits for the other; push fails when the ring is full
+ * and pop when it is empty. The counters only grow, the slot is the
+ * counter modulo the capacity, which has to be a power of two. They are
+ * kept on cache lines of their own, so that the two threads do not
+ * invalidate each others caches when they only read.
+ */
+template<class T, uint capacity>
+class spsc_ring
+{
+public:
+    spsc_ring() : head(0), tail(0) {}
+
+    // Producer only
+    bool push(const T &value)
+    {
+        uint64 h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == capacity) {
+            return false; // Full
+        }
+        slots[h & (capacity - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T &value)
+    {
+        uint64 t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false; // Empty
+        }
+        value = slots[t & (capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; seen from the producer, the ring can only get emptier
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint64> head; // The next slot to write, changed by the producer
+    char                head_padding[64 - sizeof(std::atomic<uint64>)];
+    std::atomic<uint64> tail; // The next slot to read, changed by the consumer
+    char                tail_padding[64 - sizeof(std::atomic<uint64>)];
+    T                   slots[capacity];
+
+    // Not copyable
+    spsc_ring(const spsc_ring &);
+    spsc_ring &operator=(const spsc_ring &);
+};
+
+#endif  /* SPSC_RING_H */
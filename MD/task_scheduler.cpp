@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <algorithm>
+#include <omp.h>
+
+// Own includes
+#include "task_scheduler.h"
+
+/* Orders task indexes by decreasing weight, by index when equal */
+struct heavier_task
+{
+    const vector<uint64> &weights;
+    heavier_task(const vector<uint64> &weights_in) : weights(weights_in) {}
+    bool operator()(uint a, uint b) const { return weights[a] != weights[b] ? weights[a] > weights[b] : a < b; }
+};
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR
+////////////////////////////////////////////////////////////////
+
+task_scheduler::task_scheduler()
+{
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void task_scheduler::run(const vector<uint64> &weights, callback<void (*)(void*, uint, uint)> task)
+{
+    const uint num_threads = uint(omp_get_max_threads());
+    if (busy_time.size() < num_threads) {
+        busy_time .resize(num_threads, 0);
+        idle_time .resize(num_threads, 0);
+        num_stolen.resize(num_threads, 0);
+    }
+    deal_tasks(weights, num_threads);
+
+    vector<omp_lock_t> locks(num_threads);
+    vector<double>     busy_in_run(num_threads, 0);
+    for (uint t = 0; t < num_threads; t++) {
+        omp_init_lock(&locks[t]);
+    }
+    uint   team_size  = 1;
+    double start_time = omp_get_wtime();
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const uint thread = uint(omp_get_thread_num());
+        #pragma omp master
+        team_size = uint(omp_get_num_threads());
+        for (;;) {
+            // From the front of the own queue, else from the back of the others
+            uint index = 0;
+            bool found = false;
+            for (uint k = 0; k < num_threads && !found; k++) {
+                uint victim = (thread + k) % num_threads;
+                omp_set_lock(&locks[victim]);
+                if (queue_head[victim] < queue_tail[victim]) {
+                    index = victim == thread ? queued_tasks[queue_head[victim]++] : queued_tasks[--queue_tail[victim]];
+                    found = true;
+                    if (victim != thread) num_stolen[thread]++;
+                }
+                omp_unset_lock(&locks[victim]);
+            }
+            if (!found) {
+                break; // Nothing left anywhere, tasks are never added
+            }
+            double task_start = omp_get_wtime();
+            task.func(task.param, index, thread);
+            busy_in_run[thread] += omp_get_wtime() - task_start;
+        }
+    }
+    double run_time = omp_get_wtime() - start_time;
+    for (uint t = 0; t < num_threads; t++) {
+        omp_destroy_lock(&locks[t]);
+        if (t < team_size) {
+            busy_time[t] += busy_in_run[t];
+            idle_time[t] += run_time - busy_in_run[t];
+        }
+    }
+}
+
+void task_scheduler::reset_statistics()
+{
+    busy_time .clear();
+    idle_time .clear();
+    num_stolen.clear();
+}
+
+uint task_scheduler::get_num_threads() const
+{
+    return uint(busy_time.size());
+}
+
+double task_scheduler::get_busy_time(uint thread) const
+{
+    return busy_time[thread];
+}
+
+double task_scheduler::get_idle_time(uint thread) const
+{
+    return idle_time[thread];
+}
+
+uint64 task_scheduler::get_num_stolen(uint thread) const
+{
+    return num_stolen[thread];
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void task_scheduler::deal_tasks(const vector<uint64> &weights, uint num_threads)
+{
+    /*
+     * Heaviest first to the thread with the least work so far, which gives
+     * every queue its heavy tasks at the front and its light ones, the ones
+     * that are stolen, at the back.
+     */
+    const uint num_tasks = uint(weights.size());
+    vector<uint> order(num_tasks);
+    for (uint i = 0; i < num_tasks; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), heavier_task(weights));
+    vector<uint>   owner(num_tasks);
+    vector<uint64> load(num_threads, 0);
+    vector<uint>   queue_size(num_threads, 0);
+    for (uint k = 0; k < num_tasks; k++) {
+        uint least = 0;
+        for (uint t = 1; t < num_threads; t++) {
+            if (load[t] < load[least]) least = t;
+        }
+        owner[k] = least;
+        load[least] += weights[order[k]] + 1; // Tasks without weight are still dealt out evenly
+        queue_size[least]++;
+    }
+    queue_head.resize(num_threads);
+    queue_tail.resize(num_threads);
+    uint start = 0;
+    for (uint t = 0; t < num_threads; t++) {
+        queue_head[t] = queue_tail[t] = start;
+        start += queue_size[t];
+    }
+    queued_tasks.resize(num_tasks);
+    for (uint k = 0; k < num_tasks; k++) {
+        queued_tasks[queue_tail[owner[k]]++] = order[k];
+    }
+}
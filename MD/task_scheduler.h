@@ -0,0 +1,54 @@
+#ifndef  TASK_SCHEDULER_H
+#define  TASK_SCHEDULER_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+using std::vector;
+
+#include "definitions.h"
+#include "callback.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Runs tasks of very different sizes on all threads, with work stealing.
+ * Every thread gets a queue of tasks, dealt out heaviest first to the
+ * thread with the least work so far, from weights that estimate the work
+ * of each task. A thread runs the tasks of its own queue from the front,
+ * and when it is empty it steals from the back of the queues of the
+ * others, so the weights only have to be roughly right. The time every
+ * thread spends in the tasks (busy) and waiting for the others (idle) is
+ * summed over the calls, to show how well the work is balanced.
+ */
+class task_scheduler
+{
+public:
+    // Constructor
+    task_scheduler();
+
+    // Calls task(param, task index, thread) once for every weight, from outside a parallel region
+    void run(const vector<uint64> &weights, callback<void (*)(void*, uint, uint)> task);
+
+    void   reset_statistics();
+    uint   get_num_threads() const;            // That have statistics
+    double get_busy_time (uint thread) const;  // [s]
+    double get_idle_time (uint thread) const;  // [s]
+    uint64 get_num_stolen(uint thread) const;  // Tasks taken from the queues of other threads
+
+private:
+    vector<uint>   queued_tasks; // The queues of the threads, one after the other
+    vector<uint>   queue_head;   // The next task of each queue in queued_tasks
+    vector<uint>   queue_tail;   // One past the last task of each queue
+    vector<double> busy_time;
+    vector<double> idle_time;
+    vector<uint64> num_stolen;
+
+    void deal_tasks(const vector<uint64> &weights, uint num_threads);
+};
+
+#endif  /* TASK_SCHEDULER_H */
@@ -0,0 +1,112 @@
+#ifndef  THERMOSTATS_H
+#define  THERMOSTATS_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// ENUMERATIONS
+////////////////////////////////////////////////////////////////
+
+/* Enumeration of thermostats */
+enum enum_thermostat_types
+{
+    NO_THERMOSTAT,
+    BERENDSEN_THERMOSTAT,
+    NOSE_HOOVER_THERMOSTAT,
+    LANGEVIN_THERMOSTAT,
+    NUM_THERMOSTAT_TYPES,
+    // Aliases
+    CHING_CHIS_THERMOSTAT = BERENDSEN_THERMOSTAT,  // Smooth scaling thermostat (Berendsen et. al, 1984)
+    LASSES_THERMOSTAT     = NOSE_HOOVER_THERMOSTAT // Friction term added to the accelerations
+};
+
+////////////////////////////////////////////////////////////////
+// THERMOSTAT POLICIES
+////////////////////////////////////////////////////////////////
+
+/*
+ * Every policy tells at compile time how the thermostat value is applied to
+ * the particles, so that mdsystem can be instantiated once per thermostat
+ * without any branching in the time step loop.
+ *
+ *   enabled           - If the thermostat does anything at all
+ *   scales_velocities - The velocities are multiplied by the thermostat value
+ *   adds_friction     - The thermostat value times the velocity is subtracted
+ *                       from the acceleration
+ *   uses_baoab        - The system is integrated with the BAOAB splitting
+ *                       (Leimkuhler & Matthews, 2013) instead of leapfrog, and
+ *                       the thermostat value is the friction coefficient
+ */
+
+/* No thermostat */
+struct no_thermostat
+{
+    static const bool enabled           = false;
+    static const bool scales_velocities = false;
+    static const bool adds_friction     = false;
+    static const bool uses_baoab        = false;
+
+    static ftype value_when_extreme_cooling(ftype /*dt*/) {return 0;}
+    static ftype value_when_inactive       (            ) {return 0;}
+    static ftype calculate_value(ftype /*insttemp*/, ftype /*desired_temp*/, ftype /*thermostat_time*/, ftype /*dt*/) {return 0;}
+};
+
+/* Smooth scaling thermostat (Berendsen et. al, 1984), multiplicative */
+struct berendsen_thermostat
+{
+    static const bool enabled           = true;
+    static const bool scales_velocities = true;
+    static const bool adds_friction     = false;
+    static const bool uses_baoab        = false;
+
+    static ftype value_when_extreme_cooling(ftype /*dt*/) {return 0;}
+    static ftype value_when_inactive       (            ) {return 1;}
+    static ftype calculate_value(ftype insttemp, ftype desired_temp, ftype thermostat_time, ftype dt)
+    {
+        ftype arg = 1 +  dt / thermostat_time * (desired_temp / insttemp - 1);
+        return arg > 0 ? sqrt(arg) : 0;
+    }
+};
+
+/* Lasse's thermostat, additive friction term */
+struct nose_hoover_thermostat
+{
+    static const bool enabled           = true;
+    static const bool scales_velocities = false;
+    static const bool adds_friction     = true;
+    static const bool uses_baoab        = false;
+
+    static ftype value_when_extreme_cooling(ftype dt) {return 1/dt;}
+    static ftype value_when_inactive       (        ) {return 0;}
+    static ftype calculate_value(ftype insttemp, ftype desired_temp, ftype thermostat_time, ftype dt)
+    {
+        ftype value = (1 - desired_temp/insttemp) / (2*thermostat_time);
+        return value < 1/dt ? value : 1/dt;
+    }
+};
+
+/* Langevin thermostat, friction and random kicks on every atom every step */
+struct langevin_thermostat
+{
+    static const bool enabled           = true;
+    static const bool scales_velocities = false;
+    static const bool adds_friction     = false;
+    static const bool uses_baoab        = true;
+
+    static ftype value_when_extreme_cooling(ftype /*dt*/) {return -1;} // Never reached
+    static ftype value_when_inactive       (            ) {return  0;}
+    static ftype calculate_value(ftype /*insttemp*/, ftype /*desired_temp*/, ftype thermostat_time, ftype /*dt*/)
+    {
+        return 1/thermostat_time;
+    }
+};
+
+typedef  berendsen_thermostat    ching_chis_thermostat;
+typedef  nose_hoover_thermostat  lasses_thermostat;
+
+#endif  /* THERMOSTATS_H */
@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "time_series.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR AND DESTRUCTOR
+////////////////////////////////////////////////////////////////
+
+time_series::time_series(uint chunk_shift_in)
+{
+    chunk_shift       = chunk_shift_in;
+    chunk_mask        = (1u << chunk_shift) - 1;
+    num_values        = 0;
+    ram_budget        = ~uint64(0); // Unlimited
+    spill_file        = -1;
+    num_mapped_chunks = 0;
+    const char *tmpdir = getenv("TMPDIR");
+    spill_directory = tmpdir ? tmpdir : "/tmp";
+}
+
+time_series::~time_series()
+{
+    clear();
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void time_series::set_ram_budget(uint64 ram_budget_in)
+{
+    // Only affects chunks added after this
+    ram_budget = ram_budget_in;
+}
+
+void time_series::set_spill_directory(const string &spill_directory_in)
+{
+    spill_directory = spill_directory_in;
+}
+
+bool time_series::is_spilled() const
+{
+    return num_mapped_chunks > 0;
+}
+
+uint time_series::size() const
+{
+    return num_values;
+}
+
+bool time_series::empty() const
+{
+    return num_values == 0;
+}
+
+void time_series::resize(uint size_in)
+{
+    uint num_chunks_needed = uint((uint64(size_in) + chunk_mask) >> chunk_shift);
+    while (chunks.size() > num_chunks_needed) {
+        remove_chunk();
+    }
+    // Values left from before a shrinking have to be cleared, new chunks are already zero
+    uint allocated = uint(chunks.size()) << chunk_shift;
+    for (uint i = num_values; i < size_in && i < allocated; i++) {
+        (*this)[i] = 0;
+    }
+    while (chunks.size() < num_chunks_needed) {
+        add_chunk();
+    }
+    num_values = size_in;
+}
+
+void time_series::push_back(ftype value)
+{
+    if (num_values == uint(chunks.size()) << chunk_shift) {
+        add_chunk();
+    }
+    (*this)[num_values] = value;
+    num_values++;
+}
+
+void time_series::clear()
+{
+    while (!chunks.empty()) {
+        remove_chunk();
+    }
+    num_values = 0;
+#ifndef _WIN32
+    if (spill_file >= 0) {
+        close(spill_file);
+        spill_file = -1;
+    }
+#endif
+}
+
+bool time_series::make_private()
+{
+#ifndef _WIN32
+    if (spill_file < 0) {
+        return true;
+    }
+    // The same part of the file mapped copy-on-write at the same address, so the values stay and nothing moves
+    uint64 chunk_bytes = uint64(chunk_capacity())*sizeof(ftype);
+    uint   mapped = 0;
+    bool   all_private = true;
+    for (uint c = 0; c < chunks.size(); c++) {
+        if (chunk_mapped[c]) {
+            void *memory = mmap(chunks[c], size_t(chunk_bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, spill_file, off_t(mapped*chunk_bytes));
+            all_private = all_private && memory != MAP_FAILED;
+            mapped++;
+        }
+    }
+    close(spill_file);
+    spill_file = -1;
+    return all_private;
+#else
+    return true;
+#endif
+}
+
+void time_series::assign(const time_series &other)
+{
+    if (&other == this) {
+        return;
+    }
+    resize(other.size());
+    if (other.chunk_shift == chunk_shift) {
+        for (uint c = 0; c < num_chunks(); c++) {
+            memcpy(chunks[c], other.chunks[c], chunk_length(c)*sizeof(ftype));
+        }
+    }
+    else {
+        for (uint i = 0; i < num_values; i++) {
+            (*this)[i] = other[i];
+        }
+    }
+}
+
+uint time_series::num_chunks() const
+{
+    return uint(chunks.size());
+}
+
+uint time_series::chunk_capacity() const
+{
+    return chunk_mask + 1;
+}
+
+uint time_series::chunk_length(uint c) const
+{
+    uint first = c << chunk_shift;
+    return num_values - first < chunk_capacity() ? num_values - first : chunk_capacity();
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void time_series::add_chunk()
+{
+    uint64 chunk_bytes = uint64(chunk_capacity())*sizeof(ftype);
+    ftype *chunk_memory = 0;
+#ifndef _WIN32
+    // Chunks beyond the budget are mapped from the spill file, or allocated anyway if that fails
+    if ((chunks.size() + 1)*chunk_bytes > ram_budget) {
+        chunk_memory = map_chunk(chunk_bytes);
+    }
+#endif
+    if (chunk_memory) {
+        num_mapped_chunks++;
+        chunk_mapped.push_back(true);
+    }
+    else {
+        chunk_memory = new ftype[chunk_capacity()](); // Zero initialized
+        chunk_mapped.push_back(false);
+    }
+    chunks.push_back(chunk_memory);
+}
+
+void time_series::remove_chunk()
+{
+    ftype *chunk_memory = chunks.back();
+    if (chunk_mapped.back()) {
+#ifndef _WIN32
+        uint64 chunk_bytes = uint64(chunk_capacity())*sizeof(ftype);
+        munmap(chunk_memory, size_t(chunk_bytes));
+        num_mapped_chunks--;
+        // Truncated so that the space is zero if it is mapped again
+        if (ftruncate(spill_file, off_t(num_mapped_chunks*chunk_bytes)) != 0) {
+            // Harmless, the file is just kept longer
+        }
+#endif
+    }
+    else {
+        delete[] chunk_memory;
+    }
+    chunks      .pop_back();
+    chunk_mapped.pop_back();
+}
+
+ftype *time_series::map_chunk(uint64 chunk_bytes)
+{
+#ifndef _WIN32
+    // The mappings have to start at page boundaries
+    if (chunk_bytes % uint64(sysconf(_SC_PAGESIZE))) {
+        return 0;
+    }
+    if (spill_file < 0) {
+        // The file is unlinked at once, so it disappears with the series even after a crash
+        string path = spill_directory + "/md_time_series_XXXXXX";
+        vector<char> path_buffer(path.begin(), path.end());
+        path_buffer.push_back('\0');
+        spill_file = mkstemp(&path_buffer[0]);
+        if (spill_file < 0) {
+            return 0;
+        }
+        unlink(&path_buffer[0]);
+    }
+    off_t offset = off_t(num_mapped_chunks*chunk_bytes);
+    if (ftruncate(spill_file, off_t(offset + chunk_bytes)) != 0) {
+        return 0;
+    }
+    void *memory = mmap(0, size_t(chunk_bytes), PROT_READ | PROT_WRITE, MAP_SHARED, spill_file, offset);
+    if (memory == MAP_FAILED) {
+        return 0;
+    }
+    return static_cast<ftype*>(memory); // Zero since the file was just extended
+#else
+    (void)chunk_bytes;
+    return 0;
+#endif
+}
@@ -0,0 +1,86 @@
+#ifndef  TIME_SERIES_H
+#define  TIME_SERIES_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/* Default number of values in each chunk, as a power of two (256 kB of floats) */
+const uint TIME_SERIES_CHUNK_SHIFT = 16;
+
+/*
+ * A sequence of values stored in fixed size chunks instead of one array.
+ * The chunks that fit in the RAM budget are allocated in memory, the rest
+ * are memory mapped from a temporary file, so that the operating system
+ * can write them out when memory is short. Growing the series never moves
+ * the values that are already stored, which makes it possible to extend a
+ * run, and the chunks can be read one at a time without copying anything.
+ * On Windows all chunks are kept in memory.
+ */
+class time_series
+{
+public:
+    // Constructor and destructor
+    explicit time_series(uint chunk_shift_in = TIME_SERIES_CHUNK_SHIFT);
+    ~time_series();
+
+    // Memory
+    void set_ram_budget(uint64 ram_budget_in); // In bytes, chunks beyond it are spilled to disk
+    void set_spill_directory(const string &spill_directory_in);
+    bool is_spilled() const;
+    bool make_private(); // In a forked process: the spilled chunks become copies of its own, and the next ones go to a file of its own
+
+    // Size
+    uint size() const;
+    bool empty() const;
+    void resize(uint size_in); // New values are zero
+    void push_back(ftype value);
+    void clear();              // Also releases the memory
+    void assign(const time_series &other);
+
+    // Random access
+    ftype       &operator[](uint i)       { return chunks[i >> chunk_shift][i & chunk_mask]; }
+    const ftype &operator[](uint i) const { return chunks[i >> chunk_shift][i & chunk_mask]; }
+
+    // Sequential access, chunk by chunk
+    uint         num_chunks() const;
+    uint         chunk_capacity() const;       // Number of values in a full chunk
+    uint         chunk_length(uint c) const;   // Number of values in use in chunk c
+    // The values from chunk_begin(i) up to chunk_end(i) are stored after each other
+    uint         chunk_begin(uint i) const { return i & ~chunk_mask; }
+    uint         chunk_end  (uint i) const { return (i & ~chunk_mask) + chunk_mask + 1; }
+    ftype       *chunk(uint c)       { return chunks[c]; }
+    const ftype *chunk(uint c) const { return chunks[c]; }
+
+private:
+    uint           chunk_shift;
+    uint           chunk_mask;
+    uint           num_values;
+    vector<ftype*> chunks;
+    vector<bool>   chunk_mapped;      // If each chunk is mapped from the spill file instead of allocated
+    uint64         ram_budget;
+    string         spill_directory;
+    int            spill_file;        // File descriptor, -1 if not opened
+    uint           num_mapped_chunks;
+
+    void   add_chunk();
+    void   remove_chunk();
+    ftype *map_chunk(uint64 chunk_bytes);
+
+    // Not copyable, the chunks are owned
+    time_series(const time_series &);
+    time_series &operator=(const time_series &);
+};
+
+#endif  /* TIME_SERIES_H */
@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <cmath>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Own includes
+#include "trajectory.h"
+
+////////////////////////////////////////////////////////////////
+// BIT PACKING
+////////////////////////////////////////////////////////////////
+
+/* Bits needed for the block widths (0-32) */
+const uint BLOCK_WIDTH_BITS = 6;
+
+void pack_values(const uint32 *values, uint num_values, vector<char> &packed)
+{
+    uint64 bits = 0;     // Bits not yet appended, the first ones in the lowest bits
+    uint   num_bits = 0;
+    for (uint first = 0; first < num_values; first += TRAJECTORY_BLOCK_SIZE) {
+        uint last = first + TRAJECTORY_BLOCK_SIZE < num_values ? first + TRAJECTORY_BLOCK_SIZE : num_values;
+
+        // The width of the block is given by its largest value
+        uint32 largest = 0;
+        for (uint i = first; i < last; i++) {
+            largest |= values[i];
+        }
+        uint width = 0;
+        while (width < 32 && (largest >> width)) {
+            width++;
+        }
+
+        bits |= uint64(width) << num_bits;
+        num_bits += BLOCK_WIDTH_BITS;
+        for (uint i = first; i < last; i++) {
+            while (num_bits >= 8) {
+                packed.push_back(char(bits & 0xFF));
+                bits >>= 8;
+                num_bits -= 8;
+            }
+            bits |= uint64(values[i]) << num_bits;
+            num_bits += width;
+        }
+    }
+    while (num_bits > 0) {
+        packed.push_back(char(bits & 0xFF));
+        bits >>= 8;
+        num_bits = num_bits > 8 ? num_bits - 8 : 0;
+    }
+}
+
+uint64 unpack_values(const char *packed, uint num_values, uint32 *values)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(packed);
+    uint64 num_bytes_read = 0;
+    uint64 bits = 0;
+    uint   num_bits = 0;
+    for (uint first = 0; first < num_values; first += TRAJECTORY_BLOCK_SIZE) {
+        uint last = first + TRAJECTORY_BLOCK_SIZE < num_values ? first + TRAJECTORY_BLOCK_SIZE : num_values;
+
+        while (num_bits < BLOCK_WIDTH_BITS) {
+            bits |= uint64(bytes[num_bytes_read++]) << num_bits;
+            num_bits += 8;
+        }
+        uint width = uint(bits & ((1u << BLOCK_WIDTH_BITS) - 1));
+        bits >>= BLOCK_WIDTH_BITS;
+        num_bits -= BLOCK_WIDTH_BITS;
+        uint64 mask = (uint64(1) << width) - 1;
+        for (uint i = first; i < last; i++) {
+            while (num_bits < width) {
+                bits |= uint64(bytes[num_bytes_read++]) << num_bits;
+                num_bits += 8;
+            }
+            values[i] = uint32(bits & mask);
+            bits >>= width;
+            num_bits -= width;
+        }
+    }
+    return num_bytes_read;
+}
+
+////////////////////////////////////////////////////////////////
+// WRITER
+////////////////////////////////////////////////////////////////
+
+trajectory_writer::trajectory_writer()
+{
+    writer    = 0;
+    file      = 0;
+    file_open = false;
+    position  = 0;
+}
+
+void trajectory_writer::open(async_writer &writer_in, const string &path, uint num_particles, uint frame_period, uint keyframe_period, ftype relative_precision, ftype length_unit, ftype time_step)
+{
+    if (file_open) {
+        close();
+    }
+    // The smallest power of two number of levels that gives the precision
+    uint bits = uint(ceil(-log(double(relative_precision))/log(2.0)));
+    bits = bits < 1 ? 1 : bits > 30 ? 30 : bits;
+
+    header.version             = TRAJECTORY_FORMAT_VERSION;
+    header.value_size          = uint32(sizeof(ftype));
+    header.num_particles       = num_particles;
+    header.bits_per_coordinate = bits;
+    header.frame_period        = frame_period;
+    header.keyframe_period     = keyframe_period > 0 ? keyframe_period : 1;
+    header.length_unit         = length_unit;
+    header.time_step           = time_step;
+
+    writer    = &writer_in;
+    file      = writer->open(path);
+    file_open = true;
+    writer->write(file, "MDTRAJEC", 8);
+    writer->write_uint32(file, header.version);
+    writer->write_uint32(file, header.value_size);
+    writer->write_uint32(file, header.num_particles);
+    writer->write_uint32(file, header.bits_per_coordinate);
+    writer->write_uint32(file, header.frame_period);
+    writer->write_uint32(file, header.keyframe_period);
+    writer->write(file, &header.length_unit, sizeof(ftype));
+    writer->write(file, &header.time_step  , sizeof(ftype));
+    position = 8 + 6*4 + 2*sizeof(ftype);
+
+    frame_offsets.clear();
+    previous.assign(3*num_particles, 0);
+    values  .resize(3*num_particles);
+}
+
+void trajectory_writer::write_frame(uint64 timestep, const vector<particle> &particles, ftype box_size)
+{
+    const uint32 levels = uint32(1) << header.bits_per_coordinate;
+    const uint32 mask   = levels - 1;
+    const uint32 half   = levels/2;
+    const int    num_particles = int(header.num_particles);
+    const bool   keyframe = frame_offsets.size() % header.keyframe_period == 0;
+    const double scale = double(levels)/box_size;
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        for (uint d = 0; d < 3; d++) {
+            uint32 q = uint32(floor(double(particles[i].pos[d])*scale + 0.5)) & mask;
+            if (keyframe) {
+                values[3*i + d] = q;
+            }
+            else {
+                // Change wrapped into [-levels/2, levels/2), zigzag coded so that small changes of both signs are small values
+                int delta = int((q - previous[3*i + d] + half) & mask) - int(half);
+                values[3*i + d] = (uint32(delta) << 1) ^ uint32(delta >> 31);
+            }
+            previous[3*i + d] = q;
+        }
+    }
+    packed.clear();
+    pack_values(&values[0], uint(values.size()), packed);
+
+    frame_offsets.push_back(position);
+    writer->write_uint64(file, timestep);
+    writer->write(file, &box_size, sizeof(ftype));
+    writer->write_uint32(file, keyframe);
+    writer->write_uint32(file, uint32(packed.size()));
+    if (!packed.empty()) {
+        writer->write(file, &packed[0], packed.size());
+    }
+    position += TRAJECTORY_FRAME_HEADER_SIZE + packed.size();
+}
+
+void trajectory_writer::close()
+{
+    if (!file_open) {
+        return;
+    }
+    for (uint i = 0; i < frame_offsets.size(); i++) {
+        writer->write_uint64(file, frame_offsets[i]);
+    }
+    writer->write_uint64(file, frame_offsets.size());
+    writer->write(file, "MDTRAJIX", 8);
+    writer->close(file);
+    file_open = false;
+}
+
+bool trajectory_writer::is_open() const
+{
+    return file_open;
+}
+
+uint trajectory_writer::num_frames() const
+{
+    return uint(frame_offsets.size());
+}
+
+uint64 trajectory_writer::num_bytes() const
+{
+    return position;
+}
+
+////////////////////////////////////////////////////////////////
+// READER
+////////////////////////////////////////////////////////////////
+
+trajectory_reader::trajectory_reader()
+{
+    data    = 0;
+    size    = 0;
+    mapping = 0;
+}
+
+trajectory_reader::~trajectory_reader()
+{
+    close();
+}
+
+bool trajectory_reader::open(const string &path, string &error)
+{
+    close();
+#ifndef _WIN32
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        error = path + " could not be opened";
+        return false;
+    }
+    struct stat file_status;
+    if (fstat(file, &file_status) != 0 || file_status.st_size == 0) {
+        ::close(file);
+        error = path + " is empty";
+        return false;
+    }
+    size = uint64(file_status.st_size);
+    mapping = mmap(0, size_t(size), PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file); // The mapping stays
+    if (mapping == MAP_FAILED) {
+        mapping = 0;
+        size    = 0;
+        error = path + " could not be mapped into memory";
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+#else
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        error = path + " could not be opened";
+        return false;
+    }
+    char block[1 << 16];
+    size_t num_read;
+    while ((num_read = fread(block, 1, sizeof(block), file)) > 0) {
+        contents.insert(contents.end(), block, block + num_read);
+    }
+    fclose(file);
+    size = contents.size();
+    data = contents.empty() ? 0 : &contents[0];
+#endif
+
+    // Header
+    const uint64 header_size = 8 + 6*4 + 2*sizeof(ftype);
+    if (size < header_size + 16 || memcmp(data, "MDTRAJEC", 8) != 0) {
+        close();
+        error = path + " is not a trajectory file";
+        return false;
+    }
+    const char *p = data + 8;
+    memcpy(&header.version            , p, 4); p += 4;
+    memcpy(&header.value_size         , p, 4); p += 4;
+    memcpy(&header.num_particles      , p, 4); p += 4;
+    memcpy(&header.bits_per_coordinate, p, 4); p += 4;
+    memcpy(&header.frame_period       , p, 4); p += 4;
+    memcpy(&header.keyframe_period    , p, 4); p += 4;
+    if (header.version != TRAJECTORY_FORMAT_VERSION || header.value_size != sizeof(ftype)) {
+        close();
+        error = path + " has an unsupported version or precision";
+        return false;
+    }
+    memcpy(&header.length_unit, p, sizeof(ftype)); p += sizeof(ftype);
+    memcpy(&header.time_step  , p, sizeof(ftype)); p += sizeof(ftype);
+
+    // Index at the end
+    uint64 num_frames_in_file;
+    memcpy(&num_frames_in_file, data + size - 16, 8);
+    if (memcmp(data + size - 8, "MDTRAJIX", 8) != 0 || num_frames_in_file > (size - header_size - 16)/(8 + TRAJECTORY_FRAME_HEADER_SIZE)) {
+        close();
+        error = path + " has no index, the run was probably interrupted";
+        return false;
+    }
+    frame_offsets.resize(size_t(num_frames_in_file));
+    if (num_frames_in_file > 0) {
+        memcpy(&frame_offsets[0], data + size - 16 - 8*num_frames_in_file, size_t(8*num_frames_in_file));
+    }
+    for (uint f = 0; f < frame_offsets.size(); f++) {
+        if (frame_offsets[f] < header_size || frame_offsets[f] + TRAJECTORY_FRAME_HEADER_SIZE > size) {
+            close();
+            error = path + " has a broken index";
+            return false;
+        }
+    }
+    return true;
+}
+
+void trajectory_reader::close()
+{
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, size_t(size));
+    }
+#endif
+    mapping = 0;
+    data    = 0;
+    size    = 0;
+    contents.clear();
+    frame_offsets.clear();
+}
+
+const trajectory_header &trajectory_reader::get_header() const
+{
+    return header;
+}
+
+uint trajectory_reader::num_frames() const
+{
+    return uint(frame_offsets.size());
+}
+
+uint trajectory_reader::keyframe_before(uint frame) const
+{
+    return frame - frame % header.keyframe_period;
+}
+
+uint64 trajectory_reader::frame_timestep(uint frame) const
+{
+    uint64 timestep;
+    memcpy(&timestep, data + frame_offsets[frame], 8);
+    return timestep;
+}
+
+ftype trajectory_reader::frame_box_size(uint frame) const
+{
+    ftype box_size;
+    memcpy(&box_size, data + frame_offsets[frame] + 8, sizeof(ftype));
+    return box_size;
+}
+
+void trajectory_reader::read_frame(uint frame, cursor &c, vector<vec3> &positions) const
+{
+    // Continue from the cursor if possible, otherwise from the keyframe
+    uint first = keyframe_before(frame);
+    if (c.frame == ~0u || c.frame > frame || c.frame < first) {
+        c.frame = ~0u;
+        for (uint f = first; f <= frame; f++) {
+            decode(f, c);
+        }
+    }
+    else {
+        for (uint f = c.frame + 1; f <= frame; f++) {
+            decode(f, c);
+        }
+    }
+
+    const uint   num_particles = header.num_particles;
+    const double scale = double(frame_box_size(frame))/double(uint32(1) << header.bits_per_coordinate);
+    positions.resize(num_particles);
+    for (uint i = 0; i < num_particles; i++) {
+        positions[i] = vec3(ftype(c.quantized[3*i    ]*scale),
+                            ftype(c.quantized[3*i + 1]*scale),
+                            ftype(c.quantized[3*i + 2]*scale));
+    }
+}
+
+void trajectory_reader::decode(uint frame, cursor &c) const
+{
+    const uint   num_values = 3*header.num_particles;
+    const uint32 mask = (uint32(1) << header.bits_per_coordinate) - 1;
+    const char  *frame_data = data + frame_offsets[frame];
+    uint32 keyframe;
+    memcpy(&keyframe, frame_data + 8 + sizeof(ftype), 4);
+
+    c.values   .resize(num_values);
+    c.quantized.resize(num_values);
+    unpack_values(frame_data + TRAJECTORY_FRAME_HEADER_SIZE, num_values, &c.values[0]);
+    if (keyframe) {
+        c.quantized.swap(c.values);
+    }
+    else {
+        for (uint i = 0; i < num_values; i++) {
+            uint32 z = c.values[i];
+            c.quantized[i] = (c.quantized[i] + ((z >> 1) ^ (0u - (z & 1)))) & mask;
+        }
+    }
+    c.frame = frame;
+}
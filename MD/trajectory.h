@@ -0,0 +1,145 @@
+#ifndef  TRAJECTORY_H
+#define  TRAJECTORY_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+using std::vector;
+using std::string;
+
+#include "definitions.h"
+#include "particle.h"
+#include "async_writer.h"
+
+////////////////////////////////////////////////////////////////
+// FILE FORMAT
+////////////////////////////////////////////////////////////////
+
+/*
+ * A trajectory file (.mdt) holds the particle positions every frame_period
+ * timesteps, in the byte order of the machine that wrote it:
+ *   header: "MDTRAJEC", then the members of trajectory_header
+ *   frames: the timestep (uint64), the box size (ftype), if it is a
+ *           keyframe (uint32), the size of the packed values (uint32) and
+ *           the packed values
+ *   index:  the file offset of every frame (uint64), the number of frames
+ *           (uint64) and "MDTRAJIX"
+ * The positions are quantized to levels = 2^bits_per_coordinate steps of
+ * the box size. Keyframes hold the quantized coordinates, the other frames
+ * the change since the previous frame, wrapped around the box, so that
+ * they can only be decoded from the keyframe before them. The values are
+ * packed in blocks of TRAJECTORY_BLOCK_SIZE, each with the number of bits
+ * needed for its largest value (like the small integers of XTC files).
+ */
+
+const uint32 TRAJECTORY_FORMAT_VERSION = 1;
+const uint   TRAJECTORY_BLOCK_SIZE     = 96; // 32 particles
+const uint   TRAJECTORY_FRAME_HEADER_SIZE = 8 + sizeof(ftype) + 4 + 4;
+const uint   TRAJECTORY_DEFAULT_KEYFRAME_PERIOD = 50;
+
+struct trajectory_header
+{
+    uint32 version;
+    uint32 value_size;          // Size of ftype in bytes
+    uint32 num_particles;
+    uint32 bits_per_coordinate;
+    uint32 frame_period;        // Timesteps between the frames
+    uint32 keyframe_period;     // Frames between the keyframes
+    ftype  length_unit;         // [m] Positions and box sizes are in this unit
+    ftype  time_step;           // [s]
+};
+
+// Bit packing of unsigned values, the packed bytes are appended
+void   pack_values  (const uint32 *values, uint num_values, vector<char> &packed);
+// Returns the number of bytes read
+uint64 unpack_values(const char *packed, uint num_values, uint32 *values);
+
+////////////////////////////////////////////////////////////////
+// WRITER
+////////////////////////////////////////////////////////////////
+
+/*
+ * Encodes frames on the calling thread and hands them over to an
+ * async_writer, so that nothing waits for the disk.
+ */
+class trajectory_writer
+{
+public:
+    // Constructor
+    trajectory_writer();
+
+    void open (async_writer &writer_in, const string &path, uint num_particles, uint frame_period, uint keyframe_period, ftype relative_precision, ftype length_unit, ftype time_step);
+    void write_frame(uint64 timestep, const vector<particle> &particles, ftype box_size);
+    void close(); // Writes the index
+    bool is_open() const;
+    uint   num_frames() const;
+    uint64 num_bytes() const;
+
+private:
+    async_writer     *writer;
+    uint              file;
+    bool              file_open;
+    trajectory_header header;
+    vector<uint32>    previous; // Quantized coordinates of the previous frame
+    vector<uint32>    values;
+    vector<char>      packed;
+    vector<uint64>    frame_offsets;
+    uint64            position; // Bytes written so far
+};
+
+////////////////////////////////////////////////////////////////
+// READER
+////////////////////////////////////////////////////////////////
+
+/*
+ * Reads a trajectory file mapped into memory (read into memory on Windows).
+ * The reader itself is never changed by reading, so several threads can
+ * read frames at the same time, each with a cursor of its own.
+ */
+class trajectory_reader
+{
+public:
+    /* Decoding state of one thread */
+    struct cursor
+    {
+        uint           frame; // The frame in quantized, ~0 if none
+        vector<uint32> quantized;
+        vector<uint32> values;
+
+        cursor() : frame(~0u) {}
+    };
+
+    // Constructor and destructor
+    trajectory_reader();
+    ~trajectory_reader();
+
+    bool open (const string &path, string &error);
+    void close();
+
+    const trajectory_header &get_header() const;
+    uint   num_frames() const;
+    uint   keyframe_before(uint frame) const;
+    uint64 frame_timestep(uint frame) const;
+    ftype  frame_box_size(uint frame) const;
+    // The positions of a frame, fastest when the frames are read in order with the same cursor
+    void   read_frame(uint frame, cursor &c, vector<vec3> &positions) const;
+
+private:
+    const char       *data;
+    uint64            size;
+    void             *mapping;   // Of the whole file, 0 if not mapped
+    vector<char>      contents;  // Used instead of the mapping on Windows
+    trajectory_header header;
+    vector<uint64>    frame_offsets;
+
+    void decode(uint frame, cursor &c) const;
+
+    // Not copyable
+    trajectory_reader(const trajectory_reader &);
+    trajectory_reader &operator=(const trajectory_reader &);
+};
+
+#endif  /* TRAJECTORY_H */
@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <thread>
+#include <omp.h>
+
+// Own includes
+#include "work_stealing_pool.h"
+
+////////////////////////////////////////////////////////////////
+// CONSTRUCTOR AND DESTRUCTOR
+////////////////////////////////////////////////////////////////
+
+work_stealing_pool::work_stealing_pool(uint num_workers_in)
+{
+    uint num_workers = num_workers_in > 0 ? num_workers_in : uint(omp_get_num_procs());
+    for (uint i = 0; i < num_workers; i++) {
+        queues.push_back(new worker_queue);
+    }
+    next_queue  = 0;
+    num_waiting = 0;
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+    for (uint i = 0; i < queues.size(); i++) {
+        delete queues[i];
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+void work_stealing_pool::submit(const task &new_task)
+{
+    worker_queue &queue = *queues[next_queue];
+    next_queue = (next_queue + 1) % queues.size();
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(new_task);
+    num_waiting++;
+}
+
+void work_stealing_pool::run()
+{
+    // The calling thread is the first worker
+    vector<std::thread> threads;
+    for (uint worker = 1; worker < queues.size(); worker++) {
+        threads.push_back(std::thread(&work_stealing_pool::work, this, worker));
+    }
+    work(0);
+    for (uint i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+uint work_stealing_pool::get_num_workers() const
+{
+    return queues.size();
+}
+
+uint work_stealing_pool::get_num_waiting() const
+{
+    return num_waiting;
+}
+
+////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+////////////////////////////////////////////////////////////////
+
+bool work_stealing_pool::take(uint worker, task &next_task)
+{
+    // The newest task of the own queue
+    {
+        worker_queue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            next_task = own.tasks.back();
+            own.tasks.pop_back();
+            num_waiting--;
+            return true;
+        }
+    }
+    // The oldest task of another queue, starting with the next worker
+    for (uint i = 1; i < queues.size(); i++) {
+        worker_queue &victim = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            next_task = victim.tasks.front();
+            victim.tasks.pop_front();
+            num_waiting--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void work_stealing_pool::work(uint worker)
+{
+    // No new tasks are submitted while running, so empty queues stay empty
+    task next_task;
+    while (take(worker, next_task)) {
+        next_task();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef  WORK_STEALING_POOL_H
+#define  WORK_STEALING_POOL_H
+
+////////////////////////////////////////////////////////////////
+// INCLUDES
+////////////////////////////////////////////////////////////////
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+using std::deque;
+using std::vector;
+
+#include "definitions.h"
+
+////////////////////////////////////////////////////////////////
+// CLASS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Runs independent tasks on a fixed number of threads. Every worker has a
+ * queue of its own; the tasks are dealt out over the queues when they are
+ * submitted, and a worker takes the newest task of its own queue. A worker
+ * whose queue is empty steals the oldest task of another queue, so the
+ * workers stay busy when the tasks take very different times. The tasks
+ * are long (whole simulations), so each queue simply has a mutex of its
+ * own; the workers never wait for each other, only for a queue.
+ */
+class work_stealing_pool
+{
+public:
+    typedef std::function<void ()> task;
+
+    // Constructor and destructor
+    explicit work_stealing_pool(uint num_workers_in = 0); // 0 for one worker per core
+    ~work_stealing_pool();
+
+    void submit(const task &new_task); // Call before run
+    void run();                        // Returns when all tasks are done
+
+    uint get_num_workers() const;
+    uint get_num_waiting() const;      // Submitted but not started
+
+private:
+    struct worker_queue
+    {
+        std::mutex  mutex;
+        deque<task> tasks;
+    };
+    vector<worker_queue*> queues;
+    uint                  next_queue;  // Where the next task is submitted
+    std::atomic<uint>     num_waiting;
+
+    bool take (uint worker, task &next_task);
+    void work (uint worker);
+
+    // Not copyable
+    work_stealing_pool(const work_stealing_pool &);
+    work_stealing_pool &operator=(const work_stealing_pool &);
+};
+
+#endif  /* WORK_STEALING_POOL_H */
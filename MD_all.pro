@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Builds the engine library and everything using it
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+CONFIG  += ordered
+
+SUBDIRS += MD_core \
+    MD \
+    MD_cli \
+    MD_analysis
@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Offline analysis of the trajectory files written by MD
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+# The keyframe segments of a trajectory are analysed on all cores
+win32-msvc* {
+    QMAKE_CXXFLAGS += -openmp
+} else {
+    QMAKE_CXXFLAGS += -fopenmp -std=c++0x -pthread
+    QMAKE_LFLAGS   += -fopenmp -pthread
+}
+
+TARGET = md_analysis
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../MD
+
+SOURCES += main.cpp \
+    ../MD/trajectory.cpp \
+    ../MD/cell_grid.cpp \
+    ../MD/filters.cpp \
+    ../MD/time_series.cpp \
+    ../MD/async_writer.cpp
+
+HEADERS  += ../MD/trajectory.h \
+    ../MD/cell_grid.h \
+    ../MD/filters.h \
+    ../MD/time_series.h \
+    ../MD/async_writer.h \
+    ../MD/definitions.h \
+    ../MD/particle.h
@@ -0,0 +1,367 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <omp.h>
+
+// Own includes
+#include "trajectory.h"
+#include "cell_grid.h"
+#include "filters.h"
+#include "async_writer.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::setprecision;
+using std::stringstream;
+
+////////////////////////////////////////////////////////////////
+// OPTIONS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Recomputes properties of a finished run from its trajectory file (.mdt).
+ * The trajectory is mapped into memory and split at its keyframes; every
+ * keyframe segment can be decoded on its own, so the segments are spread
+ * over all cores. Only positions are stored, so the temperature and
+ * everything else that needs the velocities can not be recomputed.
+ */
+
+struct analysis_options
+{
+    string path;
+    string prefix;
+    ftype  epsilon_in_ev;      // The energy scale of the potential, not stored in the trajectory
+    ftype  cutoff;             // [sigma] Cutoff of the potential
+    ftype  rdf_max;            // [sigma] Largest distance of the radial distribution function
+    uint   num_bins;
+    uint   stride;             // Frames between the frames used for the potential energy and g(r)
+    ftype  decay_time_in_fs;   // Impulse response decay time of the filter
+};
+
+static void print_usage()
+{
+    cerr << "Usage: md_analysis <trajectory.mdt> [options]" << endl
+         << "  --epsilon <eV>      Energy scale of the potential (0.0104 for argon)" << endl
+         << "  --cutoff <sigma>    Cutoff of the potential (2.5)" << endl
+         << "  --rdf-max <sigma>   Largest distance in g(r), at most half the box (3.5)" << endl
+         << "  --bins <n>          Number of bins in g(r) (200)" << endl
+         << "  --stride <n>        Use every n:th frame for the energy and g(r) (1)" << endl
+         << "  --decay-time <fs>   Impulse response decay time of the filter (100)" << endl
+         << "  --prefix <text>     Prefix of the output files (\"Analysis_\")" << endl;
+}
+
+static bool parse_options(int argc, char* args[], analysis_options &options)
+{
+    options.prefix           = "Analysis_";
+    options.epsilon_in_ev    = ftype(0.0104);
+    options.cutoff           = ftype(2.5);
+    options.rdf_max          = ftype(3.5); // The first three neighbour shells of a solid
+    options.num_bins         = 200;
+    options.stride           = 1;
+    options.decay_time_in_fs = 100;
+    for (int a = 1; a < argc; a++) {
+        string arg = args[a];
+        if (arg.compare(0, 2, "--") != 0) {
+            if (!options.path.empty()) return false;
+            options.path = arg;
+            continue;
+        }
+        if (a + 1 >= argc) return false;
+        const char *value = args[++a];
+        if      (arg == "--epsilon"   ) options.epsilon_in_ev    = ftype(atof(value));
+        else if (arg == "--cutoff"    ) options.cutoff           = ftype(atof(value));
+        else if (arg == "--rdf-max"   ) options.rdf_max          = ftype(atof(value));
+        else if (arg == "--bins"      ) options.num_bins         = uint(atoi(value));
+        else if (arg == "--stride"    ) options.stride           = uint(atoi(value));
+        else if (arg == "--decay-time") options.decay_time_in_fs = ftype(atof(value));
+        else if (arg == "--prefix"    ) options.prefix           = value;
+        else return false;
+    }
+    return !options.path.empty() && options.cutoff > 0 && options.rdf_max > 0 && options.num_bins > 0 && options.stride > 0;
+}
+
+////////////////////////////////////////////////////////////////
+// PAIR PROPERTIES
+////////////////////////////////////////////////////////////////
+
+/* The shortest vector between two positions inside the box, with periodic boundary conditions */
+static inline vec3 minimum_image(vec3 d, ftype box_size)
+{
+    ftype half_box = box_size/2;
+    for (uint k = 0; k < 3; k++) {
+        if      (d[k] >  half_box) d[k] -= box_size;
+        else if (d[k] < -half_box) d[k] += box_size;
+    }
+    return d;
+}
+
+/* Neighbouring cells such that every pair of neighbours is visited once */
+static const int half_shell[13][3] = {
+    { 1, 0, 0}, {-1, 1, 0}, { 0, 1, 0}, { 1, 1, 0},
+    {-1,-1, 1}, { 0,-1, 1}, { 1,-1, 1}, {-1, 0, 1}, { 0, 0, 1}, { 1, 0, 1}, {-1, 1, 1}, { 0, 1, 1}, { 1, 1, 1}
+};
+
+/* The potential energy and the pair distance histogram of one frame */
+class pair_analysis
+{
+public:
+    pair_analysis(ftype cutoff, ftype rdf_max_in, uint num_bins_in)
+    {
+        sqr_cutoff  = cutoff*cutoff;
+        ftype q = 1/sqr_cutoff;
+        q = q*q*q;
+        E_cutoff    = 4*q*(q - 1);
+        rdf_max     = rdf_max_in;
+        num_bins    = num_bins_in;
+        max_distance = cutoff > rdf_max ? cutoff : rdf_max;
+    }
+
+    // Returns the potential energy per particle and adds the pair distances to histogram
+    ftype analyse(const vector<vec3> &positions, ftype box_size, vector<uint64> &histogram)
+    {
+        uint n = uint(box_size/max_distance);
+        if (n > 64) n = 64;
+        uint num_particles = uint(positions.size());
+        double Ep = 0;
+        if (n < 3) { // The neighbouring cells would be counted more than once
+            for (uint i = 0; i < num_particles; i++) {
+                for (uint j = i + 1; j < num_particles; j++) {
+                    Ep += pair(positions[i], positions[j], box_size, histogram);
+                }
+            }
+            return ftype(Ep/num_particles);
+        }
+        grid.build(positions, box_size, n, vec3(0, 0, 0));
+        for (uint cell = 0; cell < grid.num_cells(); cell++) {
+            int x = int(cell % n);
+            int y = int(cell / n % n);
+            int z = int(cell / n / n);
+            for (uint a = grid.cell_start[cell]; a < grid.cell_start[cell + 1]; a++) {
+                const vec3 &pos = positions[grid.cell_particles[a]];
+                // The pairs within the cell, then the 13 neighbouring cells in the forward half
+                for (uint b = a + 1; b < grid.cell_start[cell + 1]; b++) {
+                    Ep += pair(pos, positions[grid.cell_particles[b]], box_size, histogram);
+                }
+                for (uint h = 0; h < 13; h++) {
+                    uint neighbour = grid.cell_index(x + half_shell[h][0], y + half_shell[h][1], z + half_shell[h][2]);
+                    for (uint b = grid.cell_start[neighbour]; b < grid.cell_start[neighbour + 1]; b++) {
+                        Ep += pair(pos, positions[grid.cell_particles[b]], box_size, histogram);
+                    }
+                }
+            }
+        }
+        return ftype(Ep/num_particles);
+    }
+
+private:
+    ftype     sqr_cutoff, E_cutoff, rdf_max, max_distance;
+    uint      num_bins;
+    cell_grid grid;
+
+    ftype pair(const vec3 &a, const vec3 &b, ftype box_size, vector<uint64> &histogram) const
+    {
+        ftype sqr_distance = minimum_image(a - b, box_size).sqr_length();
+        ftype Ep = 0;
+        if (sqr_distance < sqr_cutoff) {
+            ftype p = 1/sqr_distance;
+            p = p*p*p;
+            Ep = 4 * p * (p - 1) - E_cutoff;
+        }
+        if (sqr_distance < rdf_max*rdf_max) {
+            uint bin = uint(sqrt(sqr_distance)/rdf_max*num_bins);
+            if (bin < num_bins) histogram[bin]++;
+        }
+        return Ep;
+    }
+};
+
+////////////////////////////////////////////////////////////////
+// OUTPUT
+////////////////////////////////////////////////////////////////
+
+static void write_text(async_writer &writer, const string &path, const string &text)
+{
+    uint file = writer.open(path);
+    writer.write(file, text.data(), text.size());
+    writer.close(file);
+}
+
+////////////////////////////////////////////////////////////////
+// THE MAIN FUNCTION
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char* args[])
+{
+    analysis_options options;
+    if (!parse_options(argc, args, options)) {
+        print_usage();
+        return 1;
+    }
+
+    trajectory_reader reader;
+    string error;
+    if (!reader.open(options.path, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    const trajectory_header &header = reader.get_header();
+    const uint  num_particles = header.num_particles;
+    const uint  num_frames    = reader.num_frames();
+    const uint  keyframe_period = header.keyframe_period;
+    const ftype frame_time    = header.time_step*header.frame_period; // [s]
+    if (num_frames == 0 || num_particles == 0) {
+        cerr << "Error: " << options.path << " holds no frames" << endl;
+        return 1;
+    }
+    // Distances beyond half the box are not counted fully with periodic boundaries
+    ftype rdf_max = reader.frame_box_size(0)/2;
+    if (options.rdf_max < rdf_max) rdf_max = options.rdf_max;
+    cout << options.path << ": " << num_particles << " particles, " << num_frames << " frames, "
+         << omp_get_max_threads() << " threads" << endl;
+
+    double start_time = omp_get_wtime();
+
+    /*
+     * First pass, segment by segment: the potential energy and g(r) of the
+     * frames in use, and the displacement of every particle over the whole
+     * segment (up to the first frame of the next), following the particles
+     * through the periodic boundaries.
+     */
+    const uint num_segments = (num_frames - 1)/keyframe_period + 1;
+    vector<vector<vec3> > segment_displacement(num_segments);
+    vector<ftype> Ep_of_frame(num_frames, 0);
+    vector<vector<uint64> > thread_histogram(omp_get_max_threads(), vector<uint64>(options.num_bins, 0));
+    #pragma omp parallel
+    {
+        trajectory_reader::cursor cursor;
+        vector<vec3> positions, previous;
+        pair_analysis pairs(options.cutoff, rdf_max, options.num_bins);
+        vector<uint64> &histogram = thread_histogram[omp_get_thread_num()];
+        #pragma omp for schedule(dynamic)
+        for (int s = 0; s < int(num_segments); s++) {
+            uint first = s*keyframe_period;
+            uint last  = first + keyframe_period < num_frames ? first + keyframe_period : num_frames - 1; // Including the next keyframe
+            vector<vec3> &displacement = segment_displacement[s];
+            displacement.assign(num_particles, vec3(0, 0, 0));
+            for (uint f = first; f <= last; f++) {
+                reader.read_frame(f, cursor, positions);
+                ftype box_size = reader.frame_box_size(f);
+                if (f > first) {
+                    for (uint i = 0; i < num_particles; i++) {
+                        displacement[i] += minimum_image(positions[i] - previous[i], box_size);
+                    }
+                }
+                if (f < first + keyframe_period && f % options.stride == 0) {
+                    Ep_of_frame[f] = pairs.analyse(positions, box_size, histogram);
+                }
+                previous.swap(positions);
+            }
+        }
+    }
+
+    // The displacement at the start of each segment
+    vector<vector<vec3> > segment_start(num_segments);
+    segment_start[0].assign(num_particles, vec3(0, 0, 0));
+    for (uint s = 1; s < num_segments; s++) {
+        segment_start[s] = segment_start[s - 1];
+        for (uint i = 0; i < num_particles; i++) {
+            segment_start[s][i] += segment_displacement[s - 1][i];
+        }
+    }
+
+    // Second pass: the mean square displacement of every frame
+    time_series msd;
+    msd.resize(num_frames);
+    #pragma omp parallel
+    {
+        trajectory_reader::cursor cursor;
+        vector<vec3> positions, previous, displacement;
+        #pragma omp for schedule(dynamic)
+        for (int s = 0; s < int(num_segments); s++) {
+            uint first = s*keyframe_period;
+            uint last  = first + keyframe_period < num_frames ? first + keyframe_period : num_frames;
+            displacement = segment_start[s];
+            for (uint f = first; f < last; f++) {
+                reader.read_frame(f, cursor, positions);
+                ftype box_size = reader.frame_box_size(f);
+                double sum = 0;
+                for (uint i = 0; i < num_particles; i++) {
+                    if (f > first) {
+                        displacement[i] += minimum_image(positions[i] - previous[i], box_size);
+                    }
+                    sum += displacement[i].sqr_length();
+                }
+                msd[f] = ftype(sum/num_particles);
+                previous.swap(positions);
+            }
+        }
+    }
+    double decode_time = omp_get_wtime() - start_time;
+
+    // The potential energy of the frames in use, filtered like during the run
+    time_series Ep, Ep_filtered, msd_filtered;
+    for (uint f = 0; f < num_frames; f += options.stride) {
+        Ep.push_back(Ep_of_frame[f]);
+    }
+    filter_workspace workspace;
+    filter_channel channels[] = {
+        filter_channel(Ep , Ep_filtered , options.decay_time_in_fs*P_SI_FS, 1, true),
+        filter_channel(msd, msd_filtered, options.decay_time_in_fs*P_SI_FS, 1, true)
+    };
+    two_sided_exponential_decay_filter::filter_channels(channels    , 1, frame_time*options.stride, 1, workspace);
+    two_sided_exponential_decay_filter::filter_channels(channels + 1, 1, frame_time               , 1, workspace);
+
+    // g(r), normalized by the pairs expected in each shell of an ideal gas
+    vector<uint64> histogram(options.num_bins, 0);
+    for (uint t = 0; t < thread_histogram.size(); t++) {
+        for (uint b = 0; b < options.num_bins; b++) {
+            histogram[b] += thread_histogram[t][b];
+        }
+    }
+    uint num_frames_used = Ep.size();
+    ftype box_size = reader.frame_box_size(0);
+    double density = num_particles/(double(box_size)*box_size*box_size);
+
+    // Output in SI units
+    const ftype length_unit = header.length_unit;
+    const ftype energy_unit = options.epsilon_in_ev; // [eV]
+    async_writer writer;
+    stringstream text;
+    text << setprecision(9);
+    for (uint f = 0; f < num_frames; f++) {
+        text << reader.frame_timestep(f)*header.time_step << ' ' << msd[f]*length_unit*length_unit << ' ' << msd_filtered[f]*length_unit*length_unit << '\n';
+    }
+    write_text(writer, options.prefix + "MSD.dat", text.str());
+    text.str("");
+    for (uint f = 0; f < num_frames_used; f++) {
+        text << reader.frame_timestep(f*options.stride)*header.time_step << ' ' << Ep[f]*energy_unit << ' ' << Ep_filtered[f]*energy_unit << '\n';
+    }
+    write_text(writer, options.prefix + "Potential.dat", text.str());
+    text.str("");
+    for (uint b = 0; b < options.num_bins; b++) {
+        double r_inner = rdf_max*b/options.num_bins;
+        double r_outer = rdf_max*(b + 1)/options.num_bins;
+        double shell   = 4*M_PI/3*(r_outer*r_outer*r_outer - r_inner*r_inner*r_inner);
+        double ideal   = num_frames_used*0.5*num_particles*density*shell;
+        text << (r_inner + r_outer)/2*length_unit << ' ' << histogram[b]/ideal << '\n';
+    }
+    write_text(writer, options.prefix + "RDF.dat", text.str());
+    writer.wait();
+    if (writer.take_errors(error)) {
+        cerr << error;
+        return 1;
+    }
+
+    double megabytes = double(num_frames)*num_particles*3*sizeof(uint32)/(1 << 20);
+    cout << "Decoded and analysed " << num_frames << " frames in " << decode_time << " s (" << 2*megabytes/decode_time << " MB/s of coordinates)" << endl;
+    return 0;
+}
@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Runs the simulations in Resources/Simulations
+# without a GUI
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+win32-msvc* {
+    QMAKE_CXXFLAGS += -openmp
+} else {
+    QMAKE_CXXFLAGS += -fopenmp -std=c++0x -pthread
+    QMAKE_LFLAGS   += -fopenmp -pthread
+}
+
+TARGET = md_cli
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../MD
+
+# The engine, built by ../MD_core
+win32:CONFIG(release, debug|release): MD_CORE_DIR = ../MD_core/release
+else:win32:CONFIG(debug, debug|release): MD_CORE_DIR = ../MD_core/debug
+else: MD_CORE_DIR = ../MD_core
+LIBS           += -L$$MD_CORE_DIR -lmd_core
+win32-msvc*: PRE_TARGETDEPS += $$MD_CORE_DIR/md_core.lib
+else:        PRE_TARGETDEPS += $$MD_CORE_DIR/libmd_core.a
+
+SOURCES += main.cpp
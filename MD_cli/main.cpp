@@ -0,0 +1,341 @@
+////////////////////////////////////////////////////////////////
+// INCLUDE FILES
+////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+
+// Own includes
+#include "mdsystem.h"
+#include "settings.h"
+#include "run_parameters.h"
+#include "parameter_sweep.h"
+#include "replica_exchange.h"
+#include "replica_batch.h"
+#include "forked_ensemble.h"
+#include "domain_decomposition.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+////////////////////////////////////////////////////////////////
+// OPTIONS
+////////////////////////////////////////////////////////////////
+
+/*
+ * Runs a simulation described by a settings file in the format of
+ * Resources/Simulations, without a GUI, for batch jobs on servers. The
+ * output is written to the standard output as it comes and nothing else is
+ * done between the timesteps. With --sweep or --seeds, the simulation is run
+ * for every combination of the values and seeds, many runs at a time (see
+ * parameter_sweep). With --replicas, one replica is run at each of the
+ * temperatures and they exchange temperatures (see replica_exchange). With
+ * --batch, many copies of a small system are run side by side on one core,
+ * one per SIMD lane (see replica_batch). With --ensemble, the system is
+ * equilibrated once and NVE trajectories are branched from it in forked
+ * processes (see forked_ensemble). With --domains, one system is split into
+ * slabs simulated by processes of their own (see domain_decomposition).
+ */
+
+struct cli_options
+{
+    string path;
+    string elements_directory;    // Empty for the Elements directory next to the simulation's directory
+    string output_directory;
+    string restart_path;          // A checkpoint to continue from instead of initializing
+    string state_cache_directory; // Empty for no state cache
+    uint   random_seed;
+    ftype  checkpoint_interval;   // [s] 0 for no checkpoints
+    vector<string> sweeps;        // "Name=value,value,..."
+    uint   num_seeds;
+    uint   num_jobs;              // Runs at a time in a sweep, 0 for one per core
+    string replica_temperatures;  // "value,value,..."
+    uint   exchange_period;       // [timesteps]
+    uint   num_batch_replicas;    // 0 for no batch
+    uint   num_trajectories;      // 0 for no ensemble
+    uint   num_domains;           // 0 for no domain decomposition
+};
+
+static void print_usage()
+{
+    cerr << "Usage: md_cli <simulation.txt> [options]" << endl
+         << "  --elements <dir>      Directory of the element files (../Elements from the simulation file)" << endl
+         << "  --output <dir>        Directory of the results (the working directory)" << endl
+         << "  --seed <n>            Random seed (from the time)" << endl
+         << "  --restart <file.mdc>  Continue from a checkpoint instead of initializing" << endl
+         << "  --checkpoint <s>      Wall-clock seconds between the checkpoints, 0 for none (600)" << endl
+         << "  --state-cache <dir>   Start from and add to cached equilibrated states" << endl
+         << "  --sweep <name=v,v,..> Run for every value of a setting, may be repeated for a grid" << endl
+         << "  --seeds <n>           Run every point of the sweep with n seeds from --seed (1)" << endl
+         << "  --jobs <n>            Runs at a time in a sweep, replica exchange or ensemble (one per core)" << endl
+         << "  --replicas <T,T,...>  Replica exchange between these temperatures, increasing" << endl
+         << "  --exchange-period <n> Timesteps between the replica exchanges (100)" << endl
+         << "  --batch <n>           Run n copies of a small system with seeds from --seed side by side" << endl
+         << "  --ensemble <n>        Equilibrate once and branch n NVE trajectories from it" << endl
+         << "  --domains <n>         Split the system into n slabs, each run by a process of its own" << endl;
+}
+
+static bool parse_options(int argc, char* args[], cli_options &options)
+{
+    options.random_seed         = uint(time(NULL));
+    options.checkpoint_interval = 600;
+    options.num_seeds           = 1;
+    options.num_jobs            = 0;
+    options.exchange_period     = 100;
+    options.num_batch_replicas  = 0;
+    options.num_trajectories    = 0;
+    options.num_domains         = 0;
+    for (int a = 1; a < argc; a++) {
+        string arg = args[a];
+        if (arg.compare(0, 2, "--") != 0) {
+            if (!options.path.empty()) return false;
+            options.path = arg;
+            continue;
+        }
+        if (a + 1 >= argc) return false;
+        const char *value = args[++a];
+        if      (arg == "--elements"   ) options.elements_directory    = value;
+        else if (arg == "--output"     ) options.output_directory      = value;
+        else if (arg == "--seed"       ) options.random_seed           = uint(strtoul(value, 0, 10));
+        else if (arg == "--restart"    ) options.restart_path          = value;
+        else if (arg == "--checkpoint" ) options.checkpoint_interval   = ftype(atof(value));
+        else if (arg == "--state-cache") options.state_cache_directory = value;
+        else if (arg == "--sweep"      ) options.sweeps.push_back(value);
+        else if (arg == "--seeds"      ) options.num_seeds             = uint(strtoul(value, 0, 10));
+        else if (arg == "--jobs"       ) options.num_jobs              = uint(strtoul(value, 0, 10));
+        else if (arg == "--replicas"   ) options.replica_temperatures  = value;
+        else if (arg == "--exchange-period") options.exchange_period   = uint(strtoul(value, 0, 10));
+        else if (arg == "--batch"      ) options.num_batch_replicas    = uint(strtoul(value, 0, 10));
+        else if (arg == "--ensemble"   ) options.num_trajectories      = uint(strtoul(value, 0, 10));
+        else if (arg == "--domains"    ) options.num_domains           = uint(strtoul(value, 0, 10));
+        else return false;
+    }
+    return !options.path.empty() || !options.restart_path.empty();
+}
+
+////////////////////////////////////////////////////////////////
+// THE MAIN FUNCTION
+////////////////////////////////////////////////////////////////
+
+static void write_to_cout(void* /*ptr*/, string output)
+{
+    cout << output << std::flush;
+}
+
+static int run_sweep(const cli_options &options)
+{
+    parameter_sweep sweep;
+    sweep.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    sweep.set_simulation(options.path, options.elements_directory);
+    sweep.set_seeds(options.random_seed, options.num_seeds);
+    sweep.set_num_workers(options.num_jobs);
+    sweep.set_output_directory(options.output_directory);
+    for (uint i = 0; i < options.sweeps.size(); i++) {
+        const string &sweep_text = options.sweeps[i];
+        size_t separator = sweep_text.find('=');
+        if (separator == string::npos) {
+            cerr << "Error: Expected --sweep \"Name=value,value,...\", got " << sweep_text << endl;
+            return 1;
+        }
+        vector<string> expressions;
+        std::stringstream values(sweep_text.substr(separator + 1));
+        string value;
+        while (getline(values, value, ',')) {
+            expressions.push_back(value);
+        }
+        sweep.add_axis(sweep_text.substr(0, separator), expressions);
+    }
+    string error;
+    if (!sweep.run(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int run_replica_exchange(const cli_options &options)
+{
+    replica_exchange exchange;
+    exchange.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    exchange.set_exchange_period(options.exchange_period);
+    exchange.set_random_seed(options.random_seed);
+    exchange.set_num_workers(options.num_jobs);
+    exchange.set_output_directory(options.output_directory);
+    cout << "Random seed " << options.random_seed << endl;
+
+    // The simulation file read once per temperature, so that the settings depending on it follow
+    std::stringstream temperatures(options.replica_temperatures);
+    string temperature;
+    string error;
+    while (getline(temperatures, temperature, ',')) {
+        settings replica_settings;
+        replica_settings.set_override("Initial temperature", temperature);
+        replica_settings.set_override("Desired temperature", temperature);
+        run_parameters parameters;
+        if (!replica_settings.read(options.path, options.elements_directory, error) || !read_run_parameters(replica_settings, parameters, error)) {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+        exchange.add_replica(parameters);
+    }
+    if (!exchange.run(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int run_batch(const cli_options &options)
+{
+    settings run_settings;
+    run_parameters parameters;
+    string error;
+    if (!run_settings.read(options.path, options.elements_directory, error) || !read_run_parameters(run_settings, parameters, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    cout << "Random seed " << options.random_seed << endl;
+    replica_batch batch;
+    batch.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    batch.set_output_directory(options.output_directory);
+    if (!batch.init(parameters, options.random_seed, options.num_batch_replicas, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    batch.run();
+    return 0;
+}
+
+static int run_ensemble(const cli_options &options)
+{
+    settings run_settings;
+    run_parameters parameters;
+    string error;
+    if (!run_settings.read(options.path, options.elements_directory, error) || !read_run_parameters(run_settings, parameters, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    cout << "Random seed " << options.random_seed << endl;
+    forked_ensemble ensemble;
+    ensemble.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    ensemble.set_parameters(parameters);
+    ensemble.set_num_trajectories(options.num_trajectories);
+    ensemble.set_random_seed(options.random_seed);
+    ensemble.set_num_workers(options.num_jobs);
+    ensemble.set_output_directory(options.output_directory);
+    if (!ensemble.run(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int run_domains(const cli_options &options)
+{
+    settings run_settings;
+    run_parameters parameters;
+    string error;
+    if (!run_settings.read(options.path, options.elements_directory, error) || !read_run_parameters(run_settings, parameters, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    cout << "Random seed " << options.random_seed << endl;
+    domain_decomposition domains;
+    domains.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    domains.set_num_domains(options.num_domains);
+    domains.set_random_seed(options.random_seed);
+    domains.set_output_directory(options.output_directory);
+    if (!domains.init(parameters, error) || !domains.run(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* args[])
+{
+    cli_options options;
+    if (!parse_options(argc, args, options)) {
+        print_usage();
+        return 1;
+    }
+    if (!options.replica_temperatures.empty()) {
+        if (options.path.empty()) {
+            print_usage();
+            return 1;
+        }
+        return run_replica_exchange(options);
+    }
+    if (options.num_trajectories > 0) {
+        if (options.path.empty()) {
+            print_usage();
+            return 1;
+        }
+        return run_ensemble(options);
+    }
+    if (options.num_domains > 0) {
+        if (options.path.empty()) {
+            print_usage();
+            return 1;
+        }
+        return run_domains(options);
+    }
+    if (options.num_batch_replicas > 0) {
+        if (options.path.empty()) {
+            print_usage();
+            return 1;
+        }
+        return run_batch(options);
+    }
+    if (!options.sweeps.empty() || options.num_seeds > 1) {
+        if (options.path.empty()) {
+            print_usage();
+            return 1;
+        }
+        return run_sweep(options);
+    }
+
+    // Only the output callback, no events to process between the timesteps
+    mdsystem simulation;
+    simulation.set_output_callback(callback<void (*)(void*, string)>(write_to_cout, 0));
+    simulation.set_output_directory(options.output_directory);
+    simulation.set_checkpointing(options.checkpoint_interval > 0, options.checkpoint_interval);
+
+    if (!options.restart_path.empty()) {
+        if (!simulation.load_checkpoint(options.restart_path)) {
+            return 1;
+        }
+        simulation.run_simulation();
+        return 0;
+    }
+
+    settings run_settings;
+    string   error;
+    if (!run_settings.read(options.path, options.elements_directory, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    run_parameters parameters;
+    if (!read_run_parameters(run_settings, parameters, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    vector<string> unused = run_settings.unused_names();
+    for (uint i = 0; i < unused.size(); i++) {
+        cout << "Ignored setting: " << unused[i] << endl;
+    }
+
+    // Init system and run simulation
+    cout << "Random seed " << options.random_seed << endl;
+    simulation.set_random_seed(options.random_seed);
+    if (!options.state_cache_directory.empty()) {
+        simulation.set_state_cache(true, options.state_cache_directory);
+        simulation.set_tiling(true, 200);
+    }
+    return run_with_parameters(simulation, parameters) ? 0 : 1;
+}
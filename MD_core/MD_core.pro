@@ -0,0 +1,71 @@
+#-------------------------------------------------
+#
+# The simulation engine without Qt, shared by MD,
+# md_cli and md_analysis
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+# OpenMP is used to spread loops over particles on all cores, and the
+# output is written by a C++11 thread
+win32-msvc* {
+    QMAKE_CXXFLAGS += -openmp
+} else {
+    QMAKE_CXXFLAGS += -fopenmp -std=c++0x -pthread
+}
+
+TARGET = md_core
+CONFIG   += staticlib
+TEMPLATE = lib
+
+INCLUDEPATH += ../MD
+
+SOURCES += ../MD/mdsystem.cpp \
+    ../MD/settings.cpp \
+    ../MD/filters.cpp \
+    ../MD/cell_grid.cpp \
+    ../MD/time_series.cpp \
+    ../MD/async_writer.cpp \
+    ../MD/trajectory.cpp \
+    ../MD/checkpoint.cpp \
+    ../MD/run_parameters.cpp \
+    ../MD/work_stealing_pool.cpp \
+    ../MD/parameter_sweep.cpp \
+    ../MD/replica_exchange.cpp \
+    ../MD/replica_batch.cpp \
+    ../MD/forked_ensemble.cpp \
+    ../MD/domain_transport.cpp \
+    ../MD/domain_decomposition.cpp \
+    ../MD/task_scheduler.cpp \
+    ../MD/sparse_cell_grid.cpp \
+    ../MD/all_pairs_forces.cpp
+
+HEADERS  += ../MD/mdsystem.h \
+    ../MD/definitions.h \
+    ../MD/base_float_vec3.h \
+    ../MD/particle.h \
+    ../MD/callback.h \
+    ../MD/settings.h \
+    ../MD/preprocessing.h \
+    ../MD/thermostats.h \
+    ../MD/filters.h \
+    ../MD/philox.h \
+    ../MD/cell_grid.h \
+    ../MD/simd.h \
+    ../MD/time_series.h \
+    ../MD/async_writer.h \
+    ../MD/trajectory.h \
+    ../MD/spsc_ring.h \
+    ../MD/checkpoint.h \
+    ../MD/run_parameters.h \
+    ../MD/work_stealing_pool.h \
+    ../MD/parameter_sweep.h \
+    ../MD/replica_exchange.h \
+    ../MD/replica_batch.h \
+    ../MD/forked_ensemble.h \
+    ../MD/domain_transport.h \
+    ../MD/domain_decomposition.h \
+    ../MD/task_scheduler.h \
+    ../MD/sparse_cell_grid.h \
+    ../MD/all_pairs_forces.h